@@ -0,0 +1,125 @@
+/**
+ * @file
+ * @brief Advertising interval profiles, including a fast discovery burst after boot and
+ * after every disconnect.
+ *
+ * A profile sets a fast interval used for a burst of ADV_FAST_SECONDS seconds whenever
+ * advertising starts after boot or a disconnect, and a slow interval used afterwards:
+ *
+ *   | Profile        | Burst        | Afterwards     |
+ *   |----------------|--------------|----------------|
+ *   | 0 Balanced     | 100-150 ms   | 100-150 ms     |
+ *   | 1 FastThenSlow | 20-30 ms     | 1000 ms        |
+ *   | 2 Fast         | 20-30 ms     | 20-30 ms       |
+ *   | 3 LowPower     | 1000 ms      | 1000 ms        |
+ *
+ * The compile-time profile is TESTER_ADVERTISING_PROFILE. A client can select another one
+ * by writing [profile u8] or [profile u8][burst seconds u16] to the advertising control
+ * characteristic, which restarts advertising with the new profile at the start of a burst.
+ * Writing [profile u8][burst seconds u16][state advertising u8] also turns state
+ * advertising on or off. Reading it returns an AdvertisingStatus.
+ *
+ * The advertising payload carries the flags and the complete 128-bit service UUID, so
+ * clients can filter on the service without connecting, and the scan response carries the
+ * device name. Both do not fit in a single 31-byte legacy payload. With state advertising
+ * on, the payload carries the flags and the state record in manufacturer-specific data
+ * instead (see state_broadcast.h), and the scan response carries the service UUID and the
+ * name shortened to fit.
+ *
+ * Builds with TESTER_EXTENDED_ADVERTISING drive the controller through the BLE 5 extended
+ * advertising commands instead, since the controller does not accept legacy and extended
+ * commands side by side. Set 0 sends the same connectable legacy PDUs as other builds, and
+ * set 1 is a non-connectable extended set with periodic advertising that carries the full
+ * state report. This needs Bluedroid on a Bluetooth 5 chip (ESP32-C3, ESP32-S3); NimBLE
+ * builds only offer extended advertising when NimBLE-Arduino is built for it, which
+ * replaces its legacy advertising API, so they keep to legacy advertising.
+ */
+
+#ifndef ADVERTISING_PROFILES_H
+#define ADVERTISING_PROFILES_H
+
+#include "ble_backend.h"
+
+/// The UUID of the advertising control characteristic.
+#define ADVERTISING_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b6"
+
+/**
+ * @brief The advertising profiles, as written to the control characteristic.
+ */
+enum class AdvertisingProfile : uint8_t {
+    Balanced = 0,
+    FastThenSlow = 1,
+    Fast = 2,
+    LowPower = 3,
+    Count
+};
+
+/// The profile used from boot until a client selects another one.
+#ifndef TESTER_ADVERTISING_PROFILE
+#define TESTER_ADVERTISING_PROFILE 1
+#endif
+
+/// Set to 1 to put the state record in the advertising payload from boot.
+#ifndef TESTER_STATE_ADVERTISING
+#define TESTER_STATE_ADVERTISING 0
+#endif
+
+/// Set to 1 to add extended and periodic advertising of the state report.
+#ifndef TESTER_EXTENDED_ADVERTISING
+#define TESTER_EXTENDED_ADVERTISING 0
+#endif
+
+/// The largest state record that fits the legacy payload next to the flags and the
+/// manufacturer data header.
+#define ADV_MAX_STATE_RECORD_BYTES 24
+
+/// The largest state report sent by extended and periodic advertising. This keeps each
+/// payload within a single HCI command.
+#define ADV_MAX_STATE_REPORT_BYTES 200
+
+/// The length of the fast burst after boot and after every disconnect, in seconds.
+#ifndef ADV_FAST_SECONDS
+#define ADV_FAST_SECONDS 30
+#endif
+
+/**
+ * @brief The wire format of the advertising status. All fields are little-endian.
+ */
+struct __attribute__((packed)) AdvertisingStatus {
+    uint8_t profile;          ///< The active AdvertisingProfile.
+    uint16_t burstSeconds;    ///< The length of the fast burst.
+    uint8_t inBurst;          ///< 1 while the fast burst is running.
+    uint16_t minInterval;     ///< The current minimum interval in units of 0.625 ms.
+    uint16_t maxInterval;     ///< The current maximum interval in units of 0.625 ms.
+    uint8_t stateAdvertising; ///< 1 if the legacy payload carries the state record.
+    uint8_t extended;         ///< 1 if extended and periodic advertising carry the state report.
+};
+
+/**
+ * @brief Sets up the advertising payload and the control characteristic.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ * @param serviceUuid The UUID of the service to advertise.
+ * @param deviceName The name to put in the scan response.
+ */
+void setupAdvertisingProfiles(BLEService* pService, const char* serviceUuid, const char* deviceName);
+
+/**
+ * @brief Starts or restarts advertising with the active profile.
+ *
+ * @param burst true to start with the fast burst, as after boot or a disconnect; false to
+ *              continue in the current phase, as after a connect that leaves room for more.
+ */
+void startProfileAdvertising(bool burst);
+
+/**
+ * @brief Updates the state carried by the advertising payloads in place.
+ *
+ * @param record The state record for the legacy payload.
+ * @param recordLength The length of the record, which must leave room for the flags.
+ * @param report The state report for extended and periodic advertising.
+ * @param reportLength The length of the report.
+ */
+void setAdvertisedState(const uint8_t* record, size_t recordLength, const uint8_t* report, size_t reportLength);
+
+#endif // ADVERTISING_PROFILES_H
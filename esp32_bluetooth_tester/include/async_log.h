@@ -0,0 +1,83 @@
+/**
+ * @file
+ * @brief Asynchronous, level-filtered logging for code that runs on the BLE hot path.
+ *
+ * Writing to the serial console from a BLE callback blocks the BLE task for as long as the
+ * UART or USB CDC takes to accept the line. The LOG_* macros instead format the message
+ * into a fixed-size record and push it onto a lock-free queue; a low-priority task drains
+ * the queue to Serial. When the queue is full the record is dropped and counted, and the
+ * drain task reports the number of dropped records once it catches up.
+ *
+ * Messages above TESTER_LOG_LEVEL are removed by the preprocessor, arguments included, so
+ * a build with -D TESTER_LOG_LEVEL=TESTER_LOG_LEVEL_WARN carries no per-write logging at all.
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdint.h>
+
+#define TESTER_LOG_LEVEL_NONE 0
+#define TESTER_LOG_LEVEL_ERROR 1
+#define TESTER_LOG_LEVEL_WARN 2
+#define TESTER_LOG_LEVEL_INFO 3
+#define TESTER_LOG_LEVEL_DEBUG 4
+
+/// The most verbose level that is compiled in. Per-write messages are logged at DEBUG.
+#ifndef TESTER_LOG_LEVEL
+#define TESTER_LOG_LEVEL TESTER_LOG_LEVEL_DEBUG
+#endif
+
+/// The longest message a record holds. Longer messages are truncated.
+#define LOG_RECORD_TEXT_LENGTH 128
+
+/// The number of records the queue holds. Must be a power of two.
+#ifndef LOG_QUEUE_RECORDS
+#define LOG_QUEUE_RECORDS 32
+#endif
+
+/**
+ * @brief Starts the task that drains log records to Serial. Call after Serial.begin().
+ *
+ * Records logged before this call are queued and printed once the task starts.
+ */
+void setupAsyncLog();
+
+/**
+ * @brief Formats a message into a record and queues it. Use the LOG_* macros instead.
+ *
+ * @param level One of the TESTER_LOG_LEVEL_* values.
+ * @param format A printf-style format string.
+ */
+void logWrite(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Returns the number of records dropped because the queue was full.
+ */
+uint32_t logDroppedCount();
+
+#if TESTER_LOG_LEVEL >= TESTER_LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(TESTER_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if TESTER_LOG_LEVEL >= TESTER_LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(TESTER_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if TESTER_LOG_LEVEL >= TESTER_LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(TESTER_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if TESTER_LOG_LEVEL >= TESTER_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(TESTER_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#endif // ASYNC_LOG_H
@@ -0,0 +1,301 @@
+/**
+ * @file
+ * @brief Selects the BLE host stack the firmware is built on.
+ *
+ * By default the firmware uses the Bluedroid-based ESP32 BLE Arduino library. Building with
+ * TESTER_USE_NIMBLE=1 (see the *_nimble environments in platformio.ini) switches to
+ * NimBLE-Arduino, which needs considerably less RAM and flash and brings the stack up faster.
+ *
+ * The rest of the firmware is written against the Bluedroid class names. This header maps
+ * those names to their NimBLE equivalents and provides a few helpers for the places where
+ * the two libraries differ:
+ *   - Characteristic properties, which are BleProperty constants instead of
+ *     BLECharacteristic::PROPERTY_* values.
+ *   - Encrypted access and the Client Characteristic Configuration Descriptor (0x2902),
+ *     both of which are handled by createBleCharacteristic().
+ *   - Reading the attribute value without going through std::string (BleValue).
+ *   - Looking up the connection a characteristic is being served to (bleConnId()).
+ *   - Installing statically allocated server callbacks (setBleServerCallbacks()).
+ *   - The per-event connection information passed to callbacks (BleConnParam), and the
+ *     connection ID it carries.
+ */
+
+#ifndef BLE_BACKEND_H
+#define BLE_BACKEND_H
+
+#ifndef TESTER_USE_NIMBLE
+#define TESTER_USE_NIMBLE 0
+#endif
+
+#if TESTER_USE_NIMBLE
+
+#include <NimBLEDevice.h>
+#include <vector>
+
+// NimBLE-Arduino 1.x defines most of these as compatibility macros already.
+#ifndef BLEDevice
+using BLEDevice = NimBLEDevice;
+#endif
+#ifndef BLEServer
+using BLEServer = NimBLEServer;
+#endif
+#ifndef BLEService
+using BLEService = NimBLEService;
+#endif
+#ifndef BLECharacteristic
+using BLECharacteristic = NimBLECharacteristic;
+#endif
+#ifndef BLEServerCallbacks
+using BLEServerCallbacks = NimBLEServerCallbacks;
+#endif
+#ifndef BLECharacteristicCallbacks
+using BLECharacteristicCallbacks = NimBLECharacteristicCallbacks;
+#endif
+#ifndef BLEAdvertising
+using BLEAdvertising = NimBLEAdvertising;
+#endif
+#ifndef BLEAdvertisementData
+using BLEAdvertisementData = NimBLEAdvertisementData;
+#endif
+#ifndef BLEUUID
+using BLEUUID = NimBLEUUID;
+#endif
+
+/// The name of the BLE host stack, as reported in the boot report.
+#define BLE_BACKEND_NAME "NimBLE"
+
+/// The type of the status code passed to BLECharacteristicCallbacks::onStatus().
+typedef int BleStatusCode;
+
+/// The connection information passed to server and characteristic callbacks.
+typedef ble_gap_conn_desc BleConnParam;
+
+/// Returns the connection ID carried by a connect event.
+inline uint16_t bleConnectConnId(const BleConnParam* param) { return param->conn_handle; }
+
+/// Returns the connection ID carried by a disconnect event.
+inline uint16_t bleDisconnectConnId(const BleConnParam* param) { return param->conn_handle; }
+
+/// Returns the connection ID carried by a write event.
+inline uint16_t bleWriteConnId(const BleConnParam* param) { return param->conn_handle; }
+
+/// Returns the connection ID carried by a read event.
+inline uint16_t bleReadConnId(const BleConnParam* param) { return param->conn_handle; }
+
+/// Returns the peer's identity address from a connect event.
+inline const uint8_t* bleConnectAddress(const BleConnParam* param) { return param->peer_id_addr.val; }
+
+/// Returns the connection interval, in units of 1.25 ms, from a connect event.
+inline uint16_t bleConnectInterval(const BleConnParam* param) { return param->conn_itvl; }
+
+/// Returns the slave latency from a connect event.
+inline uint16_t bleConnectLatency(const BleConnParam* param) { return param->conn_latency; }
+
+/// Returns the supervision timeout, in units of 10 ms, from a connect event.
+inline uint16_t bleConnectTimeout(const BleConnParam* param) { return param->supervision_timeout; }
+
+/**
+ * @brief Backend-neutral characteristic properties.
+ */
+namespace BleProperty {
+const uint32_t kRead = NIMBLE_PROPERTY::READ;
+const uint32_t kWrite = NIMBLE_PROPERTY::WRITE;
+const uint32_t kWriteNoResponse = NIMBLE_PROPERTY::WRITE_NR;
+const uint32_t kNotify = NIMBLE_PROPERTY::NOTIFY;
+const uint32_t kIndicate = NIMBLE_PROPERTY::INDICATE;
+}
+
+/**
+ * @class BleValue
+ * @brief A read-only view of a characteristic's value.
+ *
+ * NimBLE only hands out copies of attribute values, so this holds the copy for as long
+ * as the view is in scope.
+ */
+class BleValue {
+public:
+    explicit BleValue(BLECharacteristic* pCharacteristic) : value(pCharacteristic->getValue()) {}
+    const uint8_t* data() const { return value.data(); }
+    size_t length() const { return value.length(); }
+
+private:
+    NimBLEAttValue value;
+};
+
+/**
+ * @brief Returns the handle of a connected client, or BLE_HS_CONN_HANDLE_NONE if there is none.
+ */
+inline uint16_t bleConnId(BLEServer* pServer) {
+    std::vector<uint16_t> peers = pServer->getPeerDevices();
+    return peers.empty() ? BLE_HS_CONN_HANDLE_NONE : peers.front();
+}
+
+/**
+ * @brief Installs server callbacks that the server must not delete.
+ */
+inline void setBleServerCallbacks(BLEServer* pServer, BLEServerCallbacks* pCallbacks) {
+    pServer->setCallbacks(pCallbacks, false);
+}
+
+/**
+ * @brief Creates a service with room for the given number of attribute handles.
+ *
+ * NimBLE sizes services automatically, so the handle count is ignored.
+ */
+inline BLEService* createBleService(BLEServer* pServer, const char* uuid, uint32_t numHandles) {
+    return pServer->createService(uuid);
+}
+
+/**
+ * @brief Creates a characteristic, adding encryption and the CCCD as needed.
+ *
+ * NimBLE adds the CCCD itself to characteristics that notify or indicate.
+ */
+inline BLECharacteristic* createBleCharacteristic(BLEService* pService, const char* uuid,
+                                                  uint32_t properties, bool encrypted = false) {
+    if (encrypted) {
+        if (properties & NIMBLE_PROPERTY::READ) {
+            properties |= NIMBLE_PROPERTY::READ_ENC;
+        }
+        if (properties & (NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR)) {
+            properties |= NIMBLE_PROPERTY::WRITE_ENC;
+        }
+    }
+    return pService->createCharacteristic(uuid, properties);
+}
+
+#else // Bluedroid
+
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+#include <BLE2902.h>
+#include <new>
+#include <type_traits>
+
+/// The number of CCCD descriptors that are allocated statically. Characteristics beyond
+/// this fall back to the heap; gatt_profile.cpp checks at build time that the tester's own
+/// and the generated characteristics fit.
+#ifndef TESTER_CCCD_POOL_SIZE
+#define TESTER_CCCD_POOL_SIZE 16
+#endif
+
+/// The name of the BLE host stack, as reported in the boot report.
+#define BLE_BACKEND_NAME "Bluedroid"
+
+/// The type of the status code passed to BLECharacteristicCallbacks::onStatus().
+typedef uint32_t BleStatusCode;
+
+/// The connection information passed to server and characteristic callbacks.
+typedef esp_ble_gatts_cb_param_t BleConnParam;
+
+/// Returns the connection ID carried by a connect event.
+inline uint16_t bleConnectConnId(const BleConnParam* param) { return param->connect.conn_id; }
+
+/// Returns the connection ID carried by a disconnect event.
+inline uint16_t bleDisconnectConnId(const BleConnParam* param) { return param->disconnect.conn_id; }
+
+/// Returns the connection ID carried by a write event.
+inline uint16_t bleWriteConnId(const BleConnParam* param) { return param->write.conn_id; }
+
+/// Returns the connection ID carried by a read event.
+inline uint16_t bleReadConnId(const BleConnParam* param) { return param->read.conn_id; }
+
+/// Returns the peer's address from a connect event.
+inline const uint8_t* bleConnectAddress(const BleConnParam* param) { return param->connect.remote_bda; }
+
+/// Returns the connection interval, in units of 1.25 ms, from a connect event.
+inline uint16_t bleConnectInterval(const BleConnParam* param) { return param->connect.conn_params.interval; }
+
+/// Returns the slave latency from a connect event.
+inline uint16_t bleConnectLatency(const BleConnParam* param) { return param->connect.conn_params.latency; }
+
+/// Returns the supervision timeout, in units of 10 ms, from a connect event.
+inline uint16_t bleConnectTimeout(const BleConnParam* param) { return param->connect.conn_params.timeout; }
+
+/**
+ * @brief Backend-neutral characteristic properties.
+ */
+namespace BleProperty {
+const uint32_t kRead = BLECharacteristic::PROPERTY_READ;
+const uint32_t kWrite = BLECharacteristic::PROPERTY_WRITE;
+const uint32_t kWriteNoResponse = BLECharacteristic::PROPERTY_WRITE_NR;
+const uint32_t kNotify = BLECharacteristic::PROPERTY_NOTIFY;
+const uint32_t kIndicate = BLECharacteristic::PROPERTY_INDICATE;
+}
+
+/**
+ * @class BleValue
+ * @brief A read-only view of a characteristic's value.
+ *
+ * Bluedroid exposes the stored value directly, so the view does not copy it. It is only
+ * valid until the value is next written.
+ */
+class BleValue {
+public:
+    explicit BleValue(BLECharacteristic* pCharacteristic)
+        : bytes(pCharacteristic->getData()), size(pCharacteristic->getLength()) {}
+    const uint8_t* data() const { return bytes; }
+    size_t length() const { return size; }
+
+private:
+    const uint8_t* bytes;
+    size_t size;
+};
+
+/**
+ * @brief Returns the connection ID of the most recently connected client.
+ */
+inline uint16_t bleConnId(BLEServer* pServer) {
+    return pServer->getConnId();
+}
+
+/**
+ * @brief Installs server callbacks that the server must not delete.
+ */
+inline void setBleServerCallbacks(BLEServer* pServer, BLEServerCallbacks* pCallbacks) {
+    pServer->setCallbacks(pCallbacks);
+}
+
+/**
+ * @brief Constructs a CCCD descriptor in a static pool rather than on the heap.
+ *
+ * Descriptors live as long as the service, so the pool never frees them.
+ */
+inline BLE2902* newCccd() {
+    static std::aligned_storage<sizeof(BLE2902), alignof(BLE2902)>::type pool[TESTER_CCCD_POOL_SIZE];
+    static size_t used = 0;
+    if (used >= TESTER_CCCD_POOL_SIZE) {
+        return new BLE2902();
+    }
+    return new (&pool[used++]) BLE2902();
+}
+
+/**
+ * @brief Creates a service with room for the given number of attribute handles.
+ */
+inline BLEService* createBleService(BLEServer* pServer, const char* uuid, uint32_t numHandles) {
+    return pServer->createService(BLEUUID(uuid), numHandles);
+}
+
+/**
+ * @brief Creates a characteristic, adding encryption and the CCCD as needed.
+ *
+ * Characteristics that notify or indicate get a BLE2902 descriptor, which can be looked up
+ * with getDescriptorByUUID(BLEUUID((uint16_t)0x2902)) to attach descriptor callbacks.
+ */
+inline BLECharacteristic* createBleCharacteristic(BLEService* pService, const char* uuid,
+                                                  uint32_t properties, bool encrypted = false) {
+    BLECharacteristic* pCharacteristic = pService->createCharacteristic(uuid, properties);
+    if (encrypted) {
+        pCharacteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED);
+    }
+    if (properties & (BleProperty::kNotify | BleProperty::kIndicate)) {
+        pCharacteristic->addDescriptor(newCccd());
+    }
+    return pCharacteristic;
+}
+
+#endif // TESTER_USE_NIMBLE
+
+#endif // BLE_BACKEND_H
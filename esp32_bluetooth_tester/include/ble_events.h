@@ -0,0 +1,44 @@
+/**
+ * @file
+ * @brief Fan-out of raw Bluedroid GAP and GATT server events to several modules.
+ *
+ * The ESP32 BLE Arduino library only accepts a single custom GAP handler and a single
+ * custom GATTS handler. Modules that need low-level events, such as CCCD writes per
+ * connection or security completion, register here instead, and the dispatcher forwards
+ * every event to each registered handler in registration order.
+ *
+ * Handlers run on the Bluedroid BTC task and must not block. NimBLE builds do not use this
+ * module; NimBLE reports the equivalent events through the server and characteristic callbacks.
+ */
+
+#ifndef BLE_EVENTS_H
+#define BLE_EVENTS_H
+
+#include "ble_backend.h"
+
+#if !TESTER_USE_NIMBLE
+
+/// The maximum number of handlers that can be registered for each kind of event.
+#ifndef BLE_EVENTS_MAX_HANDLERS
+#define BLE_EVENTS_MAX_HANDLERS 8
+#endif
+
+/**
+ * @brief Registers a handler for raw GAP events.
+ *
+ * @param handler The handler to call for every GAP event.
+ * @return true if the handler was registered, false if the handler table is full.
+ */
+bool addGapEventHandler(gap_event_handler handler);
+
+/**
+ * @brief Registers a handler for raw GATT server events.
+ *
+ * @param handler The handler to call for every GATT server event.
+ * @return true if the handler was registered, false if the handler table is full.
+ */
+bool addGattsEventHandler(gatts_event_handler handler);
+
+#endif // !TESTER_USE_NIMBLE
+
+#endif // BLE_EVENTS_H
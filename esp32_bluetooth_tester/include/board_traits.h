@@ -0,0 +1,74 @@
+/**
+ * @file
+ * @brief Compile-time descriptions of the dev boards the tester runs on.
+ *
+ * Each supported board has a BoardTraits constant, and the build selects one with
+ * TESTER_BOARD (see platformio.ini for the matching environments). Everything that used to
+ * be edited by hand for a new board, such as the LED pin, comes from kBoard.
+ *
+ * On dual-core chips the BLE host and controller stay on core 0, where the framework pins
+ * them, and the tester's own tasks are pinned to core 1 with createAppTask(). On
+ * single-core chips every task shares core 0, so comparing the two builds shows what the
+ * scheduling contention costs.
+ */
+
+#ifndef BOARD_TRAITS_H
+#define BOARD_TRAITS_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/// The Adafruit QT Py ESP32-C3: single core, onboard Neopixel on GPIO2.
+#define TESTER_BOARD_QT_PY_C3 1
+
+/// The Smart Bee BeeS3 (ESP32-S3): dual core, onboard Neopixel on GPIO48.
+#define TESTER_BOARD_BEE_S3 2
+
+/// The board the firmware is built for.
+#ifndef TESTER_BOARD
+#define TESTER_BOARD TESTER_BOARD_QT_PY_C3
+#endif
+
+/**
+ * @brief The properties of a dev board that the firmware depends on.
+ */
+struct BoardTraits {
+    const char* name;   ///< A short name, printed in the boot report.
+    uint8_t ledPin;     ///< The GPIO the Neopixel data line is connected to.
+    uint16_t ledPixels; ///< The number of Neopixels on the board.
+    uint8_t cores;      ///< The number of CPU cores.
+    uint8_t rmtChannel; ///< The RMT channel that drives the Neopixels.
+};
+
+constexpr BoardTraits kQtPyC3Board = {"qt_py_esp32c3", 2, 1, 1, 0};
+constexpr BoardTraits kBeeS3Board = {"bee_s3", 48, 1, 2, 0};
+
+#if TESTER_BOARD == TESTER_BOARD_QT_PY_C3
+constexpr BoardTraits kBoard = kQtPyC3Board;
+#elif TESTER_BOARD == TESTER_BOARD_BEE_S3
+constexpr BoardTraits kBoard = kBeeS3Board;
+#else
+#error "Unknown TESTER_BOARD"
+#endif
+
+static_assert(kBoard.cores == portNUM_PROCESSORS,
+              "TESTER_BOARD does not match the chip the firmware is built for");
+
+/// The core the BLE host and controller run on.
+constexpr BaseType_t kBleCore = 0;
+
+/// The core the tester's own tasks run on, or no affinity on single-core chips.
+constexpr BaseType_t kAppCore = kBoard.cores > 1 ? 1 : tskNO_AFFINITY;
+
+/**
+ * @brief Creates one of the tester's tasks, pinned away from the BLE host where possible.
+ *
+ * Takes the same arguments as xTaskCreate().
+ */
+inline BaseType_t createAppTask(TaskFunction_t function, const char* name, uint32_t stackDepth,
+                                void* parameter, UBaseType_t priority, TaskHandle_t* pHandle) {
+    return xTaskCreatePinnedToCore(function, name, stackDepth, parameter, priority, pHandle, kAppCore);
+}
+
+#endif // BOARD_TRAITS_H
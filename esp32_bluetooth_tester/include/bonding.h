@@ -0,0 +1,105 @@
+/**
+ * @file
+ * @brief Persistent bonds and pairing and reconnect latency measurement.
+ *
+ * The tester bonds with every client that pairs, and the BLE stack keeps the keys in NVS,
+ * so a client that reconnects after a disconnect or a reboot encrypts the link with the
+ * stored keys instead of pairing again. At most TESTER_MAX_BONDS bonds are kept; when a new
+ * pairing would exceed that, the oldest bond is removed.
+ *
+ * Every connection is timed until its link is encrypted. A new pairing is timed from the
+ * start of pairing to encryption complete, and a reconnect of a bonded client from the
+ * connection to encryption complete. NimBLE does not report when pairing starts, so NimBLE
+ * builds time new pairings from the connection too.
+ *
+ * The bonds characteristic requires an encrypted link, so a client that has not paired can
+ * neither list the bonds nor remove them. Reading it returns a BondingStats record followed
+ * by the 6-byte address of every bond, in the same byte order as the connections
+ * characteristic. Commands written to it are binary:
+ *
+ *   - 0x00 Reset the latency statistics.
+ *   - 0x01 Remove all bonds.
+ *   - 0x02 Remove one bond: [0x02][address 6 bytes]
+ *
+ * Removing a bond does not disconnect the client, but it has to pair again the next time.
+ */
+
+#ifndef BONDING_H
+#define BONDING_H
+
+#include "ble_backend.h"
+
+/// The maximum number of bonds kept in NVS. This cannot exceed the stack's own limit:
+/// CONFIG_BT_SMP_MAX_BONDS on Bluedroid (15 in the Arduino core) or
+/// CONFIG_BT_NIMBLE_MAX_BONDS on NimBLE (3 by default, raise it with a build flag).
+#ifndef TESTER_MAX_BONDS
+#define TESTER_MAX_BONDS 3
+#endif
+
+/// The UUID of the bonds characteristic.
+#define BONDS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890bd"
+
+/// The opcode that resets the latency statistics.
+#define BONDS_OPCODE_RESET_STATS 0x00
+
+/// The opcode that removes all bonds.
+#define BONDS_OPCODE_CLEAR 0x01
+
+/// The opcode that removes the bond with one address.
+#define BONDS_OPCODE_REMOVE 0x02
+
+/**
+ * @brief The wire format of the bonding stats. All fields are little-endian and all
+ * latencies are in microseconds.
+ */
+struct __attribute__((packed)) BondingStats {
+    uint8_t bonds;             ///< The number of bonds stored, and of addresses that follow.
+    uint8_t maxBonds;          ///< TESTER_MAX_BONDS.
+    uint32_t pairings;         ///< New pairings completed.
+    uint32_t reconnects;       ///< Links encrypted with the keys of an existing bond.
+    uint32_t failures;         ///< Pairings or encryptions that failed.
+    uint32_t evictions;        ///< Bonds removed to make room for a new one.
+    uint32_t lastPairingUs;    ///< Pairing start to encryption complete, most recent.
+    uint32_t minPairingUs;
+    uint32_t maxPairingUs;
+    uint32_t lastReconnectUs;  ///< Connection to encryption complete, most recent reconnect.
+    uint32_t minReconnectUs;
+    uint32_t maxReconnectUs;
+};
+
+/**
+ * @brief Creates the bonds characteristic and hooks bond tracking into the BLE stack.
+ *
+ * The security configuration itself, with bonding enabled, is applied in setup().
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupBonding(BLEService* pService);
+
+/**
+ * @brief Starts timing a new connection until its link is encrypted.
+ *
+ * @param connId The connection ID.
+ */
+void onBondingConnected(uint16_t connId);
+
+/**
+ * @brief Stops timing a connection.
+ */
+void onBondingDisconnected(uint16_t connId);
+
+/**
+ * @brief Returns true if the link of a connection was encrypted with the keys of a bond that
+ * was already stored when the client connected, rather than by pairing on this connection.
+ */
+bool bondingReconnected(uint16_t connId);
+
+#if TESTER_USE_NIMBLE
+/**
+ * @brief Records the outcome of pairing or encryption on a NimBLE connection. Bluedroid
+ * builds get the same from GAP events.
+ */
+void onBondingAuthenticationComplete(const ble_gap_conn_desc* desc);
+#endif
+
+#endif // BONDING_H
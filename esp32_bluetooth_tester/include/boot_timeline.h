@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @brief Timestamps of the phases of setup(), for measuring how soon the device is connectable.
+ *
+ * setup() marks each phase as it completes. The timestamps are esp_timer microseconds, which
+ * count from early application startup, so time spent in the ROM and second-stage bootloader
+ * is not included. The timeline is printed to the serial console once setup() is done, and
+ * reading the boot timeline characteristic returns it as a BootTimelineRecord.
+ *
+ * Building with TESTER_FAST_BOOT=1 reorders setup() so that the BLE stack, the tester
+ * service and advertising come first. The LED, the serial console and the trace file
+ * system mount follow, and on Bluedroid so do the generated load-test services, OTA and
+ * the traffic generator. NimBLE registers its attribute table with the host when
+ * advertising starts, and adding services later needs a GATT reset that waits until no
+ * client is connected, so NimBLE builds still create those services before advertising.
+ * Bonds are loaded from NVS by the stack inside BLEDevice::init(), which has to come first
+ * either way.
+ */
+
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include "ble_backend.h"
+
+/// Set to 1 to start advertising before everything outside the tester service is initialized.
+#ifndef TESTER_FAST_BOOT
+#define TESTER_FAST_BOOT 0
+#endif
+
+/// The UUID of the boot timeline characteristic.
+#define BOOT_TIMELINE_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b5"
+
+/**
+ * @brief The phases of setup(), in the order they appear in the timeline record.
+ */
+enum class BootPhase : uint8_t {
+    SetupEntered = 0, ///< setup() was called by the Arduino core.
+    LedReady,         ///< The Neopixel is initialized and handed to the render task.
+    ConsoleReady,     ///< Serial and the asynchronous logger are running.
+    StackReady,       ///< BLEDevice::init() has returned.
+    SecurityReady,    ///< Security parameters are configured.
+    GattReady,        ///< The service is started.
+    Advertising,      ///< Advertising has started and the device is connectable.
+    SetupDone,        ///< setup() is about to return.
+    Count
+};
+
+/// The number of phases in the timeline.
+const size_t kBootPhaseCount = static_cast<size_t>(BootPhase::Count);
+
+/**
+ * @brief The wire format of the boot timeline. All fields are little-endian.
+ */
+struct __attribute__((packed)) BootTimelineRecord {
+    uint8_t fastBoot;                   ///< 1 if the firmware was built with TESTER_FAST_BOOT.
+    uint8_t phaseCount;                 ///< The number of entries in phaseUs.
+    uint32_t phaseUs[kBootPhaseCount];  ///< When each BootPhase completed, or 0 if it has not.
+};
+
+/**
+ * @brief Records the completion time of a phase.
+ */
+void markBootPhase(BootPhase phase);
+
+/**
+ * @brief Creates the boot timeline characteristic.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupBootTimeline(BLEService* pService);
+
+/**
+ * @brief Prints the timeline to the serial console.
+ */
+void printBootTimeline();
+
+#endif // BOOT_TIMELINE_H
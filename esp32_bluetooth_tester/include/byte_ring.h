@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief A fixed-capacity, single-producer single-consumer ring of variable-length records.
+ *
+ * Each record is stored as a little-endian uint16 length followed by its bytes, wrapping
+ * around the end of the buffer as needed. The storage is a member array, so a ring declared
+ * at namespace scope lives in static RAM and never touches the heap. One task may push while
+ * another pops without any locking.
+ */
+
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+/**
+ * @class ByteRing
+ * @brief A lock-free SPSC queue of byte records.
+ *
+ * @tparam Capacity The size of the storage in bytes, including the two-byte header of every
+ *                  record. Must be a power of two.
+ */
+template <size_t Capacity>
+class ByteRing {
+public:
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "The ring capacity must be a power of two");
+    static_assert(Capacity <= 0x80000000u, "The ring capacity must fit the 32-bit indices");
+
+    /// The number of bytes each record uses in addition to its payload.
+    static const size_t kHeaderLength = 2;
+
+    ByteRing() : head(0), tail(0) {}
+
+    /**
+     * @brief Appends a record. Call from the producer only.
+     *
+     * @param data The bytes of the record.
+     * @param length The number of bytes, from 1 to 65535.
+     * @return false if the record is empty or does not fit in the free space.
+     */
+    bool push(const uint8_t* data, size_t length) {
+        if (length == 0 || length > 0xFFFF) {
+            return false;
+        }
+        const uint32_t writeIndex = head.load(std::memory_order_relaxed);
+        const uint32_t used = writeIndex - tail.load(std::memory_order_acquire);
+        if (kHeaderLength + length > Capacity - used) {
+            return false;
+        }
+        const uint8_t header[kHeaderLength] = {
+            static_cast<uint8_t>(length & 0xFF),
+            static_cast<uint8_t>(length >> 8),
+        };
+        copyIn(writeIndex, header, kHeaderLength);
+        copyIn(writeIndex + kHeaderLength, data, length);
+        head.store(writeIndex + kHeaderLength + length, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest record. Call from the consumer only.
+     *
+     * @param out The buffer the record is copied into.
+     * @param outCapacity The size of the buffer. Longer records are truncated.
+     * @param length Receives the full length of the record, which may exceed outCapacity.
+     * @return false if the ring is empty.
+     */
+    bool pop(uint8_t* out, size_t outCapacity, size_t* length) {
+        const uint32_t readIndex = tail.load(std::memory_order_relaxed);
+        if (readIndex == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        uint8_t header[kHeaderLength];
+        copyOut(readIndex, header, kHeaderLength);
+        const size_t recordLength = header[0] | (header[1] << 8);
+        copyOut(readIndex + kHeaderLength, out, recordLength < outCapacity ? recordLength : outCapacity);
+        tail.store(readIndex + kHeaderLength + recordLength, std::memory_order_release);
+        *length = recordLength;
+        return true;
+    }
+
+    /**
+     * @brief Returns the number of bytes currently queued, including record headers.
+     */
+    size_t used() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Returns the total size of the storage in bytes.
+     */
+    static size_t capacity() {
+        return Capacity;
+    }
+
+private:
+    void copyIn(uint32_t index, const uint8_t* data, size_t length) {
+        const size_t offset = index & (Capacity - 1);
+        const size_t first = length < Capacity - offset ? length : Capacity - offset;
+        memcpy(storage + offset, data, first);
+        memcpy(storage, data + first, length - first);
+    }
+
+    void copyOut(uint32_t index, uint8_t* data, size_t length) const {
+        const size_t offset = index & (Capacity - 1);
+        const size_t first = length < Capacity - offset ? length : Capacity - offset;
+        memcpy(data, storage + offset, first);
+        memcpy(data + first, storage, length - first);
+    }
+
+    uint8_t storage[Capacity];
+    std::atomic<uint32_t> head; ///< Total bytes ever pushed. Written by the producer only.
+    std::atomic<uint32_t> tail; ///< Total bytes ever popped. Written by the consumer only.
+};
+
+#endif // BYTE_RING_H
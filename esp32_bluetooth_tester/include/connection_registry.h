@@ -0,0 +1,242 @@
+/**
+ * @file
+ * @brief Tracks the state of every connected client when serving several centrals at once.
+ *
+ * The tester accepts up to TESTER_MAX_CONNECTIONS simultaneous connections and restarts
+ * advertising after every connect and disconnect while there is room for another client.
+ * For each connection the registry keeps the ATT MTU, the CCCD subscriptions to every
+ * tracked characteristic, the security level, and write and notification counters.
+ *
+ * The registry is also exposed over GATT. Reading the connections characteristic returns
+ * the number of active connections as a uint8 followed by one PeerConnectionRecord per
+ * connection.
+ */
+
+#ifndef CONNECTION_REGISTRY_H
+#define CONNECTION_REGISTRY_H
+
+#include "ble_backend.h"
+
+/// The maximum number of clients that can be connected at the same time. This cannot exceed
+/// the stack's own limit: CONFIG_BT_ACL_CONNECTIONS on Bluedroid (4 in the Arduino core) or
+/// CONFIG_BT_NIMBLE_MAX_CONNECTIONS on NimBLE (3 by default).
+#ifndef TESTER_MAX_CONNECTIONS
+#define TESTER_MAX_CONNECTIONS 3
+#endif
+
+/// The maximum number of characteristics whose subscriptions can be tracked.
+#define TRACKED_CHARACTERISTICS_MAX 32
+
+/// The UUID of the characteristic that reports the connection registry.
+#define CONNECTIONS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b0"
+
+/**
+ * @brief The security level of a connection.
+ */
+enum class PeerSecurity : uint8_t {
+    None = 0,          ///< The link is not encrypted.
+    Encrypted = 1,     ///< The link is encrypted with an unauthenticated (Just Works) key.
+    Authenticated = 2, ///< The link is encrypted with an authenticated key.
+};
+
+/**
+ * @brief The wire format of one connection in the connections characteristic.
+ *
+ * Bit i of the subscription masks refers to the i-th characteristic registered with
+ * trackSubscriptions(). All fields are little-endian.
+ */
+struct __attribute__((packed)) PeerConnectionRecord {
+    uint16_t connId;
+    uint8_t address[6];
+    uint16_t mtu;
+    uint8_t security;
+    uint32_t notifySubscriptions;
+    uint32_t indicateSubscriptions;
+    uint32_t writes;
+    uint32_t notifications;
+};
+
+/**
+ * @class TrackedCharacteristicCallbacks
+ * @brief Base class for characteristic callbacks that feeds the connection registry.
+ *
+ * It records every write against the connection it came from before forwarding to
+ * onConnectionWrite(), which in turn calls the plain onWrite() overload unless a subclass
+ * needs to know the connection and overrides it, and times the callback for the firmware
+ * stats. onStatus() counts failed notifications. On NimBLE it also records CCCD writes,
+ * which NimBLE reports through onSubscribe() rather than descriptor callbacks. Subclasses
+ * that override onStatus() or onSubscribe() must call this implementation.
+ */
+class TrackedCharacteristicCallbacks : public BLECharacteristicCallbacks {
+public:
+    using BLECharacteristicCallbacks::onWrite;
+
+    void onWrite(BLECharacteristic* pCharacteristic, BleConnParam* param) override;
+
+    /**
+     * @brief Called for every write with the ID of the connection it arrived on.
+     */
+    virtual void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) {
+        onWrite(pCharacteristic);
+    }
+
+    void onStatus(BLECharacteristic* pCharacteristic, Status s, BleStatusCode code) override;
+
+#if TESTER_USE_NIMBLE
+    void onSubscribe(BLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc, uint16_t subValue) override;
+#endif
+};
+
+/**
+ * @brief Creates the connections characteristic and hooks the registry into the BLE stack.
+ *
+ * @param pServer A pointer to the BLE server, used to restart advertising and to reject
+ *                connections beyond TESTER_MAX_CONNECTIONS.
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupConnectionRegistry(BLEServer* pServer, BLEService* pService);
+
+/**
+ * @brief Starts tracking per-connection subscriptions to a characteristic.
+ *
+ * @param pCharacteristic A pointer to a characteristic that notifies or indicates.
+ * @return The bit index of the characteristic in the subscription masks, or -1 if the
+ *         table of tracked characteristics is full.
+ */
+int trackSubscriptions(BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief Records a new connection and restarts advertising if there is room for another.
+ *
+ * @param connId The connection ID.
+ * @param address The peer's Bluetooth device address.
+ */
+void registerConnection(uint16_t connId, const uint8_t* address);
+
+/**
+ * @brief Forgets a connection and restarts advertising.
+ *
+ * @param connId The connection ID.
+ */
+void unregisterConnection(uint16_t connId);
+
+/**
+ * @brief Records the ATT MTU negotiated on a connection.
+ */
+void recordConnectionMtu(uint16_t connId, uint16_t mtu);
+
+/**
+ * @brief Records the security level reached on a connection.
+ */
+void recordConnectionSecurity(uint16_t connId, PeerSecurity security);
+
+/**
+ * @brief Returns the security level reached on a connection, or PeerSecurity::None if the
+ * connection is unknown.
+ */
+PeerSecurity connectionSecurity(uint16_t connId);
+
+/**
+ * @brief Records a CCCD write on a connection.
+ *
+ * @param connId The connection ID.
+ * @param pCharacteristic The characteristic whose CCCD was written.
+ * @param value The CCCD value: bit 0 enables notifications, bit 1 indications.
+ */
+void recordSubscription(uint16_t connId, BLECharacteristic* pCharacteristic, uint16_t value);
+
+/**
+ * @brief Looks up the peer address of a connection.
+ *
+ * @param connId The connection ID.
+ * @param address Receives the 6-byte peer address.
+ * @return true if the connection is in the registry.
+ */
+bool connectionAddress(uint16_t connId, uint8_t* address);
+
+/**
+ * @brief Looks up the connection to a peer address.
+ *
+ * @param address The 6-byte peer address.
+ * @param connId Receives the connection ID.
+ * @return true if a connection to the address is in the registry.
+ */
+bool connectionForAddress(const uint8_t* address, uint16_t* connId);
+
+/**
+ * @brief Returns true if a connection is in the registry.
+ */
+bool connectionActive(uint16_t connId);
+
+/**
+ * @brief Returns the number of connections currently in the registry.
+ */
+size_t activeConnectionCount();
+
+/**
+ * @brief Copies the records of the active connections.
+ *
+ * @param records Receives up to capacity records.
+ * @param capacity The number of records that fit.
+ * @return The number of records copied.
+ */
+size_t connectionRecords(PeerConnectionRecord* records, size_t capacity);
+
+/**
+ * @brief Returns true if any connection has notifications or indications enabled on a
+ * characteristic. Characteristics that are not tracked are assumed to have subscribers.
+ */
+bool hasSubscribers(const BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief Returns true if any connection has indications enabled on a characteristic.
+ * Characteristics that are not tracked are assumed to have subscribers.
+ */
+bool hasIndicationSubscribers(const BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief Notifies a characteristic's current value and counts it for every subscribed connection.
+ *
+ * Nothing is sent when no connection has notifications enabled, which saves the stack from
+ * building a notification only to drop it.
+ *
+ * @param pCharacteristic A pointer to the characteristic to notify.
+ * @return false if the notification was skipped because nobody is subscribed.
+ */
+bool notifyCharacteristic(BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief Indicates a characteristic's current value and counts it for every connection
+ * subscribed to indications.
+ *
+ * Nothing is sent when no connection has indications enabled. The confirmation, or its
+ * timeout, is reported through the characteristic's onStatus() callback.
+ *
+ * @param pCharacteristic A pointer to the characteristic to indicate.
+ * @return false if the indication was skipped because nobody is subscribed.
+ */
+bool indicateCharacteristic(BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief The outcome of a notification sent to a single connection.
+ */
+enum class ConnectionNotifyResult : uint8_t {
+    Sent,          ///< The stack queued the notification.
+    NotSubscribed, ///< The connection is gone or has notifications disabled, so nothing was sent.
+    Failed,        ///< The stack refused the notification, typically because its buffers are full.
+};
+
+/**
+ * @brief Notifies a characteristic's current value to one connection only.
+ *
+ * For replies and streams that belong to the client that asked for them, and that are
+ * sized to its MTU. Characteristics that are not tracked are assumed to be subscribed.
+ * The result is also reported through onStatus() on NimBLE, but not on Bluedroid.
+ *
+ * @param pCharacteristic A pointer to the characteristic to notify.
+ * @param connId The connection to notify.
+ * @return Whether the notification was sent, skipped or refused.
+ */
+ConnectionNotifyResult notifyConnection(BLECharacteristic* pCharacteristic, uint16_t connId);
+
+#endif // CONNECTION_REGISTRY_H
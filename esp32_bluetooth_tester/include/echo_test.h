@@ -0,0 +1,38 @@
+/**
+ * @file
+ * @brief Round-trip latency echo test for the ESP32 BLE tester.
+ *
+ * The echo characteristic sends every write straight back as a notification, from within
+ * the write callback and without touching the serial console or the LED. Two little-endian
+ * uint64 timestamps from esp_timer are appended to the echoed payload:
+ *
+ *   [payload][receive time in us][send time in us]
+ *
+ * The receive time is taken on entry to the write callback, and the send time immediately
+ * before the notification is handed to the stack. Clients should keep their payloads at
+ * least 16 bytes shorter than MTU - 3 so the timestamps are not truncated.
+ *
+ * The firmware also records the on-device turnaround, from the receive timestamp until the
+ * stack has accepted the notification, in a fixed-bucket histogram. Reading the histogram
+ * characteristic returns a LatencyHistogramSnapshot; writing any value to it resets it.
+ */
+
+#ifndef ECHO_TEST_H
+#define ECHO_TEST_H
+
+#include "ble_backend.h"
+
+/// The UUID of the echo characteristic.
+#define ECHO_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890ae"
+
+/// The UUID of the echo latency histogram characteristic.
+#define ECHO_HISTOGRAM_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890af"
+
+/**
+ * @brief Creates the echo and latency histogram characteristics.
+ *
+ * @param pService A pointer to the service the characteristics are added to.
+ */
+void setupEchoTest(BLEService* pService);
+
+#endif // ECHO_TEST_H
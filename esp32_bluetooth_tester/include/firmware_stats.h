@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @brief Firmware-wide counters for spotting regressions between builds.
+ *
+ * The hot paths only increment atomics: the connection registry records every write with
+ * its callback duration and every notification with its status, and the server callbacks
+ * record connects and disconnects. Heap and stack figures are sampled when the stats are
+ * read, so they cost nothing in between.
+ *
+ * Reading the stats characteristic returns a FirmwareStats record. Subscribers also get it
+ * as a notification every FIRMWARE_STATS_NOTIFY_MS milliseconds, so a soak test can be
+ * followed over BLE without a serial console.
+ *
+ * A heap report is printed to the serial console after setup() and again every
+ * TESTER_HEAP_REPORT_WRITES writes, so heap growth and fragmentation show up in the log of
+ * a long run.
+ */
+
+#ifndef FIRMWARE_STATS_H
+#define FIRMWARE_STATS_H
+
+#include "ble_backend.h"
+
+/// The UUID of the firmware stats characteristic.
+#define FIRMWARE_STATS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b4"
+
+/// How often the stats are notified to subscribed clients, in milliseconds.
+#ifndef FIRMWARE_STATS_NOTIFY_MS
+#define FIRMWARE_STATS_NOTIFY_MS 1000
+#endif
+
+/// The number of writes between heap reports.
+#ifndef TESTER_HEAP_REPORT_WRITES
+#define TESTER_HEAP_REPORT_WRITES 1000000
+#endif
+
+/// The version of the FirmwareStats layout. Bump it whenever the layout changes.
+#define FIRMWARE_STATS_VERSION 3
+
+/**
+ * @brief The wire format of the firmware stats. All fields are little-endian.
+ */
+struct __attribute__((packed)) FirmwareStats {
+    uint8_t version;                 ///< FIRMWARE_STATS_VERSION.
+    uint32_t uptimeMs;
+    uint32_t writes;                 ///< Writes handled by any characteristic.
+    uint32_t notifications;          ///< Notifications sent, counted once per subscribed connection.
+    uint32_t failedNotifications;    ///< Notifications and indications the stack failed to send.
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t writeMinUs;             ///< The shortest write callback, or 0 if there were none.
+    uint32_t writeAvgUs;
+    uint32_t writeMaxUs;
+    uint32_t freeHeap;               ///< Free heap in bytes.
+    uint32_t minFreeHeap;            ///< The lowest free heap since boot, in bytes.
+    uint32_t largestFreeBlock;       ///< The largest block that can currently be allocated, in bytes.
+    uint32_t bleStackHighWater;      ///< Unused stack of the BLE callback task in bytes, or 0 if unknown.
+    uint32_t logDropped;             ///< Log records dropped because the log queue was full.
+    uint32_t skippedNotifications;   ///< Notifications not sent because nobody was subscribed.
+    uint32_t coalescedNotifications; ///< Value changes superseded before they were notified.
+};
+
+/**
+ * @brief Creates the stats characteristic and starts the periodic notification.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupFirmwareStats(BLEService* pService);
+
+/**
+ * @brief Records a handled write and how long its callback took.
+ */
+void statsRecordWrite(uint32_t durationUs);
+
+/**
+ * @brief Records a notification sent to one subscribed connection.
+ */
+void statsRecordNotification();
+
+/**
+ * @brief Records a notification that was skipped because nobody was subscribed.
+ */
+void statsRecordSkippedNotification();
+
+/**
+ * @brief Records a value change that was replaced by a newer one before it was notified.
+ */
+void statsRecordCoalescedNotification();
+
+/**
+ * @brief Records a notification that failed.
+ */
+void statsRecordFailedNotification();
+
+/**
+ * @brief Records a connection. Call from the BLE callback task, whose stack is then monitored.
+ */
+void statsRecordConnect();
+
+/**
+ * @brief Records a disconnection.
+ */
+void statsRecordDisconnect();
+
+/**
+ * @brief Prints the write count, free and minimum free heap, and largest free block.
+ *
+ * The report bypasses the log level so that perf builds still print it.
+ */
+void printHeapReport();
+
+/**
+ * @brief Fills a stats record with the current counters, heap and stack figures.
+ */
+void firmwareStatsSnapshot(FirmwareStats& stats);
+
+/**
+ * @brief Resets the write, notification and connection counters.
+ *
+ * The heap figures, the log drop count and the monitored BLE task are left as they are.
+ */
+void resetFirmwareStats();
+
+#endif // FIRMWARE_STATS_H
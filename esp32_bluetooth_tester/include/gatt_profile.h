@@ -0,0 +1,276 @@
+/**
+ * @file
+ * @brief A GATT database generated at boot from a compile-time table, for load-testing
+ * service discovery and attribute caching in client apps.
+ *
+ * The table lists services, and for each service the characteristics it contains, with
+ * their properties, permissions, value size and notify behaviour. Entries are run-length
+ * encoded: a GattServiceSpec stands for `count` identical services and a
+ * GattCharacteristicSpec for `count` consecutive characteristics, so a large preset stays a
+ * few lines long. The size of the database, including attribute handles, is computed at
+ * compile time and checked against the stack's limits.
+ *
+ * TESTER_GATT_PROFILE selects a preset:
+ *
+ *   | Preset   | Services | Characteristics per service |
+ *   |----------|----------|-----------------------------|
+ *   | 0 None   | 0        | 0                           |
+ *   | 1 Small  | 2        | 5                           |
+ *   | 2 Medium | 5        | 10                          |
+ *   | 3 Large  | 10       | 20                          |
+ *
+ * Service i (counting from 0) gets the UUID GATT_PROFILE_UUID_PREFIX followed by
+ * "iiii00000000" in hex, and its characteristic j (counting from 1) the same with the last
+ * four digits replaced by j. Characteristic values start zero-filled at their value size.
+ * Periodic characteristics notify a little-endian 32-bit counter at the start of their
+ * value every GATT_PROFILE_NOTIFY_MS milliseconds; OnWrite characteristics notify every
+ * value written to them.
+ *
+ * Characteristics that notify are tracked with trackSubscriptions() for as long as the
+ * registry has slots left (TRACKED_CHARACTERISTICS_MAX, shared with the tester's own
+ * characteristics), so only subscribed connections count their notifications. The rest, for
+ * instance most of the Large preset, are notified as if every connection were subscribed
+ * and are left out of the per-connection and firmware notification counts. On Bluedroid
+ * every CCCD comes from the static pool in ble_backend.h, so a preset that does not fit
+ * TESTER_CCCD_POOL_SIZE fails to build.
+ *
+ * Reading the profile info characteristic in the tester service returns a GattProfileInfo.
+ */
+
+#ifndef GATT_PROFILE_H
+#define GATT_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ble_backend.h"
+
+/// The preset to generate, a GattProfilePreset.
+#ifndef TESTER_GATT_PROFILE
+#define TESTER_GATT_PROFILE 0
+#endif
+
+/// The first 24 characters of the UUIDs of the generated services and characteristics.
+#ifndef GATT_PROFILE_UUID_PREFIX
+#define GATT_PROFILE_UUID_PREFIX "abcd1234-1234-1234-7000-"
+#endif
+
+/// How often periodic characteristics notify, in milliseconds.
+#ifndef GATT_PROFILE_NOTIFY_MS
+#define GATT_PROFILE_NOTIFY_MS 1000
+#endif
+
+/// The UUID of the profile info characteristic.
+#define GATT_PROFILE_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890be"
+
+/**
+ * @brief The generated profiles, as selected by TESTER_GATT_PROFILE.
+ */
+enum class GattProfilePreset : uint8_t {
+    None = 0,
+    Small = 1,
+    Medium = 2,
+    Large = 3,
+    Count
+};
+
+/**
+ * @brief When a generated characteristic notifies.
+ */
+enum class GattNotifyMode : uint8_t {
+    None = 0,     ///< Never.
+    OnWrite = 1,  ///< Whenever a value is written to it.
+    Periodic = 2, ///< Every GATT_PROFILE_NOTIFY_MS milliseconds.
+};
+
+/**
+ * @brief A run of identical characteristics.
+ */
+struct GattCharacteristicSpec {
+    uint32_t properties;   ///< BleProperty flags.
+    bool encrypted;        ///< Reads and writes need an encrypted link.
+    uint16_t valueSize;    ///< The size of the initial value, in bytes.
+    GattNotifyMode notify;
+    uint8_t count;         ///< The number of consecutive characteristics generated.
+};
+
+/**
+ * @brief A run of identical services.
+ */
+struct GattServiceSpec {
+    const GattCharacteristicSpec* characteristics;
+    uint8_t characteristicSpecs; ///< The number of entries in characteristics.
+    uint8_t count;               ///< The number of services generated.
+};
+
+/**
+ * @brief A generated profile.
+ */
+struct GattProfileSpec {
+    const char* name;
+    const GattServiceSpec* services;
+    uint8_t serviceSpecs; ///< The number of entries in services.
+};
+
+/**
+ * @brief The wire format of the profile info. All fields are little-endian.
+ */
+struct __attribute__((packed)) GattProfileInfo {
+    uint8_t preset;           ///< TESTER_GATT_PROFILE.
+    uint16_t services;        ///< Generated services.
+    uint16_t characteristics; ///< Generated characteristics.
+    uint16_t handles;         ///< Attribute handles of the generated services.
+    uint32_t setupMs;         ///< The time it took to create and start the generated services.
+};
+
+namespace gatt_profile {
+
+template <typename T, size_t N>
+constexpr uint8_t specCount(const T (&)[N]) {
+    return N;
+}
+
+constexpr bool hasCccd(const GattCharacteristicSpec& spec) {
+    return (spec.properties & (BleProperty::kNotify | BleProperty::kIndicate)) != 0;
+}
+
+/// The declaration and the value take one handle each, and the CCCD one more.
+constexpr uint32_t characteristicHandles(const GattCharacteristicSpec* specs, size_t n) {
+    return n == 0 ? 0 : specs[0].count * (2 + (hasCccd(specs[0]) ? 1 : 0)) + characteristicHandles(specs + 1, n - 1);
+}
+
+constexpr uint32_t characteristicCount(const GattCharacteristicSpec* specs, size_t n) {
+    return n == 0 ? 0 : specs[0].count + characteristicCount(specs + 1, n - 1);
+}
+
+constexpr uint32_t periodicCount(const GattCharacteristicSpec* specs, size_t n) {
+    return n == 0 ? 0
+        : (specs[0].notify == GattNotifyMode::Periodic ? specs[0].count : 0) + periodicCount(specs + 1, n - 1);
+}
+
+constexpr uint32_t cccdCount(const GattCharacteristicSpec* specs, size_t n) {
+    return n == 0 ? 0 : (hasCccd(specs[0]) ? specs[0].count : 0) + cccdCount(specs + 1, n - 1);
+}
+
+/// The service declaration takes one handle.
+constexpr uint32_t serviceHandles(const GattServiceSpec& spec) {
+    return 1 + characteristicHandles(spec.characteristics, spec.characteristicSpecs);
+}
+
+constexpr uint32_t totalServices(const GattServiceSpec* specs, size_t n) {
+    return n == 0 ? 0 : specs[0].count + totalServices(specs + 1, n - 1);
+}
+
+constexpr uint32_t totalCharacteristics(const GattServiceSpec* specs, size_t n) {
+    return n == 0 ? 0
+        : specs[0].count * characteristicCount(specs[0].characteristics, specs[0].characteristicSpecs) +
+          totalCharacteristics(specs + 1, n - 1);
+}
+
+constexpr uint32_t totalHandles(const GattServiceSpec* specs, size_t n) {
+    return n == 0 ? 0 : specs[0].count * serviceHandles(specs[0]) + totalHandles(specs + 1, n - 1);
+}
+
+constexpr uint32_t totalPeriodic(const GattServiceSpec* specs, size_t n) {
+    return n == 0 ? 0
+        : specs[0].count * periodicCount(specs[0].characteristics, specs[0].characteristicSpecs) +
+          totalPeriodic(specs + 1, n - 1);
+}
+
+constexpr uint32_t totalCccds(const GattServiceSpec* specs, size_t n) {
+    return n == 0 ? 0
+        : specs[0].count * cccdCount(specs[0].characteristics, specs[0].characteristicSpecs) +
+          totalCccds(specs + 1, n - 1);
+}
+
+constexpr GattCharacteristicSpec kSmallCharacteristics[] = {
+    {BleProperty::kRead, false, 20, GattNotifyMode::None, 2},
+    {BleProperty::kRead | BleProperty::kWrite, false, 20, GattNotifyMode::None, 1},
+    {BleProperty::kRead | BleProperty::kNotify, false, 8, GattNotifyMode::Periodic, 1},
+    {BleProperty::kRead | BleProperty::kWrite | BleProperty::kNotify, false, 64, GattNotifyMode::OnWrite, 1},
+};
+
+constexpr GattCharacteristicSpec kMediumCharacteristics[] = {
+    {BleProperty::kRead, false, 20, GattNotifyMode::None, 4},
+    {BleProperty::kRead | BleProperty::kWrite, false, 20, GattNotifyMode::None, 2},
+    {BleProperty::kRead | BleProperty::kNotify, false, 8, GattNotifyMode::Periodic, 2},
+    {BleProperty::kRead | BleProperty::kWrite | BleProperty::kNotify, false, 64, GattNotifyMode::OnWrite, 1},
+    {BleProperty::kRead | BleProperty::kWrite, true, 20, GattNotifyMode::None, 1},
+};
+
+constexpr GattCharacteristicSpec kLargeCharacteristics[] = {
+    {BleProperty::kRead, false, 20, GattNotifyMode::None, 8},
+    {BleProperty::kRead | BleProperty::kWrite, false, 20, GattNotifyMode::None, 4},
+    {BleProperty::kRead | BleProperty::kNotify, false, 8, GattNotifyMode::Periodic, 4},
+    {BleProperty::kRead | BleProperty::kWrite | BleProperty::kNotify, false, 64, GattNotifyMode::OnWrite, 2},
+    {BleProperty::kRead | BleProperty::kWrite, true, 20, GattNotifyMode::None, 1},
+    {BleProperty::kRead, false, 244, GattNotifyMode::None, 1},
+};
+
+constexpr GattServiceSpec kSmallServices[] = {
+    {kSmallCharacteristics, specCount(kSmallCharacteristics), 2},
+};
+
+constexpr GattServiceSpec kMediumServices[] = {
+    {kMediumCharacteristics, specCount(kMediumCharacteristics), 5},
+};
+
+constexpr GattServiceSpec kLargeServices[] = {
+    {kLargeCharacteristics, specCount(kLargeCharacteristics), 10},
+};
+
+/// The presets, in GattProfilePreset order.
+constexpr GattProfileSpec kPresets[] = {
+    {"none", nullptr, 0},
+    {"small", kSmallServices, specCount(kSmallServices)},
+    {"medium", kMediumServices, specCount(kMediumServices)},
+    {"large", kLargeServices, specCount(kLargeServices)},
+};
+
+static_assert(specCount(kPresets) == static_cast<size_t>(GattProfilePreset::Count),
+              "Every GATT profile preset needs a table");
+
+} // namespace gatt_profile
+
+static_assert(TESTER_GATT_PROFILE >= 0 && TESTER_GATT_PROFILE < static_cast<int>(GattProfilePreset::Count),
+              "TESTER_GATT_PROFILE must name a GattProfilePreset");
+
+/// The profile selected for this build.
+constexpr GattProfileSpec kGattProfile = gatt_profile::kPresets[TESTER_GATT_PROFILE];
+
+/// The number of services generated.
+constexpr uint32_t kGattProfileServices = gatt_profile::totalServices(kGattProfile.services, kGattProfile.serviceSpecs);
+
+/// The number of characteristics generated.
+constexpr uint32_t kGattProfileCharacteristics =
+    gatt_profile::totalCharacteristics(kGattProfile.services, kGattProfile.serviceSpecs);
+
+/// The number of attribute handles the generated services take.
+constexpr uint32_t kGattProfileHandles = gatt_profile::totalHandles(kGattProfile.services, kGattProfile.serviceSpecs);
+
+/// The number of characteristics that notify periodically.
+constexpr uint32_t kGattProfilePeriodic = gatt_profile::totalPeriodic(kGattProfile.services, kGattProfile.serviceSpecs);
+
+/// The number of characteristics that notify, and so have a CCCD.
+constexpr uint32_t kGattProfileCccds = gatt_profile::totalCccds(kGattProfile.services, kGattProfile.serviceSpecs);
+
+/**
+ * @brief Creates the profile info characteristic.
+ *
+ * @param pService A pointer to the service the info characteristic is added to. Call
+ *                 before it is started.
+ */
+void setupGattProfile(BLEService* pService);
+
+/**
+ * @brief Generates and starts the services of the selected preset, and starts the periodic
+ * notifications.
+ *
+ * Until this has run, the info characteristic reports the size of the preset with a setup
+ * time of 0.
+ *
+ * @param pServer A pointer to the BLE server the services are added to.
+ */
+void startGattProfile(BLEServer* pServer);
+
+#endif // GATT_PROFILE_H
@@ -0,0 +1,121 @@
+/**
+ * @file
+ * @brief Indication delivery with confirmation-latency tracking.
+ *
+ * Every indication sent through indicateCharacteristic() is timed from the send to the
+ * client's confirmation, once for each subscribed connection, and the latency is recorded
+ * in a histogram. This covers the LED characteristics, whose changes are indicated through
+ * indicateLatest(), and the traffic generator's indicate mode.
+ *
+ * ATT allows only one indication in flight per connection, so indicateLatest() sends from
+ * a dedicated task that waits for each confirmation before the next indication. What
+ * happens to a change that arrives while an indication is in flight depends on pipelining:
+ *
+ *   - Off (stop-and-wait): the change is not indicated and is counted as busy. The client
+ *     sees it on its next read. Every sample is the latency of a single, unqueued indication.
+ *   - On: the change is held, and the latest held value of each characteristic goes out as
+ *     soon as the confirmation arrives. Held values that are replaced before they are sent are
+ *     counted as superseded. This gives the highest reliable delivery rate.
+ *
+ * The compile-time default is INDICATION_PIPELINING. Writing [0x01][pipelining u8] to the
+ * indication stats characteristic switches it, and [0x00] resets the stats; both reset the
+ * counters and the histogram. Reading it returns an IndicationStats.
+ */
+
+#ifndef INDICATION_TRACKER_H
+#define INDICATION_TRACKER_H
+
+#include "ble_backend.h"
+#include "latency_histogram.h"
+
+/// The UUID of the indication stats characteristic.
+#define INDICATION_STATS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890e0"
+
+/// Set to 1 to send held changes as soon as the previous indication is confirmed.
+#ifndef INDICATION_PIPELINING
+#define INDICATION_PIPELINING 0
+#endif
+
+/// The maximum number of characteristics whose indications can be timed.
+#define INDICATION_TRACKED_MAX 8
+
+/// The opcode that resets the stats.
+#define INDICATION_OPCODE_RESET 0x00
+
+/// The opcode that turns pipelining on or off.
+#define INDICATION_OPCODE_PIPELINING 0x01
+
+/**
+ * @brief What became of an indication, as reported to onStatus().
+ */
+enum class IndicationOutcome : uint8_t {
+    Confirmed = 0, ///< The client confirmed it.
+    Failed = 1,    ///< It timed out or the link failed before the confirmation.
+    NotSent = 2,   ///< The stack did not send it, because it was refused or nobody was subscribed.
+};
+
+/**
+ * @brief The wire format of the indication stats. All fields are little-endian.
+ */
+struct __attribute__((packed)) IndicationStats {
+    uint8_t pipelining;   ///< 1 if pipelining is on.
+    uint32_t sent;        ///< Indications sent, counted once per subscribed connection.
+    uint32_t confirmed;
+    uint32_t failed;
+    uint32_t notSent;
+    uint32_t busy;        ///< Changes not indicated because an indication was in flight.
+    uint32_t superseded;  ///< Held changes replaced by a later one before they were sent.
+    LatencyHistogramSnapshot latency; ///< Send-to-confirmation latency.
+};
+
+/**
+ * @brief Creates the indication stats characteristic and starts the indication task.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupIndicationTracker(BLEService* pService);
+
+/**
+ * @brief Indicates the current value of a characteristic from the indication task.
+ *
+ * Nothing happens if no connection has indications enabled.
+ *
+ * @param pCharacteristic A characteristic tracked with trackSubscriptions().
+ */
+void indicateLatest(BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief Waits until no other sender has an indication in flight, and holds off the others
+ * until giveIndicationSlot().
+ *
+ * ATT allows only one indication in flight per connection, and NimBLE drops an indication
+ * sent while another is unconfirmed without reporting it. The indication task takes the
+ * slot around every indication and its confirmation, and so must any other task that
+ * calls indicateCharacteristic().
+ *
+ * @param timeoutMs How long to wait for the slot, in milliseconds.
+ * @return false if the slot was not free in time.
+ */
+bool takeIndicationSlot(uint32_t timeoutMs);
+
+/**
+ * @brief Releases the slot taken with takeIndicationSlot().
+ */
+void giveIndicationSlot();
+
+/**
+ * @brief Starts timing an indication. Called by indicateCharacteristic() just before it sends.
+ *
+ * @param pCharacteristic The characteristic being indicated.
+ * @param connections The number of connections the indication goes to.
+ */
+void recordIndicationSent(BLECharacteristic* pCharacteristic, size_t connections);
+
+/**
+ * @brief Records the outcome of an indication for one connection. Called from
+ * TrackedCharacteristicCallbacks::onStatus(); does nothing if no indication of the
+ * characteristic is in flight.
+ */
+void recordIndicationOutcome(BLECharacteristic* pCharacteristic, IndicationOutcome outcome);
+
+#endif // INDICATION_TRACKER_H
@@ -0,0 +1,105 @@
+/**
+ * @file
+ * @brief L2CAP connection-oriented channel (CoC) server for bulk transfer benchmarks.
+ *
+ * A client opens an LE credit-based channel to L2CAP_COC_PSM and moves data over it
+ * without the ATT overhead, so the result can be compared with the GATT throughput test.
+ * Flow control is the channel's own: the client grants credits as it consumes SDUs, and the
+ * server returns credits as it hands the stack a fresh receive buffer for each SDU. The
+ * channel runs in one of three modes:
+ *
+ *   - Sink: received SDUs are counted and discarded.
+ *   - Source: the device sends SDUs of the client's SDU MTU back to back for a set time,
+ *     waiting whenever the client runs out of credits. Each SDU uses the throughput test
+ *     format: a little-endian uint32 sequence number, then (sequence + index) & 0xFF.
+ *   - Echo: every received SDU is sent back. An SDU that arrives while the previous echo is
+ *     still waiting for credits is dropped and counted.
+ *
+ * Writing [mode u8] or [mode u8][source seconds u16] to the L2CAP characteristic selects the
+ * mode, resets the counters and, for Source, starts sending if a channel is open. Reading it
+ * returns an L2capStats, which also carries the PSM for clients that look it up over GATT.
+ * The stats are notified when a source run ends or the channel closes. One channel is
+ * served at a time.
+ *
+ * LE CoC needs NimBLE built with CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM of 1 or more. The
+ * Bluedroid host in ESP-IDF 4.4 has no LE CoC API, so other builds keep the characteristic
+ * but report the channel as unsupported.
+ */
+
+#ifndef L2CAP_COC_H
+#define L2CAP_COC_H
+
+#include "ble_backend.h"
+
+/// The UUID of the L2CAP characteristic.
+#define L2CAP_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890bf"
+
+/// 1 if this build can serve L2CAP connection-oriented channels.
+#if TESTER_USE_NIMBLE && defined(CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM) && CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM > 0
+#define L2CAP_COC_SUPPORTED 1
+#else
+#define L2CAP_COC_SUPPORTED 0
+#endif
+
+/// The LE protocol/service multiplexer the server listens on, in the dynamic range 0x80-0xFF.
+#ifndef L2CAP_COC_PSM
+#define L2CAP_COC_PSM 0x0080
+#endif
+
+/// The largest SDU the server accepts, in bytes.
+#ifndef L2CAP_COC_MTU
+#define L2CAP_COC_MTU 512
+#endif
+
+/// The mode used from boot until a client selects another one, an L2capMode.
+#ifndef L2CAP_COC_DEFAULT_MODE
+#define L2CAP_COC_DEFAULT_MODE 0
+#endif
+
+/// The source run length used when the mode is written without a number of seconds.
+#ifndef L2CAP_COC_SOURCE_SECONDS
+#define L2CAP_COC_SOURCE_SECONDS 10
+#endif
+
+/**
+ * @brief What the server does with the channel.
+ */
+enum class L2capMode : uint8_t {
+    Sink = 0,
+    Source = 1,
+    Echo = 2,
+    Count
+};
+
+/**
+ * @brief The wire format of the L2CAP stats. All fields are little-endian.
+ *
+ * The counters and rates cover the time since the channel opened or the mode was last
+ * written, whichever is later, up to the point the channel closed.
+ */
+struct __attribute__((packed)) L2capStats {
+    uint8_t supported;         ///< 1 if the build serves L2CAP channels.
+    uint8_t mode;              ///< The L2capMode.
+    uint8_t connected;         ///< 1 while a channel is open.
+    uint16_t psm;              ///< L2CAP_COC_PSM.
+    uint16_t localMtu;         ///< The largest SDU the server receives.
+    uint16_t peerMtu;          ///< The largest SDU the client receives, the source SDU size.
+    uint32_t rxSdus;
+    uint32_t rxBytes;
+    uint32_t txSdus;
+    uint32_t txBytes;
+    uint32_t stalls;           ///< Sends that had to wait for the client to grant credits.
+    uint32_t dropped;          ///< Echoes dropped because the previous one was still queued.
+    uint32_t elapsedMs;
+    uint32_t rxBytesPerSecond;
+    uint32_t txBytesPerSecond;
+};
+
+/**
+ * @brief Creates the L2CAP characteristic and starts listening for channels.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupL2capCoc(BLEService* pService);
+
+#endif // L2CAP_COC_H
@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @brief Transfers of payloads larger than the MTU, by long writes or by chunks.
+ *
+ * A client announces a transfer on the control characteristic, then sends the payload with
+ * one of two methods:
+ *
+ *   - Long writes: the client writes the payload to the long write characteristic in
+ *     pieces of up to 512 bytes. Each piece is a long (prepared) write when it exceeds
+ *     MTU - 3 bytes, so the stack queues the ATT Prepare Write requests and delivers the
+ *     piece once the client executes them. Pieces are appended in the order they arrive.
+ *   - Chunks: the client writes chunks without response to the chunk characteristic, each
+ *     with its own header. All fields are little-endian:
+ *       [offset u32][length u16][CRC-32 of the chunk data u32][data]
+ *     Chunks may arrive in any order, and may be resent or overlap: only bytes that have
+ *     not arrived before count towards the payload, and the latest chunk's data is kept.
+ *
+ * Both methods reassemble the payload into the same preallocated buffer of
+ * LARGE_PAYLOAD_BUFFER_BYTES. The control command is:
+ *
+ *   [0x01][method u8][total length u32][CRC-32 of the whole payload u32]
+ *
+ * with method 1 for long writes and 2 for chunks. Announcing a new transfer abandons the
+ * previous one. CRCs are the standard CRC-32 (as computed by zlib).
+ *
+ * Reading the control characteristic returns a LargePayloadStats record, which is also
+ * notified when a transfer completes or fails. Goodput is the payload length divided by
+ * the time from the control command to the final byte.
+ */
+
+#ifndef LARGE_PAYLOAD_H
+#define LARGE_PAYLOAD_H
+
+#include "ble_backend.h"
+
+/// The UUID of the transfer control characteristic.
+#define LARGE_PAYLOAD_CONTROL_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890ba"
+
+/// The UUID of the long write characteristic.
+#define LARGE_PAYLOAD_LONG_WRITE_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890bb"
+
+/// The UUID of the chunk characteristic.
+#define LARGE_PAYLOAD_CHUNK_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890bc"
+
+/// The size of the reassembly buffer, and so the largest payload, in bytes.
+#ifndef LARGE_PAYLOAD_BUFFER_BYTES
+#define LARGE_PAYLOAD_BUFFER_BYTES 8192
+#endif
+
+/// The opcode that announces a transfer.
+#define LARGE_PAYLOAD_OPCODE_BEGIN 0x01
+
+/**
+ * @brief The ways a payload can be transferred.
+ */
+enum class LargePayloadMethod : uint8_t {
+    None = 0,
+    LongWrite = 1,
+    Chunked = 2,
+};
+
+/**
+ * @brief The state of the current transfer.
+ */
+enum class LargePayloadState : uint8_t {
+    Idle = 0,        ///< No transfer has been announced.
+    Receiving = 1,   ///< The transfer was announced and is not complete.
+    Complete = 2,    ///< The whole payload arrived and its CRC matched.
+    CrcMismatch = 3, ///< The whole payload arrived but its CRC did not match.
+    Invalid = 4,     ///< The control command was malformed or the payload does not fit.
+};
+
+/**
+ * @brief The wire format of the transfer statistics. All fields are little-endian.
+ */
+struct __attribute__((packed)) LargePayloadStats {
+    uint8_t method;          ///< The LargePayloadMethod of the current transfer.
+    uint8_t state;           ///< The LargePayloadState of the current transfer.
+    uint32_t totalLength;    ///< The announced payload length.
+    uint32_t received;       ///< Distinct payload bytes received so far.
+    uint32_t writes;         ///< Writes received on the data characteristic.
+    uint32_t rejectedWrites; ///< Writes that were out of range or failed their chunk CRC.
+    uint32_t elapsedUs;      ///< Time from the control command to the latest byte.
+    uint32_t goodputBps;     ///< Payload bytes per second, once the transfer is complete.
+};
+
+/**
+ * @brief Creates the control, long write and chunk characteristics.
+ *
+ * @param pService A pointer to the service the characteristics are added to.
+ */
+void setupLargePayload(BLEService* pService);
+
+#endif // LARGE_PAYLOAD_H
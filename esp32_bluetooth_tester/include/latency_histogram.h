@@ -0,0 +1,139 @@
+/**
+ * @file
+ * @brief A fixed-bucket latency histogram for measurements taken on the BLE hot path.
+ *
+ * Samples are recorded in microseconds into power-of-two buckets, so recording a sample
+ * costs a count-leading-zeros instruction and a few atomic increments, and never allocates.
+ * Bucket 0 counts samples of 0 us, bucket i counts samples in [2^(i-1), 2^i) us, and the
+ * last bucket also counts every sample larger than its lower bound.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * @brief The wire format of a histogram snapshot, as read over GATT.
+ *
+ * All fields are little-endian. Percentiles are reported as the upper bound of the
+ * bucket that contains them, so they are accurate to within a factor of two.
+ */
+struct __attribute__((packed)) LatencyHistogramSnapshot {
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint32_t p50Us;
+    uint32_t p99Us;
+    uint32_t buckets[24];
+};
+
+/**
+ * @class LatencyHistogram
+ * @brief Records latency samples into fixed power-of-two buckets.
+ *
+ * Recording is safe from any task. A snapshot taken while samples are being recorded
+ * may be off by the samples in flight, which is acceptable for statistics.
+ */
+class LatencyHistogram {
+public:
+    /// The number of buckets, covering latencies up to about 8 seconds.
+    static const size_t kBucketCount = 24;
+
+    LatencyHistogram() {
+        reset();
+    }
+
+    /**
+     * @brief Records a single latency sample.
+     *
+     * @param us The latency in microseconds.
+     */
+    void record(uint32_t us) {
+        buckets[bucketFor(us)]++;
+        count++;
+
+        uint32_t currentMin = minUs;
+        while (us < currentMin && !minUs.compare_exchange_weak(currentMin, us)) {
+        }
+        uint32_t currentMax = maxUs;
+        while (us > currentMax && !maxUs.compare_exchange_weak(currentMax, us)) {
+        }
+    }
+
+    /**
+     * @brief Clears all recorded samples.
+     */
+    void reset() {
+        for (size_t i = 0; i < kBucketCount; i++) {
+            buckets[i] = 0;
+        }
+        count = 0;
+        minUs = UINT32_MAX;
+        maxUs = 0;
+    }
+
+    /**
+     * @brief Returns the upper bound of the bucket containing the given percentile.
+     *
+     * @param percent The percentile to look up, from 1 to 100.
+     * @return The latency in microseconds, or 0 if no samples have been recorded.
+     */
+    uint32_t percentile(uint32_t percent) const {
+        const uint32_t total = count;
+        if (total == 0) {
+            return 0;
+        }
+        // The rank of the sample at the requested percentile, rounded up.
+        const uint64_t rank = ((uint64_t)total * percent + 99) / 100;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return upperBound(i);
+            }
+        }
+        return maxUs;
+    }
+
+    /**
+     * @brief Fills a snapshot of the histogram in its wire format.
+     *
+     * @param snapshot The snapshot to fill.
+     */
+    void snapshot(LatencyHistogramSnapshot& snapshot) const {
+        snapshot.count = count;
+        snapshot.minUs = snapshot.count > 0 ? minUs.load() : 0;
+        snapshot.maxUs = maxUs;
+        snapshot.p50Us = percentile(50);
+        snapshot.p99Us = percentile(99);
+        for (size_t i = 0; i < kBucketCount; i++) {
+            snapshot.buckets[i] = buckets[i];
+        }
+    }
+
+private:
+    static size_t bucketFor(uint32_t us) {
+        if (us == 0) {
+            return 0;
+        }
+        const size_t bucket = 32 - __builtin_clz(us);
+        return bucket < kBucketCount ? bucket : kBucketCount - 1;
+    }
+
+    static uint32_t upperBound(size_t bucket) {
+        return bucket == 0 ? 0 : (1u << bucket) - 1;
+    }
+
+    static_assert(sizeof(LatencyHistogramSnapshot::buckets) / sizeof(uint32_t) == kBucketCount,
+                  "The snapshot must carry one counter per bucket");
+
+    std::atomic<uint32_t> buckets[kBucketCount];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> minUs;
+    std::atomic<uint32_t> maxUs;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,103 @@
+/**
+ * @file
+ * @brief Animations that the render task draws on its own, from a single BLE write.
+ *
+ * Writing a command to the animation characteristic starts an animation that the render
+ * task draws every LED_ANIMATION_FRAME_MS, so a client spends one write instead of one
+ * write per frame. The command is little-endian:
+ *
+ *   [type u8][period ms u16][color A r g b][color B r g b][width u8]
+ *
+ *   - 0x00 Stop: freezes the current frame. Only the type byte is required.
+ *   - 0x01 Fade: fades the whole strip from color A to color B over one period, then stops.
+ *   - 0x02 Pulse: fades the whole strip from color A to B and back, once per period.
+ *   - 0x03 Chase: a segment of width pixels in color A, fading out behind its head, runs
+ *     around a color B background once per period.
+ *   - 0x04 Gradient: a gradient from color A to B and back across the strip, rotating once
+ *     per period. A period of 0 draws it once without rotating.
+ *
+ * Showing a frame through the framebuffer or the LED characteristics stops the animation.
+ * Animation frames are drawn outside the framebuffer, so delta writes that follow an
+ * animation apply to the last committed frame.
+ * All animation math is fixed point.
+ *
+ * Reading the characteristic returns a LedAnimationStats record. It shows whether the
+ * device holds a steady frame rate while it animates.
+ */
+
+#ifndef LED_ANIMATION_H
+#define LED_ANIMATION_H
+
+#include "ble_backend.h"
+
+/// The UUID of the LED animation characteristic.
+#define LED_ANIMATION_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b9"
+
+/// The time between two animation frames, in milliseconds.
+#ifndef LED_ANIMATION_FRAME_MS
+#define LED_ANIMATION_FRAME_MS 16
+#endif
+
+/**
+ * @brief The kinds of animation.
+ */
+enum class LedAnimationType : uint8_t {
+    Stop = 0x00,
+    Fade = 0x01,
+    Pulse = 0x02,
+    Chase = 0x03,
+    Gradient = 0x04,
+};
+
+/**
+ * @brief The parameters of an animation, as decoded from a command.
+ */
+struct LedAnimation {
+    LedAnimationType type;
+    uint16_t periodMs;
+    uint8_t colorA[3];
+    uint8_t colorB[3];
+    uint8_t width;
+};
+
+/**
+ * @brief The wire format of the animation statistics. All fields are little-endian.
+ */
+struct __attribute__((packed)) LedAnimationStats {
+    uint8_t type;              ///< The LedAnimationType running now, or Stop.
+    uint32_t frames;           ///< Animation frames rendered since the animation started.
+    uint32_t targetIntervalUs; ///< The configured time between frames.
+    uint32_t lastIntervalUs;   ///< The time between the two latest frames.
+    uint32_t minIntervalUs;    ///< The shortest time between two frames.
+    uint32_t maxIntervalUs;    ///< The longest time between two frames.
+    uint32_t lateFrames;       ///< Frames rendered more than half an interval late.
+};
+
+/**
+ * @brief Decodes an animation command.
+ *
+ * @param data The bytes written to the animation characteristic.
+ * @param length The number of bytes.
+ * @param pAnimation Receives the decoded animation.
+ * @return false if the command is malformed.
+ */
+bool parseLedAnimation(const uint8_t* data, size_t length, LedAnimation* pAnimation);
+
+/**
+ * @brief Draws one frame of an animation.
+ *
+ * @param animation The animation to draw.
+ * @param elapsedMs The time since the animation started.
+ * @param frame The frame to draw into, LED_FRAME_BYTES bytes in red, green, blue order.
+ * @return false if the frame is final and the animation will not change any more.
+ */
+bool drawLedAnimation(const LedAnimation& animation, uint32_t elapsedMs, uint8_t* frame);
+
+/**
+ * @brief Creates the LED animation characteristic.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupLedAnimation(BLEService* pService);
+
+#endif // LED_ANIMATION_H
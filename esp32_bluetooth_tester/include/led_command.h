@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @brief Parser for the commands written to the LED characteristics.
+ *
+ * The LED characteristics accept two equivalent command formats:
+ *   - Text: "ON" or "OFF", as sent by the original tester clients.
+ *   - Binary: a single opcode byte, 0x01 for on and 0x00 for off.
+ *
+ * Parsing works directly on the attribute value bytes, so it costs a length check and
+ * at most one short memcmp per write, and never allocates.
+ */
+
+#ifndef LED_COMMAND_H
+#define LED_COMMAND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/// The binary opcode that turns the LED off.
+#define LED_OPCODE_OFF 0x00
+
+/// The binary opcode that turns the LED on.
+#define LED_OPCODE_ON 0x01
+
+/**
+ * @brief The commands that can be written to an LED characteristic.
+ */
+enum class LedCommand : uint8_t {
+    Off,
+    On,
+    Unknown,
+};
+
+/**
+ * @brief Decodes a value written to an LED characteristic.
+ *
+ * @param data A pointer to the written bytes.
+ * @param length The number of bytes written.
+ * @return The decoded command, or LedCommand::Unknown if the value is not a valid command.
+ */
+inline LedCommand parseLedCommand(const uint8_t* data, size_t length) {
+    if (length == 1) {
+        if (data[0] == LED_OPCODE_ON) {
+            return LedCommand::On;
+        }
+        if (data[0] == LED_OPCODE_OFF) {
+            return LedCommand::Off;
+        }
+        return LedCommand::Unknown;
+    }
+    if (length == 2 && memcmp(data, "ON", 2) == 0) {
+        return LedCommand::On;
+    }
+    if (length == 3 && memcmp(data, "OFF", 3) == 0) {
+        return LedCommand::Off;
+    }
+    return LedCommand::Unknown;
+}
+
+#endif // LED_COMMAND_H
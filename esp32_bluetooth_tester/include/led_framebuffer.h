@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief A BLE characteristic that streams frames to a multi-pixel LED strip.
+ *
+ * Clients write drawing commands into the strip's framebuffer (see led_renderer.h). A
+ * frame can be sent whole, across as many writes as the MTU requires, or as a delta
+ * against the previous frame. Setting bit 0x80 of the opcode shows the frame once the
+ * write has been applied. All multi-byte fields are little-endian, colors are red, green,
+ * blue, and pixel indices start at 0:
+ *
+ *   - 0x00 Reset statistics: [0x00]
+ *   - 0x01 Pixel range: [0x01][first pixel u16][r g b]...
+ *     Sets consecutive pixels, starting at the first pixel. A full frame is a series of
+ *     pixel range writes with increasing first pixels.
+ *   - 0x02 Runs: [0x02] followed by one or more [first pixel u16][count u16][r g b]
+ *     Sets each run of pixels to one color.
+ *   - 0x03 Changed pixels: [0x03] followed by one or more [pixel u16][r g b]
+ *   - 0x04 Show: [0x04]
+ *
+ * A write that is malformed or addresses a pixel past the end of the strip is ignored as a
+ * whole. Reading the characteristic returns a LedFramebufferStats record, which separates
+ * the time spent receiving a frame over BLE from the time spent clocking it out to the
+ * strip.
+ */
+
+#ifndef LED_FRAMEBUFFER_H
+#define LED_FRAMEBUFFER_H
+
+#include "ble_backend.h"
+
+/// The UUID of the LED framebuffer characteristic.
+#define LED_FRAMEBUFFER_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b8"
+
+/// The opcode that resets the framebuffer statistics.
+#define LED_FRAME_OPCODE_RESET_STATS 0x00
+
+/// The opcode that sets a range of consecutive pixels.
+#define LED_FRAME_OPCODE_PIXEL_RANGE 0x01
+
+/// The opcode that sets runs of pixels to one color each.
+#define LED_FRAME_OPCODE_RUNS 0x02
+
+/// The opcode that sets a list of individual pixels.
+#define LED_FRAME_OPCODE_CHANGED_PIXELS 0x03
+
+/// The opcode that shows the framebuffer without changing it.
+#define LED_FRAME_OPCODE_SHOW 0x04
+
+/// The opcode flag that shows the framebuffer after the write has been applied.
+#define LED_FRAME_FLAG_SHOW 0x80
+
+/**
+ * @brief The wire format of the framebuffer statistics. All fields are little-endian.
+ */
+struct __attribute__((packed)) LedFramebufferStats {
+    uint16_t pixels;          ///< The number of pixels on the strip.
+    uint32_t writes;          ///< Framebuffer writes applied.
+    uint32_t invalidWrites;   ///< Framebuffer writes ignored because they were malformed.
+    uint32_t framesCommitted; ///< Frames shown, including those from the LED characteristics.
+    uint32_t framesRendered;  ///< Frames pushed to the strip.
+    uint32_t framesDropped;   ///< Frames replaced by a newer one before they were rendered.
+    uint32_t lastAssemblyUs;  ///< Time from the first write of the latest frame until it was shown.
+    uint32_t lastFrameGapUs;  ///< Time between the two latest frames being shown.
+    uint32_t lastOutputUs;    ///< Time the latest frame took to clock out to the strip.
+    uint32_t maxOutputUs;     ///< The longest time a frame took to clock out to the strip.
+};
+
+/**
+ * @brief Creates the LED framebuffer characteristic.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupLedFramebuffer(BLEService* pService);
+
+#endif // LED_FRAMEBUFFER_H
@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @brief A compile-time lookup table that maps framebuffer levels to strip output levels.
+ *
+ * Each entry applies gamma correction followed by the LED_BRIGHTNESS scale, so rendering a
+ * pixel costs one table lookup per channel instead of a multiply and a shift. Applying the
+ * brightness after gamma correction scales the light output linearly, so dimmed fades keep
+ * their shape. The gamma curve approximates 2.2 with a 3:1 blend of the square and the
+ * cube, which needs only integer arithmetic and therefore fits a C++11 constexpr function.
+ *
+ * Define LED_GAMMA_CORRECTION as 0 to apply the brightness scale alone.
+ */
+
+#ifndef LED_GAMMA_H
+#define LED_GAMMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "led_renderer.h"
+
+/// Whether framebuffer levels are gamma corrected before they are sent to the strip.
+#ifndef LED_GAMMA_CORRECTION
+#define LED_GAMMA_CORRECTION 1
+#endif
+
+namespace led_gamma {
+
+/**
+ * @brief Returns the gamma-corrected value of a level, from 0 to 255.
+ */
+constexpr uint32_t correct(uint32_t level) {
+    return LED_GAMMA_CORRECTION
+        ? (3 * level * level * 255 + level * level * level + 2 * 255 * 255) / (4 * 255 * 255)
+        : level;
+}
+
+/**
+ * @brief Returns the output level for a framebuffer level.
+ */
+constexpr uint8_t outputLevel(uint32_t level) {
+    return static_cast<uint8_t>((correct(level) * (LED_BRIGHTNESS + 1)) >> 8);
+}
+
+/// A list of indices, used to expand the table at compile time.
+template <size_t... Indices>
+struct IndexList {};
+
+/// Builds IndexList<0, 1, ..., Count - 1>.
+template <size_t Count, size_t... Indices>
+struct MakeIndexList : MakeIndexList<Count - 1, Count - 1, Indices...> {};
+
+template <size_t... Indices>
+struct MakeIndexList<0, Indices...> {
+    typedef IndexList<Indices...> type;
+};
+
+/// The lookup table, wrapped in a struct so a constexpr function can return it.
+struct Table {
+    uint8_t levels[256];
+};
+
+template <size_t... Indices>
+constexpr Table makeTable(IndexList<Indices...>) {
+    return Table{{outputLevel(Indices)...}};
+}
+
+} // namespace led_gamma
+
+/// The output level for every framebuffer level, indexed by the framebuffer level.
+constexpr led_gamma::Table kLedOutputTable = led_gamma::makeTable(led_gamma::MakeIndexList<256>::type());
+
+static_assert(kLedOutputTable.levels[0] == 0, "Black must stay black");
+static_assert(kLedOutputTable.levels[255] == ((255 * (LED_BRIGHTNESS + 1)) >> 8),
+              "Full level must map to the brightness limit");
+
+#endif // LED_GAMMA_H
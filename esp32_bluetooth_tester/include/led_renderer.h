@@ -0,0 +1,115 @@
+/**
+ * @file
+ * @brief Renders the LED strip framebuffer from a dedicated FreeRTOS task.
+ *
+ * BLE callbacks draw into a framebuffer and commit it; they never wait on the strip. A
+ * commit publishes the frame through a lock-free triple buffer, so the render task always
+ * picks up the newest complete frame, frames committed faster than the strip can show them
+ * are coalesced, and a frame is never torn. The render task pushes frames to the strip
+ * through the RMT peripheral (see led_strip_rmt.h) no faster than the configured frame
+ * interval.
+ *
+ * The render task also draws animations on its own (see led_animation.h). Committing a
+ * frame stops the running animation.
+ *
+ * The framebuffer has a single writer: call postLedColor(), ledDrawBuffer() and
+ * commitLedFrame() from the BLE callbacks or before the BLE stack is started.
+ */
+
+#ifndef LED_RENDERER_H
+#define LED_RENDERER_H
+
+#include <stdint.h>
+
+#include "board_traits.h"
+
+struct LedAnimation;
+struct LedAnimationStats;
+
+/// The number of pixels on the strip. Defaults to the board's onboard pixels.
+#ifndef LED_STRIP_PIXELS
+#define LED_STRIP_PIXELS (kBoard.ledPixels)
+#endif
+
+/// The brightness applied to every pixel when it is rendered, from 0 to 255. It is folded
+/// into the output table at compile time (see led_gamma.h).
+#ifndef LED_BRIGHTNESS
+#define LED_BRIGHTNESS 50
+#endif
+
+/// The minimum time between two frames pushed to the strip, in milliseconds.
+#ifndef LED_RENDER_MIN_FRAME_MS
+#define LED_RENDER_MIN_FRAME_MS 10
+#endif
+
+/// The size of the framebuffer in bytes, three (red, green, blue) per pixel.
+#define LED_FRAME_BYTES (LED_STRIP_PIXELS * 3)
+
+/**
+ * @brief Counters describing how frames moved through the renderer.
+ */
+struct LedRenderStats {
+    uint32_t framesCommitted; ///< Frames published with commitLedFrame() or postLedColor().
+    uint32_t framesRendered;  ///< Frames pushed to the strip.
+    uint32_t framesDropped;   ///< Frames replaced by a newer one before they were rendered.
+    uint32_t lastOutputUs;    ///< The time the most recent frame took to clock out.
+    uint32_t maxOutputUs;     ///< The longest time a frame took to clock out.
+};
+
+/**
+ * @brief Packs a color the way postLedColor() expects it.
+ */
+inline uint32_t ledColor(uint8_t red, uint8_t green, uint8_t blue) {
+    return ((uint32_t)red << 16) | ((uint32_t)green << 8) | blue;
+}
+
+/**
+ * @brief Sets up the RMT output, turns the strip off and starts the render task.
+ *
+ * @param pin The GPIO the strip's data line is connected to.
+ */
+void setupLedRenderer(uint8_t pin);
+
+/**
+ * @brief Fills the framebuffer with one color and commits it.
+ *
+ * @param color The color, packed as returned by ledColor().
+ */
+void postLedColor(uint32_t color);
+
+/**
+ * @brief Returns the framebuffer, LED_FRAME_BYTES bytes in red, green, blue order.
+ *
+ * The framebuffer keeps its contents after a commit, so a client can update only the
+ * pixels that changed since the previous frame.
+ */
+uint8_t* ledDrawBuffer();
+
+/**
+ * @brief Publishes the framebuffer to the render task. This copies the frame and wakes the
+ * task, so it is cheap enough to call from BLE callbacks.
+ */
+void commitLedFrame();
+
+/**
+ * @brief Hands an animation to the render task, replacing the running one. A Stop
+ * animation freezes the current frame.
+ */
+void postLedAnimation(const LedAnimation& animation);
+
+/**
+ * @brief Returns the frame timing of the running animation.
+ */
+LedAnimationStats getLedAnimationStats();
+
+/**
+ * @brief Returns the renderer counters.
+ */
+LedRenderStats getLedRenderStats();
+
+/**
+ * @brief Resets the renderer counters.
+ */
+void resetLedRenderStats();
+
+#endif // LED_RENDERER_H
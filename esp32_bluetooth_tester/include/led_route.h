@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @brief The dispatch table that maps each LED characteristic to what turning it on shows.
+ *
+ * The table is built once in setup() and looked up on every LED write by characteristic
+ * pointer, so a write costs a comparison per LED characteristic and never builds a UUID.
+ */
+
+#ifndef LED_ROUTE_H
+#define LED_ROUTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ble_backend.h"
+#include "state_broadcast.h"
+
+/**
+ * @brief A route in the LED write dispatch table.
+ *
+ * Each LED characteristic gets one route that holds the color, the broadcast state and the
+ * status message used when the LED is turned on through that characteristic.
+ */
+struct LedRoute {
+    const BLECharacteristic* characteristic;
+    uint32_t onColor;
+    BroadcastLedState onState;
+    const char* onMessage;
+    size_t onMessageLength;
+};
+
+/**
+ * @class LedRouteTable
+ * @brief A fixed-capacity table of LED routes, keyed by characteristic pointer.
+ *
+ * @tparam Capacity The number of routes the table holds.
+ */
+template <size_t Capacity>
+class LedRouteTable {
+public:
+    LedRouteTable() : count(0) {
+    }
+
+    /**
+     * @brief Adds a characteristic to the table.
+     *
+     * @param pCharacteristic A pointer to the LED characteristic.
+     * @param onColor The color to show when "ON" is written to the characteristic.
+     * @param onState The LED state to broadcast when the LED is turned on.
+     * @param onMessage The status message to notify when the LED is turned on.
+     * @return false if the table is full.
+     */
+    bool add(const BLECharacteristic* pCharacteristic, uint32_t onColor, BroadcastLedState onState,
+             const char* onMessage) {
+        if (count == Capacity) {
+            return false;
+        }
+        LedRoute& route = routes[count++];
+        route.characteristic = pCharacteristic;
+        route.onColor = onColor;
+        route.onState = onState;
+        route.onMessage = onMessage;
+        route.onMessageLength = strlen(onMessage);
+        return true;
+    }
+
+    /**
+     * @brief Looks up the route for an LED characteristic.
+     *
+     * @param pCharacteristic A pointer to the characteristic that was written.
+     * @return The route for the characteristic, or nullptr if it is not an LED characteristic.
+     */
+    const LedRoute* find(const BLECharacteristic* pCharacteristic) const {
+        for (size_t i = 0; i < count; i++) {
+            if (routes[i].characteristic == pCharacteristic) {
+                return &routes[i];
+            }
+        }
+        return nullptr;
+    }
+
+    /// The number of routes in the table.
+    size_t size() const {
+        return count;
+    }
+
+private:
+    LedRoute routes[Capacity];
+    size_t count;
+};
+
+#endif // LED_ROUTE_H
@@ -0,0 +1,41 @@
+/**
+ * @file
+ * @brief WS2812 (Neopixel) output driven by the ESP32 RMT peripheral.
+ *
+ * The RMT peripheral generates the WS2812 bit timing in hardware. A translator running in
+ * the RMT interrupt expands each data byte into eight RMT items as the peripheral's memory
+ * block drains, so no per-bit buffer is allocated and interrupts stay enabled for the whole
+ * transfer. Waiting for a transfer to finish blocks only the calling task.
+ */
+
+#ifndef LED_STRIP_RMT_H
+#define LED_STRIP_RMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "board_traits.h"
+
+/// The RMT channel used for the LED strip. Defaults to the board's channel.
+#ifndef LED_RMT_CHANNEL
+#define LED_RMT_CHANNEL (static_cast<rmt_channel_t>(kBoard.rmtChannel))
+#endif
+
+/**
+ * @brief Configures the RMT channel to drive a WS2812 strip on the given pin.
+ *
+ * @param pin The GPIO the strip's data line is connected to.
+ * @return false if the RMT driver could not be installed.
+ */
+bool setupLedStripRmt(uint8_t pin);
+
+/**
+ * @brief Sends raw pixel data to the strip and waits until it has been clocked out.
+ *
+ * @param data The bytes in the order the strip expects them, which is GRB for WS2812.
+ * @param length The number of bytes, three per pixel.
+ * @return false if the transfer could not be started.
+ */
+bool writeLedStripRmt(const uint8_t* data, size_t length);
+
+#endif // LED_STRIP_RMT_H
@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief Runtime control of connection parameters, PHY and LE Data Length Extension.
+ *
+ * The link control characteristic lets a client request new link-layer settings for its
+ * own connection and reports back what the central actually accepted. Commands are binary,
+ * with all multi-byte fields little-endian:
+ *
+ *   - 0x01 Connection parameters:
+ *       [0x01][min interval u16][max interval u16][slave latency u16][supervision timeout u16]
+ *     Intervals are in units of 1.25 ms and the timeout in units of 10 ms.
+ *   - 0x02 Preferred PHY:
+ *       [0x02][tx PHY mask u8][rx PHY mask u8]
+ *     Bit 0 selects 1M, bit 1 selects 2M and bit 2 selects Coded. Only supported on
+ *     chips with Bluetooth 5 (ESP32-C3, ESP32-S3).
+ *   - 0x03 Data length:
+ *       [0x03][max tx octets u16]
+ *     Between 27 and 251 octets per link-layer packet.
+ *
+ * Reading the characteristic returns a LinkParamsReport for the reading connection. The
+ * same report is notified whenever the link changes or a request completes. NimBLE-Arduino
+ * does not report the negotiated data length, so on NimBLE a data length request stays
+ * Pending and txOctets and rxOctets keep their initial 27 octets.
+ *
+ * Default parameters can be requested on every new connection by defining
+ * TESTER_DEFAULT_CONN_INTERVAL_MIN/MAX, TESTER_DEFAULT_CONN_LATENCY and
+ * TESTER_DEFAULT_CONN_TIMEOUT, TESTER_DEFAULT_PHY_MASK, or TESTER_DEFAULT_DATA_LENGTH.
+ */
+
+#ifndef LINK_CONTROL_H
+#define LINK_CONTROL_H
+
+#include "ble_backend.h"
+
+/// The UUID of the link control characteristic.
+#define LINK_CONTROL_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b1"
+
+/// The opcode that requests new connection parameters.
+#define LINK_OPCODE_CONN_PARAMS 0x01
+
+/// The opcode that requests a preferred PHY.
+#define LINK_OPCODE_PHY 0x02
+
+/// The opcode that requests a maximum link-layer data length.
+#define LINK_OPCODE_DATA_LENGTH 0x03
+
+/**
+ * @brief The status of the most recent link control request.
+ */
+enum class LinkRequestStatus : uint8_t {
+    None = 0,        ///< No request has been made on this connection.
+    Pending = 1,     ///< The request was sent to the controller and has not completed.
+    Accepted = 2,    ///< The central accepted the request.
+    Rejected = 3,    ///< The central or the controller rejected the request.
+    Unsupported = 4, ///< The request is not supported on this chip or BLE stack.
+    Invalid = 5,     ///< The command was malformed or out of range.
+};
+
+/**
+ * @brief The wire format of the link control report. All fields are little-endian.
+ */
+struct __attribute__((packed)) LinkParamsReport {
+    uint16_t connId;
+    uint16_t interval;  ///< Connection interval in units of 1.25 ms.
+    uint16_t latency;   ///< Slave latency in connection events.
+    uint16_t timeout;   ///< Supervision timeout in units of 10 ms.
+    uint8_t txPhy;      ///< 1 = 1M, 2 = 2M, 3 = Coded.
+    uint8_t rxPhy;      ///< 1 = 1M, 2 = 2M, 3 = Coded.
+    uint16_t txOctets;  ///< Maximum link-layer payload sent per packet.
+    uint16_t rxOctets;  ///< Maximum link-layer payload received per packet.
+    uint8_t lastOpcode; ///< The opcode of the most recent request.
+    uint8_t lastStatus; ///< A LinkRequestStatus for the most recent request.
+};
+
+/**
+ * @brief Creates the link control characteristic and hooks it into the BLE stack.
+ *
+ * @param pServer A pointer to the BLE server.
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupLinkControl(BLEServer* pServer, BLEService* pService);
+
+/**
+ * @brief Records the initial link parameters of a new connection and requests the
+ * compile-time defaults, if any are configured.
+ *
+ * Call this after the connection has been added to the connection registry.
+ *
+ * @param connId The connection ID.
+ * @param interval The initial connection interval, in units of 1.25 ms.
+ * @param latency The initial slave latency.
+ * @param timeout The initial supervision timeout, in units of 10 ms.
+ */
+void onLinkConnected(uint16_t connId, uint16_t interval, uint16_t latency, uint16_t timeout);
+
+/**
+ * @brief Forgets the link state of a connection.
+ */
+void onLinkDisconnected(uint16_t connId);
+
+/**
+ * @brief Copies the current link parameters of a connection.
+ *
+ * @return false if the connection is unknown.
+ */
+bool linkParams(uint16_t connId, LinkParamsReport& report);
+
+/**
+ * @brief Returns the current connection interval of a connection, in units of 1.25 ms,
+ * or 0 if the connection is unknown.
+ */
+uint16_t linkConnectionInterval(uint16_t connId);
+
+/**
+ * @brief Returns the shortest connection interval of all connections, in units of 1.25 ms,
+ * or 0 if nothing is connected.
+ */
+uint16_t linkShortestInterval();
+
+#endif // LINK_CONTROL_H
@@ -0,0 +1,96 @@
+/**
+ * @file
+ * @brief Live status characteristic served from a cached snapshot, with per-connection RSSI.
+ *
+ * The status task refreshes a snapshot every LIVE_STATUS_REFRESH_MS: the uptime, the free
+ * heap, and for every connection its RSSI, link parameters and registry counters. Reading
+ * the live status characteristic builds the value in onRead() from that snapshot, so a read
+ * only copies memory and never waits for the controller. The age of the snapshot at the
+ * time of the read is filled in on the way out. Subscribers also get every new snapshot as
+ * a notification, which gives a link quality timeline alongside a benchmark run.
+ *
+ * The RSSI of each connection is read from the controller on every refresh. NimBLE returns
+ * it directly; Bluedroid reports it in a GAP event, so there the value in a snapshot is the
+ * one read on the refresh before. Each connection keeps the latest value, a smoothed value
+ * that moves 1/8 of the way to each new sample, and the lowest and highest since it
+ * connected. An RSSI of 127 means no sample has been taken yet.
+ *
+ * Writing [0x01][refresh ms u16] to the characteristic changes the refresh rate, within
+ * LIVE_STATUS_MIN_REFRESH_MS and LIVE_STATUS_MAX_REFRESH_MS, and refreshes at once. The
+ * value is a LiveStatusHeader followed by a LiveLinkRecord per connection. All fields are
+ * little-endian.
+ */
+
+#ifndef LIVE_STATUS_H
+#define LIVE_STATUS_H
+
+#include "ble_backend.h"
+
+/// The UUID of the live status characteristic.
+#define LIVE_STATUS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890e4"
+
+/// The time between snapshots from boot, in milliseconds.
+#ifndef LIVE_STATUS_REFRESH_MS
+#define LIVE_STATUS_REFRESH_MS 1000
+#endif
+
+/// The shortest refresh interval a client can set, in milliseconds.
+#define LIVE_STATUS_MIN_REFRESH_MS 100
+
+/// The longest refresh interval a client can set, in milliseconds.
+#define LIVE_STATUS_MAX_REFRESH_MS 60000
+
+/// The opcode that sets the refresh interval.
+#define LIVE_STATUS_OPCODE_REFRESH 0x01
+
+/// The RSSI reported before the first sample, as in the HCI specification.
+#define LIVE_STATUS_RSSI_UNAVAILABLE 127
+
+/// The version of the LiveStatusHeader and LiveLinkRecord layouts. Bump it whenever they change.
+#define LIVE_STATUS_VERSION 1
+
+/**
+ * @brief The header of the live status value.
+ */
+struct __attribute__((packed)) LiveStatusHeader {
+    uint8_t version;      ///< LIVE_STATUS_VERSION.
+    uint8_t connections;  ///< LiveLinkRecords that follow.
+    uint16_t refreshMs;   ///< The refresh interval.
+    uint32_t uptimeMs;    ///< When the snapshot was taken.
+    uint32_t ageMs;       ///< The age of the snapshot when it was read or notified.
+    uint32_t refreshes;   ///< Snapshots taken since boot.
+    uint32_t refreshUs;   ///< How long taking this snapshot took.
+    uint32_t freeHeap;    ///< Free heap in bytes.
+};
+
+/**
+ * @brief The link quality of one connection in the live status value.
+ */
+struct __attribute__((packed)) LiveLinkRecord {
+    uint16_t connId;
+    uint16_t mtu;
+    int8_t rssi;            ///< The latest RSSI in dBm.
+    int8_t rssiSmoothed;    ///< The exponentially smoothed RSSI in dBm.
+    int8_t rssiMin;         ///< The lowest RSSI since the connection was made.
+    int8_t rssiMax;         ///< The highest RSSI since the connection was made.
+    uint32_t rssiSamples;   ///< RSSI reads that succeeded.
+    uint32_t rssiFailures;  ///< RSSI reads that failed.
+    uint16_t interval;      ///< Connection interval in units of 1.25 ms.
+    uint16_t latency;       ///< Slave latency in connection events.
+    uint16_t timeout;       ///< Supervision timeout in units of 10 ms.
+    uint8_t txPhy;          ///< 1 = 1M, 2 = 2M, 3 = Coded.
+    uint8_t rxPhy;
+    uint16_t txOctets;      ///< Maximum link-layer payload sent per packet.
+    uint16_t rxOctets;      ///< Maximum link-layer payload received per packet.
+    uint32_t writes;        ///< Writes received on this connection.
+    uint32_t notifications; ///< Notifications sent to this connection.
+};
+
+/**
+ * @brief Creates the live status characteristic and starts the status task.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupLiveStatus(BLEService* pService);
+
+#endif // LIVE_STATUS_H
@@ -0,0 +1,47 @@
+/**
+ * @file
+ * @brief Coalesces rapid value changes into at most one notification per connection interval.
+ *
+ * The controller can only deliver one batch of notifications per connection event, so a
+ * characteristic that changes several times within one interval would queue stale values
+ * that the client replaces immediately. With coalescing enabled, a change that arrives
+ * within one connection interval of the previous notification is deferred until the interval
+ * has passed, and only the value current at that time is sent. Superseded changes are counted
+ * in the firmware stats.
+ *
+ * The window is the shortest connection interval of all connected clients, as tracked by
+ * link control.
+ */
+
+#ifndef NOTIFY_COALESCER_H
+#define NOTIFY_COALESCER_H
+
+#include "ble_backend.h"
+
+/// Set to 1 to coalesce notifications of the LED characteristics.
+#ifndef TESTER_NOTIFY_COALESCING
+#define TESTER_NOTIFY_COALESCING 0
+#endif
+
+/// The maximum number of characteristics that can be coalesced.
+#define NOTIFY_COALESCING_MAX 8
+
+/**
+ * @brief Enables coalescing for a characteristic.
+ *
+ * @param pCharacteristic A characteristic tracked with trackSubscriptions().
+ * @return false if the table of coalesced characteristics is full.
+ */
+bool enableNotifyCoalescing(BLECharacteristic* pCharacteristic);
+
+/**
+ * @brief Notifies the current value of a characteristic, deferring it if coalescing is
+ * enabled and the previous notification went out less than one connection interval ago.
+ *
+ * Characteristics without coalescing are notified straight away with notifyCharacteristic().
+ *
+ * @param pCharacteristic A pointer to the characteristic whose value has changed.
+ */
+void notifyLatest(BLECharacteristic* pCharacteristic);
+
+#endif // NOTIFY_COALESCER_H
@@ -0,0 +1,144 @@
+/**
+ * @file
+ * @brief Firmware updates over BLE, streamed into the next OTA partition.
+ *
+ * The OTA service has its own UUID and three characteristics. The control and data
+ * characteristics require an encrypted link. An encrypted link alone proves little, as the
+ * tester pairs with Just Works and any client in range can pair, so a transfer can only be
+ * started by a connection whose link is authenticated (MITM-protected pairing), or that was
+ * encrypted with the keys of a bond stored before it connected. A client that has just paired
+ * therefore disconnects and reconnects before it updates the firmware. A transfer belongs to
+ * the connection that started it: packets and commands from other connections are ignored,
+ * and a start from another connection is refused while a transfer is in progress. If that
+ * connection drops before the image is complete, the transfer is aborted.
+ *
+ * This keeps out clients that were never bonded, but not one that pairs, reconnects and
+ * then updates; remove the bonds of clients you do not know with the bonds characteristic.
+ * The image itself is only checked by esp_ota_end(), for integrity, not for who built it.
+ * All multi-byte fields are little-endian.
+ *
+ * A transfer runs as follows:
+ *
+ *   1. The client writes [0x01][image size u32][window u16][packet payload u16] to the
+ *      control characteristic. The device prepares the next OTA partition and notifies an
+ *      OtaNotification of type Status with state Receiving and the window it accepted, which
+ *      may be smaller than requested so that two windows always fit in one flash buffer.
+ *   2. The client writes the image to the data characteristic without response, as
+ *      packets of [sequence u16][up to packet payload bytes]. Sequence numbers start at 0.
+ *      The device acknowledges every window of packets with an Ack carrying the next
+ *      expected sequence number. The client may have at most two windows unacknowledged.
+ *   3. If a packet arrives out of sequence, the device drops it and everything after it
+ *      and notifies a Nack with the expected sequence number, from which the client resends.
+ *   4. Once every byte is acknowledged, the client writes [0x02][reboot u8]. The device
+ *      writes the last buffer, validates the image, selects the new partition for the next
+ *      boot and notifies a Status with state Done or Failed. If reboot is non-zero, the
+ *      device restarts into the new firmware a second later.
+ *
+ * If the connection may not start a transfer, or another connection owns the one in
+ * progress, the device notifies a Refused to that connection only and leaves the transfer
+ * as it was. Acks and Nacks go only to the connection that owns the transfer, and Status
+ * notifications to every subscriber. Writing [0x03] aborts the transfer.
+ *
+ * Received data is collected into two buffers of OTA_BUFFER_BYTES: while a task writes one
+ * to flash, the radio fills the other. Acks are
+ * held back while neither buffer has room for two more windows; the time they are held is
+ * the flash-write stall reported in OtaStats, which is read from the stats characteristic.
+ */
+
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include "ble_backend.h"
+
+/// The UUID of the OTA service.
+#define OTA_SERVICE_UUID "abcd1234-1234-1234-1234-1234567890c0"
+
+/// The UUID of the OTA control characteristic.
+#define OTA_CONTROL_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890c1"
+
+/// The UUID of the OTA data characteristic.
+#define OTA_DATA_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890c2"
+
+/// The UUID of the OTA stats characteristic.
+#define OTA_STATS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890c3"
+
+/// The size of each of the two flash write buffers. One flash sector by default.
+#ifndef OTA_BUFFER_BYTES
+#define OTA_BUFFER_BYTES 4096
+#endif
+
+/// The opcode that starts a transfer.
+#define OTA_OPCODE_BEGIN 0x01
+
+/// The opcode that finishes a transfer.
+#define OTA_OPCODE_FINISH 0x02
+
+/// The opcode that aborts a transfer.
+#define OTA_OPCODE_ABORT 0x03
+
+/**
+ * @brief The state of the OTA transfer.
+ */
+enum class OtaState : uint8_t {
+    Idle = 0,      ///< No transfer has been started.
+    Preparing = 1, ///< The OTA partition is being prepared.
+    Receiving = 2, ///< Packets are being received.
+    Finishing = 3, ///< The last buffer is being written and the image validated.
+    Done = 4,      ///< The image was written and selected for the next boot.
+    Failed = 5,    ///< The transfer failed. OtaStats::lastError holds the reason.
+};
+
+/**
+ * @brief The kinds of OTA control notification.
+ */
+enum class OtaNotificationType : uint8_t {
+    Ack = 0x10,     ///< A window of packets was received.
+    Nack = 0x11,    ///< A packet was out of sequence; resend from nextSequence.
+    Status = 0x12,  ///< The state changed.
+    Refused = 0x13, ///< A command was refused, and the transfer state is unchanged.
+};
+
+/**
+ * @brief The wire format of the OTA control notifications.
+ */
+struct __attribute__((packed)) OtaNotification {
+    uint8_t type;          ///< An OtaNotificationType.
+    uint8_t state;         ///< The current OtaState.
+    uint16_t nextSequence; ///< The sequence number of the next packet the device expects.
+    uint32_t received;     ///< Image bytes received in sequence so far.
+    uint16_t window;       ///< The number of packets acknowledged at once.
+};
+
+/**
+ * @brief The wire format of the OTA stats.
+ */
+struct __attribute__((packed)) OtaStats {
+    uint8_t state;            ///< The current OtaState.
+    uint16_t window;          ///< The accepted window, in packets.
+    uint32_t imageSize;       ///< The announced image size in bytes.
+    uint32_t received;        ///< Image bytes received in sequence.
+    uint32_t written;         ///< Image bytes written to flash.
+    uint32_t packets;         ///< Data packets received, including dropped ones.
+    uint32_t droppedPackets;  ///< Packets dropped because they were out of sequence.
+    uint32_t acks;            ///< Acks sent.
+    uint32_t elapsedMs;       ///< Time from the partition being ready to the latest packet.
+    uint32_t rateBps;         ///< Image bytes received per second.
+    uint32_t flashWriteMs;    ///< Total time spent writing to flash.
+    uint32_t maxFlashWriteUs; ///< The longest single buffer write.
+    uint32_t stallMs;         ///< Total time acks were held back waiting for a free buffer.
+    int32_t lastError;        ///< The esp_err_t of the most recent failure, or 0.
+};
+
+/**
+ * @brief Creates and starts the OTA service and its flash writer task.
+ *
+ * @param pServer A pointer to the BLE server.
+ */
+void setupOtaUpdate(BLEServer* pServer);
+
+/**
+ * @brief Aborts the transfer if the connection that owns it is still sending the image.
+ */
+void onOtaDisconnected(uint16_t connId);
+
+#endif // OTA_UPDATE_H
@@ -0,0 +1,95 @@
+/**
+ * @file
+ * @brief A record of which bytes of a reassembled payload have arrived.
+ *
+ * Chunks can arrive in any order, be resent, or overlap, so counting the bytes of each
+ * chunk is not enough to tell when the payload is complete. The coverage keeps one bit per
+ * payload byte and only counts the bytes a chunk adds.
+ */
+
+#ifndef PAYLOAD_COVERAGE_H
+#define PAYLOAD_COVERAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * @class PayloadCoverage
+ * @brief A fixed-size bitmap of the payload bytes that have arrived.
+ *
+ * @tparam Bytes The largest payload, in bytes.
+ */
+template <size_t Bytes>
+class PayloadCoverage {
+public:
+    PayloadCoverage() : count(0) {
+        memset(bits, 0, sizeof(bits));
+    }
+
+    /**
+     * @brief Forgets every byte that arrived.
+     */
+    void reset() {
+        memset(bits, 0, sizeof(bits));
+        count = 0;
+    }
+
+    /**
+     * @brief Marks a range of the payload as arrived.
+     *
+     * @param offset The offset of the first byte. The range must lie within Bytes.
+     * @param length The number of bytes.
+     * @return The number of bytes in the range that had not arrived before.
+     */
+    size_t mark(size_t offset, size_t length) {
+        size_t added = 0;
+        size_t index = offset;
+        const size_t end = offset + length;
+
+        // Single bits up to the first whole byte of the bitmap, then whole bytes, then the rest
+        while (index < end && (index & 7) != 0) {
+            added += markBit(index++);
+        }
+        while (end - index >= 8) {
+            uint8_t& word = bits[index >> 3];
+            added += 8 - __builtin_popcount(word);
+            word = 0xFF;
+            index += 8;
+        }
+        while (index < end) {
+            added += markBit(index++);
+        }
+
+        count += added;
+        return added;
+    }
+
+    /**
+     * @brief Returns true if the byte at an offset has arrived.
+     */
+    bool covers(size_t offset) const {
+        return bits[offset >> 3] & (1 << (offset & 7));
+    }
+
+    /// The number of distinct bytes that have arrived.
+    size_t covered() const {
+        return count;
+    }
+
+private:
+    size_t markBit(size_t offset) {
+        const uint8_t mask = 1 << (offset & 7);
+        uint8_t& word = bits[offset >> 3];
+        if (word & mask) {
+            return 0;
+        }
+        word |= mask;
+        return 1;
+    }
+
+    uint8_t bits[(Bytes + 7) / 8];
+    size_t count;
+};
+
+#endif // PAYLOAD_COVERAGE_H
@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @brief Power-managed idle and active/idle time accounting.
+ *
+ * Building with TESTER_POWER_SAVE=1 configures ESP-IDF power management so the CPU drops to
+ * the crystal frequency when nothing is running. Automatic light sleep and BLE controller
+ * modem sleep are enabled too when the framework's sdkconfig supports them, which needs
+ * CONFIG_PM_ENABLE, CONFIG_FREERTOS_USE_TICKLESS_IDLE and the controller's modem sleep
+ * option. Whatever could not be enabled is reported in the power stats and the log.
+ *
+ * In every build the firmware accounts for the time the CPU spends idle versus running
+ * tasks. Where FreeRTOS run-time stats are available the idle task's run time is used,
+ * which is accurate to the microsecond and includes time spent in light sleep. Otherwise an
+ * idle hook estimates it, which overcounts idle time by up to one tick per wake-up and
+ * cannot see light sleep. Reading the power stats characteristic returns a PowerStats
+ * record for the current measurement window; writing any value to it starts a new window.
+ */
+
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include "ble_backend.h"
+
+/// Set to 1 to enable frequency scaling, automatic light sleep and modem sleep.
+#ifndef TESTER_POWER_SAVE
+#define TESTER_POWER_SAVE 0
+#endif
+
+/// The UUID of the power stats characteristic.
+#define POWER_STATS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b7"
+
+/**
+ * @brief How idle time is measured.
+ */
+enum class IdleSource : uint8_t {
+    RunTimeStats = 1, ///< The idle task's FreeRTOS run-time counter.
+    IdleHook = 2,     ///< An estimate from the FreeRTOS idle hook.
+};
+
+/**
+ * @brief The wire format of the power stats. All fields are little-endian.
+ */
+struct __attribute__((packed)) PowerStats {
+    uint8_t frequencyScaling; ///< 1 if the CPU scales down to the crystal frequency when idle.
+    uint8_t lightSleep;       ///< 1 if automatic light sleep is enabled.
+    uint8_t modemSleep;       ///< 1 if BLE controller modem sleep is enabled.
+    uint8_t idleSource;       ///< An IdleSource.
+    uint32_t windowMs;        ///< The length of the measurement window so far.
+    uint32_t activeMs;        ///< Time spent running tasks during the window.
+    uint32_t idleMs;          ///< Time spent idle or asleep during the window.
+};
+
+/**
+ * @brief Applies the power configuration, starts the accounting and creates the stats
+ * characteristic. Call after BLEDevice::init(), since modem sleep needs the controller.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupPowerManager(BLEService* pService);
+
+#endif // POWER_MANAGER_H
@@ -0,0 +1,106 @@
+/**
+ * @file
+ * @brief A fixed-capacity, lock-free multi-producer queue of fixed-size records.
+ *
+ * This is a bounded queue in the style of Dmitry Vyukov's MPMC queue: every slot carries a
+ * sequence number that tells producers and consumers whether it is free or filled, so any
+ * number of tasks can push concurrently without a mutex or a critical section. The storage
+ * is a member array and never touches the heap.
+ */
+
+#ifndef SLOT_RING_H
+#define SLOT_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * @class SlotRing
+ * @brief A lock-free bounded queue of records of type T.
+ *
+ * @tparam T The record type. It is copied in and out, so keep it small and trivially copyable.
+ * @tparam Slots The number of records the queue holds. Must be a power of two.
+ */
+template <typename T, size_t Slots>
+class SlotRing {
+public:
+    static_assert(Slots >= 2 && (Slots & (Slots - 1)) == 0,
+                  "The number of slots must be a power of two");
+
+    SlotRing() : enqueuePos(0), dequeuePos(0) {
+        for (size_t i = 0; i < Slots; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Appends a record. Safe to call from any number of tasks at once.
+     *
+     * @return false if the queue is full.
+     */
+    bool push(const T& value) {
+        Cell* cell;
+        uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & (Slots - 1)];
+            const uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const int32_t diff = (int32_t)(sequence - pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest record.
+     *
+     * @return false if the queue is empty.
+     */
+    bool pop(T& value) {
+        Cell* cell;
+        uint32_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos & (Slots - 1)];
+            const uint32_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const int32_t diff = (int32_t)(sequence - (pos + 1));
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->data;
+        cell->sequence.store(pos + Slots, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        T data;
+    };
+
+    Cell cells[Slots];
+    std::atomic<uint32_t> enqueuePos;
+    std::atomic<uint32_t> dequeuePos;
+};
+
+#endif // SLOT_RING_H
@@ -0,0 +1,149 @@
+/**
+ * @file
+ * @brief Time series of heap, stack, connection and timing health for multi-day soak runs.
+ *
+ * Every SOAK_INTERVAL_S seconds the soak task takes a SoakSample, and the samples are kept
+ * in a fixed series of SOAK_SAMPLES in RAM, so a run can be reviewed over BLE without a
+ * serial console. When the series is full it is compacted: each pair of neighbouring samples
+ * is merged into one and the interval doubles, so the series always spans the whole run at
+ * a resolution that halves as the run gets longer. A merged sample keeps the worst of the
+ * pair: the lowest heap and stack figures, the highest connection count, latencies and idle
+ * gap, and the sum of the counts.
+ *
+ * Task watchdog near-misses are caught from the idle hook of each core. The task watchdog
+ * fires when a core's idle task does not run for CONFIG_ESP_TASK_WDT_TIMEOUT_S, so every
+ * time the idle task runs after being starved for SOAK_NEAR_MISS_PERCENT of that timeout or
+ * more, the gap is recorded as a near-miss. A gap of the full timeout or more means the
+ * watchdog did fire. Under automatic light sleep the gaps also include time spent asleep,
+ * so near-misses are only meaningful with TESTER_POWER_SAVE off.
+ *
+ * The soak characteristic takes these commands:
+ *
+ *   - [0x00]: clears the series and the near-miss log.
+ *   - [0x01][first sample u16]: selects the series, starting at the given sample.
+ *   - [0x02]: selects the near-miss log.
+ *
+ * Reading the series returns a SoakChunkHeader followed by as many samples from the cursor as
+ * fit in SOAK_CHUNK_BYTES, and moves the cursor past them, so a client downloads the series
+ * by reading until a chunk has no samples. If the compaction count changes during a download,
+ * the series was compacted and the client starts again from sample 0. Reading the near-miss
+ * log returns a SoakNearMissLog followed by its records, oldest first. All fields are
+ * little-endian.
+ */
+
+#ifndef SOAK_MONITOR_H
+#define SOAK_MONITOR_H
+
+#include "ble_backend.h"
+
+/// The UUID of the soak characteristic.
+#define SOAK_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890e1"
+
+/// The time between samples until the series is first compacted, in seconds.
+#ifndef SOAK_INTERVAL_S
+#define SOAK_INTERVAL_S 60
+#endif
+
+/// The number of samples kept, an even number.
+#ifndef SOAK_SAMPLES
+#define SOAK_SAMPLES 192
+#endif
+
+/// The idle gap that counts as a watchdog near-miss, as a percentage of the watchdog timeout.
+#ifndef SOAK_NEAR_MISS_PERCENT
+#define SOAK_NEAR_MISS_PERCENT 50
+#endif
+
+/// The number of the most recent near-misses kept in the log.
+#define SOAK_NEAR_MISS_LOG 8
+
+/// The largest chunk of the series returned by one read, in bytes.
+#define SOAK_CHUNK_BYTES 512
+
+/// The number of tasks whose stack high-water mark is sampled. See SoakSample::stackHighWater.
+#define SOAK_TASK_COUNT 16
+
+/// The version of the SoakChunkHeader and SoakSample layouts. Bump it whenever they change.
+#define SOAK_VERSION 3
+
+/// The opcode that clears the series and the near-miss log.
+#define SOAK_OPCODE_RESET 0x00
+
+/// The opcode that selects the series.
+#define SOAK_OPCODE_SERIES 0x01
+
+/// The opcode that selects the near-miss log.
+#define SOAK_OPCODE_NEAR_MISSES 0x02
+
+/**
+ * @brief One sample of the series, covering the interval that ends at its uptime.
+ */
+struct __attribute__((packed)) SoakSample {
+    uint32_t uptimeS;          ///< The uptime at the end of the interval.
+    uint32_t freeHeap;         ///< Free heap in bytes.
+    uint32_t minFreeHeap;      ///< The lowest free heap since boot, in bytes.
+    uint32_t largestFreeBlock; ///< The largest block that can be allocated, in bytes.
+    uint32_t callbacks;        ///< Write callbacks handled in the interval.
+    uint32_t callbackP50Us;    ///< The median write callback duration in the interval.
+    uint32_t callbackP99Us;
+    uint32_t callbackMaxUs;
+    uint16_t maxIdleGapMs;     ///< The longest time any core's idle task was starved.
+    uint8_t connections;       ///< Connected clients.
+    uint8_t nearMisses;        ///< Watchdog near-misses in the interval, saturating at 255.
+
+    /**
+     * Unused stack in bytes of, in order: loopTask, esp_timer, btController, the BLE host
+     * task (BTC_TASK or nimble_host), log_drain, stats, led_render, indications, throughput,
+     * write_sink, traffic, ota_writer, l2cap_source, soak, trace and live_status. 0 if the
+     * task does not exist.
+     */
+    uint16_t stackHighWater[SOAK_TASK_COUNT];
+};
+
+/**
+ * @brief The header of every series chunk.
+ */
+struct __attribute__((packed)) SoakChunkHeader {
+    uint8_t version;      ///< SOAK_VERSION.
+    uint8_t sampleSize;   ///< sizeof(SoakSample), so older clients can skip new fields.
+    uint8_t taskCount;    ///< SOAK_TASK_COUNT.
+    uint8_t compactions;  ///< Times the series has been compacted since it was cleared.
+    uint32_t intervalS;   ///< The time each stored sample covers.
+    uint16_t count;       ///< Samples in the series.
+    uint16_t first;       ///< The index of the first sample in this chunk.
+    uint8_t samples;      ///< Samples in this chunk.
+    uint32_t nearMisses;  ///< Watchdog near-misses since the series was cleared.
+};
+
+/**
+ * @brief A watchdog near-miss.
+ */
+struct __attribute__((packed)) SoakNearMiss {
+    uint32_t uptimeMs;  ///< When the idle task ran again.
+    uint16_t gapMs;     ///< How long it had been starved, saturating at 65535.
+    uint8_t core;
+};
+
+/**
+ * @brief The header of the near-miss log.
+ */
+struct __attribute__((packed)) SoakNearMissLog {
+    uint32_t total;       ///< Near-misses since the log was cleared.
+    uint16_t timeoutMs;   ///< The task watchdog timeout.
+    uint16_t thresholdMs; ///< The idle gap that counts as a near-miss.
+    uint8_t count;        ///< Records that follow, at most SOAK_NEAR_MISS_LOG.
+};
+
+/**
+ * @brief Creates the soak characteristic, installs the idle hooks and starts the soak task.
+ *
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupSoakMonitor(BLEService* pService);
+
+/**
+ * @brief Records how long a write callback took. Called by statsRecordWrite().
+ */
+void soakRecordCallback(uint32_t durationUs);
+
+#endif // SOAK_MONITOR_H
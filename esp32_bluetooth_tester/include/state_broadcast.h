@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @brief Connectionless broadcast of the tester's state in manufacturer-specific data.
+ *
+ * Gateways that monitor many testers can follow the LED state and a digest of the firmware
+ * stats from advertisements alone, without connecting. The state is a BroadcastStateRecord
+ * under the company ID STATE_BROADCAST_COMPANY_ID. It is rebuilt whenever the LED state
+ * changes, at most once every STATE_BROADCAST_MIN_UPDATE_MS milliseconds, and its digest is
+ * refreshed every STATE_BROADCAST_DIGEST_MS milliseconds. The advertising payload is
+ * updated in place; advertising does not restart.
+ *
+ * With state advertising on (TESTER_STATE_ADVERTISING, or the advertising control
+ * characteristic), the legacy advertising payload carries the flags and the record, and the
+ * service UUID moves to the scan response (see advertising_profiles.h).
+ *
+ * Builds with TESTER_EXTENDED_ADVERTISING also run a second, non-connectable extended
+ * advertising set with periodic advertising, which carries a BroadcastStateReport: the
+ * record followed by a full FirmwareStats record.
+ */
+
+#ifndef STATE_BROADCAST_H
+#define STATE_BROADCAST_H
+
+#include <stdint.h>
+
+#include "firmware_stats.h"
+
+/// The company ID of the manufacturer-specific data. 0xFFFF is reserved for testing; use an
+/// assigned ID for devices in the field.
+#ifndef STATE_BROADCAST_COMPANY_ID
+#define STATE_BROADCAST_COMPANY_ID 0xFFFF
+#endif
+
+/// The minimum time between two updates of the advertising payload, in milliseconds.
+#ifndef STATE_BROADCAST_MIN_UPDATE_MS
+#define STATE_BROADCAST_MIN_UPDATE_MS 100
+#endif
+
+/// How often the stats digest is refreshed, in milliseconds.
+#ifndef STATE_BROADCAST_DIGEST_MS
+#define STATE_BROADCAST_DIGEST_MS 10000
+#endif
+
+/// The version of the BroadcastStateRecord layout. Bump it whenever the layout changes.
+#define STATE_BROADCAST_VERSION 1
+
+/**
+ * @brief What the LED shows, as broadcast in the state record.
+ */
+enum class BroadcastLedState : uint8_t {
+    Off = 0,
+    Green = 1,  ///< Turned on through the open characteristic.
+    Red = 2,    ///< Turned on through the encrypted characteristic.
+    Custom = 3, ///< A framebuffer frame or an animation.
+};
+
+/**
+ * @brief The wire format of the state record. All fields are little-endian.
+ *
+ * It fits a legacy advertising payload next to the flags.
+ */
+struct __attribute__((packed)) BroadcastStateRecord {
+    uint8_t version;        ///< STATE_BROADCAST_VERSION.
+    uint8_t ledState;       ///< A BroadcastLedState.
+    uint16_t sequence;      ///< Incremented on every LED state change, so missed changes show.
+    uint8_t connections;    ///< Clients connected when the record was built.
+    uint32_t uptimeS;
+    uint32_t writes;        ///< Writes handled by any characteristic.
+    uint32_t notifications; ///< Notifications sent.
+    uint16_t minFreeHeapKb; ///< The lowest free heap since boot, in KiB.
+};
+
+/**
+ * @brief The wire format of the state report in extended and periodic advertising.
+ */
+struct __attribute__((packed)) BroadcastStateReport {
+    BroadcastStateRecord record;
+    FirmwareStats stats;
+};
+
+/**
+ * @brief Builds the first record and starts refreshing the digest. Call after
+ * setupAdvertisingProfiles().
+ */
+void setupStateBroadcast();
+
+/**
+ * @brief Records what the LED shows. The advertising payload is updated if it changed.
+ *
+ * This is cheap enough to call for every LED write.
+ */
+void setBroadcastLedState(BroadcastLedState state);
+
+#endif // STATE_BROADCAST_H
@@ -0,0 +1,55 @@
+/**
+ * @file
+ * @brief Bulk notification throughput test for the ESP32 BLE tester.
+ *
+ * The throughput test adds a characteristic to the tester service that, once started,
+ * streams back-to-back notifications to the client that started it, sized to that
+ * client's negotiated ATT MTU. Each notification
+ * carries a sequence number and a verifiable payload pattern so that a client can detect
+ * lost or reordered packets:
+ *
+ *   - Bytes 0-3: the sequence number as a little-endian uint32, starting at 0.
+ *   - Bytes 4..n: the pattern byte (sequence + index) & 0xFF, where index is the byte
+ *     offset within the notification.
+ *
+ * The test is controlled by writing text commands to the characteristic:
+ *   - "START" streams for the default duration.
+ *   - "START <seconds>" streams for the given number of seconds.
+ *   - "STOP" ends a running test early.
+ *
+ * When the test ends, the characteristic value is set to a summary string and notified to
+ * the same client:
+ *   "DONE packets=<n> bytes=<n> ms=<n> bps=<n> failed=<n> mtu=<n>"
+ *
+ * A failed send is a notification the BLE stack refused to queue. The sequence number
+ * is only advanced for notifications that were accepted, so any gap the client sees in the
+ * sequence numbers is a notification that was dropped over the air or in the client's stack.
+ */
+
+#ifndef THROUGHPUT_TEST_H
+#define THROUGHPUT_TEST_H
+
+#include "ble_backend.h"
+
+/// The UUID of the throughput test characteristic.
+#define THROUGHPUT_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890ad"
+
+/// The test duration used when "START" is written without a number of seconds.
+#ifndef THROUGHPUT_DEFAULT_SECONDS
+#define THROUGHPUT_DEFAULT_SECONDS 10
+#endif
+
+/// The longest test duration a client can request.
+#ifndef THROUGHPUT_MAX_SECONDS
+#define THROUGHPUT_MAX_SECONDS 600
+#endif
+
+/**
+ * @brief Creates the throughput test characteristic and starts the streaming task.
+ *
+ * @param pServer A pointer to the BLE server, used to look up the client's MTU.
+ * @param pService A pointer to the service the characteristic is added to.
+ */
+void setupThroughputTest(BLEServer* pServer, BLEService* pService);
+
+#endif // THROUGHPUT_TEST_H
@@ -0,0 +1,180 @@
+/**
+ * @file
+ * @brief Flash-backed recorder of every write and notification, for offline incident analysis.
+ *
+ * Building with TESTER_TRACE=1 adds a recorder that appends each write received by a tracked
+ * characteristic, and each notification and indication sent through the connection registry,
+ * to a trace file on LittleFS. Recording costs the BLE task a copy into a RAM ring under a
+ * short lock; a writer task drains the ring into TRACE_BATCH_BYTES batches and writes each
+ * batch to flash in one go, and flushes the file every TRACE_FLUSH_MS. Records that do not
+ * fit in the ring because flash fell behind are counted as dropped.
+ *
+ * The trace file starts with a TraceFileHeader, followed by records written back to back.
+ * Each record is a TraceRecordHeader followed by the first TRACE_CAPTURE_BYTES of the
+ * value. Timestamps are the low 32 bits of the microseconds since boot, so they wrap every
+ * 71 minutes; the records are in time order, so a reader unwraps them by adding 2^32 each
+ * time a timestamp goes backwards. All fields are little-endian.
+ *
+ * Writing to the trace control characteristic:
+ *
+ *   - [0x00]: stops recording and flushes the file.
+ *   - [0x01]: starts a new trace, replacing the previous one.
+ *   - [0x02][offset u32]: stops recording and streams the trace from the given offset.
+ *
+ * The trace is streamed as notifications of the trace data characteristic, each holding
+ * [offset u32][bytes of the file]; a notification with no bytes marks the end of the file.
+ * A client that misses a notification requests the rest again from the last offset it has.
+ * Recording stops when the file reaches TRACE_MAX_BYTES. The trace file survives a reboot,
+ * so the trace leading up to a crash can be downloaded afterwards, until a new trace is
+ * started. Reading the control characteristic returns a TraceStatus.
+ *
+ * Other builds keep both characteristics, but report the recorder as disabled.
+ */
+
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include "ble_backend.h"
+
+/// Set to 1 to build the trace recorder.
+#ifndef TESTER_TRACE
+#define TESTER_TRACE 0
+#endif
+
+/// The UUID of the trace control characteristic.
+#define TRACE_CONTROL_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890e2"
+
+/// The UUID of the trace data characteristic.
+#define TRACE_DATA_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890e3"
+
+/// The number of value bytes kept in each record, at most 255.
+#ifndef TRACE_CAPTURE_BYTES
+#define TRACE_CAPTURE_BYTES 20
+#endif
+
+/// The size of the RAM ring that records wait in, a power of two.
+#ifndef TRACE_BUFFER_BYTES
+#define TRACE_BUFFER_BYTES 8192
+#endif
+
+/// The size of each write to flash, in bytes.
+#ifndef TRACE_BATCH_BYTES
+#define TRACE_BATCH_BYTES 4096
+#endif
+
+/// How often buffered records are written and the file is flushed, in milliseconds.
+#ifndef TRACE_FLUSH_MS
+#define TRACE_FLUSH_MS 1000
+#endif
+
+/// The largest trace file, in bytes.
+#ifndef TRACE_MAX_BYTES
+#define TRACE_MAX_BYTES (512 * 1024)
+#endif
+
+/// The path of the trace file on LittleFS.
+#define TRACE_FILE_PATH "/trace.bin"
+
+/// The magic number at the start of the trace file, "BTTR" in file order.
+#define TRACE_FILE_MAGIC 0x52545442
+
+/// The version of the trace file layout. Bump it whenever the layout changes.
+#define TRACE_VERSION 1
+
+/// The opcode that stops recording.
+#define TRACE_OPCODE_STOP 0x00
+
+/// The opcode that starts a new trace.
+#define TRACE_OPCODE_START 0x01
+
+/// The opcode that streams the trace.
+#define TRACE_OPCODE_DOWNLOAD 0x02
+
+/// The connection ID of a notification or indication, which goes to every subscriber.
+#define TRACE_ALL_CONNECTIONS 0xFF
+
+/**
+ * @brief What a trace record captured.
+ */
+enum class TraceKind : uint8_t {
+    Write = 0,        ///< A write received from a client.
+    Notification = 1, ///< A notification sent to the subscribers.
+    Indication = 2,   ///< An indication sent to the subscribers.
+};
+
+/**
+ * @brief The state of the recorder.
+ */
+enum class TraceState : uint8_t {
+    Idle = 0,      ///< Not recording. Any trace from before is kept.
+    Recording = 1,
+    Full = 2,      ///< Recording stopped because the file reached TRACE_MAX_BYTES.
+    Failed = 3,    ///< LittleFS could not be mounted, or the file could not be written.
+};
+
+/**
+ * @brief The header at the start of the trace file.
+ */
+struct __attribute__((packed)) TraceFileHeader {
+    uint32_t magic;         ///< TRACE_FILE_MAGIC.
+    uint8_t version;        ///< TRACE_VERSION.
+    uint8_t captureBytes;   ///< TRACE_CAPTURE_BYTES.
+    uint32_t startUptimeMs; ///< When recording started.
+};
+
+/**
+ * @brief The header of every record in the trace file.
+ */
+struct __attribute__((packed)) TraceRecordHeader {
+    uint8_t kind;      ///< A TraceKind.
+    uint8_t connId;    ///< The connection a write came from, or TRACE_ALL_CONNECTIONS.
+    uint16_t handle;   ///< The attribute handle of the characteristic value.
+    uint32_t timeUs;   ///< The low 32 bits of the microseconds since boot.
+    uint16_t length;   ///< The length of the value.
+    uint8_t captured;  ///< The value bytes that follow, up to TRACE_CAPTURE_BYTES.
+};
+
+/**
+ * @brief The wire format of the recorder status. All fields are little-endian.
+ */
+struct __attribute__((packed)) TraceStatus {
+    uint8_t enabled;       ///< 1 if the build has the recorder.
+    uint8_t state;         ///< A TraceState.
+    uint8_t downloading;   ///< 1 while the trace is being streamed.
+    uint8_t captureBytes;  ///< TRACE_CAPTURE_BYTES.
+    uint32_t records;      ///< Records written since the trace started.
+    uint32_t dropped;      ///< Records dropped because the RAM ring was full.
+    uint32_t fileBytes;    ///< The size of the trace file.
+    uint32_t maxBytes;     ///< TRACE_MAX_BYTES.
+    uint32_t batches;      ///< Writes to flash since the trace started.
+    uint32_t maxBatchUs;   ///< The longest write or flush of the trace file.
+};
+
+/**
+ * @brief Creates the trace characteristics.
+ *
+ * @param pServer A pointer to the BLE server, used to look up the MTU of a download.
+ * @param pService A pointer to the service the characteristics are added to.
+ */
+void setupTraceRecorder(BLEServer* pServer, BLEService* pService);
+
+/**
+ * @brief Mounts LittleFS and starts the writer task.
+ *
+ * Mounting can take a while, and formats the partition on first boot, so this is kept
+ * apart from setupTraceRecorder() and can run once the device is advertising.
+ */
+void startTraceRecorder();
+
+/**
+ * @brief Records a write received by a characteristic. Called by the connection registry.
+ */
+void traceRecordWrite(BLECharacteristic* pCharacteristic, uint16_t connId);
+
+/**
+ * @brief Records a notification or indication of a characteristic's current value. Called
+ * by the connection registry before it sends.
+ */
+void traceRecordNotification(BLECharacteristic* pCharacteristic, bool indication);
+
+#endif // TRACE_RECORDER_H
@@ -0,0 +1,125 @@
+/**
+ * @file
+ * @brief Scripted server-side traffic generator for sustained notification and indication load.
+ *
+ * The traffic service has its own UUID, a control characteristic and TRAFFIC_CHANNELS
+ * channel characteristics that the generator pushes values from. A client subscribes to the
+ * channels it wants to receive, then writes [0x01][TrafficConfig] to the control
+ * characteristic to start a run, or [0x02] to stop it. All multi-byte fields are little-endian.
+ *
+ * A run sends packets across the selected channels in turn, as notifications or as
+ * indications, at the configured rate. Packets can be grouped into bursts separated by an
+ * idle gap, which is how a device that wakes to report looks to the app. The size of each
+ * packet is drawn from the configured distribution by a pseudo-random generator seeded from
+ * the config, so the same config always produces the same sequence of sizes. Each packet
+ * carries a sequence number and the throughput test's verification pattern:
+ *
+ *   - Bytes 0-3: the sequence number as a little-endian uint32, starting at 0 and counted
+ *     across all channels.
+ *   - Bytes 4..n: the pattern byte (sequence + index) & 0xFF.
+ *
+ * Packets are sized to the ATT MTU of the client that started the run. A run ends when its
+ * duration elapses, when it is stopped, or when that client disconnects. Reading the control characteristic returns a TrafficStats with the live
+ * counters, and the same record is notified when the run ends.
+ *
+ * Queue-full events are packets the BLE stack refused for lack of buffers; the generator
+ * backs off for a tick and retries the same packet. Congestion events are the times the
+ * link ran out of room: on Bluedroid, the controller's sendable-packet count dropping to
+ * zero or a GATT congestion event; NimBLE only reports congestion by refusing packets, so
+ * there it shows up as queue-full events. Indications wait for each confirmation before the
+ * next packet, and for any LED indication still in flight, so their rate is bounded by the
+ * connection interval.
+ */
+
+#ifndef TRAFFIC_GENERATOR_H
+#define TRAFFIC_GENERATOR_H
+
+#include "ble_backend.h"
+
+/// The UUID of the traffic service.
+#define TRAFFIC_SERVICE_UUID "abcd1234-1234-1234-1234-1234567890d0"
+
+/// The UUID of the traffic control characteristic.
+#define TRAFFIC_CONTROL_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890d1"
+
+/// The UUID prefix of the channel characteristics. Channel i ends in "d2" + i.
+#define TRAFFIC_CHANNEL_UUID_PREFIX "abcd1234-1234-1234-1234-1234567890d"
+
+/// The number of channel characteristics, at most 8.
+#define TRAFFIC_CHANNELS 4
+
+/// The opcode that starts a run.
+#define TRAFFIC_OPCODE_START 0x01
+
+/// The opcode that stops a run.
+#define TRAFFIC_OPCODE_STOP 0x02
+
+/**
+ * @brief How packets are sent.
+ */
+enum class TrafficMode : uint8_t {
+    Notify = 0,
+    Indicate = 1,
+};
+
+/**
+ * @brief How the size of each packet is chosen between the minimum and maximum size.
+ */
+enum class TrafficSizeDistribution : uint8_t {
+    Fixed = 0,   ///< Every packet has the maximum size.
+    Uniform = 1, ///< Uniformly distributed between the minimum and maximum size.
+    Bimodal = 2, ///< Either the minimum or the maximum size, with equal probability.
+};
+
+/**
+ * @brief The state of the traffic generator.
+ */
+enum class TrafficState : uint8_t {
+    Idle = 0,         ///< No run has been started.
+    Running = 1,
+    Done = 2,         ///< The run lasted its full duration.
+    Stopped = 3,      ///< The run was stopped by a client.
+    Disconnected = 4, ///< The run ended because the client that started it disconnected.
+};
+
+/**
+ * @brief The run configuration that follows the start opcode.
+ */
+struct __attribute__((packed)) TrafficConfig {
+    uint8_t mode;           ///< A TrafficMode.
+    uint8_t channels;       ///< Bit i selects channel i.
+    uint16_t rate;          ///< Packets per second within a burst, or 0 for as fast as the link allows.
+    uint16_t minSize;       ///< The smallest packet, in bytes, at least 4.
+    uint16_t maxSize;       ///< The largest packet, in bytes. Clamped to the ATT MTU - 3.
+    uint8_t distribution;   ///< A TrafficSizeDistribution.
+    uint16_t burstPackets;  ///< Packets per burst, or 0 to send without gaps.
+    uint16_t burstGapMs;    ///< The idle time between bursts.
+    uint16_t durationS;     ///< The length of the run, or 0 to run until stopped.
+    uint32_t seed;          ///< Seeds the packet size sequence.
+};
+
+/**
+ * @brief The wire format of the traffic stats.
+ */
+struct __attribute__((packed)) TrafficStats {
+    uint8_t state;            ///< A TrafficState.
+    uint8_t mode;             ///< The TrafficMode of the current or last run.
+    uint16_t maxSize;         ///< The largest packet after clamping to the MTU.
+    uint32_t packets;         ///< Packets sent.
+    uint32_t bytes;           ///< Payload bytes sent.
+    uint32_t skipped;         ///< Packets skipped because nobody was subscribed to the channel.
+    uint32_t queueFull;       ///< Sends the stack refused for lack of buffers.
+    uint32_t congestion;      ///< Times the link became congested.
+    uint32_t indicateErrors;  ///< Indications that timed out or failed.
+    uint32_t elapsedMs;       ///< The length of the run so far.
+    uint32_t bytesPerSecond;  ///< The payload rate achieved.
+};
+
+/**
+ * @brief Creates and starts the traffic service and the generator task.
+ *
+ * @param pServer A pointer to the BLE server the service is added to.
+ */
+void setupTrafficGenerator(BLEServer* pServer);
+
+#endif // TRAFFIC_GENERATOR_H
@@ -0,0 +1,58 @@
+/**
+ * @file
+ * @brief High-rate ingestion test for writes without response.
+ *
+ * The sink characteristic accepts only writes without response, so a client can push
+ * data as fast as the link allows without waiting for an ATT acknowledgement. The write
+ * callback copies each payload into a statically allocated ring buffer and returns; a
+ * background task drains the ring and verifies the payloads. When the ring is full the
+ * write is dropped and counted as an overrun.
+ *
+ * Payloads use the same format as the throughput test: a little-endian uint32 sequence
+ * number followed by the pattern byte (sequence + offset) & 0xFF for every remaining byte
+ * offset. A payload with sequence number 0 starts a new stream. The sequence check assumes
+ * a single client is streaming at a time.
+ *
+ * Reading the statistics characteristic returns a WriteSinkCounters record; writing any
+ * value to it resets the counters.
+ */
+
+#ifndef WRITE_SINK_H
+#define WRITE_SINK_H
+
+#include "ble_backend.h"
+
+/// The UUID of the write-without-response sink characteristic.
+#define WRITE_SINK_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b2"
+
+/// The UUID of the sink statistics characteristic.
+#define WRITE_SINK_STATS_CHARACTERISTIC_UUID "abcd1234-1234-1234-1234-1234567890b3"
+
+/// The size of the ring buffer in bytes. Must be a power of two.
+#ifndef WRITE_SINK_RING_BYTES
+#define WRITE_SINK_RING_BYTES 16384
+#endif
+
+/**
+ * @brief The wire format of the sink statistics. All fields are little-endian.
+ */
+struct __attribute__((packed)) WriteSinkCounters {
+    uint32_t writes;       ///< Writes received by the sink characteristic.
+    uint32_t bytes;        ///< Payload bytes accepted into the ring.
+    uint32_t overruns;     ///< Writes dropped because the ring was full.
+    uint32_t processed;    ///< Payloads drained from the ring and verified.
+    uint32_t sequenceGaps; ///< Sequence numbers skipped between consecutive payloads.
+    uint32_t outOfOrder;   ///< Payloads whose sequence number was lower than expected.
+    uint32_t corrupt;      ///< Payloads that were too short or did not match the pattern.
+    uint32_t highWater;    ///< The largest number of bytes queued in the ring at once.
+    uint32_t elapsedMs;    ///< Time from the first to the most recent write.
+};
+
+/**
+ * @brief Creates the sink and statistics characteristics and starts the consumer task.
+ *
+ * @param pService A pointer to the service the characteristics are added to.
+ */
+void setupWriteSink(BLEService* pService);
+
+#endif // WRITE_SINK_H
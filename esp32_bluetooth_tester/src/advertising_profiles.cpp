@@ -0,0 +1,375 @@
+/**
+ * @file
+ * @brief Implementation of the advertising interval profiles and payloads.
+ *
+ * Extended builds issue every advertising command as a raw GAP call, because the BLE
+ * library's advertising class only knows the legacy commands. The payloads are still built
+ * with BLEAdvertisementData where they fit the 31-byte legacy limit it enforces.
+ */
+
+#include "advertising_profiles.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <string.h>
+#include <string>
+
+#include "async_log.h"
+#include "connection_registry.h"
+#include "state_broadcast.h"
+
+#if TESTER_EXTENDED_ADVERTISING && (TESTER_USE_NIMBLE || !defined(CONFIG_BT_BLE_50_FEATURES_SUPPORTED))
+#error "TESTER_EXTENDED_ADVERTISING needs Bluedroid on a chip with Bluetooth 5 features"
+#endif
+
+namespace {
+
+/// The size of a legacy advertising payload.
+const size_t kLegacyPayloadBytes = 31;
+
+/// The space the 128-bit service UUID takes in a payload.
+const size_t kServiceUuidBytes = 18;
+
+/// The longest name that fits the scan response next to the service UUID.
+const size_t kMaxShortNameLength = kLegacyPayloadBytes - kServiceUuidBytes - 2;
+
+/// The manufacturer data starts with the little-endian company ID.
+const size_t kCompanyIdBytes = 2;
+
+#if TESTER_EXTENDED_ADVERTISING
+/// The advertising set with the connectable legacy PDUs.
+const uint8_t kConnectableInstance = 0;
+
+/// The non-connectable extended set with periodic advertising.
+const uint8_t kBroadcastInstance = 1;
+
+/// The interval of the extended broadcast set, in units of 0.625 ms: 1 s.
+const uint32_t kBroadcastInterval = 1600;
+
+/// The periodic advertising interval, in units of 1.25 ms: 1 s.
+const uint16_t kPeriodicInterval = 800;
+
+/// The AD types used in the raw extended payloads.
+const uint8_t kAdTypeCompleteName = 0x09;
+const uint8_t kAdTypeManufacturerData = 0xFF;
+#endif
+
+/**
+ * @brief The intervals of one profile, in units of 0.625 ms.
+ */
+struct ProfileIntervals {
+    uint16_t burstMin;
+    uint16_t burstMax;
+    uint16_t slowMin;
+    uint16_t slowMax;
+};
+
+/// The intervals of each profile, in AdvertisingProfile order.
+const ProfileIntervals kProfiles[] = {
+    {160, 240, 160, 240},     // Balanced: 100-150 ms
+    {32, 48, 1600, 1600},     // FastThenSlow: 20-30 ms, then 1 s
+    {32, 48, 32, 48},         // Fast: 20-30 ms
+    {1600, 1600, 1600, 1600}, // LowPower: 1 s
+};
+
+static_assert(sizeof(kProfiles) / sizeof(kProfiles[0]) == static_cast<size_t>(AdvertisingProfile::Count),
+              "Every advertising profile needs its intervals");
+
+BLEAdvertising* advertising = nullptr;
+esp_timer_handle_t burstTimer = nullptr;
+
+const char* advertisedServiceUuid = nullptr;
+const char* advertisedName = nullptr;
+
+// Updated from the BLE task and the esp_timer task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+AdvertisingStatus status;
+
+// The manufacturer data of the state record and report, each behind the company ID.
+uint8_t stateRecord[kCompanyIdBytes + ADV_MAX_STATE_RECORD_BYTES];
+size_t stateRecordLength = 0;
+#if TESTER_EXTENDED_ADVERTISING
+uint8_t stateReport[kCompanyIdBytes + ADV_MAX_STATE_REPORT_BYTES];
+size_t stateReportLength = 0;
+bool broadcastStarted = false;
+
+/**
+ * @brief Returns the parameters of an advertising set on the 1M PHY.
+ */
+esp_ble_gap_ext_adv_params_t extendedParams(esp_ble_ext_adv_type_mask_t type, uint32_t minInterval,
+                                            uint32_t maxInterval, uint8_t sid) {
+    esp_ble_gap_ext_adv_params_t params = {};
+    params.type = type;
+    params.interval_min = minInterval;
+    params.interval_max = maxInterval;
+    params.channel_map = ADV_CHNL_ALL;
+    params.own_addr_type = BLE_ADDR_TYPE_PUBLIC;
+    params.peer_addr_type = BLE_ADDR_TYPE_PUBLIC;
+    params.filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY;
+    params.tx_power = EXT_ADV_TX_PWR_NO_PREFERENCE;
+    params.primary_phy = ESP_BLE_GAP_PHY_1M;
+    params.secondary_phy = ESP_BLE_GAP_PHY_1M;
+    params.sid = sid;
+    return params;
+}
+
+/**
+ * @brief Appends an AD structure to a raw payload.
+ */
+void appendAdStructure(uint8_t* payload, size_t& length, uint8_t type, const void* data, size_t dataLength) {
+    payload[length++] = dataLength + 1;
+    payload[length++] = type;
+    memcpy(payload + length, data, dataLength);
+    length += dataLength;
+}
+
+/**
+ * @brief Puts the state report into the broadcast set and its periodic advertising, and
+ * starts both the first time.
+ */
+void applyBroadcastPayloads() {
+    uint8_t report[sizeof(stateReport)];
+    portENTER_CRITICAL(&lock);
+    const size_t reportLength = stateReportLength;
+    memcpy(report, stateReport, reportLength);
+    portEXIT_CRITICAL(&lock);
+
+    // The extended payload carries the name, the periodic payload only the report
+    uint8_t payload[kLegacyPayloadBytes + 2 + sizeof(report)];
+    size_t length = 0;
+    const size_t nameLength = strnlen(advertisedName, kLegacyPayloadBytes - 2);
+    appendAdStructure(payload, length, kAdTypeCompleteName, advertisedName, nameLength);
+    const size_t periodicStart = length;
+    appendAdStructure(payload, length, kAdTypeManufacturerData, report, reportLength);
+
+    esp_ble_gap_config_ext_adv_data_raw(kBroadcastInstance, length, payload);
+    esp_ble_gap_config_periodic_adv_data_raw(kBroadcastInstance, length - periodicStart, payload + periodicStart);
+
+    if (!broadcastStarted) {
+        const esp_ble_gap_ext_adv_t set = {kBroadcastInstance, 0, 0};
+        esp_ble_gap_ext_adv_start(1, &set);
+        esp_ble_gap_periodic_adv_start(kBroadcastInstance);
+        broadcastStarted = true;
+    }
+}
+#endif
+
+/**
+ * @brief Builds the connectable advertising payload and scan response and applies them in
+ * place, without restarting advertising.
+ */
+void applyPayloads() {
+    uint8_t record[sizeof(stateRecord)];
+    portENTER_CRITICAL(&lock);
+    const bool withState = status.stateAdvertising && stateRecordLength > 0;
+    const size_t recordLength = stateRecordLength;
+    memcpy(record, stateRecord, recordLength);
+    portEXIT_CRITICAL(&lock);
+
+    BLEAdvertisementData advertisementData;
+    BLEAdvertisementData scanResponseData;
+    advertisementData.setFlags(0x06); // General discoverable, BR/EDR not supported
+    if (withState) {
+        advertisementData.setManufacturerData(std::string(reinterpret_cast<const char*>(record), recordLength));
+        scanResponseData.setCompleteServices(BLEUUID(advertisedServiceUuid));
+        scanResponseData.setShortName(std::string(advertisedName).substr(0, kMaxShortNameLength));
+    } else {
+        advertisementData.setCompleteServices(BLEUUID(advertisedServiceUuid));
+        scanResponseData.setName(advertisedName);
+    }
+
+#if TESTER_EXTENDED_ADVERTISING
+    const std::string payload = advertisementData.getPayload();
+    const std::string scanResponse = scanResponseData.getPayload();
+    esp_ble_gap_config_ext_adv_data_raw(kConnectableInstance, payload.length(),
+                                        reinterpret_cast<const uint8_t*>(payload.data()));
+    esp_ble_gap_config_ext_scan_rsp_data_raw(kConnectableInstance, scanResponse.length(),
+                                             reinterpret_cast<const uint8_t*>(scanResponse.data()));
+#else
+    advertising->setAdvertisementData(advertisementData);
+    advertising->setScanResponseData(scanResponseData);
+#endif
+}
+
+/**
+ * @brief Applies the intervals of the current phase and restarts advertising if there is
+ * room for another connection.
+ */
+void applyIntervals() {
+    portENTER_CRITICAL(&lock);
+    const ProfileIntervals& intervals = kProfiles[status.profile];
+    status.minInterval = status.inBurst ? intervals.burstMin : intervals.slowMin;
+    status.maxInterval = status.inBurst ? intervals.burstMax : intervals.slowMax;
+    const uint16_t minInterval = status.minInterval;
+    const uint16_t maxInterval = status.maxInterval;
+    portEXIT_CRITICAL(&lock);
+
+#if TESTER_EXTENDED_ADVERTISING
+    esp_ble_gap_ext_adv_stop(1, &kConnectableInstance);
+    const esp_ble_gap_ext_adv_params_t params = extendedParams(
+        ESP_BLE_GAP_SET_EXT_ADV_PROP_LEGACY_IND, minInterval, maxInterval, kConnectableInstance);
+    esp_ble_gap_ext_adv_set_params(kConnectableInstance, &params);
+    if (activeConnectionCount() < TESTER_MAX_CONNECTIONS) {
+        const esp_ble_gap_ext_adv_t set = {kConnectableInstance, 0, 0};
+        esp_ble_gap_ext_adv_start(1, &set);
+    }
+#else
+    advertising->stop();
+    advertising->setMinInterval(minInterval);
+    advertising->setMaxInterval(maxInterval);
+    if (activeConnectionCount() < TESTER_MAX_CONNECTIONS) {
+        advertising->start();
+    }
+#endif
+}
+
+/**
+ * @brief Ends the fast burst.
+ */
+void onBurstTimer(void* arg) {
+    portENTER_CRITICAL(&lock);
+    status.inBurst = 0;
+    portEXIT_CRITICAL(&lock);
+
+    applyIntervals();
+}
+
+/**
+ * @class AdvertisingCallbacks
+ * @brief Selects the advertising profile and reports the current intervals.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the advertising status before it is read.
+ *
+ * @method onWrite
+ * Selects a profile, and optionally the burst length and state advertising, then restarts
+ * advertising with a burst.
+ */
+class AdvertisingCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        AdvertisingStatus current;
+        portENTER_CRITICAL(&lock);
+        current = status;
+        portEXIT_CRITICAL(&lock);
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&current), sizeof(current));
+    }
+
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if ((length != 1 && length != 3 && length != 4) ||
+            data[0] >= static_cast<uint8_t>(AdvertisingProfile::Count)) {
+            LOG_WARN("Invalid advertising profile command");
+            return;
+        }
+
+        portENTER_CRITICAL(&lock);
+        status.profile = data[0];
+        if (length >= 3) {
+            status.burstSeconds = data[1] | (data[2] << 8);
+        }
+        const bool stateChanged = length == 4 && status.stateAdvertising != (data[3] != 0);
+        if (length == 4) {
+            status.stateAdvertising = data[3] != 0;
+        }
+        portEXIT_CRITICAL(&lock);
+
+        LOG_INFO("Advertising profile %u, %u s burst, state advertising %s",
+                 status.profile, status.burstSeconds, status.stateAdvertising ? "on" : "off");
+        if (stateChanged) {
+            applyPayloads();
+        }
+        startProfileAdvertising(true);
+    }
+};
+
+AdvertisingCallbacks advertisingCallbacks;
+
+} // namespace
+
+void setupAdvertisingProfiles(BLEService* pService, const char* serviceUuid, const char* deviceName) {
+    advertising = BLEDevice::getAdvertising();
+    advertisedServiceUuid = serviceUuid;
+    advertisedName = deviceName;
+
+    status.profile = TESTER_ADVERTISING_PROFILE;
+    status.burstSeconds = ADV_FAST_SECONDS;
+    status.stateAdvertising = TESTER_STATE_ADVERTISING;
+    status.extended = TESTER_EXTENDED_ADVERTISING;
+
+#if TESTER_EXTENDED_ADVERTISING
+    // A set takes its data only once its parameters are known
+    const ProfileIntervals& intervals = kProfiles[status.profile];
+    const esp_ble_gap_ext_adv_params_t connectableParams = extendedParams(
+        ESP_BLE_GAP_SET_EXT_ADV_PROP_LEGACY_IND, intervals.burstMin, intervals.burstMax, kConnectableInstance);
+    esp_ble_gap_ext_adv_set_params(kConnectableInstance, &connectableParams);
+
+    const esp_ble_gap_ext_adv_params_t broadcastParams = extendedParams(
+        ESP_BLE_GAP_SET_EXT_ADV_PROP_NONCONN_NONSCANNABLE_UNDIRECTED, kBroadcastInterval, kBroadcastInterval,
+        kBroadcastInstance);
+    esp_ble_gap_ext_adv_set_params(kBroadcastInstance, &broadcastParams);
+
+    esp_ble_gap_periodic_adv_params_t periodicParams = {};
+    periodicParams.interval_min = kPeriodicInterval;
+    periodicParams.interval_max = kPeriodicInterval;
+    esp_ble_gap_periodic_adv_set_params(kBroadcastInstance, &periodicParams);
+#endif
+    applyPayloads();
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onBurstTimer;
+    timerArgs.name = "adv_burst";
+    esp_timer_create(&timerArgs, &burstTimer);
+
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        ADVERTISING_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pCharacteristic->setCallbacks(&advertisingCallbacks);
+}
+
+void startProfileAdvertising(bool burst) {
+    if (burst) {
+        esp_timer_stop(burstTimer);
+        portENTER_CRITICAL(&lock);
+        status.inBurst = status.burstSeconds > 0;
+        const uint16_t burstSeconds = status.burstSeconds;
+        portEXIT_CRITICAL(&lock);
+        if (burstSeconds > 0) {
+            esp_timer_start_once(burstTimer, (uint64_t)burstSeconds * 1000000);
+        }
+    }
+    applyIntervals();
+}
+
+void setAdvertisedState(const uint8_t* record, size_t recordLength, const uint8_t* report, size_t reportLength) {
+    if (recordLength > ADV_MAX_STATE_RECORD_BYTES || reportLength > ADV_MAX_STATE_REPORT_BYTES) {
+        return;
+    }
+    const uint8_t companyId[kCompanyIdBytes] = {
+        STATE_BROADCAST_COMPANY_ID & 0xFF,
+        STATE_BROADCAST_COMPANY_ID >> 8,
+    };
+
+    portENTER_CRITICAL(&lock);
+    memcpy(stateRecord, companyId, kCompanyIdBytes);
+    memcpy(stateRecord + kCompanyIdBytes, record, recordLength);
+    stateRecordLength = kCompanyIdBytes + recordLength;
+#if TESTER_EXTENDED_ADVERTISING
+    memcpy(stateReport, companyId, kCompanyIdBytes);
+    memcpy(stateReport + kCompanyIdBytes, report, reportLength);
+    stateReportLength = kCompanyIdBytes + reportLength;
+#endif
+    const bool withState = status.stateAdvertising;
+    portEXIT_CRITICAL(&lock);
+
+    if (withState) {
+        applyPayloads();
+    }
+#if TESTER_EXTENDED_ADVERTISING
+    applyBroadcastPayloads();
+#endif
+}
@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief Implementation of the asynchronous logger.
+ */
+
+#include "async_log.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <stdarg.h>
+
+#include "board_traits.h"
+#include "slot_ring.h"
+
+namespace {
+
+/// How often the drain task checks for records it was not woken for, in milliseconds.
+const uint32_t kDrainPollMs = 100;
+
+/**
+ * @brief One queued log message.
+ */
+struct LogRecord {
+    uint32_t timestampMs;
+    uint8_t level;
+    uint8_t length;
+    char text[LOG_RECORD_TEXT_LENGTH];
+};
+
+SlotRing<LogRecord, LOG_QUEUE_RECORDS> queue;
+TaskHandle_t task = nullptr;
+
+std::atomic<uint32_t> dropped(0);
+
+/**
+ * @brief Returns the single-letter tag printed for a level.
+ */
+char levelTag(uint8_t level) {
+    switch (level) {
+        case TESTER_LOG_LEVEL_ERROR: return 'E';
+        case TESTER_LOG_LEVEL_WARN: return 'W';
+        case TESTER_LOG_LEVEL_INFO: return 'I';
+        default: return 'D';
+    }
+}
+
+/**
+ * @brief The FreeRTOS task that prints queued records and reports drops.
+ */
+void drainTask(void* parameter) {
+    LogRecord record;
+    uint32_t reportedDrops = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kDrainPollMs));
+
+        while (queue.pop(record)) {
+            Serial.printf("[%8u %c] ", record.timestampMs, levelTag(record.level));
+            Serial.write(reinterpret_cast<const uint8_t*>(record.text), record.length);
+            Serial.println();
+        }
+
+        const uint32_t drops = dropped;
+        if (drops != reportedDrops) {
+            Serial.printf("[%8u W] Log dropped %u records\n", (uint32_t)millis(), drops - reportedDrops);
+            reportedDrops = drops;
+        }
+    }
+}
+
+} // namespace
+
+void setupAsyncLog() {
+    createAppTask(drainTask, "log_drain", 3072, nullptr, 1, &task);
+}
+
+void logWrite(uint8_t level, const char* format, ...) {
+    LogRecord record;
+    record.timestampMs = millis();
+    record.level = level;
+
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(record.text, sizeof(record.text), format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    record.length = (size_t)length < sizeof(record.text) ? length : sizeof(record.text) - 1;
+
+    if (!queue.push(record)) {
+        dropped++;
+        return;
+    }
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
+    }
+}
+
+uint32_t logDroppedCount() {
+    return dropped;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file
+ * @brief Implementation of the Bluedroid GAP and GATT server event fan-out.
+ */
+
+#include "ble_events.h"
+
+#if !TESTER_USE_NIMBLE
+
+namespace {
+
+gap_event_handler gapHandlers[BLE_EVENTS_MAX_HANDLERS];
+size_t gapHandlerCount = 0;
+
+gatts_event_handler gattsHandlers[BLE_EVENTS_MAX_HANDLERS];
+size_t gattsHandlerCount = 0;
+
+void dispatchGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    for (size_t i = 0; i < gapHandlerCount; i++) {
+        gapHandlers[i](event, param);
+    }
+}
+
+void dispatchGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+    for (size_t i = 0; i < gattsHandlerCount; i++) {
+        gattsHandlers[i](event, gattsIf, param);
+    }
+}
+
+} // namespace
+
+bool addGapEventHandler(gap_event_handler handler) {
+    if (gapHandlerCount >= BLE_EVENTS_MAX_HANDLERS) {
+        return false;
+    }
+    gapHandlers[gapHandlerCount++] = handler;
+    if (gapHandlerCount == 1) {
+        BLEDevice::setCustomGapHandler(dispatchGapEvent);
+    }
+    return true;
+}
+
+bool addGattsEventHandler(gatts_event_handler handler) {
+    if (gattsHandlerCount >= BLE_EVENTS_MAX_HANDLERS) {
+        return false;
+    }
+    gattsHandlers[gattsHandlerCount++] = handler;
+    if (gattsHandlerCount == 1) {
+        BLEDevice::setCustomGattsHandler(dispatchGattsEvent);
+    }
+    return true;
+}
+
+#endif // !TESTER_USE_NIMBLE
@@ -0,0 +1,396 @@
+/**
+ * @file
+ * @brief Implementation of bond management and pairing latency measurement.
+ *
+ * Both stacks persist bonds in NVS on their own once bonding is enabled, so this module only
+ * caps their number, serves the bond list and times each connection. On Bluedroid the
+ * timing comes from GAP events: a security request from the client marks the start of a
+ * new pairing, and authentication complete marks encryption with either new or stored
+ * keys. On NimBLE a connection counts as a reconnect if the client was bonded when it
+ * connected.
+ */
+
+#include "bonding.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <string.h>
+
+#include "async_log.h"
+#include "ble_events.h"
+#include "connection_registry.h"
+
+#if TESTER_USE_NIMBLE
+static_assert(TESTER_MAX_BONDS <= CONFIG_BT_NIMBLE_MAX_BONDS,
+              "TESTER_MAX_BONDS exceeds CONFIG_BT_NIMBLE_MAX_BONDS; raise both");
+#elif defined(CONFIG_BT_SMP_MAX_BONDS)
+static_assert(TESTER_MAX_BONDS <= CONFIG_BT_SMP_MAX_BONDS,
+              "TESTER_MAX_BONDS exceeds the stack's CONFIG_BT_SMP_MAX_BONDS");
+#endif
+
+namespace {
+
+/// The most bond addresses returned by one read of the bonds characteristic. This covers
+/// the stack limit, so bonds left behind by a build with a larger TESTER_MAX_BONDS show up.
+const size_t kMaxListedBonds = 16;
+
+/// The size of a Bluetooth device address.
+const size_t kAddressLength = 6;
+
+/**
+ * @brief The timing state kept for one connection until its link is encrypted.
+ */
+struct ConnectionTiming {
+    bool active;
+    bool encrypted;        ///< The link was encrypted, so later encryption changes are ignored.
+    bool reconnected;      ///< The link was encrypted with the keys of an existing bond.
+    bool bondedAtConnect;  ///< The client was bonded when it connected (NimBLE only).
+    uint16_t connId;
+    int64_t connectedUs;
+    int64_t pairingStartedUs; ///< When the client started pairing, or 0 (Bluedroid only).
+};
+
+/**
+ * @brief The last, shortest and longest of a series of latencies.
+ */
+struct LatencyStats {
+    uint32_t lastUs;
+    uint32_t minUs;
+    uint32_t maxUs;
+
+    void record(uint32_t latencyUs) {
+        lastUs = latencyUs;
+        if (minUs == 0 || latencyUs < minUs) {
+            minUs = latencyUs;
+        }
+        if (latencyUs > maxUs) {
+            maxUs = latencyUs;
+        }
+    }
+};
+
+ConnectionTiming timings[TESTER_MAX_CONNECTIONS];
+
+// The counters of the stats; the latencies are kept apart since packed fields cannot be
+// passed by reference.
+BondingStats stats;
+LatencyStats pairingLatency;
+LatencyStats reconnectLatency;
+
+// Guards timings and stats, which are updated from the BLE task and GAP events.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if !TESTER_USE_NIMBLE
+// The bond list, shared by the read callback and GAP events, which both run on the BTC task.
+esp_ble_bond_dev_t bondList[kMaxListedBonds];
+#endif
+
+/**
+ * @brief Returns the timing state of a connection, or nullptr. Call with the lock held.
+ */
+ConnectionTiming* findTiming(uint16_t connId) {
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (timings[i].active && timings[i].connId == connId) {
+            return &timings[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Copies the addresses of the stored bonds.
+ *
+ * @param addresses Receives up to kMaxListedBonds addresses of kAddressLength bytes.
+ * @return The number of addresses copied.
+ */
+size_t copyBondAddresses(uint8_t* addresses) {
+#if TESTER_USE_NIMBLE
+    size_t count = NimBLEDevice::getNumBonds();
+    if (count > kMaxListedBonds) {
+        count = kMaxListedBonds;
+    }
+    for (size_t i = 0; i < count; i++) {
+        memcpy(addresses + i * kAddressLength, NimBLEDevice::getBondedAddress(i).getNative(), kAddressLength);
+    }
+    return count;
+#else
+    int count = kMaxListedBonds;
+    if (esp_ble_get_bond_device_list(&count, bondList) != ESP_OK) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        memcpy(addresses + i * kAddressLength, bondList[i].bd_addr, kAddressLength);
+    }
+    return count;
+#endif
+}
+
+/**
+ * @brief Removes the bond with an address.
+ *
+ * @return true if the stack accepted the removal.
+ */
+bool removeBond(const uint8_t* address) {
+#if TESTER_USE_NIMBLE
+    const int count = NimBLEDevice::getNumBonds();
+    for (int i = 0; i < count; i++) {
+        const NimBLEAddress bonded = NimBLEDevice::getBondedAddress(i);
+        if (memcmp(bonded.getNative(), address, kAddressLength) == 0) {
+            return NimBLEDevice::deleteBond(bonded);
+        }
+    }
+    return false;
+#else
+    esp_bd_addr_t bdAddress;
+    memcpy(bdAddress, address, kAddressLength);
+    return esp_ble_remove_bond_device(bdAddress) == ESP_OK;
+#endif
+}
+
+/**
+ * @brief Removes every bond.
+ */
+void clearBonds() {
+#if TESTER_USE_NIMBLE
+    NimBLEDevice::deleteAllBonds();
+#else
+    uint8_t addresses[kMaxListedBonds * kAddressLength];
+    const size_t count = copyBondAddresses(addresses);
+    for (size_t i = 0; i < count; i++) {
+        removeBond(addresses + i * kAddressLength);
+    }
+#endif
+}
+
+/**
+ * @brief Removes the oldest bonds until no more than TESTER_MAX_BONDS are stored.
+ *
+ * The stacks list bonds in the order they were created.
+ *
+ * @param newAddress The address of the bond just created, which is never removed.
+ */
+void enforceBondLimit(const uint8_t* newAddress) {
+    uint8_t addresses[kMaxListedBonds * kAddressLength];
+    size_t count = copyBondAddresses(addresses);
+    for (size_t i = 0; i < count && count > TESTER_MAX_BONDS; i++) {
+        const uint8_t* address = addresses + i * kAddressLength;
+        if (memcmp(address, newAddress, kAddressLength) == 0 || !removeBond(address)) {
+            continue;
+        }
+        count--;
+        portENTER_CRITICAL(&lock);
+        stats.evictions++;
+        portEXIT_CRITICAL(&lock);
+        LOG_INFO("Removed the oldest bond to stay within %u bonds", TESTER_MAX_BONDS);
+    }
+}
+
+/**
+ * @brief Marks the start of a new pairing on a connection.
+ */
+void recordPairingStarted(uint16_t connId) {
+    portENTER_CRITICAL(&lock);
+    ConnectionTiming* timing = findTiming(connId);
+    if (timing != nullptr && !timing->encrypted) {
+        timing->pairingStartedUs = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Records the outcome of pairing or encryption on a connection.
+ *
+ * @param connId The connection ID.
+ * @param success true if the link is now encrypted.
+ * @param address The client's address, used to keep a new bond when enforcing the limit.
+ */
+void recordEncryption(uint16_t connId, bool success, const uint8_t* address) {
+    const int64_t now = esp_timer_get_time();
+    bool pairing = false;
+    uint32_t latencyUs = 0;
+
+    portENTER_CRITICAL(&lock);
+    ConnectionTiming* timing = findTiming(connId);
+    if (timing == nullptr || timing->encrypted) {
+        // Not tracked, or a key refresh on a link that is already encrypted
+        portEXIT_CRITICAL(&lock);
+        return;
+    }
+#if TESTER_USE_NIMBLE
+    pairing = !timing->bondedAtConnect;
+#else
+    pairing = timing->pairingStartedUs != 0;
+#endif
+    if (!success) {
+        // The client may try again on the same connection
+        stats.failures++;
+        timing->pairingStartedUs = 0;
+        portEXIT_CRITICAL(&lock);
+        LOG_WARN("Pairing or encryption failed on connection %u", connId);
+        return;
+    }
+    timing->encrypted = true;
+    timing->reconnected = !pairing;
+    const int64_t startedUs = timing->pairingStartedUs != 0 ? timing->pairingStartedUs : timing->connectedUs;
+    latencyUs = now - startedUs;
+    if (pairing) {
+        stats.pairings++;
+        pairingLatency.record(latencyUs);
+    } else {
+        stats.reconnects++;
+        reconnectLatency.record(latencyUs);
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (pairing) {
+        LOG_INFO("Paired on connection %u in %u us", connId, latencyUs);
+        enforceBondLimit(address);
+    } else {
+        LOG_INFO("Bonded client reconnected on connection %u, encrypted after %u us", connId, latencyUs);
+    }
+}
+
+#if !TESTER_USE_NIMBLE
+/**
+ * @brief Times pairing and encryption from Bluedroid's security events.
+ */
+void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    uint16_t connId;
+    if (event == ESP_GAP_BLE_SEC_REQ_EVT) {
+        if (connectionForAddress(param->ble_security.ble_req.bd_addr, &connId)) {
+            recordPairingStarted(connId);
+        }
+    } else if (event == ESP_GAP_BLE_AUTH_CMPL_EVT) {
+        const esp_ble_auth_cmpl_t& result = param->ble_security.auth_cmpl;
+        if (connectionForAddress(result.bd_addr, &connId)) {
+            recordEncryption(connId, result.success, result.bd_addr);
+        }
+    }
+}
+#endif
+
+/**
+ * @class BondsCallbacks
+ * @brief Serves the bond list and the latency statistics, and handles bond commands.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the stats and the address of every bond.
+ *
+ * @method onWrite
+ * Handles the commands documented in bonding.h.
+ */
+class BondsCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        uint8_t buffer[sizeof(BondingStats) + kMaxListedBonds * kAddressLength];
+        const size_t count = copyBondAddresses(buffer + sizeof(BondingStats));
+
+        portENTER_CRITICAL(&lock);
+        BondingStats report = stats;
+        report.lastPairingUs = pairingLatency.lastUs;
+        report.minPairingUs = pairingLatency.minUs;
+        report.maxPairingUs = pairingLatency.maxUs;
+        report.lastReconnectUs = reconnectLatency.lastUs;
+        report.minReconnectUs = reconnectLatency.minUs;
+        report.maxReconnectUs = reconnectLatency.maxUs;
+        portEXIT_CRITICAL(&lock);
+        report.bonds = count;
+        report.maxBonds = TESTER_MAX_BONDS;
+
+        memcpy(buffer, &report, sizeof(report));
+        pCharacteristic->setValue(buffer, sizeof(BondingStats) + count * kAddressLength);
+    }
+
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if (length == 0) {
+            return;
+        }
+
+        if (data[0] == BONDS_OPCODE_RESET_STATS) {
+            portENTER_CRITICAL(&lock);
+            stats = BondingStats();
+            pairingLatency = LatencyStats();
+            reconnectLatency = LatencyStats();
+            portEXIT_CRITICAL(&lock);
+            LOG_INFO("Bonding stats reset");
+        } else if (data[0] == BONDS_OPCODE_CLEAR) {
+            clearBonds();
+            LOG_INFO("All bonds removed");
+        } else if (data[0] == BONDS_OPCODE_REMOVE && length == 1 + kAddressLength) {
+            if (removeBond(data + 1)) {
+                LOG_INFO("Bond removed");
+            } else {
+                LOG_WARN("No bond with that address");
+            }
+        } else {
+            LOG_WARN("Invalid bonds command 0x%02x (%u bytes)", data[0], (unsigned)length);
+        }
+    }
+};
+
+BondsCallbacks bondsCallbacks;
+
+} // namespace
+
+void setupBonding(BLEService* pService) {
+#if !TESTER_USE_NIMBLE
+    addGapEventHandler(handleGapEvent);
+#endif
+
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        BONDS_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite,
+        true
+    );
+    pCharacteristic->setCallbacks(&bondsCallbacks);
+}
+
+void onBondingConnected(uint16_t connId) {
+    bool bonded = false;
+#if TESTER_USE_NIMBLE
+    ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(connId, &desc) == 0) {
+        bonded = NimBLEDevice::isBonded(NimBLEAddress(desc.peer_id_addr));
+    }
+#endif
+
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (!timings[i].active) {
+            timings[i] = ConnectionTiming();
+            timings[i].active = true;
+            timings[i].bondedAtConnect = bonded;
+            timings[i].connId = connId;
+            timings[i].connectedUs = esp_timer_get_time();
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void onBondingDisconnected(uint16_t connId) {
+    portENTER_CRITICAL(&lock);
+    ConnectionTiming* timing = findTiming(connId);
+    if (timing != nullptr) {
+        timing->active = false;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+bool bondingReconnected(uint16_t connId) {
+    portENTER_CRITICAL(&lock);
+    const ConnectionTiming* timing = findTiming(connId);
+    const bool reconnected = timing != nullptr && timing->reconnected;
+    portEXIT_CRITICAL(&lock);
+    return reconnected;
+}
+
+#if TESTER_USE_NIMBLE
+void onBondingAuthenticationComplete(const ble_gap_conn_desc* desc) {
+    recordEncryption(desc->conn_handle, desc->sec_state.encrypted, desc->peer_id_addr.val);
+}
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file
+ * @brief Implementation of the boot timeline.
+ */
+
+#include "boot_timeline.h"
+
+#include <Arduino.h>
+
+#include "connection_registry.h"
+
+namespace {
+
+/// The names printed for each phase, in BootPhase order.
+const char* const kPhaseNames[kBootPhaseCount] = {
+    "setup_entered_us",
+    "led_us",
+    "console_us",
+    "stack_us",
+    "security_us",
+    "gatt_us",
+    "advertising_us",
+    "setup_done_us",
+};
+
+// Written from setup() only. A client reading while the last phases are marked sees
+// either 0 or the final value of each entry.
+uint32_t phaseUs[kBootPhaseCount];
+
+/**
+ * @class BootTimelineCallbacks
+ * @brief Serves the boot timeline over GATT.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the timeline before it is read.
+ */
+class BootTimelineCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        BootTimelineRecord record;
+        record.fastBoot = TESTER_FAST_BOOT;
+        record.phaseCount = kBootPhaseCount;
+        memcpy(record.phaseUs, phaseUs, sizeof(record.phaseUs));
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&record), sizeof(record));
+    }
+};
+
+BootTimelineCallbacks bootTimelineCallbacks;
+
+} // namespace
+
+void markBootPhase(BootPhase phase) {
+    phaseUs[static_cast<size_t>(phase)] = esp_timer_get_time();
+}
+
+void setupBootTimeline(BLEService* pService) {
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        BOOT_TIMELINE_CHARACTERISTIC_UUID,
+        BleProperty::kRead
+    );
+    pCharacteristic->setCallbacks(&bootTimelineCallbacks);
+}
+
+void printBootTimeline() {
+    Serial.printf("Boot timeline: fast_boot=%u", TESTER_FAST_BOOT);
+    for (size_t i = 0; i < kBootPhaseCount; i++) {
+        Serial.printf(" %s=%u", kPhaseNames[i], phaseUs[i]);
+    }
+    Serial.println();
+}
@@ -0,0 +1,497 @@
+/**
+ * @file
+ * @brief Implementation of the per-connection state registry.
+ */
+
+#include "connection_registry.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "advertising_profiles.h"
+#include "async_log.h"
+#include "ble_events.h"
+#include "firmware_stats.h"
+#include "indication_tracker.h"
+#include "trace_recorder.h"
+
+namespace {
+
+/// The ATT MTU every connection starts with until the client exchanges a larger one.
+const uint16_t kDefaultMtu = 23;
+
+/**
+ * @brief The state kept for one connected client.
+ */
+struct PeerConnection {
+    bool active;
+    PeerConnectionRecord record;
+};
+
+BLEServer* server = nullptr;
+
+PeerConnection peers[TESTER_MAX_CONNECTIONS];
+
+BLECharacteristic* trackedCharacteristics[TRACKED_CHARACTERISTICS_MAX];
+size_t trackedCount = 0;
+
+// Guards peers, which is updated from the BLE task and read from the tasks that notify.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if !TESTER_USE_NIMBLE
+// The GATT interface of the server, needed to notify a single connection. Taken from the
+// first GATT event, which arrives long before any client can subscribe.
+std::atomic<esp_gatt_if_t> gattsInterface(ESP_GATT_IF_NONE);
+#endif
+
+/**
+ * @brief Returns the peer with the given connection ID, or nullptr. Call with the lock held.
+ */
+PeerConnection* findPeer(uint16_t connId) {
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (peers[i].active && peers[i].record.connId == connId) {
+            return &peers[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Returns the bit index of a tracked characteristic, or -1.
+ */
+int trackedIndex(const BLECharacteristic* pCharacteristic) {
+    for (size_t i = 0; i < trackedCount; i++) {
+        if (trackedCharacteristics[i] == pCharacteristic) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Notifies or indicates a characteristic's current value to its subscribers and
+ * counts it for each of them. Indications are counted with the notifications.
+ *
+ * @return false if the send was skipped because nobody is subscribed.
+ */
+bool sendToSubscribers(BLECharacteristic* pCharacteristic, bool indication) {
+    const int index = trackedIndex(pCharacteristic);
+    const uint32_t bit = index < 0 ? 0 : 1u << index;
+
+    // Characteristics that are not tracked are assumed to be subscribed on every connection
+    size_t subscribers = 0;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        const uint32_t mask = indication ? peers[i].record.indicateSubscriptions : peers[i].record.notifySubscriptions;
+        if (peers[i].active && (index < 0 || (mask & bit))) {
+            subscribers++;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    if (subscribers == 0 && index >= 0) {
+        statsRecordSkippedNotification();
+        return false;
+    }
+
+    traceRecordNotification(pCharacteristic, indication);
+    if (indication) {
+        recordIndicationSent(pCharacteristic, subscribers);
+        pCharacteristic->indicate();
+    } else {
+        pCharacteristic->notify();
+    }
+
+    if (index >= 0) {
+        portENTER_CRITICAL(&lock);
+        for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+            const uint32_t mask = indication ? peers[i].record.indicateSubscriptions : peers[i].record.notifySubscriptions;
+            if (peers[i].active && (mask & bit)) {
+                peers[i].record.notifications++;
+                statsRecordNotification();
+            }
+        }
+        portEXIT_CRITICAL(&lock);
+    }
+    return true;
+}
+
+/**
+ * @brief Restarts advertising if another client can still connect.
+ *
+ * @param burst true to restart the fast discovery burst of the advertising profile.
+ */
+void restartAdvertisingIfRoom(bool burst) {
+    if (activeConnectionCount() < TESTER_MAX_CONNECTIONS) {
+        startProfileAdvertising(burst);
+    }
+}
+
+#if !TESTER_USE_NIMBLE
+/**
+ * @brief Records CCCD writes per connection.
+ *
+ * Bluedroid keeps a single CCCD value shared by all clients, so the per-connection state
+ * has to be captured from the raw write events.
+ */
+void handleGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+    gattsInterface = gattsIf;
+    if (event != ESP_GATTS_WRITE_EVT || param->write.is_prep || param->write.len == 0) {
+        return;
+    }
+    for (size_t i = 0; i < trackedCount; i++) {
+        BLEDescriptor* pDescriptor = trackedCharacteristics[i]->getDescriptorByUUID(BLEUUID((uint16_t)0x2902));
+        if (pDescriptor != nullptr && pDescriptor->getHandle() == param->write.handle) {
+            uint16_t value = param->write.value[0];
+            if (param->write.len > 1) {
+                value |= param->write.value[1] << 8;
+            }
+            recordSubscription(param->write.conn_id, trackedCharacteristics[i], value);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Records the security level once pairing or encryption completes.
+ */
+void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    if (event != ESP_GAP_BLE_AUTH_CMPL_EVT || !param->ble_security.auth_cmpl.success) {
+        return;
+    }
+    const PeerSecurity security = (param->ble_security.auth_cmpl.auth_mode & ESP_LE_AUTH_REQ_MITM)
+        ? PeerSecurity::Authenticated
+        : PeerSecurity::Encrypted;
+
+    uint16_t connId;
+    if (connectionForAddress(param->ble_security.auth_cmpl.bd_addr, &connId)) {
+        recordConnectionSecurity(connId, security);
+    }
+}
+#endif
+
+/**
+ * @class ConnectionsCallbacks
+ * @brief Serves the connection registry over GATT.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the count and records of all active connections.
+ */
+class ConnectionsCallbacks : public BLECharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        uint8_t buffer[1 + TESTER_MAX_CONNECTIONS * sizeof(PeerConnectionRecord)];
+        PeerConnectionRecord records[TESTER_MAX_CONNECTIONS];
+        const size_t count = connectionRecords(records, TESTER_MAX_CONNECTIONS);
+
+        buffer[0] = count;
+        memcpy(buffer + 1, records, count * sizeof(PeerConnectionRecord));
+        pCharacteristic->setValue(buffer, 1 + count * sizeof(PeerConnectionRecord));
+    }
+};
+
+ConnectionsCallbacks connectionsCallbacks;
+
+} // namespace
+
+void TrackedCharacteristicCallbacks::onWrite(BLECharacteristic* pCharacteristic, BleConnParam* param) {
+    const int64_t startedAt = esp_timer_get_time();
+    const uint16_t connId = bleWriteConnId(param);
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        peer->record.writes++;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    traceRecordWrite(pCharacteristic, connId);
+    onConnectionWrite(pCharacteristic, connId);
+
+    statsRecordWrite(esp_timer_get_time() - startedAt);
+}
+
+void TrackedCharacteristicCallbacks::onStatus(BLECharacteristic* pCharacteristic, Status s, BleStatusCode code) {
+    // Sends skipped because nobody is connected or subscribed are not failures.
+    switch (s) {
+        case SUCCESS_INDICATE:
+            recordIndicationOutcome(pCharacteristic, IndicationOutcome::Confirmed);
+            break;
+        case ERROR_INDICATE_TIMEOUT:
+        case ERROR_INDICATE_FAILURE:
+            recordIndicationOutcome(pCharacteristic, IndicationOutcome::Failed);
+            statsRecordFailedNotification();
+            break;
+        case ERROR_GATT:
+            // A refused send ends an indication in flight, as no confirmation will follow
+            recordIndicationOutcome(pCharacteristic, IndicationOutcome::NotSent);
+            statsRecordFailedNotification();
+            break;
+        case ERROR_INDICATE_DISABLED:
+        case ERROR_NO_CLIENT:
+            recordIndicationOutcome(pCharacteristic, IndicationOutcome::NotSent);
+            break;
+        default:
+            break;
+    }
+}
+
+#if TESTER_USE_NIMBLE
+void TrackedCharacteristicCallbacks::onSubscribe(BLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc, uint16_t subValue) {
+    recordSubscription(desc->conn_handle, pCharacteristic, subValue);
+}
+#endif
+
+void setupConnectionRegistry(BLEServer* pServer, BLEService* pService) {
+    server = pServer;
+
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        CONNECTIONS_CHARACTERISTIC_UUID,
+        BleProperty::kRead
+    );
+    pCharacteristic->setCallbacks(&connectionsCallbacks);
+
+#if !TESTER_USE_NIMBLE
+    addGattsEventHandler(handleGattsEvent);
+    addGapEventHandler(handleGapEvent);
+#endif
+}
+
+int trackSubscriptions(BLECharacteristic* pCharacteristic) {
+    if (trackedCount >= TRACKED_CHARACTERISTICS_MAX) {
+        return -1;
+    }
+    trackedCharacteristics[trackedCount] = pCharacteristic;
+    return trackedCount++;
+}
+
+void registerConnection(uint16_t connId, const uint8_t* address) {
+    bool registered = false;
+
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (!peers[i].active) {
+            PeerConnection& peer = peers[i];
+            memset(&peer.record, 0, sizeof(peer.record));
+            peer.record.connId = connId;
+            memcpy(peer.record.address, address, sizeof(peer.record.address));
+            peer.record.mtu = kDefaultMtu;
+            peer.record.security = static_cast<uint8_t>(PeerSecurity::None);
+            peer.active = true;
+            registered = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (!registered) {
+        // The controller accepted more connections than the tester is configured for.
+        LOG_WARN("Connection limit reached, disconnecting");
+        server->disconnect(connId);
+        return;
+    }
+
+    restartAdvertisingIfRoom(false);
+}
+
+void unregisterConnection(uint16_t connId) {
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        peer->active = false;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    restartAdvertisingIfRoom(true);
+}
+
+void recordConnectionMtu(uint16_t connId, uint16_t mtu) {
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        peer->record.mtu = mtu;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void recordConnectionSecurity(uint16_t connId, PeerSecurity security) {
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        peer->record.security = static_cast<uint8_t>(security);
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+PeerSecurity connectionSecurity(uint16_t connId) {
+    PeerSecurity security = PeerSecurity::None;
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        security = static_cast<PeerSecurity>(peer->record.security);
+    }
+    portEXIT_CRITICAL(&lock);
+    return security;
+}
+
+void recordSubscription(uint16_t connId, BLECharacteristic* pCharacteristic, uint16_t value) {
+    const int index = trackedIndex(pCharacteristic);
+    if (index < 0) {
+        return;
+    }
+    const uint32_t bit = 1u << index;
+
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        peer->record.notifySubscriptions = (value & 0x01)
+            ? peer->record.notifySubscriptions | bit
+            : peer->record.notifySubscriptions & ~bit;
+        peer->record.indicateSubscriptions = (value & 0x02)
+            ? peer->record.indicateSubscriptions | bit
+            : peer->record.indicateSubscriptions & ~bit;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+bool connectionAddress(uint16_t connId, uint8_t* address) {
+    portENTER_CRITICAL(&lock);
+    PeerConnection* peer = findPeer(connId);
+    if (peer != nullptr) {
+        memcpy(address, peer->record.address, sizeof(peer->record.address));
+    }
+    portEXIT_CRITICAL(&lock);
+    return peer != nullptr;
+}
+
+bool connectionForAddress(const uint8_t* address, uint16_t* connId) {
+    bool found = false;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (peers[i].active && memcmp(peers[i].record.address, address, sizeof(peers[i].record.address)) == 0) {
+            *connId = peers[i].record.connId;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return found;
+}
+
+bool connectionActive(uint16_t connId) {
+    portENTER_CRITICAL(&lock);
+    const bool active = findPeer(connId) != nullptr;
+    portEXIT_CRITICAL(&lock);
+    return active;
+}
+
+size_t activeConnectionCount() {
+    size_t count = 0;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (peers[i].active) {
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return count;
+}
+
+size_t connectionRecords(PeerConnectionRecord* records, size_t capacity) {
+    size_t count = 0;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS && count < capacity; i++) {
+        if (peers[i].active) {
+            records[count++] = peers[i].record;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return count;
+}
+
+bool hasSubscribers(const BLECharacteristic* pCharacteristic) {
+    const int index = trackedIndex(pCharacteristic);
+    if (index < 0) {
+        return true;
+    }
+    const uint32_t bit = 1u << index;
+
+    bool subscribed = false;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (peers[i].active && ((peers[i].record.notifySubscriptions | peers[i].record.indicateSubscriptions) & bit)) {
+            subscribed = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return subscribed;
+}
+
+bool hasIndicationSubscribers(const BLECharacteristic* pCharacteristic) {
+    const int index = trackedIndex(pCharacteristic);
+    if (index < 0) {
+        return true;
+    }
+    const uint32_t bit = 1u << index;
+
+    bool subscribed = false;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (peers[i].active && (peers[i].record.indicateSubscriptions & bit)) {
+            subscribed = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return subscribed;
+}
+
+bool indicateCharacteristic(BLECharacteristic* pCharacteristic) {
+    return sendToSubscribers(pCharacteristic, true);
+}
+
+bool notifyCharacteristic(BLECharacteristic* pCharacteristic) {
+    return sendToSubscribers(pCharacteristic, false);
+}
+
+ConnectionNotifyResult notifyConnection(BLECharacteristic* pCharacteristic, uint16_t connId) {
+    const int index = trackedIndex(pCharacteristic);
+    const uint32_t bit = index < 0 ? 0 : 1u << index;
+
+    portENTER_CRITICAL(&lock);
+    const PeerConnection* peer = findPeer(connId);
+    const bool subscribed = peer != nullptr && (index < 0 || (peer->record.notifySubscriptions & bit));
+    portEXIT_CRITICAL(&lock);
+    if (!subscribed) {
+        statsRecordSkippedNotification();
+        return ConnectionNotifyResult::NotSubscribed;
+    }
+
+    traceRecordNotification(pCharacteristic, false);
+    const BleValue value(pCharacteristic);
+#if TESTER_USE_NIMBLE
+    // The stack reports a refused notification to onStatus(), which counts it as failed
+    os_mbuf* om = ble_hs_mbuf_from_flat(value.data(), value.length());
+    if (om == nullptr) {
+        statsRecordFailedNotification();
+        return ConnectionNotifyResult::Failed;
+    }
+    if (ble_gattc_notify_custom(connId, pCharacteristic->getHandle(), om) != 0) {
+        return ConnectionNotifyResult::Failed;
+    }
+#else
+    if (esp_ble_gatts_send_indicate(gattsInterface, connId, pCharacteristic->getHandle(), value.length(),
+                                    const_cast<uint8_t*>(value.data()), false) != ESP_OK) {
+        statsRecordFailedNotification();
+        return ConnectionNotifyResult::Failed;
+    }
+#endif
+
+    portENTER_CRITICAL(&lock);
+    PeerConnection* sentTo = findPeer(connId);
+    if (sentTo != nullptr) {
+        sentTo->record.notifications++;
+    }
+    portEXIT_CRITICAL(&lock);
+    statsRecordNotification();
+    return ConnectionNotifyResult::Sent;
+}
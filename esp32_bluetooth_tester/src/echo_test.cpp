@@ -0,0 +1,113 @@
+/**
+ * @file
+ * @brief Implementation of the round-trip latency echo test.
+ */
+
+#include "echo_test.h"
+
+#include <Arduino.h>
+
+#include "async_log.h"
+#include "connection_registry.h"
+#include "latency_histogram.h"
+
+namespace {
+
+/// The largest value an attribute can hold, per the Bluetooth Core Specification.
+const size_t kMaxAttributeLength = 512;
+
+/// The number of bytes the two timestamps add to the echoed payload.
+const size_t kTimestampLength = 2 * sizeof(uint64_t);
+
+LatencyHistogram histogram;
+
+// Only touched from the BLE task, which serializes write callbacks.
+uint8_t reply[kMaxAttributeLength];
+
+/**
+ * @brief Writes a uint64 value into a buffer in little-endian order.
+ */
+void putUint64(uint8_t* buffer, uint64_t value) {
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        buffer[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+/**
+ * @class EchoCallbacks
+ * @brief Echoes every write back to the client as a notification with timestamps.
+ *
+ * @method onWrite
+ * Copies the written payload into the reply buffer, appends the receive and send
+ * timestamps, notifies the client and records the turnaround in the histogram.
+ * Nothing in this path logs or allocates so the measurement reflects the BLE stack only.
+ */
+class EchoCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const int64_t receivedAt = esp_timer_get_time();
+
+        const BleValue value(pCharacteristic);
+        size_t length = value.length();
+        if (length > kMaxAttributeLength - kTimestampLength) {
+            length = kMaxAttributeLength - kTimestampLength;
+        }
+        memcpy(reply, value.data(), length);
+        putUint64(reply + length, receivedAt);
+
+        const int64_t sentAt = esp_timer_get_time();
+        putUint64(reply + length + sizeof(uint64_t), sentAt);
+        pCharacteristic->setValue(reply, length + kTimestampLength);
+        notifyCharacteristic(pCharacteristic);
+
+        histogram.record(esp_timer_get_time() - receivedAt);
+    }
+};
+
+EchoCallbacks echoCallbacks;
+
+/**
+ * @class HistogramCallbacks
+ * @brief Serves the latency histogram over GATT.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with a snapshot of the histogram before it is read.
+ *
+ * @method onWrite
+ * Resets the histogram, regardless of the value written.
+ */
+class HistogramCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        LatencyHistogramSnapshot snapshot;
+        histogram.snapshot(snapshot);
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&snapshot), sizeof(snapshot));
+    }
+
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        histogram.reset();
+        LOG_INFO("Echo latency histogram reset");
+    }
+};
+
+HistogramCallbacks histogramCallbacks;
+
+} // namespace
+
+void setupEchoTest(BLEService* pService) {
+    BLECharacteristic* pEchoCharacteristic = createBleCharacteristic(
+        pService,
+        ECHO_CHARACTERISTIC_UUID,
+        BleProperty::kWrite |
+        BleProperty::kWriteNoResponse |
+        BleProperty::kNotify
+    );
+    pEchoCharacteristic->setCallbacks(&echoCallbacks);
+    trackSubscriptions(pEchoCharacteristic);
+
+    BLECharacteristic* pHistogramCharacteristic = createBleCharacteristic(
+        pService,
+        ECHO_HISTOGRAM_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pHistogramCharacteristic->setCallbacks(&histogramCallbacks);
+}
@@ -0,0 +1,198 @@
+/**
+ * @file
+ * @brief Implementation of the firmware-wide counters.
+ */
+
+#include "firmware_stats.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+#include "soak_monitor.h"
+
+namespace {
+
+BLECharacteristic* characteristic = nullptr;
+TaskHandle_t task = nullptr;
+
+std::atomic<uint32_t> writes(0);
+std::atomic<uint32_t> notifications(0);
+std::atomic<uint32_t> failedNotifications(0);
+std::atomic<uint32_t> skippedNotifications(0);
+std::atomic<uint32_t> coalescedNotifications(0);
+std::atomic<uint32_t> connects(0);
+std::atomic<uint32_t> disconnects(0);
+
+// 64-bit atomics are not lock-free on the ESP32-C3, so the total is kept under the lock.
+uint64_t writeTotalUs = 0;
+std::atomic<uint32_t> writeMinUs(UINT32_MAX);
+std::atomic<uint32_t> writeMaxUs(0);
+
+// Guards writeTotalUs and keeps it in step with writes.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Only touched from the stats task.
+uint32_t nextHeapReport = TESTER_HEAP_REPORT_WRITES;
+
+// The task BLE callbacks run on: BTC_TASK on Bluedroid, nimble_host on NimBLE.
+std::atomic<TaskHandle_t> bleTask(nullptr);
+
+/**
+ * @brief Prints a heap report at every write milestone and publishes a fresh snapshot to
+ * subscribed clients.
+ */
+void publishStats() {
+    const uint32_t total = writes;
+    if (total >= nextHeapReport) {
+        printHeapReport();
+        nextHeapReport = (total / TESTER_HEAP_REPORT_WRITES + 1) * TESTER_HEAP_REPORT_WRITES;
+    }
+
+    if (activeConnectionCount() == 0) {
+        return;
+    }
+    FirmwareStats stats;
+    firmwareStatsSnapshot(stats);
+    characteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    notifyCharacteristic(characteristic);
+}
+
+/**
+ * @brief The FreeRTOS task that publishes the stats every FIRMWARE_STATS_NOTIFY_MS.
+ *
+ * This runs as an application task rather than an esp_timer callback so that on dual-core
+ * chips it stays off the core the BLE host and the esp_timer task run on.
+ */
+void statsTask(void* parameter) {
+    TickType_t lastWake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(FIRMWARE_STATS_NOTIFY_MS));
+        publishStats();
+    }
+}
+
+/**
+ * @class StatsCallbacks
+ * @brief Serves the firmware stats over GATT.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with a snapshot before it is read.
+ */
+class StatsCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        FirmwareStats stats;
+        firmwareStatsSnapshot(stats);
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+StatsCallbacks statsCallbacks;
+
+} // namespace
+
+void setupFirmwareStats(BLEService* pService) {
+    characteristic = createBleCharacteristic(
+        pService,
+        FIRMWARE_STATS_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kNotify
+    );
+    characteristic->setCallbacks(&statsCallbacks);
+    trackSubscriptions(characteristic);
+
+    createAppTask(statsTask, "stats", 3072, nullptr, 1, &task);
+}
+
+void statsRecordWrite(uint32_t durationUs) {
+    portENTER_CRITICAL(&lock);
+    writes++;
+    writeTotalUs += durationUs;
+    portEXIT_CRITICAL(&lock);
+    soakRecordCallback(durationUs);
+
+    uint32_t currentMin = writeMinUs;
+    while (durationUs < currentMin && !writeMinUs.compare_exchange_weak(currentMin, durationUs)) {
+    }
+    uint32_t currentMax = writeMaxUs;
+    while (durationUs > currentMax && !writeMaxUs.compare_exchange_weak(currentMax, durationUs)) {
+    }
+}
+
+void statsRecordNotification() {
+    notifications++;
+}
+
+void statsRecordSkippedNotification() {
+    skippedNotifications++;
+}
+
+void statsRecordCoalescedNotification() {
+    coalescedNotifications++;
+}
+
+void statsRecordFailedNotification() {
+    failedNotifications++;
+}
+
+void statsRecordConnect() {
+    connects++;
+    bleTask = xTaskGetCurrentTaskHandle();
+}
+
+void statsRecordDisconnect() {
+    disconnects++;
+}
+
+void printHeapReport() {
+    Serial.printf("Heap report: writes=%u free_heap=%u min_free_heap=%u largest_free_block=%u\n",
+                  writes.load(),
+                  ESP.getFreeHeap(),
+                  ESP.getMinFreeHeap(),
+                  (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+void firmwareStatsSnapshot(FirmwareStats& stats) {
+    stats.version = FIRMWARE_STATS_VERSION;
+    stats.uptimeMs = esp_timer_get_time() / 1000;
+    portENTER_CRITICAL(&lock);
+    stats.writes = writes;
+    const uint64_t totalUs = writeTotalUs;
+    portEXIT_CRITICAL(&lock);
+    stats.notifications = notifications;
+    stats.failedNotifications = failedNotifications;
+    stats.connects = connects;
+    stats.disconnects = disconnects;
+    stats.writeMinUs = stats.writes > 0 ? writeMinUs.load() : 0;
+    stats.writeAvgUs = stats.writes > 0 ? totalUs / stats.writes : 0;
+    stats.writeMaxUs = writeMaxUs;
+    stats.freeHeap = ESP.getFreeHeap();
+    stats.minFreeHeap = ESP.getMinFreeHeap();
+    stats.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    // ESP-IDF reports the high-water mark in bytes, as its stack type is one byte wide.
+    const TaskHandle_t task = bleTask;
+    stats.bleStackHighWater = task != nullptr ? uxTaskGetStackHighWaterMark(task) : 0;
+    stats.logDropped = logDroppedCount();
+    stats.skippedNotifications = skippedNotifications;
+    stats.coalescedNotifications = coalescedNotifications;
+}
+
+void resetFirmwareStats() {
+    portENTER_CRITICAL(&lock);
+    writes = 0;
+    writeTotalUs = 0;
+    portEXIT_CRITICAL(&lock);
+    writeMinUs = UINT32_MAX;
+    writeMaxUs = 0;
+    notifications = 0;
+    failedNotifications = 0;
+    skippedNotifications = 0;
+    coalescedNotifications = 0;
+    connects = 0;
+    disconnects = 0;
+}
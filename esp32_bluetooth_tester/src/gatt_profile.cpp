@@ -0,0 +1,194 @@
+/**
+ * @file
+ * @brief Implementation of the generated GATT profile.
+ */
+
+#include "gatt_profile.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "async_log.h"
+#include "connection_registry.h"
+#include "traffic_generator.h"
+
+#if !TESTER_USE_NIMBLE && defined(CONFIG_BT_GATT_MAX_SR_PROFILES)
+// The tester, OTA and traffic services and the stack's own GAP and GATT services take five
+// of Bluedroid's service slots
+static_assert(kGattProfileServices + 5 <= CONFIG_BT_GATT_MAX_SR_PROFILES,
+              "The GATT profile preset has more services than CONFIG_BT_GATT_MAX_SR_PROFILES allows; "
+              "pick a smaller preset or build on NimBLE");
+#endif
+
+#if !TESTER_USE_NIMBLE
+// The tester's own services have 12 characteristics that notify or indicate, plus the
+// traffic channels, and each takes a CCCD from the pool in ble_backend.h
+static_assert(12 + TRAFFIC_CHANNELS + kGattProfileCccds <= TESTER_CCCD_POOL_SIZE,
+              "The GATT profile preset needs more CCCDs than TESTER_CCCD_POOL_SIZE holds; "
+              "raise TESTER_CCCD_POOL_SIZE or pick a smaller preset");
+#endif
+
+namespace {
+
+/// The largest value a generated characteristic can have, the longest attribute value.
+const uint16_t kMaxValueSize = 512;
+
+/// The length of a generated UUID, with the terminator.
+const size_t kUuidLength = 37;
+
+// The periodic characteristics and their value sizes, in the order they were generated.
+BLECharacteristic* periodicCharacteristics[kGattProfilePeriodic > 0 ? kGattProfilePeriodic : 1];
+uint16_t periodicSizes[kGattProfilePeriodic > 0 ? kGattProfilePeriodic : 1];
+size_t periodicCount = 0;
+
+// Notifying characteristics that did not get a tracking slot.
+size_t untrackedCount = 0;
+
+// Zero-filled initial values. The periodic notifications put the counter in front.
+uint8_t valueBuffer[kMaxValueSize];
+uint8_t periodicValue[kMaxValueSize];
+
+esp_timer_handle_t notifyTimer = nullptr;
+uint32_t notifyCounter = 0;
+
+GattProfileInfo info;
+
+/**
+ * @brief Formats the UUID of a generated service or characteristic.
+ *
+ * @param uuid Receives the UUID, at least kUuidLength bytes.
+ * @param service The index of the service.
+ * @param characteristic The characteristic number within the service, or 0 for the service.
+ */
+void formatUuid(char* uuid, uint32_t service, uint32_t characteristic) {
+    snprintf(uuid, kUuidLength, GATT_PROFILE_UUID_PREFIX "%04x0000%04x",
+             (unsigned)service, (unsigned)characteristic);
+}
+
+/**
+ * @brief Notifies the counter from every periodic characteristic.
+ */
+void onNotifyTimer(void* arg) {
+    notifyCounter++;
+    memcpy(periodicValue, &notifyCounter, sizeof(notifyCounter));
+    for (size_t i = 0; i < periodicCount; i++) {
+        periodicCharacteristics[i]->setValue(periodicValue, periodicSizes[i]);
+        notifyCharacteristic(periodicCharacteristics[i]);
+    }
+}
+
+/**
+ * @class EchoCallbacks
+ * @brief Notifies every value written to an OnWrite characteristic.
+ */
+class EchoCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        notifyCharacteristic(pCharacteristic);
+    }
+};
+
+/**
+ * @class InfoCallbacks
+ * @brief Serves the profile info.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the profile info before it is read.
+ */
+class InfoCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&info), sizeof(info));
+    }
+};
+
+// Characteristics that do not notify on write still count their writes for the stats
+TrackedCharacteristicCallbacks plainCallbacks;
+EchoCallbacks echoCallbacks;
+InfoCallbacks infoCallbacks;
+
+/**
+ * @brief Creates the characteristics of one run in a service.
+ *
+ * @param pService The service the characteristics are added to.
+ * @param service The index of the service.
+ * @param number The number of the first characteristic, advanced past the run.
+ */
+void createCharacteristics(BLEService* pService, uint32_t service, uint32_t& number,
+                           const GattCharacteristicSpec& spec) {
+    const uint16_t valueSize = spec.valueSize > kMaxValueSize ? kMaxValueSize : spec.valueSize;
+    char uuid[kUuidLength];
+    for (uint8_t i = 0; i < spec.count; i++) {
+        formatUuid(uuid, service, ++number);
+        BLECharacteristic* pCharacteristic = createBleCharacteristic(pService, uuid, spec.properties, spec.encrypted);
+        pCharacteristic->setValue(valueBuffer, valueSize);
+        pCharacteristic->setCallbacks(spec.notify == GattNotifyMode::OnWrite ? &echoCallbacks : &plainCallbacks);
+        if (gatt_profile::hasCccd(spec) && trackSubscriptions(pCharacteristic) < 0) {
+            untrackedCount++;
+        }
+        if (spec.notify == GattNotifyMode::Periodic && periodicCount < kGattProfilePeriodic) {
+            periodicCharacteristics[periodicCount] = pCharacteristic;
+            periodicSizes[periodicCount++] = valueSize;
+        }
+    }
+}
+
+/**
+ * @brief Generates and starts the services of the selected preset.
+ */
+void createServices(BLEServer* pServer) {
+    uint32_t service = 0;
+    char uuid[kUuidLength];
+    for (uint8_t s = 0; s < kGattProfile.serviceSpecs; s++) {
+        const GattServiceSpec& spec = kGattProfile.services[s];
+        for (uint8_t copy = 0; copy < spec.count; copy++, service++) {
+            formatUuid(uuid, service, 0);
+            BLEService* pService = createBleService(pServer, uuid, gatt_profile::serviceHandles(spec));
+            uint32_t number = 0;
+            for (uint8_t c = 0; c < spec.characteristicSpecs; c++) {
+                createCharacteristics(pService, service, number, spec.characteristics[c]);
+            }
+            pService->start();
+        }
+    }
+}
+
+} // namespace
+
+void setupGattProfile(BLEService* pService) {
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        GATT_PROFILE_CHARACTERISTIC_UUID,
+        BleProperty::kRead
+    );
+    pCharacteristic->setCallbacks(&infoCallbacks);
+
+    info.preset = TESTER_GATT_PROFILE;
+    info.services = kGattProfileServices;
+    info.characteristics = kGattProfileCharacteristics;
+    info.handles = kGattProfileHandles;
+}
+
+void startGattProfile(BLEServer* pServer) {
+    if (kGattProfileServices == 0) {
+        return;
+    }
+
+    const int64_t started = esp_timer_get_time();
+    createServices(pServer);
+    info.setupMs = (esp_timer_get_time() - started) / 1000;
+    LOG_INFO("GATT profile %s: %u services, %u characteristics, %u handles in %u ms",
+             kGattProfile.name, info.services, info.characteristics, info.handles, info.setupMs);
+    if (untrackedCount > 0) {
+        LOG_WARN("GATT profile: %u notifying characteristics are not tracked and are left out of the notification stats",
+                 (unsigned)untrackedCount);
+    }
+
+    if (periodicCount > 0) {
+        esp_timer_create_args_t timerArgs = {};
+        timerArgs.callback = onNotifyTimer;
+        timerArgs.name = "gatt_notify";
+        esp_timer_create(&timerArgs, &notifyTimer);
+        esp_timer_start_periodic(notifyTimer, (uint64_t)GATT_PROFILE_NOTIFY_MS * 1000);
+    }
+}
@@ -0,0 +1,290 @@
+/**
+ * @file
+ * @brief Implementation of indication delivery and confirmation-latency tracking.
+ *
+ * Confirmations are reported from the BLE stack's task on NimBLE, and from within
+ * indicate() on Bluedroid, which blocks its caller until the confirmation arrives. Either
+ * way the indication task only moves on once the tracker has seen every connection's
+ * outcome, or after kConfirmationTimeoutMs.
+ */
+
+#include "indication_tracker.h"
+
+#include <Arduino.h>
+#include <freertos/semphr.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+
+namespace {
+
+/// How long the indication task waits for the confirmations. A little longer than the ATT
+/// transaction timeout, after which the stack reports the failure itself.
+const uint32_t kConfirmationTimeoutMs = 35000;
+
+/**
+ * @brief The timing and delivery state of one characteristic.
+ */
+struct TrackedIndication {
+    BLECharacteristic* characteristic;
+    int64_t sentUs;      ///< When the indication in flight was sent.
+    size_t outstanding;  ///< Connections that have not yet reported an outcome.
+    bool pending;        ///< A change waits for the indication task.
+    bool awaited;        ///< The indication task waits for this characteristic's outcome.
+};
+
+TrackedIndication entries[INDICATION_TRACKED_MAX];
+size_t entryCount = 0;
+size_t nextEntry = 0;
+
+// True while the indication task is sending or waiting for a confirmation.
+bool inFlight = false;
+
+// Guards the entries and inFlight, which are updated from the BLE stack and the indication task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+TaskHandle_t task = nullptr;
+SemaphoreHandle_t finished = nullptr;
+StaticSemaphore_t finishedBuffer;
+
+// Held by whichever task has an indication in flight, so senders never overlap.
+SemaphoreHandle_t slot = nullptr;
+StaticSemaphore_t slotBuffer;
+
+std::atomic<bool> pipelining(INDICATION_PIPELINING != 0);
+
+LatencyHistogram latency;
+std::atomic<uint32_t> sent(0);
+std::atomic<uint32_t> confirmed(0);
+std::atomic<uint32_t> failed(0);
+std::atomic<uint32_t> notSent(0);
+std::atomic<uint32_t> busy(0);
+std::atomic<uint32_t> superseded(0);
+
+/**
+ * @brief Returns the entry of a characteristic, adding one if there is room. Call with the
+ * lock held.
+ */
+TrackedIndication* findEntry(BLECharacteristic* pCharacteristic, bool add) {
+    for (size_t i = 0; i < entryCount; i++) {
+        if (entries[i].characteristic == pCharacteristic) {
+            return &entries[i];
+        }
+    }
+    if (!add || entryCount >= INDICATION_TRACKED_MAX) {
+        return nullptr;
+    }
+    TrackedIndication* entry = &entries[entryCount++];
+    entry->characteristic = pCharacteristic;
+    entry->sentUs = 0;
+    entry->outstanding = 0;
+    entry->pending = false;
+    entry->awaited = false;
+    return entry;
+}
+
+/**
+ * @brief Takes the next pending characteristic in turn, and marks it awaited. Clears
+ * inFlight if there is none. Call with the lock held.
+ */
+TrackedIndication* takePending() {
+    for (size_t n = 0; n < entryCount; n++) {
+        TrackedIndication* entry = &entries[(nextEntry + n) % entryCount];
+        if (entry->pending) {
+            nextEntry = (entry - entries + 1) % entryCount;
+            entry->pending = false;
+            entry->awaited = true;
+            return entry;
+        }
+    }
+    inFlight = false;
+    return nullptr;
+}
+
+/**
+ * @brief The FreeRTOS task that sends the pending changes, one indication at a time.
+ */
+void indicationTask(void* parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (;;) {
+            portENTER_CRITICAL(&lock);
+            TrackedIndication* entry = takePending();
+            portEXIT_CRITICAL(&lock);
+            if (entry == nullptr) {
+                break;
+            }
+
+            xSemaphoreTake(slot, portMAX_DELAY);
+            xSemaphoreTake(finished, 0);
+            if (indicateCharacteristic(entry->characteristic) &&
+                xSemaphoreTake(finished, pdMS_TO_TICKS(kConfirmationTimeoutMs)) != pdTRUE) {
+                LOG_WARN("Indication still unconfirmed after %u ms", kConfirmationTimeoutMs);
+            }
+            xSemaphoreGive(slot);
+
+            portENTER_CRITICAL(&lock);
+            entry->awaited = false;
+            portEXIT_CRITICAL(&lock);
+        }
+    }
+}
+
+void resetStats() {
+    latency.reset();
+    sent = 0;
+    confirmed = 0;
+    failed = 0;
+    notSent = 0;
+    busy = 0;
+    superseded = 0;
+}
+
+/**
+ * @class StatsCallbacks
+ * @brief Handles the indication stats characteristic.
+ *
+ * @method onWrite
+ * Resets the stats, and switches pipelining on or off.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the counters and the latency histogram.
+ */
+class StatsCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if (length == 1 && data[0] == INDICATION_OPCODE_RESET) {
+            resetStats();
+        }
+        else if (length == 2 && data[0] == INDICATION_OPCODE_PIPELINING) {
+            pipelining = data[1] != 0;
+            resetStats();
+            LOG_INFO("Indication pipelining %s", pipelining ? "on" : "off");
+        }
+        else {
+            LOG_WARN("Received unexpected indication command of %u bytes", (unsigned)length);
+        }
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        IndicationStats stats;
+        stats.pipelining = pipelining;
+        stats.sent = sent;
+        stats.confirmed = confirmed;
+        stats.failed = failed;
+        stats.notSent = notSent;
+        stats.busy = busy;
+        stats.superseded = superseded;
+        latency.snapshot(stats.latency);
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+StatsCallbacks statsCallbacks;
+
+} // namespace
+
+void setupIndicationTracker(BLEService* pService) {
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        INDICATION_STATS_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pCharacteristic->setCallbacks(&statsCallbacks);
+
+    finished = xSemaphoreCreateBinaryStatic(&finishedBuffer);
+    slot = xSemaphoreCreateMutexStatic(&slotBuffer);
+    createAppTask(indicationTask, "indications", 4096, nullptr, 1, &task);
+}
+
+void indicateLatest(BLECharacteristic* pCharacteristic) {
+    if (!hasIndicationSubscribers(pCharacteristic)) {
+        return;
+    }
+
+    bool wake = false;
+    portENTER_CRITICAL(&lock);
+    TrackedIndication* entry = findEntry(pCharacteristic, true);
+    if (entry == nullptr) {
+        // Too many characteristics: fall back to the busy count rather than blocking
+        busy++;
+    }
+    else if (!inFlight) {
+        entry->pending = true;
+        inFlight = true;
+        wake = true;
+    }
+    else if (pipelining) {
+        if (entry->pending) {
+            superseded++;
+        }
+        entry->pending = true;
+    }
+    else {
+        busy++;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (wake) {
+        xTaskNotifyGive(task);
+    }
+}
+
+bool takeIndicationSlot(uint32_t timeoutMs) {
+    return xSemaphoreTake(slot, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+}
+
+void giveIndicationSlot() {
+    xSemaphoreGive(slot);
+}
+
+void recordIndicationSent(BLECharacteristic* pCharacteristic, size_t connections) {
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    TrackedIndication* entry = findEntry(pCharacteristic, true);
+    if (entry != nullptr) {
+        entry->sentUs = now;
+        entry->outstanding = connections;
+    }
+    portEXIT_CRITICAL(&lock);
+    sent += connections;
+}
+
+void recordIndicationOutcome(BLECharacteristic* pCharacteristic, IndicationOutcome outcome) {
+    const int64_t now = esp_timer_get_time();
+    int64_t sentUs = 0;
+    bool done = false;
+
+    portENTER_CRITICAL(&lock);
+    TrackedIndication* entry = findEntry(pCharacteristic, false);
+    if (entry == nullptr || entry->outstanding == 0) {
+        portEXIT_CRITICAL(&lock);
+        return;
+    }
+    sentUs = entry->sentUs;
+    // A send the stack did not make reaches no connection, so it ends the indication
+    entry->outstanding = outcome == IndicationOutcome::NotSent ? 0 : entry->outstanding - 1;
+    done = entry->outstanding == 0 && entry->awaited;
+    portEXIT_CRITICAL(&lock);
+
+    switch (outcome) {
+        case IndicationOutcome::Confirmed:
+            confirmed++;
+            latency.record(now - sentUs);
+            break;
+        case IndicationOutcome::Failed:
+            failed++;
+            break;
+        case IndicationOutcome::NotSent:
+            notSent++;
+            break;
+    }
+    if (done) {
+        xSemaphoreGive(finished);
+    }
+}
@@ -0,0 +1,389 @@
+/**
+ * @file
+ * @brief Implementation of the L2CAP connection-oriented channel server.
+ *
+ * NimBLE-Arduino 1.4 has no wrapper for L2CAP channels, so the server uses the NimBLE host
+ * API directly. Channel events, including received SDUs, arrive on the NimBLE host task,
+ * which handles sink and echo itself. Source mode runs on a dedicated FreeRTOS task so that
+ * waiting for credits never blocks the host; the host wakes it through a semaphore when the
+ * client grants more credits.
+ */
+
+#include "l2cap_coc.h"
+
+#include <Arduino.h>
+#include <string.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+
+#if L2CAP_COC_SUPPORTED
+#include <freertos/semphr.h>
+#endif
+
+static_assert(L2CAP_COC_PSM >= 0x80 && L2CAP_COC_PSM <= 0xFF, "L2CAP_COC_PSM must be a dynamic LE PSM");
+static_assert(L2CAP_COC_MTU >= 23 && L2CAP_COC_MTU <= 65535, "L2CAP_COC_MTU must be between 23 and 65535");
+static_assert(L2CAP_COC_DEFAULT_MODE >= 0 && L2CAP_COC_DEFAULT_MODE < static_cast<int>(L2capMode::Count),
+              "L2CAP_COC_DEFAULT_MODE must name an L2capMode");
+
+namespace {
+
+const char* const kModeNames[] = {"sink", "source", "echo"};
+
+BLECharacteristic* characteristic = nullptr;
+
+std::atomic<uint8_t> mode(L2CAP_COC_DEFAULT_MODE);
+std::atomic<uint16_t> sourceSeconds(L2CAP_COC_SOURCE_SECONDS);
+std::atomic<bool> connected(false);
+std::atomic<uint16_t> peerMtu(0);
+
+std::atomic<uint32_t> rxSdus(0);
+std::atomic<uint32_t> rxBytes(0);
+std::atomic<uint32_t> txSdus(0);
+std::atomic<uint32_t> txBytes(0);
+std::atomic<uint32_t> stalls(0);
+std::atomic<uint32_t> dropped(0);
+
+// Guards the measurement window, which is read by the BLE task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+int64_t startedUs = 0;
+int64_t endedUs = 0;
+
+/**
+ * @brief Zeroes the counters and starts a new measurement window.
+ */
+void resetCounters() {
+    rxSdus = 0;
+    rxBytes = 0;
+    txSdus = 0;
+    txBytes = 0;
+    stalls = 0;
+    dropped = 0;
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    startedUs = now;
+    endedUs = 0;
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Ends the measurement window.
+ */
+void endWindow() {
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    if (endedUs == 0) {
+        endedUs = now;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+void snapshotStats(L2capStats& stats) {
+    portENTER_CRITICAL(&lock);
+    const int64_t started = startedUs;
+    const int64_t ended = endedUs;
+    portEXIT_CRITICAL(&lock);
+
+    stats.supported = L2CAP_COC_SUPPORTED;
+    stats.mode = mode;
+    stats.connected = connected;
+    stats.psm = L2CAP_COC_PSM;
+    stats.localMtu = L2CAP_COC_MTU;
+    stats.peerMtu = peerMtu;
+    stats.rxSdus = rxSdus;
+    stats.rxBytes = rxBytes;
+    stats.txSdus = txSdus;
+    stats.txBytes = txBytes;
+    stats.stalls = stalls;
+    stats.dropped = dropped;
+
+    const int64_t elapsedUs = started != 0 ? (ended != 0 ? ended : esp_timer_get_time()) - started : 0;
+    stats.elapsedMs = elapsedUs / 1000;
+    stats.rxBytesPerSecond = elapsedUs > 0 ? (uint32_t)((uint64_t)stats.rxBytes * 1000000 / elapsedUs) : 0;
+    stats.txBytesPerSecond = elapsedUs > 0 ? (uint32_t)((uint64_t)stats.txBytes * 1000000 / elapsedUs) : 0;
+}
+
+/**
+ * @brief Logs the stats in the same shape as the throughput test summary and notifies them.
+ */
+void publishStats() {
+    L2capStats stats;
+    snapshotStats(stats);
+    LOG_INFO("L2CAP DONE mode=%s rx_sdus=%u rx_bytes=%u rx_bps=%u tx_sdus=%u tx_bytes=%u tx_bps=%u ms=%u stalls=%u dropped=%u mtu=%u",
+             kModeNames[stats.mode], stats.rxSdus, stats.rxBytes, stats.rxBytesPerSecond, stats.txSdus,
+             stats.txBytes, stats.txBytesPerSecond, stats.elapsedMs, stats.stalls, stats.dropped, stats.peerMtu);
+
+    characteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    notifyCharacteristic(characteristic);
+}
+
+#if L2CAP_COC_SUPPORTED
+// The open channel, or nullptr. Set and cleared by the host task.
+std::atomic<ble_l2cap_chan*> channel(nullptr);
+
+TaskHandle_t sourceTask = nullptr;
+std::atomic<bool> sourceRunning(false);
+
+SemaphoreHandle_t unstalled = nullptr;
+StaticSemaphore_t unstalledBuffer;
+
+uint8_t payload[L2CAP_COC_MTU];
+
+/// How long the source waits for credits before checking whether to stop.
+const uint32_t kCreditWaitMs = 1000;
+
+/**
+ * @brief Fills the payload buffer with the sequence number and the verification pattern.
+ */
+void fillPayload(uint32_t sequence, size_t length) {
+    payload[0] = sequence & 0xFF;
+    payload[1] = (sequence >> 8) & 0xFF;
+    payload[2] = (sequence >> 16) & 0xFF;
+    payload[3] = (sequence >> 24) & 0xFF;
+    for (size_t i = 4; i < length; i++) {
+        payload[i] = (sequence + i) & 0xFF;
+    }
+}
+
+/**
+ * @brief Hands the stack a buffer for the next SDU, which also returns credits to the client.
+ */
+int giveReceiveBuffer(ble_l2cap_chan* chan) {
+    os_mbuf* sdu = os_msys_get_pkthdr(L2CAP_COC_MTU, 0);
+    if (sdu == nullptr) {
+        LOG_ERROR("No buffer for the next L2CAP SDU");
+        return BLE_HS_ENOMEM;
+    }
+    return ble_l2cap_recv_ready(chan, sdu);
+}
+
+/**
+ * @brief Sends SDUs of the client's SDU MTU until the run time elapses, the mode changes or
+ * the channel closes.
+ */
+void runSource() {
+    const int64_t endUs = esp_timer_get_time() + (int64_t)sourceSeconds * 1000000;
+    uint32_t sequence = 0;
+
+    while (mode == static_cast<uint8_t>(L2capMode::Source) && esp_timer_get_time() < endUs) {
+        ble_l2cap_chan* chan = channel;
+        if (chan == nullptr) {
+            return; // The channel closed; its stats were published by the host task.
+        }
+        size_t length = peerMtu;
+        if (length > sizeof(payload)) {
+            length = sizeof(payload);
+        }
+
+        os_mbuf* sdu = os_msys_get_pkthdr(length, 0);
+        if (sdu == nullptr) {
+            vTaskDelay(1); // Wait for the stack to free its buffers.
+            continue;
+        }
+        fillPayload(sequence, length);
+        if (os_mbuf_append(sdu, payload, length) != 0) {
+            os_mbuf_free_chain(sdu);
+            vTaskDelay(1);
+            continue;
+        }
+
+        xSemaphoreTake(unstalled, 0);
+        const int rc = ble_l2cap_send(chan, sdu);
+        if (rc == 0 || rc == BLE_HS_ESTALLED) {
+            // The stack owns the SDU and sends the rest of it once there are credits
+            txSdus++;
+            txBytes += length;
+            sequence++;
+            if (rc == BLE_HS_ESTALLED) {
+                stalls++;
+                xSemaphoreTake(unstalled, pdMS_TO_TICKS(kCreditWaitMs));
+            }
+        } else if (rc == BLE_HS_EBUSY) {
+            os_mbuf_free_chain(sdu);
+            vTaskDelay(1);
+        } else {
+            os_mbuf_free_chain(sdu);
+            LOG_WARN("L2CAP send failed: %d", rc);
+            break;
+        }
+    }
+
+    endWindow();
+    publishStats();
+}
+
+/**
+ * @brief The FreeRTOS task that runs the source each time it is woken.
+ */
+void l2capSourceTask(void* parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        runSource();
+        sourceRunning = false;
+    }
+}
+
+/**
+ * @brief Wakes the source task unless it is already sending.
+ */
+void startSource() {
+    if (channel != nullptr && !sourceRunning.exchange(true)) {
+        xTaskNotifyGive(sourceTask);
+    }
+}
+
+/**
+ * @brief Handles the events of the L2CAP server and its channel on the NimBLE host task.
+ */
+int handleL2capEvent(ble_l2cap_event* event, void* arg) {
+    switch (event->type) {
+        case BLE_L2CAP_EVENT_COC_ACCEPT:
+            if (channel != nullptr) {
+                LOG_WARN("Rejected a second L2CAP channel from conn %u", event->accept.conn_handle);
+                return BLE_HS_ENOMEM;
+            }
+            return giveReceiveBuffer(event->accept.chan);
+
+        case BLE_L2CAP_EVENT_COC_CONNECTED: {
+            if (event->connect.status != 0) {
+                LOG_WARN("L2CAP channel failed to open: %d", event->connect.status);
+                return 0;
+            }
+            ble_l2cap_chan_info info;
+            peerMtu = ble_l2cap_get_chan_info(event->connect.chan, &info) == 0 ? info.peer_coc_mtu : 0;
+            resetCounters();
+            channel = event->connect.chan;
+            connected = true;
+            LOG_INFO("L2CAP channel opened: conn %u, PSM 0x%02x, peer MTU %u",
+                     event->connect.conn_handle, L2CAP_COC_PSM, peerMtu.load());
+            if (mode == static_cast<uint8_t>(L2capMode::Source)) {
+                startSource();
+            }
+            return 0;
+        }
+
+        case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+            if (event->disconnect.chan != channel) {
+                return 0;
+            }
+            channel = nullptr;
+            connected = false;
+            xSemaphoreGive(unstalled);
+            endWindow();
+            LOG_INFO("L2CAP channel closed: conn %u", event->disconnect.conn_handle);
+            publishStats();
+            return 0;
+
+        case BLE_L2CAP_EVENT_COC_DATA_RECEIVED: {
+            os_mbuf* sdu = event->receive.sdu_rx;
+            if (sdu == nullptr) {
+                return 0;
+            }
+            const uint16_t length = OS_MBUF_PKTLEN(sdu);
+            rxSdus++;
+            rxBytes += length;
+            if (mode == static_cast<uint8_t>(L2capMode::Echo)) {
+                const int rc = ble_l2cap_send(event->receive.chan, sdu);
+                if (rc == 0 || rc == BLE_HS_ESTALLED) {
+                    txSdus++;
+                    txBytes += length;
+                    if (rc == BLE_HS_ESTALLED) {
+                        stalls++;
+                    }
+                } else {
+                    dropped++;
+                    os_mbuf_free_chain(sdu);
+                }
+            } else {
+                os_mbuf_free_chain(sdu);
+            }
+            giveReceiveBuffer(event->receive.chan);
+            return 0;
+        }
+
+        case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+            xSemaphoreGive(unstalled);
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+#endif // L2CAP_COC_SUPPORTED
+
+/**
+ * @class L2capCallbacks
+ * @brief Handles the L2CAP characteristic.
+ *
+ * @method onWrite
+ * Selects the mode and, for Source, the run time; resets the counters and starts the
+ * source if a channel is open.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the live stats.
+ */
+class L2capCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if ((length != 1 && length != 3) || data[0] >= static_cast<uint8_t>(L2capMode::Count)) {
+            LOG_WARN("Received unexpected L2CAP command of %u bytes", (unsigned)length);
+            return;
+        }
+        uint16_t seconds = L2CAP_COC_SOURCE_SECONDS;
+        if (length == 3) {
+            seconds = data[1] | (data[2] << 8);
+        }
+        if (seconds == 0) {
+            LOG_WARN("Invalid L2CAP source duration");
+            return;
+        }
+
+        mode = data[0];
+        sourceSeconds = seconds;
+        resetCounters();
+        LOG_INFO("L2CAP mode: %s", kModeNames[data[0]]);
+#if L2CAP_COC_SUPPORTED
+        if (mode == static_cast<uint8_t>(L2capMode::Source)) {
+            startSource();
+        }
+#else
+        LOG_WARN("L2CAP channels need NimBLE with CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM > 0");
+#endif
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        L2capStats stats;
+        snapshotStats(stats);
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+L2capCallbacks l2capCallbacks;
+
+} // namespace
+
+void setupL2capCoc(BLEService* pService) {
+    characteristic = createBleCharacteristic(
+        pService,
+        L2CAP_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify
+    );
+    characteristic->setCallbacks(&l2capCallbacks);
+    trackSubscriptions(characteristic);
+
+#if L2CAP_COC_SUPPORTED
+    unstalled = xSemaphoreCreateBinaryStatic(&unstalledBuffer);
+    createAppTask(l2capSourceTask, "l2cap_source", 4096, nullptr, 1, &sourceTask);
+
+    const int rc = ble_l2cap_create_server(L2CAP_COC_PSM, L2CAP_COC_MTU, handleL2capEvent, nullptr);
+    if (rc != 0) {
+        LOG_ERROR("Failed to create the L2CAP server: %d", rc);
+    }
+#endif
+}
@@ -0,0 +1,231 @@
+/**
+ * @file
+ * @brief Implementation of the large payload transfer test.
+ *
+ * All three characteristics are written from the BLE task only, so the transfer state
+ * needs no locking. The reassembly buffer is static and sized at build time.
+ */
+
+#include "large_payload.h"
+
+#include <Arduino.h>
+#include <esp_rom_crc.h>
+#include <string.h>
+
+#include "async_log.h"
+#include "connection_registry.h"
+#include "payload_coverage.h"
+
+namespace {
+
+/// The length of the control command.
+const size_t kBeginLength = 10;
+
+/// The length of the chunk header: offset, length and CRC.
+const size_t kChunkHeaderLength = 10;
+
+uint8_t buffer[LARGE_PAYLOAD_BUFFER_BYTES];
+
+// The bytes of a chunked transfer that have arrived, so resent chunks are not counted twice
+PayloadCoverage<LARGE_PAYLOAD_BUFFER_BYTES> coverage;
+
+BLECharacteristic* pControlCharacteristic = nullptr;
+
+LargePayloadMethod method = LargePayloadMethod::None;
+LargePayloadState state = LargePayloadState::Idle;
+uint32_t totalLength = 0;
+uint32_t expectedCrc = 0;
+uint32_t received = 0;
+uint32_t writes = 0;
+uint32_t rejectedWrites = 0;
+int64_t startedUs = 0;
+int64_t lastByteUs = 0;
+
+uint32_t readU32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+uint32_t crc32(const uint8_t* data, size_t length) {
+    return esp_rom_crc32_le(0, data, length);
+}
+
+LargePayloadStats snapshot() {
+    LargePayloadStats stats;
+    stats.method = static_cast<uint8_t>(method);
+    stats.state = static_cast<uint8_t>(state);
+    stats.totalLength = totalLength;
+    stats.received = received;
+    stats.writes = writes;
+    stats.rejectedWrites = rejectedWrites;
+    stats.elapsedUs = received > 0 ? lastByteUs - startedUs : 0;
+    stats.goodputBps = state == LargePayloadState::Complete && stats.elapsedUs > 0
+        ? (uint64_t)totalLength * 1000000 / stats.elapsedUs
+        : 0;
+    return stats;
+}
+
+/**
+ * @brief Records that payload bytes arrived and finishes the transfer once all are in.
+ *
+ * @param length The number of bytes that had not arrived before.
+ */
+void onPayloadBytes(size_t length) {
+    received += length;
+    lastByteUs = esp_timer_get_time();
+    if (received < totalLength) {
+        return;
+    }
+
+    state = crc32(buffer, totalLength) == expectedCrc ? LargePayloadState::Complete
+                                                      : LargePayloadState::CrcMismatch;
+    LargePayloadStats stats = snapshot();
+    if (state == LargePayloadState::Complete) {
+        LOG_INFO("Large payload received: %u bytes in %u us, %u B/s",
+                 stats.totalLength, stats.elapsedUs, stats.goodputBps);
+    }
+    else {
+        LOG_WARN("Large payload CRC mismatch after %u bytes", stats.totalLength);
+    }
+    pControlCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    notifyCharacteristic(pControlCharacteristic);
+}
+
+/**
+ * @class ControlCallbacks
+ * @brief Announces transfers and serves the transfer statistics.
+ *
+ * @method onWrite
+ * Starts a new transfer, abandoning the current one.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the current statistics before it is read.
+ */
+class ControlCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+
+        received = 0;
+        coverage.reset();
+        writes = 0;
+        rejectedWrites = 0;
+        startedUs = esp_timer_get_time();
+        lastByteUs = startedUs;
+
+        if (value.length() != kBeginLength || data[0] != LARGE_PAYLOAD_OPCODE_BEGIN ||
+            data[1] < static_cast<uint8_t>(LargePayloadMethod::LongWrite) ||
+            data[1] > static_cast<uint8_t>(LargePayloadMethod::Chunked)) {
+            method = LargePayloadMethod::None;
+            state = LargePayloadState::Invalid;
+            LOG_WARN("Invalid large payload command");
+            return;
+        }
+
+        method = static_cast<LargePayloadMethod>(data[1]);
+        totalLength = readU32(data + 2);
+        expectedCrc = readU32(data + 6);
+        if (totalLength == 0 || totalLength > sizeof(buffer)) {
+            state = LargePayloadState::Invalid;
+            LOG_WARN("Large payload of %u bytes does not fit", totalLength);
+            return;
+        }
+        state = LargePayloadState::Receiving;
+        LOG_INFO("Large payload transfer started: method=%u length=%u",
+                 static_cast<unsigned>(method), totalLength);
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        LargePayloadStats stats = snapshot();
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+ControlCallbacks controlCallbacks;
+
+/**
+ * @class LongWriteCallbacks
+ * @brief Appends each (long) write to the payload.
+ *
+ * @method onWrite
+ * Called once per write, after the stack has executed any queued prepared writes, so the
+ * value holds the whole piece.
+ */
+class LongWriteCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        writes++;
+        if (state != LargePayloadState::Receiving || method != LargePayloadMethod::LongWrite ||
+            received + value.length() > totalLength) {
+            rejectedWrites++;
+            return;
+        }
+        memcpy(buffer + received, value.data(), value.length());
+        onPayloadBytes(value.length());
+    }
+};
+
+LongWriteCallbacks longWriteCallbacks;
+
+/**
+ * @class ChunkCallbacks
+ * @brief Places each chunk at its offset in the payload.
+ *
+ * @method onWrite
+ * Checks the chunk header and CRC and copies the data into place. Rejected chunks are only
+ * counted, so the client can resend them. Only the bytes a chunk adds count towards the
+ * payload, so a resent or overlapping chunk cannot complete the transfer early.
+ */
+class ChunkCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        writes++;
+        if (state != LargePayloadState::Receiving || method != LargePayloadMethod::Chunked ||
+            value.length() < kChunkHeaderLength) {
+            rejectedWrites++;
+            return;
+        }
+
+        const uint32_t offset = readU32(data);
+        const uint16_t length = data[4] | (data[5] << 8);
+        const uint8_t* chunk = data + kChunkHeaderLength;
+        if (length != value.length() - kChunkHeaderLength || offset > totalLength ||
+            length > totalLength - offset || crc32(chunk, length) != readU32(data + 6)) {
+            rejectedWrites++;
+            return;
+        }
+        memcpy(buffer + offset, chunk, length);
+        onPayloadBytes(coverage.mark(offset, length));
+    }
+};
+
+ChunkCallbacks chunkCallbacks;
+
+} // namespace
+
+void setupLargePayload(BLEService* pService) {
+    pControlCharacteristic = createBleCharacteristic(
+        pService,
+        LARGE_PAYLOAD_CONTROL_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify
+    );
+    pControlCharacteristic->setCallbacks(&controlCallbacks);
+    trackSubscriptions(pControlCharacteristic);
+
+    BLECharacteristic* pLongWriteCharacteristic = createBleCharacteristic(
+        pService,
+        LARGE_PAYLOAD_LONG_WRITE_CHARACTERISTIC_UUID,
+        BleProperty::kWrite
+    );
+    pLongWriteCharacteristic->setCallbacks(&longWriteCallbacks);
+
+    BLECharacteristic* pChunkCharacteristic = createBleCharacteristic(
+        pService,
+        LARGE_PAYLOAD_CHUNK_CHARACTERISTIC_UUID,
+        BleProperty::kWrite |
+        BleProperty::kWriteNoResponse
+    );
+    pChunkCharacteristic->setCallbacks(&chunkCallbacks);
+}
@@ -0,0 +1,164 @@
+/**
+ * @file
+ * @brief Implementation of the LED animations and the animation characteristic.
+ *
+ * Time within a period is a 16-bit phase, where 65536 is one full period, and blend factors
+ * run from 0 (color A) to 256 (color B). Every step is an integer multiply and shift.
+ */
+
+#include "led_animation.h"
+
+#include <string.h>
+
+#include "async_log.h"
+#include "connection_registry.h"
+#include "led_renderer.h"
+#include "state_broadcast.h"
+
+namespace {
+
+/// The length of a full animation command.
+const size_t kCommandLength = 10;
+
+/// One full period, as a 16-bit phase.
+const uint32_t kFullPhase = 0x10000;
+
+/**
+ * @brief Returns the position within the current period as a phase from 0 to 65535.
+ */
+uint32_t phaseOf(uint32_t elapsedMs, uint16_t periodMs) {
+    return ((elapsedMs % periodMs) << 16) / periodMs;
+}
+
+/**
+ * @brief Maps a phase to a blend factor that rises from 0 to 256 and falls back to 0.
+ */
+uint32_t triangle(uint32_t phase) {
+    return phase < kFullPhase / 2 ? phase >> 7 : (kFullPhase - phase) >> 7;
+}
+
+/**
+ * @brief Writes the blend of two colors into one pixel.
+ *
+ * @param blend The weight of color B, from 0 to 256.
+ */
+void blendPixel(uint8_t* pixel, const uint8_t* colorA, const uint8_t* colorB, uint32_t blend) {
+    for (int i = 0; i < 3; i++) {
+        pixel[i] = (colorA[i] * (256 - blend) + colorB[i] * blend) >> 8;
+    }
+}
+
+void fillBlend(uint8_t* frame, const LedAnimation& animation, uint32_t blend) {
+    for (size_t pixel = 0; pixel < LED_STRIP_PIXELS; pixel++) {
+        blendPixel(frame + pixel * 3, animation.colorA, animation.colorB, blend);
+    }
+}
+
+void drawChase(uint8_t* frame, const LedAnimation& animation, uint32_t phase) {
+    const uint32_t head = (phase * LED_STRIP_PIXELS) >> 16;
+    for (size_t pixel = 0; pixel < LED_STRIP_PIXELS; pixel++) {
+        // How far the pixel trails the head, wrapping around the end of the strip
+        const uint32_t behind = (head + LED_STRIP_PIXELS - pixel) % LED_STRIP_PIXELS;
+        const uint32_t blend = behind < animation.width ? (behind << 8) / animation.width : 256;
+        blendPixel(frame + pixel * 3, animation.colorA, animation.colorB, blend);
+    }
+}
+
+void drawGradient(uint8_t* frame, const LedAnimation& animation, uint32_t phase) {
+    for (size_t pixel = 0; pixel < LED_STRIP_PIXELS; pixel++) {
+        const uint32_t position = (((pixel << 16) / LED_STRIP_PIXELS) + phase) & (kFullPhase - 1);
+        blendPixel(frame + pixel * 3, animation.colorA, animation.colorB, triangle(position));
+    }
+}
+
+/**
+ * @class AnimationCallbacks
+ * @brief Starts animations and serves the animation statistics.
+ *
+ * @method onWrite
+ * Decodes the command and hands it to the render task.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the current statistics before it is read.
+ */
+class AnimationCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        LedAnimation animation;
+        if (!parseLedAnimation(value.data(), value.length(), &animation)) {
+            LOG_WARN("Invalid LED animation command");
+            return;
+        }
+        postLedAnimation(animation);
+        setBroadcastLedState(BroadcastLedState::Custom);
+        LOG_DEBUG("LED animation %u started", static_cast<unsigned>(animation.type));
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        LedAnimationStats stats = getLedAnimationStats();
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+AnimationCallbacks animationCallbacks;
+
+} // namespace
+
+bool parseLedAnimation(const uint8_t* data, size_t length, LedAnimation* pAnimation) {
+    if (length == 1 && data[0] == static_cast<uint8_t>(LedAnimationType::Stop)) {
+        pAnimation->type = LedAnimationType::Stop;
+        return true;
+    }
+    if (length != kCommandLength || data[0] > static_cast<uint8_t>(LedAnimationType::Gradient)) {
+        return false;
+    }
+    pAnimation->type = static_cast<LedAnimationType>(data[0]);
+    pAnimation->periodMs = data[1] | (data[2] << 8);
+    memcpy(pAnimation->colorA, data + 3, 3);
+    memcpy(pAnimation->colorB, data + 6, 3);
+    pAnimation->width = data[9];
+
+    // Pulses and chases repeat every period, so they need one
+    if (pAnimation->periodMs == 0 &&
+        (pAnimation->type == LedAnimationType::Pulse || pAnimation->type == LedAnimationType::Chase)) {
+        return false;
+    }
+    return pAnimation->type != LedAnimationType::Chase || pAnimation->width > 0;
+}
+
+bool drawLedAnimation(const LedAnimation& animation, uint32_t elapsedMs, uint8_t* frame) {
+    switch (animation.type) {
+        case LedAnimationType::Fade:
+            if (elapsedMs >= animation.periodMs) {
+                fillBlend(frame, animation, 256);
+                return false;
+            }
+            fillBlend(frame, animation, (elapsedMs << 8) / animation.periodMs);
+            return true;
+        case LedAnimationType::Pulse:
+            fillBlend(frame, animation, triangle(phaseOf(elapsedMs, animation.periodMs)));
+            return true;
+        case LedAnimationType::Chase:
+            drawChase(frame, animation, phaseOf(elapsedMs, animation.periodMs));
+            return true;
+        case LedAnimationType::Gradient:
+            if (animation.periodMs == 0) {
+                drawGradient(frame, animation, 0);
+                return false;
+            }
+            drawGradient(frame, animation, phaseOf(elapsedMs, animation.periodMs));
+            return true;
+        default:
+            return false;
+    }
+}
+
+void setupLedAnimation(BLEService* pService) {
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        LED_ANIMATION_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pCharacteristic->setCallbacks(&animationCallbacks);
+}
@@ -0,0 +1,211 @@
+/**
+ * @file
+ * @brief Implementation of the LED framebuffer characteristic.
+ *
+ * Every write is validated in full before it touches the framebuffer, so a malformed write
+ * never leaves a half-applied frame behind. Only the BLE task writes the counters.
+ */
+
+#include "led_framebuffer.h"
+
+#include <Arduino.h>
+#include <string.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "connection_registry.h"
+#include "led_renderer.h"
+#include "state_broadcast.h"
+
+namespace {
+
+/// The length of a pixel range header after the opcode: the first pixel.
+const size_t kRangeHeaderLength = 2;
+
+/// The length of a run: the first pixel, the count and the color.
+const size_t kRunLength = 7;
+
+/// The length of a changed pixel: the pixel and the color.
+const size_t kChangedPixelLength = 5;
+
+std::atomic<uint32_t> writes(0);
+std::atomic<uint32_t> invalidWrites(0);
+std::atomic<uint32_t> lastAssemblyUs(0);
+std::atomic<uint32_t> lastFrameGapUs(0);
+
+// The time of the first write since the last frame was shown, or 0.
+int64_t frameStartedUs = 0;
+int64_t lastShownUs = 0;
+
+uint16_t readU16(const uint8_t* data) {
+    return data[0] | (data[1] << 8);
+}
+
+void setPixel(uint8_t* frame, uint16_t pixel, const uint8_t* color) {
+    memcpy(frame + pixel * 3, color, 3);
+}
+
+/**
+ * @brief Validates and applies a pixel range command.
+ */
+bool applyPixelRange(uint8_t* frame, const uint8_t* data, size_t length) {
+    if (length < kRangeHeaderLength || (length - kRangeHeaderLength) % 3 != 0) {
+        return false;
+    }
+    const uint16_t first = readU16(data);
+    const size_t count = (length - kRangeHeaderLength) / 3;
+    if (first + count > LED_STRIP_PIXELS) {
+        return false;
+    }
+    memcpy(frame + first * 3, data + kRangeHeaderLength, count * 3);
+    return true;
+}
+
+/**
+ * @brief Validates and applies a runs command.
+ */
+bool applyRuns(uint8_t* frame, const uint8_t* data, size_t length) {
+    if (length == 0 || length % kRunLength != 0) {
+        return false;
+    }
+    for (size_t offset = 0; offset < length; offset += kRunLength) {
+        if (readU16(data + offset) + readU16(data + offset + 2) > LED_STRIP_PIXELS) {
+            return false;
+        }
+    }
+    for (size_t offset = 0; offset < length; offset += kRunLength) {
+        const uint16_t first = readU16(data + offset);
+        const uint16_t count = readU16(data + offset + 2);
+        for (uint16_t pixel = first; pixel < first + count; pixel++) {
+            setPixel(frame, pixel, data + offset + 4);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Validates and applies a changed pixels command.
+ */
+bool applyChangedPixels(uint8_t* frame, const uint8_t* data, size_t length) {
+    if (length == 0 || length % kChangedPixelLength != 0) {
+        return false;
+    }
+    for (size_t offset = 0; offset < length; offset += kChangedPixelLength) {
+        if (readU16(data + offset) >= LED_STRIP_PIXELS) {
+            return false;
+        }
+    }
+    for (size_t offset = 0; offset < length; offset += kChangedPixelLength) {
+        setPixel(frame, readU16(data + offset), data + offset + 2);
+    }
+    return true;
+}
+
+/**
+ * @brief Publishes the framebuffer and records how long the frame took to arrive.
+ */
+void showFrame(int64_t now) {
+    commitLedFrame();
+    setBroadcastLedState(BroadcastLedState::Custom);
+    lastAssemblyUs = frameStartedUs != 0 ? now - frameStartedUs : 0;
+    lastFrameGapUs = lastShownUs != 0 ? now - lastShownUs : 0;
+    lastShownUs = now;
+    frameStartedUs = 0;
+}
+
+/**
+ * @class FramebufferCallbacks
+ * @brief Applies drawing commands to the framebuffer and serves its statistics.
+ *
+ * @method onWrite
+ * Decodes the command in place and applies it to the framebuffer. Nothing in this path
+ * logs, allocates or waits on the strip.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the current statistics before it is read.
+ */
+class FramebufferCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const int64_t now = esp_timer_get_time();
+        const BleValue value(pCharacteristic);
+        if (value.length() == 0) {
+            invalidWrites++;
+            return;
+        }
+        const uint8_t opcode = value.data()[0] & ~LED_FRAME_FLAG_SHOW;
+        const bool show = (value.data()[0] & LED_FRAME_FLAG_SHOW) != 0;
+        const uint8_t* data = value.data() + 1;
+        const size_t length = value.length() - 1;
+
+        bool applied;
+        switch (opcode) {
+            case LED_FRAME_OPCODE_RESET_STATS:
+                writes = 0;
+                invalidWrites = 0;
+                lastAssemblyUs = 0;
+                lastFrameGapUs = 0;
+                lastShownUs = 0;
+                resetLedRenderStats();
+                LOG_INFO("LED framebuffer statistics reset");
+                return;
+            case LED_FRAME_OPCODE_PIXEL_RANGE:
+                applied = applyPixelRange(ledDrawBuffer(), data, length);
+                break;
+            case LED_FRAME_OPCODE_RUNS:
+                applied = applyRuns(ledDrawBuffer(), data, length);
+                break;
+            case LED_FRAME_OPCODE_CHANGED_PIXELS:
+                applied = applyChangedPixels(ledDrawBuffer(), data, length);
+                break;
+            case LED_FRAME_OPCODE_SHOW:
+                applied = length == 0;
+                break;
+            default:
+                applied = false;
+                break;
+        }
+        if (!applied) {
+            invalidWrites++;
+            return;
+        }
+
+        writes++;
+        if (frameStartedUs == 0) {
+            frameStartedUs = now;
+        }
+        if (show || opcode == LED_FRAME_OPCODE_SHOW) {
+            showFrame(now);
+        }
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        const LedRenderStats render = getLedRenderStats();
+        LedFramebufferStats stats;
+        stats.pixels = LED_STRIP_PIXELS;
+        stats.writes = writes;
+        stats.invalidWrites = invalidWrites;
+        stats.framesCommitted = render.framesCommitted;
+        stats.framesRendered = render.framesRendered;
+        stats.framesDropped = render.framesDropped;
+        stats.lastAssemblyUs = lastAssemblyUs;
+        stats.lastFrameGapUs = lastFrameGapUs;
+        stats.lastOutputUs = render.lastOutputUs;
+        stats.maxOutputUs = render.maxOutputUs;
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+FramebufferCallbacks framebufferCallbacks;
+
+} // namespace
+
+void setupLedFramebuffer(BLEService* pService) {
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        LED_FRAMEBUFFER_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kWriteNoResponse
+    );
+    pCharacteristic->setCallbacks(&framebufferCallbacks);
+}
@@ -0,0 +1,280 @@
+/**
+ * @file
+ * @brief Implementation of the LED strip render task.
+ *
+ * The triple buffer holds three frames. The writer owns one (back), the render task owns
+ * one (front), and the third is the most recently published frame (pending). Committing
+ * swaps back and pending; rendering swaps pending and front, but only if pending holds a
+ * frame the render task has not seen yet.
+ *
+ * Animations reach the render task through a small mailbox guarded by a spinlock. While an
+ * animation runs, the task wakes on a fixed tick schedule rather than on notifications
+ * alone, so the frame rate does not depend on BLE traffic.
+ */
+
+#include "led_renderer.h"
+
+#include <Arduino.h>
+#include <string.h>
+#include <atomic>
+
+#include "board_traits.h"
+#include "led_animation.h"
+#include "led_gamma.h"
+#include "led_strip_rmt.h"
+
+namespace {
+
+/// Marks the pending slot as holding a frame that has not been rendered yet.
+const uint8_t kFreshFrame = 0x80;
+
+/// Extracts the frame index from the pending slot.
+const uint8_t kFrameIndexMask = 0x03;
+
+TaskHandle_t task = nullptr;
+
+// Owned by the writer.
+uint8_t drawFrame[LED_FRAME_BYTES];
+uint8_t backIndex = 0;
+
+// Shared between the writer and the render task.
+uint8_t frames[3][LED_FRAME_BYTES];
+std::atomic<uint8_t> pending(1);
+
+// Owned by the render task. The output buffer holds the frame in GRB order with the
+// brightness applied, and must stay untouched while the RMT peripheral clocks it out.
+uint8_t frontIndex = 2;
+uint8_t output[LED_FRAME_BYTES];
+
+// The animation mailbox, written by the BLE task and read by the render task.
+portMUX_TYPE animationMux = portMUX_INITIALIZER_UNLOCKED;
+LedAnimation postedAnimation;
+bool animationPosted = false;
+
+// Owned by the render task.
+LedAnimation animation;
+bool animating = false;
+uint8_t animationFrame[LED_FRAME_BYTES];
+
+// Animation frame timing, written by the render task.
+std::atomic<uint8_t> animationType(0);
+std::atomic<uint32_t> animationFrames(0);
+std::atomic<uint32_t> lastIntervalUs(0);
+std::atomic<uint32_t> minIntervalUs(0);
+std::atomic<uint32_t> maxIntervalUs(0);
+std::atomic<uint32_t> lateFrames(0);
+
+std::atomic<uint32_t> framesCommitted(0);
+std::atomic<uint32_t> framesRendered(0);
+std::atomic<uint32_t> framesDropped(0);
+std::atomic<uint32_t> lastOutputUs(0);
+std::atomic<uint32_t> maxOutputUs(0);
+
+/**
+ * @brief Converts an RGB frame to the strip's GRB order through the output table, which
+ * applies gamma correction and the brightness.
+ */
+void prepareOutput(const uint8_t* frame) {
+    for (size_t i = 0; i < LED_FRAME_BYTES; i += 3) {
+        output[i] = kLedOutputTable.levels[frame[i + 1]];
+        output[i + 1] = kLedOutputTable.levels[frame[i]];
+        output[i + 2] = kLedOutputTable.levels[frame[i + 2]];
+    }
+}
+
+/**
+ * @brief Pushes a frame to the strip and records how long it took.
+ */
+void showFrame(const uint8_t* frame) {
+    prepareOutput(frame);
+
+    const int64_t started = esp_timer_get_time();
+    writeLedStripRmt(output, sizeof(output));
+    const uint32_t outputUs = esp_timer_get_time() - started;
+    lastOutputUs = outputUs;
+    if (outputUs > maxOutputUs) {
+        maxOutputUs = outputUs;
+    }
+    framesRendered++;
+}
+
+/**
+ * @brief Picks up a newly posted animation, if there is one.
+ */
+void takePostedAnimation(TickType_t now, TickType_t* pNextFrame, int64_t* pStartedUs) {
+    portENTER_CRITICAL(&animationMux);
+    const bool posted = animationPosted;
+    if (posted) {
+        animation = postedAnimation;
+        animationPosted = false;
+    }
+    portEXIT_CRITICAL(&animationMux);
+    if (!posted) {
+        return;
+    }
+
+    animating = animation.type != LedAnimationType::Stop;
+    animationType = static_cast<uint8_t>(animating ? animation.type : LedAnimationType::Stop);
+    animationFrames = 0;
+    lastIntervalUs = 0;
+    minIntervalUs = 0;
+    maxIntervalUs = 0;
+    lateFrames = 0;
+    *pNextFrame = now;
+    *pStartedUs = esp_timer_get_time();
+}
+
+/**
+ * @brief Draws and shows the next animation frame and records the frame timing.
+ */
+void renderAnimationFrame(int64_t startedUs, int64_t* pLastFrameUs) {
+    const int64_t now = esp_timer_get_time();
+    animating = drawLedAnimation(animation, (now - startedUs) / 1000, animationFrame);
+    showFrame(animationFrame);
+
+    if (animationFrames++ > 0) {
+        const uint32_t intervalUs = now - *pLastFrameUs;
+        lastIntervalUs = intervalUs;
+        if (minIntervalUs == 0 || intervalUs < minIntervalUs) {
+            minIntervalUs = intervalUs;
+        }
+        if (intervalUs > maxIntervalUs) {
+            maxIntervalUs = intervalUs;
+        }
+        if (intervalUs > LED_ANIMATION_FRAME_MS * 1500) {
+            lateFrames++;
+        }
+    }
+    *pLastFrameUs = now;
+    if (!animating) {
+        animationType = static_cast<uint8_t>(LedAnimationType::Stop);
+    }
+}
+
+/**
+ * @brief The FreeRTOS task that renders the newest committed frame, or the running
+ * animation, at a bounded frame rate.
+ */
+void renderTask(void* parameter) {
+    const TickType_t frameTicks = pdMS_TO_TICKS(LED_ANIMATION_FRAME_MS);
+    TickType_t nextFrame = 0;
+    int64_t startedUs = 0;
+    int64_t lastFrameUs = 0;
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        if (animating) {
+            const int32_t remaining = static_cast<int32_t>(nextFrame - xTaskGetTickCount());
+            wait = remaining > 0 ? remaining : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        if (pending.load(std::memory_order_acquire) & kFreshFrame) {
+            // A committed frame replaces whatever is animating
+            frontIndex = pending.exchange(frontIndex, std::memory_order_acq_rel) & kFrameIndexMask;
+            animating = false;
+            animationType = static_cast<uint8_t>(LedAnimationType::Stop);
+            showFrame(frames[frontIndex]);
+
+            // Cap the frame rate. Frames committed meanwhile leave a pending notification,
+            // so the newest one is rendered as soon as the interval has passed.
+            vTaskDelay(pdMS_TO_TICKS(LED_RENDER_MIN_FRAME_MS));
+        }
+
+        const TickType_t now = xTaskGetTickCount();
+        takePostedAnimation(now, &nextFrame, &startedUs);
+        if (!animating || static_cast<int32_t>(now - nextFrame) < 0) {
+            continue;
+        }
+
+        renderAnimationFrame(startedUs, &lastFrameUs);
+
+        // Keep to the schedule, but start afresh rather than bursting after a stall
+        nextFrame += frameTicks;
+        if (static_cast<int32_t>(xTaskGetTickCount() - nextFrame) > 0) {
+            nextFrame = xTaskGetTickCount() + frameTicks;
+        }
+    }
+}
+
+} // namespace
+
+void setupLedRenderer(uint8_t pin) {
+    setupLedStripRmt(pin);
+
+    // Initialize the strip to 'off'
+    writeLedStripRmt(output, sizeof(output));
+
+    createAppTask(renderTask, "led_render", 2048, nullptr, 2, &task);
+
+    // Render any frame committed before the task existed, as happens in fast boot builds.
+    xTaskNotifyGive(task);
+}
+
+void postLedColor(uint32_t color) {
+    for (size_t i = 0; i < LED_FRAME_BYTES; i += 3) {
+        drawFrame[i] = color >> 16;
+        drawFrame[i + 1] = color >> 8;
+        drawFrame[i + 2] = color;
+    }
+    commitLedFrame();
+}
+
+uint8_t* ledDrawBuffer() {
+    return drawFrame;
+}
+
+void commitLedFrame() {
+    memcpy(frames[backIndex], drawFrame, LED_FRAME_BYTES);
+    const uint8_t previous = pending.exchange(backIndex | kFreshFrame, std::memory_order_acq_rel);
+    if (previous & kFreshFrame) {
+        framesDropped++;
+    }
+    backIndex = previous & kFrameIndexMask;
+    framesCommitted++;
+
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void postLedAnimation(const LedAnimation& newAnimation) {
+    portENTER_CRITICAL(&animationMux);
+    postedAnimation = newAnimation;
+    animationPosted = true;
+    portEXIT_CRITICAL(&animationMux);
+
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
+    }
+}
+
+LedAnimationStats getLedAnimationStats() {
+    LedAnimationStats stats;
+    stats.type = animationType;
+    stats.frames = animationFrames;
+    stats.targetIntervalUs = LED_ANIMATION_FRAME_MS * 1000;
+    stats.lastIntervalUs = lastIntervalUs;
+    stats.minIntervalUs = minIntervalUs;
+    stats.maxIntervalUs = maxIntervalUs;
+    stats.lateFrames = lateFrames;
+    return stats;
+}
+
+LedRenderStats getLedRenderStats() {
+    LedRenderStats stats;
+    stats.framesCommitted = framesCommitted;
+    stats.framesRendered = framesRendered;
+    stats.framesDropped = framesDropped;
+    stats.lastOutputUs = lastOutputUs;
+    stats.maxOutputUs = maxOutputUs;
+    return stats;
+}
+
+void resetLedRenderStats() {
+    framesCommitted = 0;
+    framesRendered = 0;
+    framesDropped = 0;
+    lastOutputUs = 0;
+    maxOutputUs = 0;
+}
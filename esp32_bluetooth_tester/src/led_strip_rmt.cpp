@@ -0,0 +1,87 @@
+/**
+ * @file
+ * @brief Implementation of the RMT-driven WS2812 output.
+ */
+
+#include "led_strip_rmt.h"
+
+#include <Arduino.h>
+#include <driver/rmt.h>
+
+namespace {
+
+/// The RMT clock divider. With the 80 MHz APB clock each tick is 25 ns.
+const uint8_t kClockDivider = 2;
+
+// WS2812 bit timings in nanoseconds.
+const uint32_t kT0HighNs = 400;
+const uint32_t kT0LowNs = 850;
+const uint32_t kT1HighNs = 800;
+const uint32_t kT1LowNs = 450;
+
+// The RMT items for a 0 and a 1 bit, computed from the channel clock in setupLedStripRmt().
+// The translator reads them from the RMT interrupt, so they live in DRAM.
+rmt_item32_t bitZero;
+rmt_item32_t bitOne;
+
+bool ready = false;
+
+/**
+ * @brief Expands data bytes into RMT items, most significant bit first.
+ *
+ * Called by the RMT driver from its interrupt whenever the channel's memory block needs
+ * refilling, so it must stay in IRAM and must not block.
+ */
+void IRAM_ATTR translateWs2812(const void* source, rmt_item32_t* destination, size_t sourceSize,
+                               size_t wantedItems, size_t* translatedSize, size_t* itemCount) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(source);
+    size_t size = 0;
+    size_t items = 0;
+    while (size < sourceSize && items + 8 <= wantedItems) {
+        for (uint8_t mask = 0x80; mask != 0; mask >>= 1) {
+            destination[items++].val = (bytes[size] & mask) ? bitOne.val : bitZero.val;
+        }
+        size++;
+    }
+    *translatedSize = size;
+    *itemCount = items;
+}
+
+/**
+ * @brief Builds an RMT item with the given high and low times.
+ */
+rmt_item32_t makeItem(uint32_t ticksPerUs, uint32_t highNs, uint32_t lowNs) {
+    rmt_item32_t item;
+    item.duration0 = highNs * ticksPerUs / 1000;
+    item.level0 = 1;
+    item.duration1 = lowNs * ticksPerUs / 1000;
+    item.level1 = 0;
+    return item;
+}
+
+} // namespace
+
+bool setupLedStripRmt(uint8_t pin) {
+    rmt_config_t config = RMT_DEFAULT_CONFIG_TX(static_cast<gpio_num_t>(pin), LED_RMT_CHANNEL);
+    config.clk_div = kClockDivider;
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(config.channel, 0, 0) != ESP_OK) {
+        return false;
+    }
+
+    uint32_t clockHz = 0;
+    rmt_get_counter_clock(config.channel, &clockHz);
+    const uint32_t ticksPerUs = clockHz / 1000000;
+    bitZero = makeItem(ticksPerUs, kT0HighNs, kT0LowNs);
+    bitOne = makeItem(ticksPerUs, kT1HighNs, kT1LowNs);
+
+    ready = rmt_translator_init(config.channel, translateWs2812) == ESP_OK;
+    return ready;
+}
+
+bool writeLedStripRmt(const uint8_t* data, size_t length) {
+    if (!ready) {
+        return false;
+    }
+    // The WS2812 latches the data once the line has been low for 50 us after the transfer.
+    return rmt_write_sample(LED_RMT_CHANNEL, data, length, true) == ESP_OK;
+}
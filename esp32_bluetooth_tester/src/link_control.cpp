@@ -0,0 +1,497 @@
+/**
+ * @file
+ * @brief Implementation of runtime connection parameter, PHY and data length control.
+ *
+ * On Bluedroid every request completes with a GAP event that carries the values the
+ * central accepted, and the report is updated and notified from that event. NimBLE-Arduino
+ * does not surface those events, so on NimBLE the report is refreshed from the host's
+ * connection table shortly after each request and whenever it is read. That table has no
+ * data length, so on NimBLE a data length request stays pending.
+ */
+
+#include "link_control.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "ble_events.h"
+#include "connection_registry.h"
+
+#ifndef TESTER_DEFAULT_CONN_LATENCY
+#define TESTER_DEFAULT_CONN_LATENCY 0
+#endif
+
+#ifndef TESTER_DEFAULT_CONN_TIMEOUT
+#define TESTER_DEFAULT_CONN_TIMEOUT 400
+#endif
+
+namespace {
+
+/// The smallest and largest link-layer payloads allowed by the Data Length Extension.
+const uint16_t kMinDataLength = 27;
+const uint16_t kMaxDataLength = 251;
+
+#if TESTER_USE_NIMBLE
+/// How long after a request the NimBLE build refreshes and notifies the report.
+const uint64_t kRefreshDelayUs = 1000000;
+#endif
+
+/**
+ * @brief The link state kept for one connection.
+ */
+struct LinkState {
+    bool active;
+    LinkParamsReport report;
+#if TESTER_USE_NIMBLE
+    uint16_t requestedMinInterval; ///< The range of the pending connection parameter request.
+    uint16_t requestedMaxInterval;
+#endif
+};
+
+BLEServer* server = nullptr;
+BLECharacteristic* characteristic = nullptr;
+
+LinkState links[TESTER_MAX_CONNECTIONS];
+
+// Guards links, which is updated from the BLE task and from GAP events.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if !TESTER_USE_NIMBLE
+// Bluedroid does not say which connection a data length event belongs to.
+uint16_t pendingDataLengthConnId = 0;
+#else
+esp_timer_handle_t refreshTimer = nullptr;
+uint16_t refreshConnId = 0;
+#endif
+
+/**
+ * @brief Returns the link state of a connection, or nullptr. Call with the lock held.
+ */
+LinkState* findLink(uint16_t connId) {
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (links[i].active && links[i].report.connId == connId) {
+            return &links[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Copies the report of a connection.
+ *
+ * @return true if the connection is known.
+ */
+bool copyReport(uint16_t connId, LinkParamsReport& report) {
+    portENTER_CRITICAL(&lock);
+    LinkState* link = findLink(connId);
+    if (link != nullptr) {
+        report = link->report;
+    }
+    portEXIT_CRITICAL(&lock);
+    return link != nullptr;
+}
+
+/**
+ * @brief Records the outcome of a request on a connection.
+ */
+void setRequestStatus(uint16_t connId, uint8_t opcode, LinkRequestStatus status) {
+    portENTER_CRITICAL(&lock);
+    LinkState* link = findLink(connId);
+    if (link != nullptr) {
+        link->report.lastOpcode = opcode;
+        link->report.lastStatus = static_cast<uint8_t>(status);
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+#if TESTER_USE_NIMBLE
+/**
+ * @brief Updates a report from NimBLE's connection table.
+ */
+void refreshReport(uint16_t connId) {
+    ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(connId, &desc) != 0) {
+        return;
+    }
+    uint8_t txPhy = 0;
+    uint8_t rxPhy = 0;
+    const bool havePhy = ble_gap_read_le_phy(connId, &txPhy, &rxPhy) == 0;
+
+    portENTER_CRITICAL(&lock);
+    LinkState* link = findLink(connId);
+    if (link != nullptr) {
+        LinkParamsReport& report = link->report;
+        if (report.lastOpcode == LINK_OPCODE_CONN_PARAMS &&
+            report.lastStatus == static_cast<uint8_t>(LinkRequestStatus::Pending)) {
+            const bool inRange = desc.conn_itvl >= link->requestedMinInterval &&
+                                 desc.conn_itvl <= link->requestedMaxInterval;
+            report.lastStatus = static_cast<uint8_t>(inRange
+                ? LinkRequestStatus::Accepted
+                : LinkRequestStatus::Rejected);
+        }
+        report.interval = desc.conn_itvl;
+        report.latency = desc.conn_latency;
+        report.timeout = desc.supervision_timeout;
+        if (havePhy) {
+            report.txPhy = txPhy;
+            report.rxPhy = rxPhy;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+}
+#else
+void refreshReport(uint16_t connId) {
+    // Bluedroid keeps the report current from GAP events.
+}
+#endif
+
+/**
+ * @brief Publishes the report of a connection as the characteristic value and notifies it.
+ */
+void publishReport(uint16_t connId) {
+    LinkParamsReport report;
+    if (!copyReport(connId, report)) {
+        return;
+    }
+    characteristic->setValue(reinterpret_cast<uint8_t*>(&report), sizeof(report));
+    notifyCharacteristic(characteristic);
+}
+
+#if TESTER_USE_NIMBLE
+/**
+ * @brief Refreshes and notifies the report once a NimBLE request has had time to complete.
+ */
+void onRefreshTimer(void* arg) {
+    refreshReport(refreshConnId);
+    publishReport(refreshConnId);
+}
+
+void scheduleRefresh(uint16_t connId) {
+    refreshConnId = connId;
+    esp_timer_stop(refreshTimer);
+    esp_timer_start_once(refreshTimer, kRefreshDelayUs);
+}
+#endif
+
+/**
+ * @brief Requests new connection parameters on a connection.
+ */
+LinkRequestStatus requestConnParams(uint16_t connId, uint16_t minInterval, uint16_t maxInterval,
+                                    uint16_t latency, uint16_t timeout) {
+    if (minInterval < 6 || maxInterval > 3200 || minInterval > maxInterval ||
+        timeout < 10 || timeout > 3200) {
+        return LinkRequestStatus::Invalid;
+    }
+#if TESTER_USE_NIMBLE
+    portENTER_CRITICAL(&lock);
+    LinkState* link = findLink(connId);
+    if (link != nullptr) {
+        link->requestedMinInterval = minInterval;
+        link->requestedMaxInterval = maxInterval;
+    }
+    portEXIT_CRITICAL(&lock);
+    server->updateConnParams(connId, minInterval, maxInterval, latency, timeout);
+    scheduleRefresh(connId);
+    return LinkRequestStatus::Pending;
+#else
+    esp_ble_conn_update_params_t params;
+    if (!connectionAddress(connId, params.bda)) {
+        return LinkRequestStatus::Invalid;
+    }
+    params.min_int = minInterval;
+    params.max_int = maxInterval;
+    params.latency = latency;
+    params.timeout = timeout;
+    return esp_ble_gap_update_conn_params(&params) == ESP_OK
+        ? LinkRequestStatus::Pending
+        : LinkRequestStatus::Rejected;
+#endif
+}
+
+/**
+ * @brief Requests a preferred PHY on a connection.
+ */
+LinkRequestStatus requestPhy(uint16_t connId, uint8_t txMask, uint8_t rxMask) {
+    if (txMask == 0 || rxMask == 0 || txMask > 0x07 || rxMask > 0x07) {
+        return LinkRequestStatus::Invalid;
+    }
+#if TESTER_USE_NIMBLE
+    if (ble_gap_set_prefered_le_phy(connId, txMask, rxMask, BLE_GAP_LE_PHY_CODED_ANY) != 0) {
+        return LinkRequestStatus::Rejected;
+    }
+    scheduleRefresh(connId);
+    return LinkRequestStatus::Pending;
+#elif defined(CONFIG_BT_BLE_50_FEATURES_SUPPORTED)
+    uint8_t address[6];
+    if (!connectionAddress(connId, address)) {
+        return LinkRequestStatus::Invalid;
+    }
+    return esp_ble_gap_set_preferred_phy(address, 0, txMask, rxMask, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF) == ESP_OK
+        ? LinkRequestStatus::Pending
+        : LinkRequestStatus::Rejected;
+#else
+    return LinkRequestStatus::Unsupported;
+#endif
+}
+
+/**
+ * @brief Requests a maximum link-layer data length on a connection.
+ */
+LinkRequestStatus requestDataLength(uint16_t connId, uint16_t txOctets) {
+    if (txOctets < kMinDataLength || txOctets > kMaxDataLength) {
+        return LinkRequestStatus::Invalid;
+    }
+#if TESTER_USE_NIMBLE
+    // NimBLE-Arduino does not surface the data length change event, so the request stays
+    // pending and the report keeps the last length that is known.
+    const uint16_t txTime = (txOctets + 14) * 8;
+    return ble_gap_set_data_len(connId, txOctets, txTime) == 0
+        ? LinkRequestStatus::Pending
+        : LinkRequestStatus::Rejected;
+#else
+    uint8_t address[6];
+    if (!connectionAddress(connId, address)) {
+        return LinkRequestStatus::Invalid;
+    }
+    pendingDataLengthConnId = connId;
+    return esp_ble_gap_set_pkt_data_len(address, txOctets) == ESP_OK
+        ? LinkRequestStatus::Pending
+        : LinkRequestStatus::Rejected;
+#endif
+}
+
+/**
+ * @brief Applies the compile-time default link parameters to a new connection.
+ */
+void applyDefaults(uint16_t connId) {
+#if defined(TESTER_DEFAULT_CONN_INTERVAL_MIN) && defined(TESTER_DEFAULT_CONN_INTERVAL_MAX)
+    setRequestStatus(connId, LINK_OPCODE_CONN_PARAMS,
+                     requestConnParams(connId, TESTER_DEFAULT_CONN_INTERVAL_MIN, TESTER_DEFAULT_CONN_INTERVAL_MAX,
+                                       TESTER_DEFAULT_CONN_LATENCY, TESTER_DEFAULT_CONN_TIMEOUT));
+#endif
+#ifdef TESTER_DEFAULT_PHY_MASK
+    setRequestStatus(connId, LINK_OPCODE_PHY,
+                     requestPhy(connId, TESTER_DEFAULT_PHY_MASK, TESTER_DEFAULT_PHY_MASK));
+#endif
+#ifdef TESTER_DEFAULT_DATA_LENGTH
+    setRequestStatus(connId, LINK_OPCODE_DATA_LENGTH,
+                     requestDataLength(connId, TESTER_DEFAULT_DATA_LENGTH));
+#endif
+}
+
+#if !TESTER_USE_NIMBLE
+/**
+ * @brief Updates the reports from the GAP events that complete link control requests.
+ */
+void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    uint16_t connId;
+
+    switch (event) {
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT: {
+            if (!connectionForAddress(param->update_conn_params.bda, &connId)) {
+                return;
+            }
+            const bool accepted = param->update_conn_params.status == ESP_BT_STATUS_SUCCESS;
+            portENTER_CRITICAL(&lock);
+            LinkState* link = findLink(connId);
+            if (link != nullptr) {
+                if (accepted) {
+                    link->report.interval = param->update_conn_params.conn_int;
+                    link->report.latency = param->update_conn_params.latency;
+                    link->report.timeout = param->update_conn_params.timeout;
+                }
+                if (link->report.lastOpcode == LINK_OPCODE_CONN_PARAMS) {
+                    link->report.lastStatus = static_cast<uint8_t>(accepted
+                        ? LinkRequestStatus::Accepted
+                        : LinkRequestStatus::Rejected);
+                }
+            }
+            portEXIT_CRITICAL(&lock);
+            break;
+        }
+
+        case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT: {
+            connId = pendingDataLengthConnId;
+            const bool accepted = param->pkt_data_lenth_cmpl.status == ESP_BT_STATUS_SUCCESS;
+            portENTER_CRITICAL(&lock);
+            LinkState* link = findLink(connId);
+            if (link != nullptr) {
+                if (accepted) {
+                    link->report.txOctets = param->pkt_data_lenth_cmpl.params.tx_len;
+                    link->report.rxOctets = param->pkt_data_lenth_cmpl.params.rx_len;
+                }
+                link->report.lastOpcode = LINK_OPCODE_DATA_LENGTH;
+                link->report.lastStatus = static_cast<uint8_t>(accepted
+                    ? LinkRequestStatus::Accepted
+                    : LinkRequestStatus::Rejected);
+            }
+            portEXIT_CRITICAL(&lock);
+            break;
+        }
+
+#if defined(CONFIG_BT_BLE_50_FEATURES_SUPPORTED)
+        case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT: {
+            if (!connectionForAddress(param->phy_update.bda, &connId)) {
+                return;
+            }
+            const bool accepted = param->phy_update.status == ESP_BT_STATUS_SUCCESS;
+            portENTER_CRITICAL(&lock);
+            LinkState* link = findLink(connId);
+            if (link != nullptr) {
+                if (accepted) {
+                    link->report.txPhy = param->phy_update.tx_phy;
+                    link->report.rxPhy = param->phy_update.rx_phy;
+                }
+                if (link->report.lastOpcode == LINK_OPCODE_PHY) {
+                    link->report.lastStatus = static_cast<uint8_t>(accepted
+                        ? LinkRequestStatus::Accepted
+                        : LinkRequestStatus::Rejected);
+                }
+            }
+            portEXIT_CRITICAL(&lock);
+            break;
+        }
+#endif
+
+        default:
+            return;
+    }
+
+    publishReport(connId);
+}
+#endif
+
+/**
+ * @brief Reads a little-endian uint16 from a buffer.
+ */
+uint16_t getUint16(const uint8_t* data) {
+    return data[0] | (data[1] << 8);
+}
+
+/**
+ * @class LinkControlCallbacks
+ * @brief Handles link control commands and serves the link report of the reading connection.
+ *
+ * @method onConnectionWrite
+ * Decodes a command, sends the request for the writing connection and notifies the
+ * report with the request's status.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the report of the reading connection.
+ */
+class LinkControlCallbacks : public TrackedCharacteristicCallbacks {
+    void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) override {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if (length == 0) {
+            return;
+        }
+
+        const uint8_t opcode = data[0];
+        LinkRequestStatus status = LinkRequestStatus::Invalid;
+        if (opcode == LINK_OPCODE_CONN_PARAMS && length == 9) {
+            status = requestConnParams(connId, getUint16(data + 1), getUint16(data + 3),
+                                       getUint16(data + 5), getUint16(data + 7));
+        }
+        else if (opcode == LINK_OPCODE_PHY && length == 3) {
+            status = requestPhy(connId, data[1], data[2]);
+        }
+        else if (opcode == LINK_OPCODE_DATA_LENGTH && length == 3) {
+            status = requestDataLength(connId, getUint16(data + 1));
+        }
+
+        setRequestStatus(connId, opcode, status);
+        publishReport(connId);
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic, BleConnParam* param) override {
+        const uint16_t connId = bleReadConnId(param);
+        refreshReport(connId);
+
+        LinkParamsReport report;
+        if (copyReport(connId, report)) {
+            pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&report), sizeof(report));
+        }
+    }
+};
+
+LinkControlCallbacks linkControlCallbacks;
+
+} // namespace
+
+void setupLinkControl(BLEServer* pServer, BLEService* pService) {
+    server = pServer;
+
+    characteristic = createBleCharacteristic(
+        pService,
+        LINK_CONTROL_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify
+    );
+    characteristic->setCallbacks(&linkControlCallbacks);
+    trackSubscriptions(characteristic);
+
+#if TESTER_USE_NIMBLE
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onRefreshTimer;
+    timerArgs.name = "link_refresh";
+    esp_timer_create(&timerArgs, &refreshTimer);
+#else
+    addGapEventHandler(handleGapEvent);
+#endif
+}
+
+void onLinkConnected(uint16_t connId, uint16_t interval, uint16_t latency, uint16_t timeout) {
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (!links[i].active) {
+            LinkParamsReport& report = links[i].report;
+            memset(&report, 0, sizeof(report));
+            report.connId = connId;
+            report.interval = interval;
+            report.latency = latency;
+            report.timeout = timeout;
+            report.txPhy = 1; // Every connection starts on the 1M PHY.
+            report.rxPhy = 1;
+            report.txOctets = kMinDataLength;
+            report.rxOctets = kMinDataLength;
+            links[i].active = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    applyDefaults(connId);
+}
+
+void onLinkDisconnected(uint16_t connId) {
+    portENTER_CRITICAL(&lock);
+    LinkState* link = findLink(connId);
+    if (link != nullptr) {
+        link->active = false;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+bool linkParams(uint16_t connId, LinkParamsReport& report) {
+    return copyReport(connId, report);
+}
+
+uint16_t linkConnectionInterval(uint16_t connId) {
+    LinkParamsReport report;
+    return copyReport(connId, report) ? report.interval : 0;
+}
+
+uint16_t linkShortestInterval() {
+    uint16_t shortest = 0;
+    portENTER_CRITICAL(&lock);
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (links[i].active && (shortest == 0 || links[i].report.interval < shortest)) {
+            shortest = links[i].report.interval;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return shortest;
+}
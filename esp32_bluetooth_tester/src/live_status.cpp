@@ -0,0 +1,306 @@
+/**
+ * @file
+ * @brief Implementation of the live status snapshot and the RSSI sampling.
+ *
+ * The status task does all the querying and builds each snapshot in its own buffer, then
+ * copies it into the cache under the lock. onRead() only copies the cache out, so a read
+ * holds the lock for a few hundred bytes of memcpy at most.
+ */
+
+#include "live_status.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "ble_events.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+#include "link_control.h"
+
+namespace {
+
+/// The longest value, a header and a record per connection.
+const size_t kMaxStatusLength = sizeof(LiveStatusHeader) + TESTER_MAX_CONNECTIONS * sizeof(LiveLinkRecord);
+
+static_assert(kMaxStatusLength <= 512, "The live status must fit in an attribute value");
+
+/**
+ * @brief The RSSI history of one connection.
+ */
+struct RssiState {
+    bool active;
+    uint16_t connId;
+    int8_t last;
+    int8_t min;
+    int8_t max;
+    int16_t smoothed16; ///< The smoothed RSSI in sixteenths of a dBm.
+    uint32_t samples;
+    uint32_t failures;
+};
+
+RssiState rssiStates[TESTER_MAX_CONNECTIONS];
+
+uint8_t cached[kMaxStatusLength];
+size_t cachedLength = 0;
+int64_t cachedAtUs = 0;
+
+// Guards rssiStates and the cache, which are updated from the status task and GAP events.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+BLECharacteristic* characteristic = nullptr;
+TaskHandle_t task = nullptr;
+
+std::atomic<uint16_t> refreshMs(LIVE_STATUS_REFRESH_MS);
+
+// Only touched from the status task.
+uint32_t refreshes = 0;
+uint8_t snapshot[kMaxStatusLength];
+
+/**
+ * @brief Returns the RSSI history of a connection, starting a new one if there is room.
+ * Call with the lock held.
+ */
+RssiState* findRssi(uint16_t connId) {
+    RssiState* freeState = nullptr;
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        if (rssiStates[i].active && rssiStates[i].connId == connId) {
+            return &rssiStates[i];
+        }
+        if (!rssiStates[i].active && freeState == nullptr) {
+            freeState = &rssiStates[i];
+        }
+    }
+    if (freeState != nullptr) {
+        freeState->active = true;
+        freeState->connId = connId;
+        freeState->last = LIVE_STATUS_RSSI_UNAVAILABLE;
+        freeState->min = LIVE_STATUS_RSSI_UNAVAILABLE;
+        freeState->max = LIVE_STATUS_RSSI_UNAVAILABLE;
+        freeState->smoothed16 = LIVE_STATUS_RSSI_UNAVAILABLE * 16;
+        freeState->samples = 0;
+        freeState->failures = 0;
+    }
+    return freeState;
+}
+
+/**
+ * @brief Records the outcome of an RSSI read.
+ */
+void recordRssi(uint16_t connId, bool success, int8_t rssi) {
+    portENTER_CRITICAL(&lock);
+    RssiState* state = findRssi(connId);
+    if (state != nullptr && !success) {
+        state->failures++;
+    }
+    else if (state != nullptr) {
+        if (state->samples == 0) {
+            state->min = rssi;
+            state->max = rssi;
+            state->smoothed16 = rssi * 16;
+        }
+        state->last = rssi;
+        state->min = rssi < state->min ? rssi : state->min;
+        state->max = rssi > state->max ? rssi : state->max;
+        state->smoothed16 += (rssi * 16 - state->smoothed16) / 8;
+        state->samples++;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Forgets the RSSI history of connections that are gone. Call with the lock held.
+ */
+void pruneRssiLocked(const PeerConnectionRecord* peers, size_t count) {
+    for (size_t i = 0; i < TESTER_MAX_CONNECTIONS; i++) {
+        bool connected = false;
+        for (size_t j = 0; j < count && !connected; j++) {
+            connected = peers[j].connId == rssiStates[i].connId;
+        }
+        if (rssiStates[i].active && !connected) {
+            rssiStates[i].active = false;
+        }
+    }
+}
+
+#if !TESTER_USE_NIMBLE
+/**
+ * @brief Records the RSSI reads that Bluedroid completes.
+ */
+void handleGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    if (event != ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT) {
+        return;
+    }
+    uint16_t connId = 0;
+    if (connectionForAddress(param->read_rssi_cmpl.remote_addr, &connId)) {
+        recordRssi(connId, param->read_rssi_cmpl.status == ESP_BT_STATUS_SUCCESS, param->read_rssi_cmpl.rssi);
+    }
+}
+#endif
+
+/**
+ * @brief Reads the RSSI of a connection from the controller.
+ */
+void sampleRssi(const PeerConnectionRecord& peer) {
+#if TESTER_USE_NIMBLE
+    int8_t rssi = 0;
+    const int rc = ble_gap_conn_rssi(peer.connId, &rssi);
+    recordRssi(peer.connId, rc == 0, rssi);
+#else
+    // The result arrives in handleGapEvent()
+    esp_bd_addr_t address;
+    memcpy(address, peer.address, sizeof(address));
+    if (esp_ble_gap_read_rssi(address) != ESP_OK) {
+        recordRssi(peer.connId, false, 0);
+    }
+#endif
+}
+
+/**
+ * @brief Takes a new snapshot and replaces the cached one with it.
+ */
+void refresh() {
+    const int64_t startedUs = esp_timer_get_time();
+
+    PeerConnectionRecord peers[TESTER_MAX_CONNECTIONS];
+    const size_t count = connectionRecords(peers, TESTER_MAX_CONNECTIONS);
+    for (size_t i = 0; i < count; i++) {
+        sampleRssi(peers[i]);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        LiveLinkRecord record = {};
+        record.connId = peers[i].connId;
+        record.mtu = peers[i].mtu;
+        record.writes = peers[i].writes;
+        record.notifications = peers[i].notifications;
+
+        LinkParamsReport link;
+        if (linkParams(peers[i].connId, link)) {
+            record.interval = link.interval;
+            record.latency = link.latency;
+            record.timeout = link.timeout;
+            record.txPhy = link.txPhy;
+            record.rxPhy = link.rxPhy;
+            record.txOctets = link.txOctets;
+            record.rxOctets = link.rxOctets;
+        }
+
+        portENTER_CRITICAL(&lock);
+        const RssiState* state = findRssi(peers[i].connId);
+        if (state != nullptr) {
+            record.rssi = state->last;
+            record.rssiSmoothed = state->smoothed16 / 16;
+            record.rssiMin = state->min;
+            record.rssiMax = state->max;
+            record.rssiSamples = state->samples;
+            record.rssiFailures = state->failures;
+        }
+        portEXIT_CRITICAL(&lock);
+        memcpy(snapshot + sizeof(LiveStatusHeader) + i * sizeof(record), &record, sizeof(record));
+    }
+
+    const int64_t now = esp_timer_get_time();
+    LiveStatusHeader header;
+    header.version = LIVE_STATUS_VERSION;
+    header.connections = count;
+    header.refreshMs = refreshMs;
+    header.uptimeMs = now / 1000;
+    header.ageMs = 0;
+    header.refreshes = ++refreshes;
+    header.refreshUs = now - startedUs;
+    header.freeHeap = ESP.getFreeHeap();
+    memcpy(snapshot, &header, sizeof(header));
+
+    const size_t length = sizeof(header) + count * sizeof(LiveLinkRecord);
+    portENTER_CRITICAL(&lock);
+    pruneRssiLocked(peers, count);
+    memcpy(cached, snapshot, length);
+    cachedLength = length;
+    cachedAtUs = now;
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief The FreeRTOS task that refreshes the snapshot, notifies it, and samples the RSSI.
+ *
+ * A notification from a refresh rate change cuts the current wait short.
+ */
+void statusTask(void* parameter) {
+    for (;;) {
+        refresh();
+        if (activeConnectionCount() > 0) {
+            characteristic->setValue(snapshot, cachedLength);
+            notifyCharacteristic(characteristic);
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(refreshMs));
+    }
+}
+
+/**
+ * @class LiveStatusCallbacks
+ * @brief Serves the live status from the cached snapshot.
+ *
+ * @method onWrite
+ * Sets the refresh interval and wakes the status task to apply it.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the cached snapshot and its age.
+ */
+class LiveStatusCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        if (value.length() != 3 || data[0] != LIVE_STATUS_OPCODE_REFRESH) {
+            LOG_WARN("Received unexpected live status command of %u bytes", (unsigned)value.length());
+            return;
+        }
+        const uint16_t ms = data[1] | (data[2] << 8);
+        if (ms < LIVE_STATUS_MIN_REFRESH_MS || ms > LIVE_STATUS_MAX_REFRESH_MS) {
+            LOG_WARN("Live status refresh of %u ms is out of range", ms);
+            return;
+        }
+        refreshMs = ms;
+        xTaskNotifyGive(task);
+        LOG_INFO("Live status refresh set to %u ms", ms);
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        uint8_t value[kMaxStatusLength];
+        portENTER_CRITICAL(&lock);
+        const size_t length = cachedLength;
+        const int64_t takenAtUs = cachedAtUs;
+        memcpy(value, cached, length);
+        portEXIT_CRITICAL(&lock);
+
+        if (length >= sizeof(LiveStatusHeader)) {
+            LiveStatusHeader header;
+            memcpy(&header, value, sizeof(header));
+            header.ageMs = (esp_timer_get_time() - takenAtUs) / 1000;
+            memcpy(value, &header, sizeof(header));
+        }
+        pCharacteristic->setValue(value, length);
+    }
+};
+
+LiveStatusCallbacks liveStatusCallbacks;
+
+} // namespace
+
+void setupLiveStatus(BLEService* pService) {
+    characteristic = createBleCharacteristic(
+        pService,
+        LIVE_STATUS_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify
+    );
+    characteristic->setCallbacks(&liveStatusCallbacks);
+    trackSubscriptions(characteristic);
+
+#if !TESTER_USE_NIMBLE
+    addGapEventHandler(handleGapEvent);
+#endif
+
+    createAppTask(statusTask, "live_status", 3072, nullptr, 1, &task);
+}
@@ -11,37 +11,77 @@
  *      It has two characteristics:
  *        - An open characteristic to turn the LED on to a green color.
  *        - An encrypted characteristic to turn the LED on to a red color.
+ *   3. Measure sustained BLE throughput by streaming MTU-sized notifications
+ *      from a dedicated throughput test characteristic (see throughput_test.h).
+ *   4. Measure write-to-notify latency with an echo characteristic that returns
+ *      every write with on-device timestamps (see echo_test.h).
+ *   5. Stream full or delta-encoded frames to a strip of LED_STRIP_PIXELS Neopixels
+ *      (see led_framebuffer.h).
+ *   6. Optionally generate a large GATT database for load-testing service discovery
+ *      (see gatt_profile.h).
  *
- * The Adafruit Neopixel library is used to control the Neopixel LED, and the ESP32 BLE
- * Arduino library is used for BLE communication.
+ * The Neopixels are driven by the RMT peripheral (see led_strip_rmt.h), and the ESP32 BLE
+ * Arduino library (or NimBLE-Arduino, see ble_backend.h) is used for BLE communication.
+ *
+ * Several clients can be connected at the same time (see connection_registry.h).
  *
  * This implementation is designed to be a practical testing tool to validate
  * and debug Bluetooth communication between a mobile application and IoT devices.
  */
 
 #include <Arduino.h>
-#include <BLEDevice.h>
-#include <BLEServer.h>
-#include <BLEUtils.h>
-#include <BLE2902.h>
-#include <Adafruit_NeoPixel.h>
 
-/*
-  SETUP: Uncomment one of the define statements below depending on the hardware configuration for your
-         ESP32 dev board. If your board is not listed, add another define statement based on the
-         PIN to which the onboard or external Neopixel LED is wired.
-*/
+#include "advertising_profiles.h"
+#include "async_log.h"
+#include "ble_backend.h"
+#include "board_traits.h"
+#include "bonding.h"
+#include "boot_timeline.h"
+#include "connection_registry.h"
+#include "echo_test.h"
+#include "firmware_stats.h"
+#include "indication_tracker.h"
+#include "gatt_profile.h"
+#include "l2cap_coc.h"
+#include "large_payload.h"
+#include "led_animation.h"
+#include "led_command.h"
+#include "led_framebuffer.h"
+#include "led_renderer.h"
+#include "led_route.h"
+#include "link_control.h"
+#include "live_status.h"
+#include "notify_coalescer.h"
+#include "ota_update.h"
+#include "power_manager.h"
+#include "soak_monitor.h"
+#include "state_broadcast.h"
+#include "throughput_test.h"
+#include "trace_recorder.h"
+#include "traffic_generator.h"
+#include "write_sink.h"
+
+// The Unity test suites in test/ bring their own setup() and loop().
+#ifndef PIO_UNIT_TESTING
+
+// The name the tester advertises under.
+#define TESTER_DEVICE_NAME "ESP32_BLE_TESTER"
 
-// On the Bee S3, the onboard Neopixel LED is connected to GPIO48
-//#define LED 48
+// The UUID of the tester service.
+#define TESTER_SERVICE_UUID "abcd1234-1234-1234-1234-1234567890aa"
 
-// On the Adafruit QT Py ESP32 C3, the Neopixel LED is connected to GPIO2
-#define LED 2
+// The number of attribute handles reserved for the tester service. Each characteristic uses
+// two handles plus one per descriptor, so this must grow as characteristics are added.
+#define TESTER_SERVICE_HANDLES 80
 
-// TODO add more common ESP32 dev boards
+// The value the LED characteristics hold while the LEDs are off.
+#define LED_OFF_MESSAGE "LED off"
 
-// Initalize the Neopixel library used to control the LED.
-Adafruit_NeoPixel led = Adafruit_NeoPixel(1, LED, NEO_GRB + NEO_KHZ800);
+// The BLE objects the sketch owns are statically allocated so setup() leaves no heap
+// blocks behind that could fragment the heap over a long run.
+#if !TESTER_USE_NIMBLE
+BLESecurity security;
+#endif
 
 /**
  * @class ServerCallbacks
@@ -53,34 +93,104 @@ Adafruit_NeoPixel led = Adafruit_NeoPixel(1, LED, NEO_GRB + NEO_KHZ800);
  *
  * @method onConnect
  * This method is called when a client device connects to the BLE server.
- * It can be used to perform actions such as logging the connection event or
- * triggering other functionalities on the ESP32.
+ * It logs the connection and adds it to the connection registry, which restarts
+ * advertising so further clients can connect, up to TESTER_MAX_CONNECTIONS, records
+ * its initial link parameters for link control, and starts timing it until the link is
+ * encrypted (see bonding.h).
  *
  * @method onDisconnect
  * This method is called when a client device disconnects from the BLE server.
- * It can be used to handle disconnection events such as logging or resetting
- * specific states on the ESP32.
+ * It logs the disconnection, removes the connection from the registry, link control and
+ * bond timing, aborts an OTA transfer the connection was still sending, and restarts
+ * advertising.
+ *
+ * @method onMtuChanged
+ * This method is called when a client exchanges the ATT MTU. It records the new MTU
+ * for the connection. NimBLE builds name it onMTUChange.
+ *
+ * @method onAuthenticationComplete
+ * NimBLE builds only. This method is called when pairing or encryption completes on a
+ * connection. It records the security level and the pairing or reconnect latency. Bluedroid
+ * builds get the same from GAP events.
  */
 class ServerCallbacks : public BLEServerCallbacks {
-    void onConnect(BLEServer* pServer) {
-        Serial.println("Device connected");
+    void onConnect(BLEServer* pServer, BleConnParam* param) {
+        LOG_INFO("Device connected");
+        statsRecordConnect();
+        registerConnection(bleConnectConnId(param), bleConnectAddress(param));
+        onLinkConnected(bleConnectConnId(param), bleConnectInterval(param),
+                        bleConnectLatency(param), bleConnectTimeout(param));
+        onBondingConnected(bleConnectConnId(param));
     }
 
-    void onDisconnect(BLEServer* pServer) {
-        Serial.println("Device disconnected");
+    void onDisconnect(BLEServer* pServer, BleConnParam* param) {
+        LOG_INFO("Device disconnected");
+        statsRecordDisconnect();
+        onLinkDisconnected(bleDisconnectConnId(param));
+        onBondingDisconnected(bleDisconnectConnId(param));
+        onOtaDisconnected(bleDisconnectConnId(param));
+        unregisterConnection(bleDisconnectConnId(param));
+    }
+
+#if TESTER_USE_NIMBLE
+    void onMTUChange(uint16_t MTU, ble_gap_conn_desc* desc) {
+        recordConnectionMtu(desc->conn_handle, MTU);
+    }
+
+    void onAuthenticationComplete(ble_gap_conn_desc* desc) {
+        if (desc->sec_state.encrypted) {
+            recordConnectionSecurity(desc->conn_handle, desc->sec_state.authenticated
+                ? PeerSecurity::Authenticated
+                : PeerSecurity::Encrypted);
+        }
+        onBondingAuthenticationComplete(desc);
+    }
+#else
+    void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        recordConnectionMtu(param->mtu.conn_id, param->mtu.mtu);
     }
+#endif
 };
 
+ServerCallbacks serverCallbacks;
+
 /**
  * @brief Sets the value of a BLE characteristic to a specified string value.
- * 
+ *
+ * The change is notified only if a client is subscribed, and is coalesced with later
+ * changes if coalescing is enabled for the characteristic (see notify_coalescer.h). Clients
+ * that enabled indications instead get it from the indication task, which times the
+ * confirmation (see indication_tracker.h).
+ *
  * @param pCharacteristic A pointer to the BLECharacteristic object to be updated.
  * @param value The string value to set for the characteristic.
+ * @param length The length of the string value, excluding any terminator.
  */
-void setCharacteristicValue(BLECharacteristic* pCharacteristic, const std::string& value) {
+void setCharacteristicValue(BLECharacteristic* pCharacteristic, const char* value, size_t length) {
     if (pCharacteristic != nullptr) { // Ensure the characteristic pointer is valid.
-        pCharacteristic->setValue(value); // Set the value.
-        pCharacteristic->notify(); // Notify connected clients about the change.
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(const_cast<char*>(value)), length); // Set the value.
+        notifyLatest(pCharacteristic); // Notify subscribed clients about the change.
+        indicateLatest(pCharacteristic); // Indicate it to clients that enabled indications.
+    }
+}
+
+// The dispatch table for the LED characteristics, keyed by characteristic pointer.
+LedRouteTable<2> ledRoutes;
+
+/**
+ * @brief Logs a CCCD value written by a client.
+ *
+ * @param value The CCCD value: bit 0 enables notifications, bit 1 indications.
+ */
+void logSubscription(uint16_t value) {
+    if (value & 0x01) { // Client has enabled notifications
+        LOG_INFO("Notifications enabled");
+    }
+    if (value & 0x02) { // Client has enabled indications
+        LOG_INFO("Indications enabled");
+    }
+    if (value == 0x00) { // Client has disabled both
+        LOG_INFO("Notifications and indications disabled");
     }
 }
 
@@ -94,145 +204,326 @@ void setCharacteristicValue(BLECharacteristic* pCharacteristic, const std::strin
  * @method onWrite
  * This method is called when a write request is received for the BLE characteristics.
  * It handles the following cases:
- *   - When "ON" is written to the open characteristic, it turns the green LED on.
- *   - When "ON" is written to the encrypted characteristic, it turns the red LED on.
- *   - When "OFF" is written to either characteristic, it turns both LEDs off.
- *   - When any other value is written, it logs the unexpected value to the serial console.
+ *   - When "ON" (or opcode 0x01) is written to the open characteristic, it turns the green LED on.
+ *   - When "ON" (or opcode 0x01) is written to the encrypted characteristic, it turns the red LED on.
+ *   - When "OFF" (or opcode 0x00) is written to either characteristic, it turns both LEDs off.
+ *   - When any other value is written, it logs the unexpected value.
  *
- * The method identifies the characteristic that was written to by comparing the characteristic's
- * UUID, and then it checks the written value to determine the appropriate action to take.
+ * The method identifies the characteristic that was written to through the dispatch table
+ * built in setup() (see led_route.h), and decodes the written bytes in place with parseLedCommand(), so no
+ * UUIDs are constructed and nothing is allocated per write. The LED itself is updated by
+ * the render task (see led_renderer.h), so the BLE task never waits on the strip. The new
+ * LED state is also broadcast in the advertising payloads (see state_broadcast.h).
  */
-class Callbacks : public BLECharacteristicCallbacks {
+class Callbacks : public TrackedCharacteristicCallbacks {
     void onWrite(BLECharacteristic* pCharacteristic) {
-        std::string value = pCharacteristic->getValue();
-        if (value == "ON") {
-            if (pCharacteristic->getUUID().equals(BLEUUID("abcd1234-1234-1234-1234-1234567890ab"))) {
-                led.setPixelColor(0, led.Color(0, 255, 0)); // Green LED
-                led.show(); 
-                Serial.println("Green LED on");
-                setCharacteristicValue(pCharacteristic, "Green LED on");
-            }
-            else if (pCharacteristic->getUUID().equals(BLEUUID("abcd1234-1234-1234-1234-1234567890ac"))) {
-                led.setPixelColor(0, led.Color(255, 0, 0)); // Red LED
-                led.show(); 
-                Serial.println("Red LED on");
-                setCharacteristicValue(pCharacteristic, "Red LED on");
-            }
+        const LedRoute* route = ledRoutes.find(pCharacteristic);
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        const LedCommand command = parseLedCommand(data, length);
+
+        if (route != nullptr && command == LedCommand::On) {
+            postLedColor(route->onColor);
+            setBroadcastLedState(route->onState);
+            LOG_DEBUG("%s", route->onMessage);
+            setCharacteristicValue(pCharacteristic, route->onMessage, route->onMessageLength);
         }
-        else if (value == "OFF") {
-            led.setPixelColor(0, led.Color(0, 0, 0)); // Off
-            led.show(); 
-            Serial.println("LED off");
-            setCharacteristicValue(pCharacteristic, "LED off");
+        else if (route != nullptr && command == LedCommand::Off) {
+            postLedColor(ledColor(0, 0, 0)); // Off
+            setBroadcastLedState(BroadcastLedState::Off);
+            LOG_DEBUG(LED_OFF_MESSAGE);
+            setCharacteristicValue(pCharacteristic, LED_OFF_MESSAGE, sizeof(LED_OFF_MESSAGE) - 1);
         } 
         else {
-          Serial.print("Received unexpected value: ");
-          Serial.println(value.c_str());
+            LOG_WARN("Received unexpected value: %.*s", (int)length, reinterpret_cast<const char*>(data));
         }
     }
+
+#if TESTER_USE_NIMBLE
+    // NimBLE reports CCCD writes here rather than through descriptor callbacks.
+    void onSubscribe(BLECharacteristic* pCharacteristic, ble_gap_conn_desc* desc, uint16_t subValue) {
+        TrackedCharacteristicCallbacks::onSubscribe(pCharacteristic, desc, subValue);
+        logSubscription(subValue);
+    }
+#endif
 };
 
+// Both LED characteristics share one callbacks object that dispatches on the characteristic
+Callbacks ledCallbacks;
+
 /**
  * @class DescriptorCallbacks
  * @brief A class to handle BLE descriptor read and write events.
  *
  * This class extends the BLEDescriptorCallbacks class and overrides its onWrite method
- * to provide custom behavior for enabling or disabling notifications on the BLE characteristics.
+ * to provide custom behavior for enabling or disabling notifications and indications on the
+ * BLE characteristics.
  *
  * @method onWrite
  * This method is called when a write request is received for the BLE2902 descriptor,
- * which is the standard descriptor for enabling or disabling notifications.
+ * which is the standard descriptor for enabling or disabling notifications and indications.
  * It handles the following cases:
- *   - When a value of 0x01 is written to the descriptor, it means the client has enabled notifications.
- *     The method will print "Notifications enabled" to the serial console.
- *   - When a value of 0x00 is written to the descriptor, it means the client has disabled notifications.
- *     The method will print "Notifications disabled" to the serial console.
- *
- * The method checks the written value to determine if notifications have been enabled or disabled.
+ *   - When bit 0 (0x01) is set, the client has enabled notifications: "Notifications enabled".
+ *   - When bit 1 (0x02) is set, the client has enabled indications: "Indications enabled".
+ *   - When 0x00 is written, the client has disabled both: "Notifications and indications disabled".
+ * NimBLE builds do not use descriptor callbacks; Callbacks::onSubscribe logs the same events.
+ * The per-connection CCCD state itself is recorded by the connection registry, which
+ * notifyCharacteristic() consults to skip notifications nobody is subscribed to.
  */
+#if !TESTER_USE_NIMBLE
 class DescriptorCallbacks : public BLEDescriptorCallbacks {
     void onWrite(BLEDescriptor* pDescriptor) {
-        uint8_t* data = pDescriptor->getValue();
-        if (data[0] == 0x01) { // Client has enabled notifications
-            Serial.println("Notifications enabled");
-        } else if (data[0] == 0x00) { // Client has disabled notifications
-            Serial.println("Notifications disabled");
-        }
+        const uint8_t* data = pDescriptor->getValue();
+        logSubscription(data[0]);
     }
 };
 
-void setup() {
-    // Initialize the LED via the Neopixel library
-    led.begin();
+DescriptorCallbacks descriptorCallbacks;
+#endif
 
-    // Set the LED brightness
-    led.setBrightness(50);
+/**
+ * @brief Attaches DescriptorCallbacks to the notification descriptor of a characteristic.
+ *
+ * @param pCharacteristic A pointer to a characteristic created with createBleCharacteristic().
+ */
+void addNotificationLogging(BLECharacteristic* pCharacteristic) {
+#if !TESTER_USE_NIMBLE
+    pCharacteristic->getDescriptorByUUID(BLEUUID((uint16_t)0x2902))->setCallbacks(&descriptorCallbacks);
+#endif
+}
 
-    // Initialize the LED s to 'off'
-    led.show(); 
+/**
+ * @brief Initializes the Neopixel strip and starts the render task.
+ */
+void setupLed() {
+    // Drive the strip from the RMT peripheral and hand it over to the render task
+    setupLedRenderer(kBoard.ledPin);
+    markBootPhase(BootPhase::LedReady);
+}
 
+/**
+ * @brief Starts the serial console and the asynchronous logger.
+ */
+void setupConsole() {
     Serial.begin(115200);
 
+    // Move console output off the BLE task
+    setupAsyncLog();
+    markBootPhase(BootPhase::ConsoleReady);
+}
+
+/**
+ * @brief Creates the services beside the tester service: the generated load-test services,
+ * if any, OTA and the traffic generator.
+ */
+void setupSecondaryServices(BLEServer* pServer) {
+    // Generate the load-test services of the profile
+    startGattProfile(pServer);
+
+    // Create and start the OTA update service
+    setupOtaUpdate(pServer);
+
+    // Create and start the traffic generator service
+    setupTrafficGenerator(pServer);
+}
+
+void setup() {
+    markBootPhase(BootPhase::SetupEntered);
+
+    // In fast boot builds the LED, the console and everything outside the tester service
+    // wait until the device is connectable (see boot_timeline.h)
+#if !TESTER_FAST_BOOT
+    setupLed();
+    setupConsole();
+#endif
+
     // Create the BLE Device
-    BLEDevice::init("ESP32_BLE_TESTER");
+    BLEDevice::init(TESTER_DEVICE_NAME);
+    markBootPhase(BootPhase::StackReady);
+
+    // Allow clients to negotiate the largest ATT MTU so notifications can carry full payloads
+    BLEDevice::setMTU(517);
 
-    // Configure BLE Security settings
-    BLESecurity *pSecurity = new BLESecurity();
-    pSecurity->setCapability(ESP_IO_CAP_NONE);
-    pSecurity->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_ONLY);
+    // Configure BLE Security settings. Bonds are stored in NVS, so reconnecting clients
+    // encrypt with the stored keys instead of pairing again (see bonding.h).
+#if TESTER_USE_NIMBLE
+    NimBLEDevice::setSecurityIOCap(BLE_HS_IO_NO_INPUT_OUTPUT);
+    NimBLEDevice::setSecurityAuth(true, false, true); // Bonding, no MITM, Secure Connections
+#else
+    security.setCapability(ESP_IO_CAP_NONE);
+    security.setAuthenticationMode(ESP_LE_AUTH_REQ_SC_BOND);
+    // Exchange identity keys too, so clients with private addresses are recognized later
+    security.setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+    security.setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+#endif
+    markBootPhase(BootPhase::SecurityReady);
 
     // Create the BLE Server
     BLEServer *pServer = BLEDevice::createServer();
-    pServer->setCallbacks(new ServerCallbacks());
+    setBleServerCallbacks(pServer, &serverCallbacks);
 
     // Create the BLE Service
-    BLEService *pService = pServer->createService("abcd1234-1234-1234-1234-1234567890aa");
+    BLEService *pService = createBleService(pServer, TESTER_SERVICE_UUID, TESTER_SERVICE_HANDLES);
 
     // Create the open BLE characteristic
-    BLECharacteristic *pOpenCharacteristic = pService->createCharacteristic(
+    BLECharacteristic *pOpenCharacteristic = createBleCharacteristic(
+        pService,
         "abcd1234-1234-1234-1234-1234567890ab",
-        BLECharacteristic::PROPERTY_READ |
-        BLECharacteristic::PROPERTY_WRITE |
-        BLECharacteristic::PROPERTY_NOTIFY
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify |
+        BleProperty::kIndicate
     );
 
     // Set initial value for the open BLE characteristic
-    pOpenCharacteristic->setValue("LED off");
+    pOpenCharacteristic->setValue(LED_OFF_MESSAGE);
 
     // Set callbacks on the open BLE characteristic
-    pOpenCharacteristic->setCallbacks(new Callbacks());
-    BLEDescriptor* pOpenNotificationDescriptor = new BLE2902();
-    pOpenNotificationDescriptor->setCallbacks(new DescriptorCallbacks());
-    pOpenCharacteristic->addDescriptor(pOpenNotificationDescriptor);
+    pOpenCharacteristic->setCallbacks(&ledCallbacks);
+    ledRoutes.add(pOpenCharacteristic, ledColor(0, 255, 0), BroadcastLedState::Green, "Green LED on"); // Green LED
+    addNotificationLogging(pOpenCharacteristic);
+    trackSubscriptions(pOpenCharacteristic);
 
-    // Create the encrypted BLE Characteristic
-    BLECharacteristic *pEncryptedCharacteristic = pService->createCharacteristic(
+    // Create the encrypted BLE Characteristic, which uses Just Works pairing
+    BLECharacteristic *pEncryptedCharacteristic = createBleCharacteristic(
+        pService,
         "abcd1234-1234-1234-1234-1234567890ac",
-        BLECharacteristic::PROPERTY_READ |
-        BLECharacteristic::PROPERTY_WRITE |
-        BLECharacteristic::PROPERTY_NOTIFY
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify |
+        BleProperty::kIndicate,
+        true
     );
 
     // Set initial value for the encrypted BLE characteristic
-    pEncryptedCharacteristic->setValue("LED off");
-
-    // Set up security on the encrypted characteristic to utilize Just Works pairing
-    pEncryptedCharacteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENCRYPTED | ESP_GATT_PERM_WRITE_ENCRYPTED);
+    pEncryptedCharacteristic->setValue(LED_OFF_MESSAGE);
 
     // Set callbacks on the encrypted characteristic
-    pEncryptedCharacteristic->setCallbacks(new Callbacks());
-    BLEDescriptor* pEncryptedNotificationDescriptor = new BLE2902();
-    pEncryptedNotificationDescriptor->setCallbacks(new DescriptorCallbacks());
-    pEncryptedCharacteristic->addDescriptor(pEncryptedNotificationDescriptor);
+    pEncryptedCharacteristic->setCallbacks(&ledCallbacks);
+    ledRoutes.add(pEncryptedCharacteristic, ledColor(255, 0, 0), BroadcastLedState::Red, "Red LED on"); // Red LED
+    addNotificationLogging(pEncryptedCharacteristic);
+    trackSubscriptions(pEncryptedCharacteristic);
+
+    // Send rapid LED changes at most once per connection interval
+    if (TESTER_NOTIFY_COALESCING) {
+        enableNotifyCoalescing(pOpenCharacteristic);
+        enableNotifyCoalescing(pEncryptedCharacteristic);
+    }
+
+    // Create the connection registry characteristic
+    setupConnectionRegistry(pServer, pService);
+
+    // Create the indication stats characteristic and start the indication task
+    setupIndicationTracker(pService);
+
+    // Create the throughput test characteristic
+    setupThroughputTest(pServer, pService);
+
+    // Create the L2CAP characteristic and listen for L2CAP channels, for comparison with GATT throughput
+    setupL2capCoc(pService);
+
+    // Create the echo latency test characteristics
+    setupEchoTest(pService);
+
+    // Create the link control characteristic
+    setupLinkControl(pServer, pService);
+
+    // Create the write-without-response sink characteristics
+    setupWriteSink(pService);
+
+    // Create the LED framebuffer characteristic
+    setupLedFramebuffer(pService);
+
+    // Create the LED animation characteristic
+    setupLedAnimation(pService);
+
+    // Create the large payload transfer characteristics
+    setupLargePayload(pService);
+
+    // Create the bonds characteristic
+    setupBonding(pService);
+
+    // Create the firmware stats characteristic
+    setupFirmwareStats(pService);
+
+    // Create the soak characteristic and start sampling the soak time series
+    setupSoakMonitor(pService);
+
+    // Create the trace characteristics
+    setupTraceRecorder(pServer, pService);
+
+    // Create the live status characteristic and start sampling the link quality
+    setupLiveStatus(pService);
+
+    // Create the boot timeline characteristic
+    setupBootTimeline(pService);
+
+    // Apply the power configuration and create the power stats characteristic
+    setupPowerManager(pService);
+
+    // Advertise the service UUID and create the advertising control characteristic
+    setupAdvertisingProfiles(pService, TESTER_SERVICE_UUID, TESTER_DEVICE_NAME);
+
+    // Put the LED state and a stats digest in the advertising payloads
+    setupStateBroadcast();
+
+    // Create the profile info characteristic
+    setupGattProfile(pService);
 
     // Start the service
     pService->start();
 
-    // Start advertising
-    pServer->getAdvertising()->start();
-    Serial.println("BLE advertising started");
+    // NimBLE fixes the attribute table when advertising starts, so fast boot builds only
+    // move the other services after it on Bluedroid
+#if !TESTER_FAST_BOOT || TESTER_USE_NIMBLE
+    setupSecondaryServices(pServer);
+#endif
+#if !TESTER_FAST_BOOT
+    startTraceRecorder();
+#endif
+    markBootPhase(BootPhase::GattReady);
+
+    // Start advertising, beginning with the fast discovery burst of the profile
+    startProfileAdvertising(true);
+    const int64_t advertisingStartedAt = esp_timer_get_time();
+    markBootPhase(BootPhase::Advertising);
+
+#if TESTER_FAST_BOOT
+    setupLed();
+    setupConsole();
+#endif
+    LOG_INFO("BLE advertising started");
+
+#if TESTER_FAST_BOOT
+    // Bluedroid adds services to a running server and tells connected clients with a
+    // Service Changed indication
+#if !TESTER_USE_NIMBLE
+    setupSecondaryServices(pServer);
+#endif
+    startTraceRecorder();
+#endif
+
+    // Report the footprint of this build so the BLE backends can be compared. This bypasses
+    // the log level so that perf builds, which compile logging out, still print it.
+    Serial.printf("Boot report: board=%s cores=%u backend=%s time_to_advertise_ms=%u free_heap=%u min_free_heap=%u sketch_size=%u\n",
+                  kBoard.name,
+                  kBoard.cores,
+                  BLE_BACKEND_NAME,
+                  (uint32_t)(advertisingStartedAt / 1000),
+                  ESP.getFreeHeap(),
+                  ESP.getMinFreeHeap(),
+                  ESP.getSketchSize());
+    printHeapReport();
+
+    markBootPhase(BootPhase::SetupDone);
+    printBootTimeline();
 }
 
 void loop() {
-    delay(2000); // A delay to keep the loop from running wild.
-}
\ No newline at end of file
+    // Everything runs in callbacks and tasks, so the loop task is not needed. Deleting it
+    // frees its stack and stops it from waking the CPU.
+    vTaskDelete(nullptr);
+}
+
+#endif // PIO_UNIT_TESTING
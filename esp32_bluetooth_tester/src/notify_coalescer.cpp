@@ -0,0 +1,136 @@
+/**
+ * @file
+ * @brief Implementation of notification coalescing.
+ */
+
+#include "notify_coalescer.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "connection_registry.h"
+#include "firmware_stats.h"
+#include "link_control.h"
+
+namespace {
+
+/// The window used before link control knows any connection interval: 7.5 ms, the shortest
+/// interval allowed by the specification.
+const uint16_t kFallbackInterval = 6;
+
+/**
+ * @brief The coalescing state of one characteristic.
+ */
+struct CoalescedCharacteristic {
+    BLECharacteristic* characteristic;
+    esp_timer_handle_t timer;
+    int64_t lastNotifyUs;
+    bool pending;
+};
+
+CoalescedCharacteristic slots[NOTIFY_COALESCING_MAX];
+size_t slotCount = 0;
+
+// Guards the slots, which are updated from the BLE task and the esp_timer task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Returns the coalescing state of a characteristic, or nullptr.
+ */
+CoalescedCharacteristic* findSlot(const BLECharacteristic* pCharacteristic) {
+    for (size_t i = 0; i < slotCount; i++) {
+        if (slots[i].characteristic == pCharacteristic) {
+            return &slots[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Returns the coalescing window in microseconds.
+ */
+int64_t windowUs() {
+    uint16_t interval = linkShortestInterval();
+    if (interval == 0) {
+        interval = kFallbackInterval;
+    }
+    return (int64_t)interval * 1250;
+}
+
+/**
+ * @brief Sends the latest value of a characteristic once its deferral has expired.
+ */
+void onDeferredNotify(void* arg) {
+    CoalescedCharacteristic* slot = static_cast<CoalescedCharacteristic*>(arg);
+
+    portENTER_CRITICAL(&lock);
+    slot->pending = false;
+    slot->lastNotifyUs = esp_timer_get_time();
+    portEXIT_CRITICAL(&lock);
+
+    notifyCharacteristic(slot->characteristic);
+}
+
+} // namespace
+
+bool enableNotifyCoalescing(BLECharacteristic* pCharacteristic) {
+    if (slotCount >= NOTIFY_COALESCING_MAX) {
+        return false;
+    }
+    CoalescedCharacteristic& slot = slots[slotCount];
+    slot.characteristic = pCharacteristic;
+    slot.lastNotifyUs = 0;
+    slot.pending = false;
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onDeferredNotify;
+    timerArgs.arg = &slot;
+    timerArgs.name = "notify_coalesce";
+    if (esp_timer_create(&timerArgs, &slot.timer) != ESP_OK) {
+        return false;
+    }
+    slotCount++;
+    return true;
+}
+
+void notifyLatest(BLECharacteristic* pCharacteristic) {
+    CoalescedCharacteristic* slot = findSlot(pCharacteristic);
+    if (slot == nullptr) {
+        notifyCharacteristic(pCharacteristic);
+        return;
+    }
+    if (!hasSubscribers(pCharacteristic)) {
+        return;
+    }
+
+    const int64_t now = esp_timer_get_time();
+    const int64_t window = windowUs();
+    bool sendNow = false;
+    bool superseded = false;
+    int64_t delayUs = 0;
+
+    portENTER_CRITICAL(&lock);
+    if (slot->pending) {
+        // The deferred notification will pick up this value instead of the previous one.
+        superseded = true;
+    }
+    else if (now - slot->lastNotifyUs >= window) {
+        slot->lastNotifyUs = now;
+        sendNow = true;
+    }
+    else {
+        slot->pending = true;
+        delayUs = window - (now - slot->lastNotifyUs);
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (superseded) {
+        statsRecordCoalescedNotification();
+    }
+    else if (sendNow) {
+        notifyCharacteristic(pCharacteristic);
+    }
+    else {
+        esp_timer_start_once(slot->timer, delayUs);
+    }
+}
@@ -0,0 +1,569 @@
+/**
+ * @file
+ * @brief Implementation of the BLE OTA service.
+ *
+ * The BLE task receives packets into the fill buffer and hands each full buffer to the
+ * flash writer task with a task notification bit. The writer task owns the OTA handle and
+ * makes every esp_ota call, so a slow flash erase never blocks the BLE task. Acks can be
+ * sent by either task, whichever frees up room for the next window, so the control
+ * notification is guarded by a mutex.
+ */
+
+#include "ota_update.h"
+
+#include <Arduino.h>
+#include <esp_ota_ops.h>
+#include <freertos/semphr.h>
+#include <string.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "bonding.h"
+#include "connection_registry.h"
+
+namespace {
+
+static_assert(OTA_BUFFER_BYTES >= 1024, "Each OTA buffer must hold two windows of full packets");
+
+/// The number of attribute handles reserved for the OTA service.
+const uint32_t kServiceHandles = 12;
+
+/// The length of the sequence number at the start of every data packet.
+const size_t kSequenceLength = 2;
+
+/// The largest packet payload a client may announce.
+const uint16_t kMaxPacketPayload = 512;
+
+/// The delay between finishing an update and rebooting into it.
+const uint32_t kRebootDelayMs = 1000;
+
+/// Passed to sendNotification() to notify every subscribed connection.
+const uint16_t kAllConnections = 0xFFFF;
+
+// Notification bits for the writer task.
+const uint32_t kBeginBit = 1 << 0;
+const uint32_t kFinishBit = 1 << 1;
+const uint32_t kAbortBit = 1 << 2;
+const uint32_t kBufferBits[2] = {1 << 3, 1 << 4};
+
+uint8_t buffers[2][OTA_BUFFER_BYTES];
+std::atomic<bool> bufferBusy[2];
+std::atomic<uint32_t> bufferLength[2];
+
+TaskHandle_t writerTask = nullptr;
+BLECharacteristic* pControlCharacteristic = nullptr;
+SemaphoreHandle_t notifyMutex = nullptr;
+StaticSemaphore_t notifyMutexBuffer;
+
+std::atomic<uint8_t> state(static_cast<uint8_t>(OtaState::Idle));
+std::atomic<bool> rebootRequested(false);
+
+// Written by the BLE task.
+uint16_t ownerConnId = 0;
+uint32_t imageSize = 0;
+uint16_t window = 0;
+uint16_t packetPayload = 0;
+uint16_t packetsSinceAck = 0;
+bool nackSent = false;
+std::atomic<uint8_t> fillIndex(0);
+std::atomic<uint32_t> fillLength(0);
+std::atomic<uint16_t> expectedSequence(0);
+std::atomic<uint32_t> received(0);
+int64_t readyUs = 0;
+int64_t lastPacketUs = 0;
+
+// The pending ack and the stall it causes, shared by both tasks under the spinlock.
+portMUX_TYPE ackMux = portMUX_INITIALIZER_UNLOCKED;
+bool ackPending = false;
+int64_t stallStartedUs = 0;
+
+// Owned by the writer task.
+esp_ota_handle_t otaHandle = 0;
+const esp_partition_t* pPartition = nullptr;
+
+std::atomic<uint32_t> written(0);
+std::atomic<uint32_t> packets(0);
+std::atomic<uint32_t> droppedPackets(0);
+std::atomic<uint32_t> acks(0);
+std::atomic<uint32_t> flashWriteUs(0);
+std::atomic<uint32_t> maxFlashWriteUs(0);
+std::atomic<uint32_t> stallUs(0);
+std::atomic<int32_t> lastError(0);
+
+/**
+ * @brief Notifies the control characteristic to one connection, or to every subscriber.
+ * Safe to call from both tasks.
+ */
+void sendNotification(OtaNotificationType type, uint16_t connId) {
+    OtaNotification notification;
+    notification.type = static_cast<uint8_t>(type);
+    notification.state = state;
+    notification.nextSequence = expectedSequence;
+    notification.received = received;
+    notification.window = window;
+
+    xSemaphoreTake(notifyMutex, portMAX_DELAY);
+    pControlCharacteristic->setValue(reinterpret_cast<uint8_t*>(&notification), sizeof(notification));
+    if (connId == kAllConnections) {
+        notifyCharacteristic(pControlCharacteristic);
+    } else {
+        notifyConnection(pControlCharacteristic, connId);
+    }
+    xSemaphoreGive(notifyMutex);
+}
+
+void setState(OtaState newState) {
+    state = static_cast<uint8_t>(newState);
+    sendNotification(OtaNotificationType::Status, kAllConnections);
+}
+
+/**
+ * @brief Returns the number of bytes that can be received without waiting for flash.
+ *
+ * A fill buffer that is already full has been handed to the writer, and the next packet
+ * goes into the other buffer once the writer has released it.
+ */
+uint32_t freeSpace() {
+    uint32_t space = OTA_BUFFER_BYTES - fillLength;
+    if (!bufferBusy[fillIndex ^ 1]) {
+        space += OTA_BUFFER_BYTES;
+    }
+    return space;
+}
+
+/**
+ * @brief Sends the pending ack if there is room for two more windows, or if the whole
+ * image has arrived. Otherwise starts timing the stall.
+ */
+void sendAckIfRoom() {
+    const int64_t now = esp_timer_get_time();
+    bool due;
+    portENTER_CRITICAL(&ackMux);
+    due = ackPending &&
+          (received == imageSize || freeSpace() >= 2u * window * packetPayload);
+    if (due) {
+        ackPending = false;
+        if (stallStartedUs != 0) {
+            stallUs += now - stallStartedUs;
+            stallStartedUs = 0;
+        }
+    }
+    else if (ackPending && stallStartedUs == 0) {
+        stallStartedUs = now;
+    }
+    portEXIT_CRITICAL(&ackMux);
+
+    if (due) {
+        acks++;
+        sendNotification(OtaNotificationType::Ack, ownerConnId);
+    }
+}
+
+/**
+ * @brief Hands the fill buffer to the writer task. Called from the BLE task.
+ */
+void handOffFillBuffer() {
+    const uint8_t index = fillIndex;
+    bufferLength[index] = fillLength.load();
+    bufferBusy[index] = true;
+    xTaskNotify(writerTask, kBufferBits[index], eSetBits);
+}
+
+/**
+ * @brief Copies a payload into the buffers, moving on to the other buffer as each fills.
+ *
+ * @return false if there is not enough free space.
+ */
+bool storePayload(const uint8_t* data, size_t length) {
+    if (length > freeSpace()) {
+        return false;
+    }
+    while (length > 0) {
+        if (fillLength == OTA_BUFFER_BYTES) {
+            fillIndex = fillIndex ^ 1;
+            fillLength = 0;
+        }
+        const size_t room = OTA_BUFFER_BYTES - fillLength;
+        const size_t count = length < room ? length : room;
+        memcpy(buffers[fillIndex] + fillLength, data, count);
+        fillLength += count;
+        data += count;
+        length -= count;
+        if (fillLength == OTA_BUFFER_BYTES) {
+            handOffFillBuffer();
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Abandons the OTA partition after an error. Called from the writer task.
+ */
+void fail(esp_err_t error, const char* step) {
+    lastError = error;
+    if (otaHandle != 0) {
+        esp_ota_abort(otaHandle);
+        otaHandle = 0;
+    }
+    LOG_ERROR("OTA %s failed: %s", step, esp_err_to_name(error));
+    setState(OtaState::Failed);
+}
+
+/**
+ * @brief Writes one buffer to flash and releases it. Called from the writer task.
+ */
+void writeBuffer(uint8_t index) {
+    if (static_cast<OtaState>(state.load()) != OtaState::Receiving &&
+        static_cast<OtaState>(state.load()) != OtaState::Finishing) {
+        bufferBusy[index] = false;
+        return;
+    }
+
+    const int64_t started = esp_timer_get_time();
+    const esp_err_t error = esp_ota_write(otaHandle, buffers[index], bufferLength[index]);
+    const uint32_t elapsedUs = esp_timer_get_time() - started;
+    flashWriteUs += elapsedUs;
+    if (elapsedUs > maxFlashWriteUs) {
+        maxFlashWriteUs = elapsedUs;
+    }
+
+    written += bufferLength[index];
+    bufferBusy[index] = false;
+    if (error != ESP_OK) {
+        fail(error, "write");
+        return;
+    }
+    sendAckIfRoom();
+}
+
+/**
+ * @brief Validates the image and selects it for the next boot. Called from the writer task.
+ */
+void finishUpdate() {
+    esp_err_t error = esp_ota_end(otaHandle);
+    otaHandle = 0;
+    if (error != ESP_OK) {
+        fail(error, "validation");
+        return;
+    }
+    error = esp_ota_set_boot_partition(pPartition);
+    if (error != ESP_OK) {
+        fail(error, "boot partition");
+        return;
+    }
+    LOG_INFO("OTA update of %u bytes written", written.load());
+    setState(OtaState::Done);
+
+    if (rebootRequested) {
+        vTaskDelay(pdMS_TO_TICKS(kRebootDelayMs));
+        esp_restart();
+    }
+}
+
+/**
+ * @brief The FreeRTOS task that makes every esp_ota call, in the order the BLE task
+ * requested them.
+ */
+void otaWriterTask(void* parameter) {
+    uint32_t pendingBits = 0;
+    uint8_t nextBuffer = 0;
+
+    for (;;) {
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+        pendingBits |= bits;
+
+        if (pendingBits & (kBeginBit | kAbortBit)) {
+            if (otaHandle != 0) {
+                esp_ota_abort(otaHandle);
+                otaHandle = 0;
+            }
+            bufferBusy[0] = false;
+            bufferBusy[1] = false;
+            nextBuffer = 0;
+            const bool begin = (pendingBits & kBeginBit) != 0;
+            pendingBits = 0;
+            if (!begin) {
+                continue;
+            }
+
+            pPartition = esp_ota_get_next_update_partition(nullptr);
+            if (pPartition == nullptr) {
+                fail(ESP_ERR_NOT_FOUND, "partition lookup");
+                continue;
+            }
+            // Sequential writes erase each sector just before it is written, instead of
+            // erasing the whole partition up front
+            const esp_err_t error = esp_ota_begin(pPartition, OTA_WITH_SEQUENTIAL_WRITES, &otaHandle);
+            if (error != ESP_OK) {
+                otaHandle = 0;
+                fail(error, "begin");
+                continue;
+            }
+            readyUs = esp_timer_get_time();
+            setState(OtaState::Receiving);
+        }
+
+        // Buffers are always handed off alternately, so write them in that order
+        while (pendingBits & kBufferBits[nextBuffer]) {
+            pendingBits &= ~kBufferBits[nextBuffer];
+            writeBuffer(nextBuffer);
+            nextBuffer ^= 1;
+        }
+
+        if ((pendingBits & kFinishBit) && !(pendingBits & (kBufferBits[0] | kBufferBits[1]))) {
+            pendingBits &= ~kFinishBit;
+            if (static_cast<OtaState>(state.load()) == OtaState::Finishing) {
+                finishUpdate();
+            }
+        }
+    }
+}
+
+/**
+ * @brief Returns true if a connection may start a transfer: its link is authenticated, or
+ * was encrypted with the keys of a bond stored before it connected.
+ */
+bool mayStartTransfer(uint16_t connId) {
+    return connectionSecurity(connId) == PeerSecurity::Authenticated || bondingReconnected(connId);
+}
+
+/**
+ * @brief Drops the partition being written and returns to Idle.
+ */
+void abortTransfer() {
+    xTaskNotify(writerTask, kAbortBit, eSetBits);
+    setState(OtaState::Idle);
+}
+
+/**
+ * @brief Returns true while a transfer is being prepared, received or finished.
+ */
+bool transferInProgress() {
+    const OtaState current = static_cast<OtaState>(state.load());
+    return current == OtaState::Preparing || current == OtaState::Receiving || current == OtaState::Finishing;
+}
+
+/**
+ * @brief Starts a transfer. Called from the BLE task.
+ */
+void beginTransfer(uint16_t connId, const uint8_t* data) {
+    ownerConnId = connId;
+    imageSize = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    const uint16_t requestedWindow = data[4] | (data[5] << 8);
+    packetPayload = data[6] | (data[7] << 8);
+
+    // Two windows have to fit in one buffer, so the writer can always make room
+    const uint16_t largestWindow = OTA_BUFFER_BYTES / (2 * packetPayload);
+    window = requestedWindow < largestWindow ? requestedWindow : largestWindow;
+    if (window == 0) {
+        window = 1;
+    }
+
+    packetsSinceAck = 0;
+    nackSent = false;
+    fillIndex = 0;
+    fillLength = 0;
+    expectedSequence = 0;
+    received = 0;
+    written = 0;
+    packets = 0;
+    droppedPackets = 0;
+    acks = 0;
+    flashWriteUs = 0;
+    maxFlashWriteUs = 0;
+    stallUs = 0;
+    lastError = 0;
+    lastPacketUs = 0;
+    portENTER_CRITICAL(&ackMux);
+    ackPending = false;
+    stallStartedUs = 0;
+    portEXIT_CRITICAL(&ackMux);
+
+    state = static_cast<uint8_t>(OtaState::Preparing);
+    LOG_INFO("OTA update started: size=%u window=%u payload=%u", imageSize, window, packetPayload);
+    xTaskNotify(writerTask, kBeginBit, eSetBits);
+}
+
+/**
+ * @class ControlCallbacks
+ * @brief Starts, finishes and aborts transfers.
+ *
+ * @method onConnectionWrite
+ * Checks that the writing connection may issue the command, decodes it and hands the work
+ * to the writer task.
+ */
+class ControlCallbacks : public TrackedCharacteristicCallbacks {
+    void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) override {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+
+        if (length > 0 && data[0] == OTA_OPCODE_BEGIN && !mayStartTransfer(connId)) {
+            LOG_WARN("OTA update refused: connection %u is neither authenticated nor a bonded reconnect", connId);
+            sendNotification(OtaNotificationType::Refused, connId);
+            return;
+        }
+        if (length > 0 && transferInProgress() && connId != ownerConnId) {
+            LOG_WARN("OTA command refused: connection %u does not own the transfer", connId);
+            sendNotification(OtaNotificationType::Refused, connId);
+            return;
+        }
+
+        if (length == 9 && data[0] == OTA_OPCODE_BEGIN) {
+            const uint16_t payload = data[7] | (data[8] << 8);
+            if (payload == 0 || payload > kMaxPacketPayload) {
+                LOG_WARN("Invalid OTA packet payload %u", payload);
+                return;
+            }
+            beginTransfer(connId, data + 1);
+        }
+        else if (length == 2 && data[0] == OTA_OPCODE_FINISH) {
+            if (static_cast<OtaState>(state.load()) != OtaState::Receiving || received != imageSize) {
+                // Tell the client where to resume
+                sendNotification(OtaNotificationType::Nack, ownerConnId);
+                return;
+            }
+            rebootRequested = data[1] != 0;
+            if (fillLength > 0 && fillLength < OTA_BUFFER_BYTES) {
+                handOffFillBuffer();
+            }
+            state = static_cast<uint8_t>(OtaState::Finishing);
+            xTaskNotify(writerTask, kFinishBit, eSetBits);
+        }
+        else if (length == 1 && data[0] == OTA_OPCODE_ABORT) {
+            LOG_INFO("OTA update aborted");
+            abortTransfer();
+        }
+        else {
+            LOG_WARN("Invalid OTA command");
+        }
+    }
+};
+
+ControlCallbacks controlCallbacks;
+
+/**
+ * @class DataCallbacks
+ * @brief Receives image packets.
+ *
+ * @method onConnectionWrite
+ * Stores in-sequence packets from the connection that owns the transfer and acknowledges
+ * every window. Nothing in this path logs, allocates or touches flash.
+ */
+class DataCallbacks : public TrackedCharacteristicCallbacks {
+    void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) override {
+        const BleValue value(pCharacteristic);
+        packets++;
+        if (static_cast<OtaState>(state.load()) != OtaState::Receiving || connId != ownerConnId ||
+            value.length() <= kSequenceLength || value.length() - kSequenceLength > packetPayload) {
+            droppedPackets++;
+            return;
+        }
+
+        const uint8_t* data = value.data();
+        const uint16_t sequence = data[0] | (data[1] << 8);
+        const size_t length = value.length() - kSequenceLength;
+        if (sequence != expectedSequence || received + length > imageSize ||
+            !storePayload(data + kSequenceLength, length)) {
+            droppedPackets++;
+            if (!nackSent) {
+                nackSent = true;
+                sendNotification(OtaNotificationType::Nack, ownerConnId);
+            }
+            return;
+        }
+
+        nackSent = false;
+        expectedSequence++;
+        received += length;
+        lastPacketUs = esp_timer_get_time();
+        if (++packetsSinceAck >= window || received == imageSize) {
+            packetsSinceAck = 0;
+            portENTER_CRITICAL(&ackMux);
+            ackPending = true;
+            portEXIT_CRITICAL(&ackMux);
+            sendAckIfRoom();
+        }
+    }
+};
+
+DataCallbacks dataCallbacks;
+
+/**
+ * @class StatsCallbacks
+ * @brief Serves the OTA statistics.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the current statistics before it is read.
+ */
+class StatsCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        OtaStats stats;
+        stats.state = state;
+        stats.window = window;
+        stats.imageSize = imageSize;
+        stats.received = received;
+        stats.written = written;
+        stats.packets = packets;
+        stats.droppedPackets = droppedPackets;
+        stats.acks = acks;
+        stats.elapsedMs = lastPacketUs > readyUs ? (lastPacketUs - readyUs) / 1000 : 0;
+        stats.rateBps = lastPacketUs > readyUs
+            ? (uint64_t)stats.received * 1000000 / (lastPacketUs - readyUs)
+            : 0;
+        stats.flashWriteMs = flashWriteUs / 1000;
+        stats.maxFlashWriteUs = maxFlashWriteUs;
+        stats.stallMs = stallUs / 1000;
+        stats.lastError = lastError;
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+StatsCallbacks statsCallbacks;
+
+} // namespace
+
+void setupOtaUpdate(BLEServer* pServer) {
+    notifyMutex = xSemaphoreCreateMutexStatic(&notifyMutexBuffer);
+
+    BLEService* pService = createBleService(pServer, OTA_SERVICE_UUID, kServiceHandles);
+
+    pControlCharacteristic = createBleCharacteristic(
+        pService,
+        OTA_CONTROL_CHARACTERISTIC_UUID,
+        BleProperty::kWrite |
+        BleProperty::kNotify,
+        true
+    );
+    pControlCharacteristic->setCallbacks(&controlCallbacks);
+    trackSubscriptions(pControlCharacteristic);
+
+    BLECharacteristic* pDataCharacteristic = createBleCharacteristic(
+        pService,
+        OTA_DATA_CHARACTERISTIC_UUID,
+        BleProperty::kWriteNoResponse,
+        true
+    );
+    pDataCharacteristic->setCallbacks(&dataCallbacks);
+
+    BLECharacteristic* pStatsCharacteristic = createBleCharacteristic(
+        pService,
+        OTA_STATS_CHARACTERISTIC_UUID,
+        BleProperty::kRead
+    );
+    pStatsCharacteristic->setCallbacks(&statsCallbacks);
+
+    createAppTask(otaWriterTask, "ota_writer", 4096, nullptr, 1, &writerTask);
+
+    pService->start();
+}
+
+void onOtaDisconnected(uint16_t connId) {
+    const OtaState current = static_cast<OtaState>(state.load());
+    if (connId == ownerConnId && (current == OtaState::Preparing || current == OtaState::Receiving)) {
+        LOG_WARN("OTA update aborted: connection %u dropped", connId);
+        abortTransfer();
+    }
+}
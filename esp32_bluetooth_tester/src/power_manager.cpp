@@ -0,0 +1,200 @@
+/**
+ * @file
+ * @brief Implementation of the power configuration and idle time accounting.
+ *
+ * Both idle sources are read as a wrapping 32-bit microsecond counter. A periodic sample
+ * folds it into a 64-bit total well before it can wrap, so windows can run for days. On
+ * dual-core chips the accounting covers core 0, where the BLE stack runs.
+ */
+
+#include "power_manager.h"
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_bt.h>
+#include <esp_freertos_hooks.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+
+#include "async_log.h"
+#include "connection_registry.h"
+
+#if defined(CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS) && defined(CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER)
+#define POWER_IDLE_FROM_RUN_TIME_STATS 1
+#else
+#define POWER_IDLE_FROM_RUN_TIME_STATS 0
+#endif
+
+namespace {
+
+/// How often the idle counter is folded into the totals. It wraps after about 71 minutes.
+const uint64_t kSamplePeriodUs = 60ULL * 1000000;
+
+#if defined(CONFIG_IDF_TARGET_ESP32C3)
+typedef esp_pm_config_esp32c3_t PmConfig;
+#elif defined(CONFIG_IDF_TARGET_ESP32S3)
+typedef esp_pm_config_esp32s3_t PmConfig;
+#else
+typedef esp_pm_config_esp32_t PmConfig;
+#endif
+
+esp_timer_handle_t sampleTimer = nullptr;
+
+// Guards the totals, which are sampled from the esp_timer task and the BLE task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+int64_t windowStartUs = 0;
+uint64_t idleTotalUs = 0;
+uint32_t lastIdleCounterUs = 0;
+
+PowerStats config = {};
+
+#if !POWER_IDLE_FROM_RUN_TIME_STATS
+/// Gaps between idle hook calls longer than this mean another task ran in between.
+const int64_t kIdleGapUs = portTICK_PERIOD_MS * 1000 + 500;
+
+std::atomic<uint32_t> hookIdleUs(0);
+int64_t lastIdleHookUs = 0; // Only touched from the idle task.
+
+/**
+ * @brief Counts the time since the previous call as idle if no task ran in between.
+ *
+ * The idle task calls this each time it wakes from waiting for an interrupt.
+ */
+bool onIdle() {
+    const int64_t now = esp_timer_get_time();
+    const int64_t gap = now - lastIdleHookUs;
+    if (gap < kIdleGapUs) {
+        hookIdleUs += gap;
+    }
+    lastIdleHookUs = now;
+    return true;
+}
+#endif
+
+/**
+ * @brief Returns the wrapping idle time counter in microseconds.
+ */
+uint32_t readIdleCounterUs() {
+#if POWER_IDLE_FROM_RUN_TIME_STATS
+    return ulTaskGetIdleRunTimeCounter();
+#else
+    return hookIdleUs;
+#endif
+}
+
+/**
+ * @brief Folds the idle counter into the total. Call with the lock held.
+ */
+void sampleLocked() {
+    const uint32_t counter = readIdleCounterUs();
+    idleTotalUs += (uint32_t)(counter - lastIdleCounterUs);
+    lastIdleCounterUs = counter;
+}
+
+void onSampleTimer(void* arg) {
+    portENTER_CRITICAL(&lock);
+    sampleLocked();
+    portEXIT_CRITICAL(&lock);
+}
+
+/**
+ * @brief Applies the power-save configuration and records what could be enabled.
+ */
+void applyPowerSave() {
+#if TESTER_POWER_SAVE
+    PmConfig pmConfig = {};
+    pmConfig.max_freq_mhz = getCpuFrequencyMhz();
+    pmConfig.min_freq_mhz = getXtalFrequencyMhz();
+#if defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE)
+    pmConfig.light_sleep_enable = true;
+#endif
+    const esp_err_t err = esp_pm_configure(&pmConfig);
+    if (err == ESP_OK) {
+        config.frequencyScaling = 1;
+        config.lightSleep = pmConfig.light_sleep_enable ? 1 : 0;
+    }
+    else {
+        LOG_WARN("Power management unavailable: %s", esp_err_to_name(err));
+    }
+    if (!config.lightSleep) {
+        LOG_WARN("Automatic light sleep needs CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE");
+    }
+
+#if defined(CONFIG_BT_CTRL_MODEM_SLEEP) || defined(CONFIG_BTDM_CTRL_MODEM_SLEEP)
+    config.modemSleep = esp_bt_sleep_enable() == ESP_OK ? 1 : 0;
+#endif
+    if (!config.modemSleep) {
+        LOG_WARN("BLE controller modem sleep is not enabled in this build");
+    }
+#endif
+}
+
+/**
+ * @class PowerStatsCallbacks
+ * @brief Serves the power stats over GATT.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the stats of the current window before it is read.
+ *
+ * @method onWrite
+ * Starts a new measurement window, regardless of the value written.
+ */
+class PowerStatsCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        PowerStats stats = config;
+        portENTER_CRITICAL(&lock);
+        sampleLocked();
+        const int64_t windowUs = esp_timer_get_time() - windowStartUs;
+        const uint64_t idleUs = idleTotalUs < (uint64_t)windowUs ? idleTotalUs : windowUs;
+        portEXIT_CRITICAL(&lock);
+
+        stats.windowMs = windowUs / 1000;
+        stats.idleMs = idleUs / 1000;
+        stats.activeMs = stats.windowMs - stats.idleMs;
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        portENTER_CRITICAL(&lock);
+        sampleLocked();
+        idleTotalUs = 0;
+        windowStartUs = esp_timer_get_time();
+        portEXIT_CRITICAL(&lock);
+        LOG_INFO("Power stats window reset");
+    }
+};
+
+PowerStatsCallbacks powerStatsCallbacks;
+
+} // namespace
+
+void setupPowerManager(BLEService* pService) {
+#if POWER_IDLE_FROM_RUN_TIME_STATS
+    config.idleSource = static_cast<uint8_t>(IdleSource::RunTimeStats);
+#else
+    config.idleSource = static_cast<uint8_t>(IdleSource::IdleHook);
+    lastIdleHookUs = esp_timer_get_time();
+    esp_register_freertos_idle_hook_for_cpu(onIdle, 0);
+#endif
+
+    applyPowerSave();
+
+    portENTER_CRITICAL(&lock);
+    lastIdleCounterUs = readIdleCounterUs();
+    windowStartUs = esp_timer_get_time();
+    portEXIT_CRITICAL(&lock);
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onSampleTimer;
+    timerArgs.name = "power_sample";
+    esp_timer_create(&timerArgs, &sampleTimer);
+    esp_timer_start_periodic(sampleTimer, kSamplePeriodUs);
+
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        POWER_STATS_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pCharacteristic->setCallbacks(&powerStatsCallbacks);
+}
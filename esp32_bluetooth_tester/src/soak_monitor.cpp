@@ -0,0 +1,381 @@
+/**
+ * @file
+ * @brief Implementation of the soak time series and the watchdog near-miss detector.
+ *
+ * The heap and stack figures are gathered by the soak task outside the lock, as looking a
+ * task up by name suspends the scheduler. The series, the near-miss log and the interval
+ * figures are guarded by the lock, as the idle hooks update them from both cores.
+ */
+
+#include "soak_monitor.h"
+
+#include <Arduino.h>
+#include <esp_freertos_hooks.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <atomic>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+#include "latency_histogram.h"
+
+namespace {
+
+/// The tasks of SoakSample::stackHighWater, in order.
+const char* const kTaskNames[SOAK_TASK_COUNT] = {
+    "loopTask",
+    "esp_timer",
+    "btController",
+#if TESTER_USE_NIMBLE
+    "nimble_host",
+#else
+    "BTC_TASK",
+#endif
+    "log_drain",
+    "stats",
+    "led_render",
+    "indications",
+    "throughput",
+    "write_sink",
+    "traffic",
+    "ota_writer",
+    "l2cap_source",
+    "soak",
+    "trace",
+    "live_status",
+};
+
+#ifdef CONFIG_ESP_TASK_WDT_TIMEOUT_S
+const uint32_t kWatchdogTimeoutMs = CONFIG_ESP_TASK_WDT_TIMEOUT_S * 1000;
+#else
+const uint32_t kWatchdogTimeoutMs = 5000;
+#endif
+
+/// The idle gap that counts as a near-miss.
+const uint32_t kNearMissUs = kWatchdogTimeoutMs * 10 * SOAK_NEAR_MISS_PERCENT;
+
+/// The samples that fit in one chunk after its header.
+const size_t kChunkSamples = (SOAK_CHUNK_BYTES - sizeof(SoakChunkHeader)) / sizeof(SoakSample);
+
+static_assert(SOAK_SAMPLES % 2 == 0 && SOAK_SAMPLES <= UINT16_MAX,
+              "The series must hold an even number of samples, indexed by a uint16");
+static_assert(kChunkSamples > 0, "A chunk must hold at least one sample");
+static_assert(sizeof(SoakNearMissLog) + SOAK_NEAR_MISS_LOG * sizeof(SoakNearMiss) <= SOAK_CHUNK_BYTES,
+              "The near-miss log must fit in one read");
+
+SoakSample series[SOAK_SAMPLES];
+size_t count = 0;
+uint8_t compactions = 0;
+uint32_t intervalS = SOAK_INTERVAL_S;
+
+// The sample being merged when the interval is longer than SOAK_INTERVAL_S.
+SoakSample pending;
+uint32_t pendingTicks = 0;
+
+SoakNearMiss nearMisses[SOAK_NEAR_MISS_LOG];
+uint32_t nearMissTotal = 0;
+uint32_t intervalNearMisses = 0;
+
+// Read without the lock by the idle hooks, so that the common case stays lock-free.
+std::atomic<uint32_t> intervalMaxGapUs(0);
+
+// Guards everything above, which is updated from the soak task, the idle hooks and the BLE stack.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Each entry is only touched from the idle task of its core.
+int64_t lastIdleUs[portNUM_PROCESSORS];
+
+LatencyHistogram callbackLatency;
+TaskHandle_t task = nullptr;
+
+// Only touched from the BLE stack.
+bool readingNearMisses = false;
+size_t cursor = 0;
+uint8_t chunk[SOAK_CHUNK_BYTES];
+
+/**
+ * @brief Returns the lower of two stack figures, ignoring a 0 for a task that did not exist.
+ */
+uint16_t lowerPresent(uint16_t a, uint16_t b) {
+    if (a == 0 || b == 0) {
+        return a | b;
+    }
+    return a < b ? a : b;
+}
+
+/**
+ * @brief Merges a later sample into an earlier one, keeping the worst of both.
+ */
+void merge(SoakSample& into, const SoakSample& later) {
+    into.uptimeS = later.uptimeS;
+    into.freeHeap = std::min(into.freeHeap, later.freeHeap);
+    into.minFreeHeap = std::min(into.minFreeHeap, later.minFreeHeap);
+    into.largestFreeBlock = std::min(into.largestFreeBlock, later.largestFreeBlock);
+    into.callbacks += later.callbacks;
+    into.callbackP50Us = std::max(into.callbackP50Us, later.callbackP50Us);
+    into.callbackP99Us = std::max(into.callbackP99Us, later.callbackP99Us);
+    into.callbackMaxUs = std::max(into.callbackMaxUs, later.callbackMaxUs);
+    into.maxIdleGapMs = std::max(into.maxIdleGapMs, later.maxIdleGapMs);
+    into.connections = std::max(into.connections, later.connections);
+    into.nearMisses = std::min(into.nearMisses + later.nearMisses, 255);
+    for (size_t i = 0; i < SOAK_TASK_COUNT; i++) {
+        into.stackHighWater[i] = lowerPresent(into.stackHighWater[i], later.stackHighWater[i]);
+    }
+}
+
+/**
+ * @brief Merges each pair of samples into one and doubles the interval. Call with the lock held.
+ */
+void compactLocked() {
+    for (size_t i = 0; i < SOAK_SAMPLES / 2; i++) {
+        series[i] = series[2 * i];
+        merge(series[i], series[2 * i + 1]);
+    }
+    count = SOAK_SAMPLES / 2;
+    intervalS *= 2;
+    compactions++;
+}
+
+/**
+ * @brief Adds a SOAK_INTERVAL_S sample to the series, merging it into the pending sample if
+ * the series has been compacted. Call with the lock held.
+ */
+void storeLocked(const SoakSample& sample) {
+    if (pendingTicks == 0) {
+        pending = sample;
+    }
+    else {
+        merge(pending, sample);
+    }
+    if (++pendingTicks < intervalS / SOAK_INTERVAL_S) {
+        return;
+    }
+    pendingTicks = 0;
+    if (count == SOAK_SAMPLES) {
+        compactLocked();
+    }
+    series[count++] = pending;
+}
+
+/**
+ * @brief Records a near-miss in the log, replacing the oldest. Call with the lock held.
+ */
+void recordNearMissLocked(int64_t now, uint32_t gapUs, uint8_t core) {
+    SoakNearMiss& entry = nearMisses[nearMissTotal % SOAK_NEAR_MISS_LOG];
+    entry.uptimeMs = now / 1000;
+    entry.gapMs = std::min<uint32_t>(gapUs / 1000, UINT16_MAX);
+    entry.core = core;
+    nearMissTotal++;
+    intervalNearMisses++;
+}
+
+/**
+ * @brief Measures how long the idle task of this core was starved since its previous call.
+ *
+ * The idle task calls this at most once per tick while it runs, so a gap much longer than
+ * a tick means other tasks kept the core busy in between.
+ */
+bool onIdle() {
+    const int64_t now = esp_timer_get_time();
+    const uint8_t core = xPortGetCoreID();
+    const uint32_t gap = std::min<int64_t>(now - lastIdleUs[core], UINT32_MAX);
+    lastIdleUs[core] = now;
+
+    if (gap > intervalMaxGapUs || gap >= kNearMissUs) {
+        portENTER_CRITICAL(&lock);
+        if (gap > intervalMaxGapUs) {
+            intervalMaxGapUs = gap;
+        }
+        if (gap >= kNearMissUs) {
+            recordNearMissLocked(now, gap, core);
+        }
+        portEXIT_CRITICAL(&lock);
+    }
+    return true;
+}
+
+/**
+ * @brief Fills the heap, connection, callback and stack figures of a sample.
+ */
+void takeSample(SoakSample& sample) {
+    sample.uptimeS = esp_timer_get_time() / 1000000;
+    sample.freeHeap = ESP.getFreeHeap();
+    sample.minFreeHeap = ESP.getMinFreeHeap();
+    sample.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    sample.connections = std::min<size_t>(activeConnectionCount(), UINT8_MAX);
+
+    LatencyHistogramSnapshot latency;
+    callbackLatency.snapshot(latency);
+    callbackLatency.reset();
+    sample.callbacks = latency.count;
+    sample.callbackP50Us = latency.p50Us;
+    sample.callbackP99Us = latency.p99Us;
+    sample.callbackMaxUs = latency.maxUs;
+
+    // ESP-IDF reports the high-water mark in bytes, as its stack type is one byte wide.
+    for (size_t i = 0; i < SOAK_TASK_COUNT; i++) {
+        const TaskHandle_t handle = xTaskGetHandle(kTaskNames[i]);
+        sample.stackHighWater[i] = handle != nullptr
+            ? std::min<UBaseType_t>(uxTaskGetStackHighWaterMark(handle), UINT16_MAX)
+            : 0;
+    }
+}
+
+/**
+ * @brief The FreeRTOS task that samples every SOAK_INTERVAL_S seconds.
+ */
+void soakTask(void* parameter) {
+    TickType_t lastWake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SOAK_INTERVAL_S * 1000));
+
+        SoakSample sample;
+        takeSample(sample);
+
+        portENTER_CRITICAL(&lock);
+        sample.maxIdleGapMs = std::min<uint32_t>(intervalMaxGapUs / 1000, UINT16_MAX);
+        sample.nearMisses = std::min<uint32_t>(intervalNearMisses, UINT8_MAX);
+        intervalMaxGapUs = 0;
+        intervalNearMisses = 0;
+        storeLocked(sample);
+        portEXIT_CRITICAL(&lock);
+
+        if (sample.nearMisses > 0) {
+            LOG_WARN("Task watchdog near-misses: %u, idle starved for up to %u ms",
+                     sample.nearMisses, sample.maxIdleGapMs);
+        }
+        LOG_DEBUG("Soak sample: free_heap=%u largest_free_block=%u connections=%u callback_p99=%u",
+                  sample.freeHeap, sample.largestFreeBlock, sample.connections, sample.callbackP99Us);
+    }
+}
+
+void reset() {
+    portENTER_CRITICAL(&lock);
+    count = 0;
+    compactions = 0;
+    intervalS = SOAK_INTERVAL_S;
+    pendingTicks = 0;
+    nearMissTotal = 0;
+    intervalNearMisses = 0;
+    intervalMaxGapUs = 0;
+    portEXIT_CRITICAL(&lock);
+    callbackLatency.reset();
+    cursor = 0;
+}
+
+/**
+ * @brief Fills the chunk with the series from the cursor, and moves the cursor past it.
+ *
+ * @return The length of the chunk in bytes.
+ */
+size_t readSeries() {
+    SoakChunkHeader header;
+    header.version = SOAK_VERSION;
+    header.sampleSize = sizeof(SoakSample);
+    header.taskCount = SOAK_TASK_COUNT;
+
+    portENTER_CRITICAL(&lock);
+    const size_t first = std::min(cursor, count);
+    const size_t samples = std::min(count - first, kChunkSamples);
+    header.compactions = compactions;
+    header.intervalS = intervalS;
+    header.count = count;
+    header.nearMisses = nearMissTotal;
+    memcpy(chunk + sizeof(header), &series[first], samples * sizeof(SoakSample));
+    portEXIT_CRITICAL(&lock);
+
+    header.first = first;
+    header.samples = samples;
+    memcpy(chunk, &header, sizeof(header));
+    cursor = first + samples;
+    return sizeof(header) + samples * sizeof(SoakSample);
+}
+
+/**
+ * @brief Fills the chunk with the near-miss log, oldest first.
+ *
+ * @return The length of the chunk in bytes.
+ */
+size_t readNearMisses() {
+    SoakNearMissLog log;
+    log.timeoutMs = kWatchdogTimeoutMs;
+    log.thresholdMs = kNearMissUs / 1000;
+
+    portENTER_CRITICAL(&lock);
+    log.total = nearMissTotal;
+    log.count = std::min<uint32_t>(nearMissTotal, SOAK_NEAR_MISS_LOG);
+    const size_t oldest = nearMissTotal - log.count;
+    for (size_t i = 0; i < log.count; i++) {
+        memcpy(chunk + sizeof(log) + i * sizeof(SoakNearMiss),
+               &nearMisses[(oldest + i) % SOAK_NEAR_MISS_LOG], sizeof(SoakNearMiss));
+    }
+    portEXIT_CRITICAL(&lock);
+
+    memcpy(chunk, &log, sizeof(log));
+    return sizeof(log) + log.count * sizeof(SoakNearMiss);
+}
+
+/**
+ * @class SoakCallbacks
+ * @brief Handles the soak characteristic.
+ *
+ * @method onWrite
+ * Clears the series, or selects what the next reads return.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the next chunk of the series, or the near-miss log.
+ */
+class SoakCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if (length == 1 && data[0] == SOAK_OPCODE_RESET) {
+            reset();
+            LOG_INFO("Soak series cleared");
+        }
+        else if (length == 3 && data[0] == SOAK_OPCODE_SERIES) {
+            readingNearMisses = false;
+            cursor = data[1] | (data[2] << 8);
+        }
+        else if (length == 1 && data[0] == SOAK_OPCODE_NEAR_MISSES) {
+            readingNearMisses = true;
+        }
+        else {
+            LOG_WARN("Received unexpected soak command of %u bytes", (unsigned)length);
+        }
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        const size_t length = readingNearMisses ? readNearMisses() : readSeries();
+        pCharacteristic->setValue(chunk, length);
+    }
+};
+
+SoakCallbacks soakCallbacks;
+
+} // namespace
+
+void setupSoakMonitor(BLEService* pService) {
+    BLECharacteristic* pCharacteristic = createBleCharacteristic(
+        pService,
+        SOAK_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pCharacteristic->setCallbacks(&soakCallbacks);
+
+    const int64_t now = esp_timer_get_time();
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+        lastIdleUs[core] = now;
+        esp_register_freertos_idle_hook_for_cpu(onIdle, core);
+    }
+
+    createAppTask(soakTask, "soak", 3072, nullptr, 1, &task);
+}
+
+void soakRecordCallback(uint32_t durationUs) {
+    callbackLatency.record(durationUs);
+}
@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief Implementation of the connectionless state broadcast.
+ *
+ * The record is always built on the esp_timer task: LED state changes only schedule an
+ * update, so bursts of LED writes cost one payload update per STATE_BROADCAST_MIN_UPDATE_MS
+ * and the BLE task never waits on the controller.
+ */
+
+#include "state_broadcast.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#include "advertising_profiles.h"
+#include "connection_registry.h"
+
+static_assert(sizeof(BroadcastStateRecord) <= ADV_MAX_STATE_RECORD_BYTES,
+              "The state record must fit the legacy advertising payload");
+static_assert(sizeof(BroadcastStateReport) <= ADV_MAX_STATE_REPORT_BYTES,
+              "The state report must fit the extended advertising payload");
+
+namespace {
+
+esp_timer_handle_t updateTimer = nullptr;
+esp_timer_handle_t digestTimer = nullptr;
+
+// Written by the BLE task and read by the esp_timer task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+BroadcastLedState ledState = BroadcastLedState::Off;
+uint16_t sequence = 0;
+bool updatePending = false;
+int64_t lastUpdateUs = 0;
+
+/**
+ * @brief Builds the report from the current state and hands it to the advertising payload.
+ */
+void publishState() {
+    BroadcastStateReport report;
+    firmwareStatsSnapshot(report.stats);
+
+    BroadcastStateRecord& record = report.record;
+    portENTER_CRITICAL(&lock);
+    record.ledState = static_cast<uint8_t>(ledState);
+    record.sequence = sequence;
+    updatePending = false;
+    portEXIT_CRITICAL(&lock);
+
+    record.version = STATE_BROADCAST_VERSION;
+    record.connections = activeConnectionCount();
+    record.uptimeS = report.stats.uptimeMs / 1000;
+    record.writes = report.stats.writes;
+    record.notifications = report.stats.notifications;
+    record.minFreeHeapKb = report.stats.minFreeHeap / 1024;
+
+    setAdvertisedState(reinterpret_cast<const uint8_t*>(&record), sizeof(record),
+                       reinterpret_cast<const uint8_t*>(&report), sizeof(report));
+
+    portENTER_CRITICAL(&lock);
+    lastUpdateUs = esp_timer_get_time();
+    portEXIT_CRITICAL(&lock);
+}
+
+void onUpdateTimer(void* arg) {
+    publishState();
+}
+
+} // namespace
+
+void setupStateBroadcast() {
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = onUpdateTimer;
+    timerArgs.name = "state_update";
+    esp_timer_create(&timerArgs, &updateTimer);
+
+    // The digest refresh shares the callback, so both run on the esp_timer task
+    timerArgs.name = "state_digest";
+    esp_timer_create(&timerArgs, &digestTimer);
+
+    publishState();
+    esp_timer_start_periodic(digestTimer, (uint64_t)STATE_BROADCAST_DIGEST_MS * 1000);
+}
+
+void setBroadcastLedState(BroadcastLedState state) {
+    portENTER_CRITICAL(&lock);
+    const bool changed = ledState != state;
+    const bool schedule = changed && !updatePending;
+    if (changed) {
+        ledState = state;
+        sequence++;
+        updatePending = true;
+    }
+    const int64_t dueUs = lastUpdateUs + (int64_t)STATE_BROADCAST_MIN_UPDATE_MS * 1000;
+    portEXIT_CRITICAL(&lock);
+
+    if (!schedule || updateTimer == nullptr) {
+        return;
+    }
+    // Update right away unless the previous update was too recent
+    const int64_t delayUs = dueUs - esp_timer_get_time();
+    esp_timer_start_once(updateTimer, delayUs > 0 ? delayUs : 1);
+}
@@ -0,0 +1,229 @@
+/**
+ * @file
+ * @brief Implementation of the bulk notification throughput test.
+ *
+ * Notifications are sent from a dedicated FreeRTOS task so that the BLE callbacks only
+ * have to parse the command and wake the task. Every notification goes to the connection
+ * that started the test only, sized to that connection's MTU. On Bluedroid the task uses
+ * the controller's sendable-packet count for that link as flow control, which keeps the
+ * link saturated without overflowing the stack's buffers. NimBLE refuses notifications when
+ * it runs out of buffers, so there the task backs off whenever a send fails.
+ */
+
+#include "throughput_test.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+
+namespace {
+
+/// The largest value an attribute can hold, per the Bluetooth Core Specification.
+const size_t kMaxAttributeLength = 512;
+
+/// The size of the ATT notification header that is subtracted from the MTU.
+const uint16_t kNotifyHeaderLength = 3;
+
+/// The default ATT MTU used until the client negotiates a larger one.
+const uint16_t kDefaultMtu = 23;
+
+BLEServer* server = nullptr;
+BLECharacteristic* characteristic = nullptr;
+TaskHandle_t task = nullptr;
+
+// Written by the BLE task before it wakes the streaming task.
+std::atomic<uint32_t> requestedSeconds(0);
+std::atomic<uint16_t> requesterConnId(0);
+
+std::atomic<bool> stopRequested(false);
+std::atomic<bool> running(false);
+
+uint8_t payload[kMaxAttributeLength];
+
+/**
+ * @brief Fills the payload buffer with the sequence number and the verification pattern.
+ *
+ * @param sequence The sequence number of the notification.
+ * @param length The number of bytes to fill.
+ */
+void fillPayload(uint32_t sequence, size_t length) {
+    payload[0] = sequence & 0xFF;
+    payload[1] = (sequence >> 8) & 0xFF;
+    payload[2] = (sequence >> 16) & 0xFF;
+    payload[3] = (sequence >> 24) & 0xFF;
+    for (size_t i = 4; i < length; i++) {
+        payload[i] = (sequence + i) & 0xFF;
+    }
+}
+
+/**
+ * @brief Streams notifications until the requested duration elapses, a stop is requested,
+ * or the client goes away, then publishes the summary.
+ *
+ * @param seconds The requested duration of the test.
+ * @param connId The connection that started the test.
+ */
+void runThroughputTest(uint32_t seconds, uint16_t connId) {
+    uint16_t mtu = server->getPeerMTU(connId);
+    if (mtu < kDefaultMtu) {
+        mtu = kDefaultMtu;
+    }
+    size_t payloadLength = mtu - kNotifyHeaderLength;
+    if (payloadLength > kMaxAttributeLength) {
+        payloadLength = kMaxAttributeLength;
+    }
+
+    uint32_t failedSends = 0;
+    bool clientUnavailable = false;
+    uint32_t sequence = 0;
+    uint64_t bytesSent = 0;
+    const int64_t startTime = esp_timer_get_time();
+    const int64_t endTime = startTime + (int64_t)seconds * 1000000;
+
+    LOG_INFO("Throughput test started: %u s, %u byte payloads", seconds, (unsigned)payloadLength);
+
+    while (!stopRequested && !clientUnavailable && esp_timer_get_time() < endTime) {
+        if (!connectionActive(connId)) {
+            clientUnavailable = true;
+            break;
+        }
+
+#if !TESTER_USE_NIMBLE
+        // Wait for the controller to have room rather than overrunning the stack's buffers.
+        if (esp_ble_get_cur_sendable_packets_num(connId) == 0) {
+            vTaskDelay(1);
+            continue;
+        }
+#endif
+
+        fillPayload(sequence, payloadLength);
+        characteristic->setValue(payload, payloadLength);
+        const ConnectionNotifyResult result = notifyConnection(characteristic, connId);
+        if (result == ConnectionNotifyResult::NotSubscribed) {
+            clientUnavailable = true; // Notifications were disabled.
+            break;
+        }
+
+        if (result == ConnectionNotifyResult::Failed) {
+            failedSends++;
+            vTaskDelay(1); // Back off and retry the same sequence number.
+        } else {
+            bytesSent += payloadLength;
+            sequence++;
+        }
+    }
+
+    const int64_t elapsedUs = esp_timer_get_time() - startTime;
+    const uint32_t elapsedMs = elapsedUs / 1000;
+    const uint32_t bytesPerSecond = elapsedUs > 0 ? (uint32_t)(bytesSent * 1000000 / elapsedUs) : 0;
+
+    char summary[96];
+    snprintf(summary, sizeof(summary), "DONE packets=%u bytes=%u ms=%u bps=%u failed=%u mtu=%u",
+             sequence, (uint32_t)bytesSent, elapsedMs, bytesPerSecond, failedSends, mtu);
+    LOG_INFO("%s", summary);
+
+    characteristic->setValue(summary);
+    if (!clientUnavailable) {
+        notifyConnection(characteristic, connId);
+    }
+}
+
+/**
+ * @brief Parses the duration that follows "START" in a command.
+ *
+ * The text is the raw attribute value and is not null-terminated.
+ *
+ * @return The duration in seconds, 0 if there is none, or a value above
+ *         THROUGHPUT_MAX_SECONDS if it is too large.
+ */
+uint32_t parseSeconds(const char* text, size_t length) {
+    size_t i = 0;
+    while (i < length && text[i] == ' ') {
+        i++;
+    }
+    uint32_t seconds = 0;
+    for (; i < length && text[i] >= '0' && text[i] <= '9'; i++) {
+        seconds = seconds * 10 + (text[i] - '0');
+        if (seconds > THROUGHPUT_MAX_SECONDS) {
+            break;
+        }
+    }
+    return seconds;
+}
+
+/**
+ * @brief The FreeRTOS task that runs a throughput test each time it is woken.
+ */
+void throughputTask(void* parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        running = true;
+        stopRequested = false;
+        runThroughputTest(requestedSeconds, requesterConnId);
+        running = false;
+    }
+}
+
+/**
+ * @class ThroughputCallbacks
+ * @brief Handles commands written to the throughput characteristic.
+ *
+ * @method onConnectionWrite
+ * Parses "START", "START <seconds>" and "STOP". Starting records the connection the
+ * command came from, wakes the streaming task and returns immediately so the BLE task is
+ * never blocked by the test.
+ */
+class ThroughputCallbacks : public TrackedCharacteristicCallbacks {
+    void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) override {
+        const BleValue value(pCharacteristic);
+        const char* command = reinterpret_cast<const char*>(value.data());
+        const size_t length = value.length();
+        if (length >= 5 && memcmp(command, "START", 5) == 0) {
+            if (running) {
+                LOG_WARN("Throughput test already running");
+                return;
+            }
+            uint32_t seconds = THROUGHPUT_DEFAULT_SECONDS;
+            if (length > 5) {
+                seconds = parseSeconds(command + 5, length - 5);
+            }
+            if (seconds == 0 || seconds > THROUGHPUT_MAX_SECONDS) {
+                LOG_WARN("Invalid throughput test duration: %.*s", (int)length, command);
+                return;
+            }
+            requestedSeconds = seconds;
+            requesterConnId = connId;
+            xTaskNotifyGive(task);
+        }
+        else if (length == 4 && memcmp(command, "STOP", 4) == 0) {
+            stopRequested = true;
+        }
+        else {
+            LOG_WARN("Received unexpected throughput command: %.*s", (int)length, command);
+        }
+    }
+};
+
+ThroughputCallbacks throughputCallbacks;
+
+} // namespace
+
+void setupThroughputTest(BLEServer* pServer, BLEService* pService) {
+    server = pServer;
+
+    characteristic = createBleCharacteristic(
+        pService,
+        THROUGHPUT_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify
+    );
+    characteristic->setValue("IDLE");
+    characteristic->setCallbacks(&throughputCallbacks);
+    trackSubscriptions(characteristic);
+
+    createAppTask(throughputTask, "throughput", 4096, nullptr, 1, &task);
+}
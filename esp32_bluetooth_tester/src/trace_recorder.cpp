@@ -0,0 +1,467 @@
+/**
+ * @file
+ * @brief Implementation of the write and notification trace recorder.
+ *
+ * The BLE task and the tasks that notify are the producers of the ring. ByteRing takes a
+ * single producer, so they take turns under a lock held only for the copy. The trace task
+ * is the only consumer, and the only task that touches the file: it drains the ring every
+ * kDrainMs, writes full batches as they fill, and streams the file when a download is
+ * requested. Downloads go to the requesting connection only, paced like the throughput test.
+ */
+
+#include "trace_recorder.h"
+
+#include <Arduino.h>
+#include <atomic>
+#if TESTER_TRACE
+#include <LittleFS.h>
+#endif
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "byte_ring.h"
+#include "connection_registry.h"
+
+namespace {
+
+std::atomic<uint8_t> state(static_cast<uint8_t>(TraceState::Idle));
+std::atomic<bool> downloading(false);
+std::atomic<uint32_t> records(0);
+std::atomic<uint32_t> dropped(0);
+std::atomic<uint32_t> fileBytes(0);
+std::atomic<uint32_t> batches(0);
+std::atomic<uint32_t> maxBatchUs(0);
+
+#if TESTER_TRACE
+static_assert(TRACE_CAPTURE_BYTES <= 255, "The captured length must fit a uint8");
+
+/// The largest value an attribute can hold, per the Bluetooth Core Specification.
+const size_t kMaxAttributeLength = 512;
+
+/// The size of the ATT notification header that is subtracted from the MTU.
+const uint16_t kNotifyHeaderLength = 3;
+
+/// The size of the offset at the start of each download notification.
+const size_t kChunkHeaderLength = 4;
+
+/// The default ATT MTU used until the client negotiates a larger one.
+const uint16_t kDefaultMtu = 23;
+
+/// How often the trace task moves records from the ring into the batch.
+const uint32_t kDrainMs = 20;
+
+/// The longest record, a header and a full capture.
+const size_t kMaxRecordLength = sizeof(TraceRecordHeader) + TRACE_CAPTURE_BYTES;
+
+/// The value of pendingCommand when no command is waiting.
+const uint8_t kNoCommand = 0xFF;
+
+BLEServer* server = nullptr;
+BLECharacteristic* dataCharacteristic = nullptr;
+TaskHandle_t task = nullptr;
+
+// Checked by the producers before they take the lock, so that recording off costs nothing.
+std::atomic<bool> recording(false);
+
+ByteRing<TRACE_BUFFER_BYTES> ring;
+portMUX_TYPE pushLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Set by the control characteristic, and picked up by the trace task.
+std::atomic<uint8_t> pendingCommand(kNoCommand);
+std::atomic<uint32_t> downloadOffset(0);
+std::atomic<uint16_t> downloadConnId(0);
+
+// Only touched from the trace task.
+File file;
+uint8_t batch[TRACE_BATCH_BYTES];
+size_t batchLength = 0;
+int64_t lastFlushUs = 0;
+uint8_t chunk[kMaxAttributeLength];
+
+/**
+ * @brief Copies a record of the characteristic's current value into the ring.
+ */
+void pushRecord(TraceKind kind, uint8_t connId, BLECharacteristic* pCharacteristic) {
+    const BleValue value(pCharacteristic);
+    TraceRecordHeader header;
+    header.kind = static_cast<uint8_t>(kind);
+    header.connId = connId;
+    header.handle = pCharacteristic->getHandle();
+    header.length = value.length();
+    header.captured = value.length() < TRACE_CAPTURE_BYTES ? value.length() : TRACE_CAPTURE_BYTES;
+
+    uint8_t record[kMaxRecordLength];
+    memcpy(record + sizeof(header), value.data(), header.captured);
+
+    // The timestamp is taken under the lock so that the records stay in time order
+    portENTER_CRITICAL(&pushLock);
+    header.timeUs = (uint32_t)esp_timer_get_time();
+    memcpy(record, &header, sizeof(header));
+    const bool queued = ring.push(record, sizeof(header) + header.captured);
+    portEXIT_CRITICAL(&pushLock);
+
+    if (!queued) {
+        dropped++;
+    }
+}
+
+/**
+ * @brief Records how long a write or flush of the file took.
+ */
+void recordBatchTime(int64_t startedUs) {
+    const uint32_t us = esp_timer_get_time() - startedUs;
+    if (us > maxBatchUs) {
+        maxBatchUs = us;
+    }
+}
+
+/**
+ * @brief Writes the batch to the file.
+ *
+ * @return false if the file could not be written.
+ */
+bool writeBatch() {
+    if (batchLength == 0) {
+        return true;
+    }
+    const int64_t startedUs = esp_timer_get_time();
+    const size_t written = file.write(batch, batchLength);
+    recordBatchTime(startedUs);
+    batches++;
+    fileBytes += written;
+    const bool complete = written == batchLength;
+    batchLength = 0;
+    if (!complete) {
+        LOG_ERROR("Trace file write failed after %u bytes", fileBytes.load());
+    }
+    return complete;
+}
+
+/**
+ * @brief Moves records from the ring into the batch, writing the batch whenever it fills.
+ *
+ * @return Recording while the trace can continue, or the state it ends in.
+ */
+TraceState drainRing() {
+    size_t length = 0;
+    for (;;) {
+        if (TRACE_BATCH_BYTES - batchLength < kMaxRecordLength && !writeBatch()) {
+            return TraceState::Failed;
+        }
+        if (fileBytes + batchLength + kMaxRecordLength > TRACE_MAX_BYTES) {
+            return TraceState::Full;
+        }
+        if (!ring.pop(batch + batchLength, TRACE_BATCH_BYTES - batchLength, &length)) {
+            return TraceState::Recording;
+        }
+        batchLength += length;
+        records++;
+    }
+}
+
+/**
+ * @brief Discards whatever is left in the ring.
+ */
+void discardRing() {
+    size_t length = 0;
+    while (ring.pop(batch, 0, &length)) {
+    }
+}
+
+/**
+ * @brief Writes the batch, flushes the file and records how long it took.
+ */
+bool flushTrace() {
+    if (!writeBatch()) {
+        return false;
+    }
+    const int64_t startedUs = esp_timer_get_time();
+    file.flush();
+    recordBatchTime(startedUs);
+    lastFlushUs = esp_timer_get_time();
+    return true;
+}
+
+/**
+ * @brief Stops recording, writes what is still buffered and closes the file.
+ *
+ * @param next The state the recorder ends in.
+ */
+void finishTrace(TraceState next) {
+    recording = false;
+    if (next != TraceState::Failed && (drainRing() == TraceState::Failed || !flushTrace())) {
+        next = TraceState::Failed;
+    }
+    batchLength = 0;
+    discardRing();
+    file.close();
+    state = static_cast<uint8_t>(next);
+    LOG_INFO("Trace stopped: records=%u bytes=%u dropped=%u",
+             records.load(), fileBytes.load(), dropped.load());
+}
+
+/**
+ * @brief Replaces the trace file with a new one and starts recording.
+ */
+void startTrace() {
+    if (file) {
+        file.close();
+    }
+    file = LittleFS.open(TRACE_FILE_PATH, FILE_WRITE);
+    if (!file) {
+        state = static_cast<uint8_t>(TraceState::Failed);
+        LOG_ERROR("Could not create the trace file");
+        return;
+    }
+
+    discardRing();
+    records = 0;
+    dropped = 0;
+    fileBytes = 0;
+    batches = 0;
+    maxBatchUs = 0;
+
+    TraceFileHeader header;
+    header.magic = TRACE_FILE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.captureBytes = TRACE_CAPTURE_BYTES;
+    header.startUptimeMs = esp_timer_get_time() / 1000;
+    memcpy(batch, &header, sizeof(header));
+    batchLength = sizeof(header);
+    lastFlushUs = esp_timer_get_time();
+
+    state = static_cast<uint8_t>(TraceState::Recording);
+    recording = true;
+    LOG_INFO("Trace started");
+}
+
+/**
+ * @brief Sends one download notification to the downloading connection, retrying while
+ * the stack has no room for it.
+ *
+ * @return false if the download has to stop.
+ */
+bool sendChunk(uint16_t connId, size_t length) {
+    for (;;) {
+        if (pendingCommand != kNoCommand) {
+            return false;
+        }
+#if !TESTER_USE_NIMBLE
+        // Wait for the controller to have room rather than overrunning the stack's buffers.
+        if (esp_ble_get_cur_sendable_packets_num(connId) == 0) {
+            if (!connectionActive(connId)) {
+                return false;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+#endif
+        dataCharacteristic->setValue(chunk, kChunkHeaderLength + length);
+        const ConnectionNotifyResult result = notifyConnection(dataCharacteristic, connId);
+        if (result != ConnectionNotifyResult::Failed) {
+            // Sent, or the client disconnected or disabled notifications
+            return result == ConnectionNotifyResult::Sent;
+        }
+        vTaskDelay(1); // Back off and resend the same chunk.
+    }
+}
+
+/**
+ * @brief Streams the trace file from an offset to its end, then sends the end marker.
+ */
+void streamTrace(uint32_t offset, uint16_t connId) {
+    File reader = LittleFS.open(TRACE_FILE_PATH, FILE_READ);
+    const uint32_t size = reader ? reader.size() : 0;
+    uint32_t position = offset < size ? offset : size;
+    if (reader) {
+        reader.seek(position);
+    }
+
+    uint16_t mtu = server->getPeerMTU(connId);
+    if (mtu < kDefaultMtu) {
+        mtu = kDefaultMtu;
+    }
+    size_t chunkLength = mtu - kNotifyHeaderLength - kChunkHeaderLength;
+    if (chunkLength > kMaxAttributeLength - kChunkHeaderLength) {
+        chunkLength = kMaxAttributeLength - kChunkHeaderLength;
+    }
+
+    downloading = true;
+    const int64_t startedUs = esp_timer_get_time();
+    LOG_INFO("Trace download started at %u of %u bytes", position, size);
+
+    for (;;) {
+        const size_t wanted = size - position < chunkLength ? size - position : chunkLength;
+        const size_t length = wanted > 0 ? reader.read(chunk + kChunkHeaderLength, wanted) : 0;
+        chunk[0] = position & 0xFF;
+        chunk[1] = (position >> 8) & 0xFF;
+        chunk[2] = (position >> 16) & 0xFF;
+        chunk[3] = (position >> 24) & 0xFF;
+        if (!sendChunk(connId, length) || length == 0) {
+            break;
+        }
+        position += length;
+    }
+
+    if (reader) {
+        reader.close();
+    }
+    downloading = false;
+    LOG_INFO("Trace download ended at %u of %u bytes after %u ms",
+             position, size, (uint32_t)((esp_timer_get_time() - startedUs) / 1000));
+}
+
+/**
+ * @brief The FreeRTOS task that writes the trace to flash and streams it to clients.
+ */
+void traceTask(void* parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kDrainMs));
+
+        if (recording) {
+            TraceState next = drainRing();
+            if (next == TraceState::Recording &&
+                esp_timer_get_time() - lastFlushUs >= (int64_t)TRACE_FLUSH_MS * 1000 && !flushTrace()) {
+                next = TraceState::Failed;
+            }
+            if (next != TraceState::Recording) {
+                finishTrace(next);
+            }
+        }
+
+        const uint8_t command = pendingCommand.exchange(kNoCommand);
+        if (command == kNoCommand) {
+            continue;
+        }
+        if (recording) {
+            finishTrace(TraceState::Idle);
+        }
+        if (command == TRACE_OPCODE_START) {
+            startTrace();
+        }
+        else if (command == TRACE_OPCODE_DOWNLOAD) {
+            streamTrace(downloadOffset, downloadConnId);
+        }
+    }
+}
+#endif
+
+/**
+ * @class ControlCallbacks
+ * @brief Handles the trace control characteristic.
+ *
+ * @method onConnectionWrite
+ * Hands a start, stop or download command to the trace task.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the recorder status.
+ */
+class ControlCallbacks : public TrackedCharacteristicCallbacks {
+    void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) {
+#if TESTER_TRACE
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if (length == 1 && (data[0] == TRACE_OPCODE_STOP || data[0] == TRACE_OPCODE_START)) {
+            pendingCommand = data[0];
+        }
+        else if (length == 5 && data[0] == TRACE_OPCODE_DOWNLOAD) {
+            downloadOffset = data[1] | (data[2] << 8) | (data[3] << 16) | ((uint32_t)data[4] << 24);
+            downloadConnId = connId;
+            pendingCommand = data[0];
+        }
+        else {
+            LOG_WARN("Received unexpected trace command of %u bytes", (unsigned)length);
+            return;
+        }
+        // The task starts with startTraceRecorder(), which fast boot builds run after
+        // advertising. The command waits for it.
+        if (task != nullptr) {
+            xTaskNotifyGive(task);
+        }
+#else
+        LOG_WARN("The trace recorder is not built in; build with TESTER_TRACE=1");
+#endif
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        TraceStatus status;
+        status.enabled = TESTER_TRACE;
+        status.state = state;
+        status.downloading = downloading;
+        status.captureBytes = TRACE_CAPTURE_BYTES;
+        status.records = records;
+        status.dropped = dropped;
+        status.fileBytes = fileBytes;
+        status.maxBytes = TRACE_MAX_BYTES;
+        status.batches = batches;
+        status.maxBatchUs = maxBatchUs;
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&status), sizeof(status));
+    }
+};
+
+ControlCallbacks controlCallbacks;
+
+// The download reads the send results from notifyConnection(), so the data characteristic
+// only needs the registry's bookkeeping.
+TrackedCharacteristicCallbacks dataCallbacks;
+
+} // namespace
+
+void setupTraceRecorder(BLEServer* pServer, BLEService* pService) {
+    BLECharacteristic* pControl = createBleCharacteristic(
+        pService,
+        TRACE_CONTROL_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pControl->setCallbacks(&controlCallbacks);
+
+    BLECharacteristic* pData = createBleCharacteristic(
+        pService,
+        TRACE_DATA_CHARACTERISTIC_UUID,
+        BleProperty::kNotify
+    );
+    pData->setCallbacks(&dataCallbacks);
+    trackSubscriptions(pData);
+
+#if TESTER_TRACE
+    server = pServer;
+    dataCharacteristic = pData;
+#endif
+}
+
+void startTraceRecorder() {
+#if TESTER_TRACE
+    if (!LittleFS.begin(true)) {
+        state = static_cast<uint8_t>(TraceState::Failed);
+        LOG_ERROR("LittleFS could not be mounted; the trace recorder is off");
+        return;
+    }
+    // Keep the trace from before the reboot available for download
+    File previous = LittleFS.open(TRACE_FILE_PATH, FILE_READ);
+    if (previous) {
+        fileBytes = previous.size();
+        previous.close();
+    }
+
+    createAppTask(traceTask, "trace", 4096, nullptr, 1, &task);
+#endif
+}
+
+void traceRecordWrite(BLECharacteristic* pCharacteristic, uint16_t connId) {
+#if TESTER_TRACE
+    if (recording) {
+        pushRecord(TraceKind::Write, connId, pCharacteristic);
+    }
+#endif
+}
+
+void traceRecordNotification(BLECharacteristic* pCharacteristic, bool indication) {
+#if TESTER_TRACE
+    if (recording) {
+        pushRecord(indication ? TraceKind::Indication : TraceKind::Notification,
+                   TRACE_ALL_CONNECTIONS, pCharacteristic);
+    }
+#endif
+}
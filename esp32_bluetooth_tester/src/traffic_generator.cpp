@@ -0,0 +1,499 @@
+/**
+ * @file
+ * @brief Implementation of the server-side traffic generator.
+ *
+ * Packets are sent from a dedicated FreeRTOS task, woken by the control characteristic, so
+ * the BLE callbacks only parse the config. The task keeps an absolute schedule: a packet
+ * that goes out late, because the tick is coarser than the interval or the link was
+ * congested, is followed by the next one right away until the run is back on schedule, as
+ * long as it is no more than kMaxLagUs behind. The send results arrive through onStatus(),
+ * which Bluedroid calls from the send itself and NimBLE calls from the host task, so an
+ * indication is followed by a wait on a semaphore that onStatus() gives. Each indication
+ * also holds the indication tracker's slot until it is confirmed, so it never overlaps one
+ * of the LED indications on the same link.
+ *
+ * Packets are sized to the MTU of the connection that started the run, and on Bluedroid
+ * paced by that link's sendable-packet count.
+ */
+
+#include "traffic_generator.h"
+
+#include <Arduino.h>
+#include <freertos/semphr.h>
+#include <string.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "ble_events.h"
+#include "board_traits.h"
+#include "connection_registry.h"
+#include "indication_tracker.h"
+
+static_assert(TRAFFIC_CHANNELS >= 1 && TRAFFIC_CHANNELS <= 8, "The channel mask and UUIDs allow 1 to 8 channels");
+
+namespace {
+
+/// The number of attribute handles reserved for the traffic service.
+const uint32_t kServiceHandles = 20;
+
+/// The largest value an attribute can hold, per the Bluetooth Core Specification.
+const size_t kMaxAttributeLength = 512;
+
+/// The size of the ATT notification header that is subtracted from the MTU.
+const uint16_t kNotifyHeaderLength = 3;
+
+/// The default ATT MTU used until the client negotiates a larger one.
+const uint16_t kDefaultMtu = 23;
+
+/// The length of the sequence number at the start of every packet.
+const uint16_t kSequenceLength = 4;
+
+/// How far the run may fall behind its schedule before the backlog is dropped.
+const int64_t kMaxLagUs = 100000;
+
+/// How long to wait for an indication to be confirmed. A little longer than the ATT
+/// transaction timeout, after which the stack reports the failure itself.
+const uint32_t kIndicateTimeoutMs = 35000;
+
+/**
+ * @brief The outcome of the last send, as reported to onStatus().
+ */
+enum class SendResult : uint8_t {
+    Sent,
+    QueueFull,  ///< The stack refused the packet; retry it.
+    Skipped,    ///< The client turned the channel off or went away.
+    Failed,     ///< The indication timed out or failed.
+};
+
+BLEServer* server = nullptr;
+BLECharacteristic* pControlCharacteristic = nullptr;
+BLECharacteristic* channelCharacteristics[TRAFFIC_CHANNELS];
+TaskHandle_t task = nullptr;
+
+SemaphoreHandle_t sendDone = nullptr;
+StaticSemaphore_t sendDoneBuffer;
+
+// Written by the BLE task before it wakes the generator task.
+TrafficConfig config;
+uint16_t requesterConnId = 0;
+
+std::atomic<bool> running(false);
+std::atomic<bool> stopRequested(false);
+std::atomic<uint8_t> lastResult(static_cast<uint8_t>(SendResult::Sent));
+
+// The counters of the current or last run. The generator task writes the first group,
+// onStatus() and the GATT event handler the second.
+std::atomic<uint8_t> state(static_cast<uint8_t>(TrafficState::Idle));
+std::atomic<uint8_t> runMode(0);
+std::atomic<uint16_t> runMaxSize(0);
+std::atomic<uint32_t> packets(0);
+std::atomic<uint32_t> bytes(0);
+std::atomic<uint32_t> skipped(0);
+std::atomic<uint32_t> queueFull(0);
+std::atomic<uint32_t> congestion(0);
+std::atomic<uint32_t> indicateErrors(0);
+
+// Guards the run times, which are read by the BLE task.
+portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+int64_t runStartUs = 0;
+int64_t runEndUs = 0;
+
+uint8_t payload[kMaxAttributeLength];
+
+/**
+ * @brief Returns the next value of a xorshift32 generator.
+ */
+uint32_t nextRandom(uint32_t& random) {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return random;
+}
+
+/**
+ * @brief Draws the size of the next packet from the configured distribution.
+ */
+uint16_t nextSize(uint32_t& random, uint16_t minSize, uint16_t maxSize) {
+    switch (static_cast<TrafficSizeDistribution>(config.distribution)) {
+        case TrafficSizeDistribution::Uniform:
+            return minSize + nextRandom(random) % (maxSize - minSize + 1);
+        case TrafficSizeDistribution::Bimodal:
+            return (nextRandom(random) & 1) ? maxSize : minSize;
+        default:
+            return maxSize;
+    }
+}
+
+/**
+ * @brief Returns the next selected channel after the given one.
+ */
+size_t nextChannel(size_t channel) {
+    do {
+        channel = (channel + 1) % TRAFFIC_CHANNELS;
+    } while ((config.channels & (1u << channel)) == 0);
+    return channel;
+}
+
+/**
+ * @brief Fills the payload buffer with the sequence number and the verification pattern.
+ */
+void fillPayload(uint32_t sequence, size_t length) {
+    payload[0] = sequence & 0xFF;
+    payload[1] = (sequence >> 8) & 0xFF;
+    payload[2] = (sequence >> 16) & 0xFF;
+    payload[3] = (sequence >> 24) & 0xFF;
+    for (size_t i = 4; i < length; i++) {
+        payload[i] = (sequence + i) & 0xFF;
+    }
+}
+
+/**
+ * @brief Fills a stats record from the counters of the current or last run.
+ */
+void snapshotStats(TrafficStats& stats) {
+    portENTER_CRITICAL(&lock);
+    const int64_t startUs = runStartUs;
+    const int64_t endUs = runEndUs;
+    portEXIT_CRITICAL(&lock);
+
+    stats.state = state;
+    stats.mode = runMode;
+    stats.maxSize = runMaxSize;
+    stats.packets = packets;
+    stats.bytes = bytes;
+    stats.skipped = skipped;
+    stats.queueFull = queueFull;
+    stats.congestion = congestion;
+    stats.indicateErrors = indicateErrors;
+
+    const int64_t elapsedUs = (endUs != 0 ? endUs : esp_timer_get_time()) - startUs;
+    stats.elapsedMs = startUs != 0 ? elapsedUs / 1000 : 0;
+    stats.bytesPerSecond = startUs != 0 && elapsedUs > 0 ? (uint32_t)((uint64_t)stats.bytes * 1000000 / elapsedUs) : 0;
+}
+
+/**
+ * @brief Sends one packet and waits for the outcome.
+ *
+ * @return The outcome reported by the stack, or Skipped if nobody is subscribed.
+ */
+SendResult sendPacket(BLECharacteristic* pCharacteristic, bool indicate) {
+    lastResult = static_cast<uint8_t>(SendResult::Sent);
+    if (!indicate) {
+        return notifyCharacteristic(pCharacteristic) ? static_cast<SendResult>(lastResult.load()) : SendResult::Skipped;
+    }
+
+    if (!takeIndicationSlot(kIndicateTimeoutMs)) {
+        indicateErrors++;
+        return SendResult::Failed;
+    }
+    xSemaphoreTake(sendDone, 0);
+    SendResult result = SendResult::Skipped;
+    if (indicateCharacteristic(pCharacteristic)) {
+        if (xSemaphoreTake(sendDone, pdMS_TO_TICKS(kIndicateTimeoutMs)) == pdTRUE) {
+            result = static_cast<SendResult>(lastResult.load());
+        } else {
+            indicateErrors++;
+            result = SendResult::Failed;
+        }
+    }
+    giveIndicationSlot();
+    return result;
+}
+
+/**
+ * @brief Runs the configured traffic until the duration elapses, a stop is requested, or
+ * the client that started it goes away, then publishes the stats.
+ */
+void runTraffic() {
+    const uint16_t connId = requesterConnId;
+    uint16_t mtu = server->getPeerMTU(connId);
+    if (mtu < kDefaultMtu) {
+        mtu = kDefaultMtu;
+    }
+    uint16_t maxSize = config.maxSize;
+    if (maxSize > mtu - kNotifyHeaderLength) {
+        maxSize = mtu - kNotifyHeaderLength;
+    }
+    if (maxSize > kMaxAttributeLength) {
+        maxSize = kMaxAttributeLength;
+    }
+    const uint16_t minSize = config.minSize < maxSize ? config.minSize : maxSize;
+    const bool indicate = static_cast<TrafficMode>(config.mode) == TrafficMode::Indicate;
+    const int64_t intervalUs = config.rate > 0 ? 1000000 / config.rate : 0;
+    uint32_t random = config.seed != 0 ? config.seed : 1;
+
+    runMode = config.mode;
+    runMaxSize = maxSize;
+    packets = 0;
+    bytes = 0;
+    skipped = 0;
+    queueFull = 0;
+    congestion = 0;
+    indicateErrors = 0;
+
+    const int64_t startUs = esp_timer_get_time();
+    const int64_t endUs = config.durationS > 0 ? startUs + (int64_t)config.durationS * 1000000 : INT64_MAX;
+    portENTER_CRITICAL(&lock);
+    runStartUs = startUs;
+    runEndUs = 0;
+    portEXIT_CRITICAL(&lock);
+    state = static_cast<uint8_t>(TrafficState::Running);
+
+    LOG_INFO("Traffic started: %s, channels 0x%02x, %u/s, %u-%u bytes, bursts %u/%u ms, %u s",
+             indicate ? "indicate" : "notify", config.channels, config.rate, minSize, maxSize,
+             config.burstPackets, config.burstGapMs, config.durationS);
+
+    TrafficState endState = TrafficState::Done;
+    int64_t dueUs = startUs;
+    uint32_t sequence = 0;
+    uint16_t inBurst = 0;
+    size_t channel = TRAFFIC_CHANNELS - 1;
+    uint16_t length = 0;
+    bool pending = false;
+#if !TESTER_USE_NIMBLE
+    bool congested = false;
+#endif
+
+    for (;;) {
+        const int64_t now = esp_timer_get_time();
+        if (stopRequested) {
+            endState = TrafficState::Stopped;
+            break;
+        }
+        if (now >= endUs) {
+            break;
+        }
+        if (!connectionActive(connId)) {
+            endState = TrafficState::Disconnected;
+            break;
+        }
+        if (now < dueUs) {
+            const TickType_t ticks = pdMS_TO_TICKS((dueUs - now) / 1000);
+            vTaskDelay(ticks > 0 ? ticks : 1);
+            continue;
+        }
+        if (now - dueUs > kMaxLagUs) {
+            dueUs = now;
+        }
+
+#if !TESTER_USE_NIMBLE
+        // Wait for the controller to have room rather than overrunning the stack's buffers.
+        if (!indicate && esp_ble_get_cur_sendable_packets_num(connId) == 0) {
+            if (!congested) {
+                congested = true;
+                congestion++;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+        congested = false;
+#endif
+
+        // A packet the stack refused is resent as it was
+        if (!pending) {
+            length = nextSize(random, minSize, maxSize);
+            channel = nextChannel(channel);
+            fillPayload(sequence, length);
+            pending = true;
+        }
+        BLECharacteristic* pCharacteristic = channelCharacteristics[channel];
+        pCharacteristic->setValue(payload, length);
+
+        const SendResult result = sendPacket(pCharacteristic, indicate);
+        if (result == SendResult::QueueFull) {
+            queueFull++;
+            vTaskDelay(1);
+            continue;
+        }
+        pending = false;
+        if (result == SendResult::Sent) {
+            packets++;
+            bytes += length;
+        } else if (result == SendResult::Skipped) {
+            skipped++;
+        }
+        sequence++;
+
+        if (config.burstPackets > 0 && ++inBurst >= config.burstPackets) {
+            inBurst = 0;
+            dueUs = esp_timer_get_time() + (int64_t)config.burstGapMs * 1000;
+        } else {
+            dueUs += intervalUs;
+        }
+    }
+
+    portENTER_CRITICAL(&lock);
+    runEndUs = esp_timer_get_time();
+    portEXIT_CRITICAL(&lock);
+    state = static_cast<uint8_t>(endState);
+
+    TrafficStats stats;
+    snapshotStats(stats);
+    LOG_INFO("Traffic ended: state=%u packets=%u bytes=%u ms=%u bps=%u skipped=%u queue_full=%u congestion=%u indicate_errors=%u",
+             stats.state, stats.packets, stats.bytes, stats.elapsedMs, stats.bytesPerSecond,
+             stats.skipped, stats.queueFull, stats.congestion, stats.indicateErrors);
+
+    pControlCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    if (endState != TrafficState::Disconnected) {
+        notifyCharacteristic(pControlCharacteristic);
+    }
+}
+
+/**
+ * @brief The FreeRTOS task that runs the traffic each time it is woken.
+ */
+void trafficTask(void* parameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        stopRequested = false;
+        runTraffic();
+        running = false;
+    }
+}
+
+#if !TESTER_USE_NIMBLE
+/**
+ * @brief Counts the congestion events Bluedroid reports while a run is sending.
+ */
+void handleGattsEvent(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+    if (event == ESP_GATTS_CONGEST_EVT && param->congest.congested && running) {
+        congestion++;
+    }
+}
+#endif
+
+/**
+ * @brief Checks a run configuration written by a client.
+ */
+bool validConfig(const TrafficConfig& candidate) {
+    return candidate.mode <= static_cast<uint8_t>(TrafficMode::Indicate) &&
+           (candidate.channels & ((1u << TRAFFIC_CHANNELS) - 1)) != 0 &&
+           (candidate.channels >> TRAFFIC_CHANNELS) == 0 &&
+           candidate.minSize >= kSequenceLength &&
+           candidate.maxSize >= candidate.minSize &&
+           candidate.distribution <= static_cast<uint8_t>(TrafficSizeDistribution::Bimodal);
+}
+
+/**
+ * @class ControlCallbacks
+ * @brief Handles the traffic control characteristic.
+ *
+ * @method onConnectionWrite
+ * Parses the start and stop commands. Starting records the connection the command came
+ * from, wakes the generator task and returns immediately so the BLE task is never blocked
+ * by the run.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the live stats.
+ */
+class ControlCallbacks : public TrackedCharacteristicCallbacks {
+    void onConnectionWrite(BLECharacteristic* pCharacteristic, uint16_t connId) override {
+        const BleValue value(pCharacteristic);
+        const uint8_t* data = value.data();
+        const size_t length = value.length();
+        if (length == 1 + sizeof(TrafficConfig) && data[0] == TRAFFIC_OPCODE_START) {
+            TrafficConfig candidate;
+            memcpy(&candidate, data + 1, sizeof(candidate));
+            if (!validConfig(candidate)) {
+                LOG_WARN("Invalid traffic config");
+                return;
+            }
+            if (running.exchange(true)) {
+                LOG_WARN("Traffic already running");
+                return;
+            }
+            config = candidate;
+            requesterConnId = connId;
+            xTaskNotifyGive(task);
+        }
+        else if (length == 1 && data[0] == TRAFFIC_OPCODE_STOP) {
+            stopRequested = true;
+        }
+        else {
+            LOG_WARN("Received unexpected traffic command of %u bytes", (unsigned)length);
+        }
+    }
+
+    void onRead(BLECharacteristic* pCharacteristic) {
+        TrafficStats stats;
+        snapshotStats(stats);
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&stats), sizeof(stats));
+    }
+};
+
+/**
+ * @class ChannelCallbacks
+ * @brief Reports the outcome of every packet sent from a channel to the generator task.
+ */
+class ChannelCallbacks : public TrackedCharacteristicCallbacks {
+    void onStatus(BLECharacteristic* pCharacteristic, Status s, BleStatusCode code) {
+        TrackedCharacteristicCallbacks::onStatus(pCharacteristic, s, code);
+        switch (s) {
+            case SUCCESS_NOTIFY:
+                break;
+            case SUCCESS_INDICATE:
+                xSemaphoreGive(sendDone);
+                break;
+            case ERROR_NOTIFY_DISABLED:
+            case ERROR_INDICATE_DISABLED:
+            case ERROR_NO_CLIENT:
+                lastResult = static_cast<uint8_t>(SendResult::Skipped);
+                xSemaphoreGive(sendDone);
+                break;
+            case ERROR_INDICATE_TIMEOUT:
+            case ERROR_INDICATE_FAILURE:
+                indicateErrors++;
+                lastResult = static_cast<uint8_t>(SendResult::Failed);
+                xSemaphoreGive(sendDone);
+                break;
+            default:
+                lastResult = static_cast<uint8_t>(SendResult::QueueFull);
+                xSemaphoreGive(sendDone);
+                break;
+        }
+    }
+};
+
+ControlCallbacks controlCallbacks;
+ChannelCallbacks channelCallbacks;
+
+} // namespace
+
+void setupTrafficGenerator(BLEServer* pServer) {
+    server = pServer;
+    sendDone = xSemaphoreCreateBinaryStatic(&sendDoneBuffer);
+
+    BLEService* pService = createBleService(pServer, TRAFFIC_SERVICE_UUID, kServiceHandles);
+
+    pControlCharacteristic = createBleCharacteristic(
+        pService,
+        TRAFFIC_CONTROL_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite |
+        BleProperty::kNotify
+    );
+    pControlCharacteristic->setCallbacks(&controlCallbacks);
+    trackSubscriptions(pControlCharacteristic);
+
+    char uuid[] = TRAFFIC_CHANNEL_UUID_PREFIX "2";
+    for (size_t i = 0; i < TRAFFIC_CHANNELS; i++) {
+        uuid[sizeof(uuid) - 2] = '2' + i;
+        channelCharacteristics[i] = createBleCharacteristic(
+            pService,
+            uuid,
+            BleProperty::kRead |
+            BleProperty::kNotify |
+            BleProperty::kIndicate
+        );
+        channelCharacteristics[i]->setCallbacks(&channelCallbacks);
+        trackSubscriptions(channelCharacteristics[i]);
+    }
+
+#if !TESTER_USE_NIMBLE
+    addGattsEventHandler(handleGattsEvent);
+#endif
+
+    createAppTask(trafficTask, "traffic", 4096, nullptr, 1, &task);
+
+    pService->start();
+}
@@ -0,0 +1,197 @@
+/**
+ * @file
+ * @brief Implementation of the write-without-response ingestion test.
+ *
+ * The BLE task is the only producer and the consumer task the only consumer, so the ring
+ * needs no locking. Each counter is written from a single task and read with atomics.
+ */
+
+#include "write_sink.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "async_log.h"
+#include "board_traits.h"
+#include "byte_ring.h"
+#include "connection_registry.h"
+
+namespace {
+
+/// The largest value an attribute can hold, per the Bluetooth Core Specification.
+const size_t kMaxAttributeLength = 512;
+
+/// The number of bytes taken by the sequence number at the start of every payload.
+const size_t kSequenceLength = 4;
+
+ByteRing<WRITE_SINK_RING_BYTES> ring;
+TaskHandle_t task = nullptr;
+
+// Written by the BLE task.
+std::atomic<uint32_t> writes(0);
+std::atomic<uint32_t> bytes(0);
+std::atomic<uint32_t> overruns(0);
+std::atomic<uint32_t> highWater(0);
+std::atomic<int64_t> firstWriteUs(0);
+std::atomic<int64_t> lastWriteUs(0);
+
+// Written by the consumer task.
+std::atomic<uint32_t> processed(0);
+std::atomic<uint32_t> sequenceGaps(0);
+std::atomic<uint32_t> outOfOrder(0);
+std::atomic<uint32_t> corrupt(0);
+
+// Tells the consumer to forget the expected sequence number.
+std::atomic<bool> resetRequested(false);
+
+// Only touched from the consumer task.
+uint8_t payload[kMaxAttributeLength];
+
+/**
+ * @brief Returns true if a payload carries the expected pattern after its sequence number.
+ */
+bool verifyPattern(uint32_t sequence, const uint8_t* data, size_t length) {
+    for (size_t i = kSequenceLength; i < length; i++) {
+        if (data[i] != ((sequence + i) & 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief The FreeRTOS task that drains the ring and checks every payload.
+ */
+void sinkTask(void* parameter) {
+    uint32_t expected = 0;
+    bool streaming = false;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        size_t length;
+        while (ring.pop(payload, sizeof(payload), &length)) {
+            if (resetRequested.exchange(false)) {
+                streaming = false;
+            }
+            processed++;
+
+            if (length < kSequenceLength || length > sizeof(payload)) {
+                corrupt++;
+                continue;
+            }
+            const uint32_t sequence = payload[0] | (payload[1] << 8) | (payload[2] << 16) |
+                                      ((uint32_t)payload[3] << 24);
+            if (!verifyPattern(sequence, payload, length)) {
+                corrupt++;
+            }
+
+            if (streaming && sequence != 0) {
+                if (sequence > expected) {
+                    sequenceGaps += sequence - expected;
+                }
+                else if (sequence < expected) {
+                    outOfOrder++;
+                    continue;
+                }
+            }
+            expected = sequence + 1;
+            streaming = true;
+        }
+    }
+}
+
+/**
+ * @class SinkCallbacks
+ * @brief Queues every write to the sink for the consumer task.
+ *
+ * @method onWrite
+ * Copies the payload into the ring and wakes the consumer, or counts an overrun if the
+ * ring is full. Nothing in this path logs, allocates or blocks.
+ */
+class SinkCallbacks : public TrackedCharacteristicCallbacks {
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        const int64_t now = esp_timer_get_time();
+        if (writes++ == 0) {
+            firstWriteUs = now;
+        }
+        lastWriteUs = now;
+
+        const BleValue value(pCharacteristic);
+        if (!ring.push(value.data(), value.length())) {
+            overruns++;
+            return;
+        }
+        bytes += value.length();
+
+        const uint32_t used = ring.used();
+        if (used > highWater) {
+            highWater = used;
+        }
+        xTaskNotifyGive(task);
+    }
+};
+
+SinkCallbacks sinkCallbacks;
+
+/**
+ * @class SinkStatsCallbacks
+ * @brief Serves the sink counters over GATT.
+ *
+ * @method onRead
+ * Refreshes the characteristic value with the current counters before it is read.
+ *
+ * @method onWrite
+ * Resets the counters, regardless of the value written.
+ */
+class SinkStatsCallbacks : public TrackedCharacteristicCallbacks {
+    void onRead(BLECharacteristic* pCharacteristic) {
+        WriteSinkCounters counters;
+        counters.writes = writes;
+        counters.bytes = bytes;
+        counters.overruns = overruns;
+        counters.processed = processed;
+        counters.sequenceGaps = sequenceGaps;
+        counters.outOfOrder = outOfOrder;
+        counters.corrupt = corrupt;
+        counters.highWater = highWater;
+        counters.elapsedMs = counters.writes > 0 ? (lastWriteUs - firstWriteUs) / 1000 : 0;
+        pCharacteristic->setValue(reinterpret_cast<uint8_t*>(&counters), sizeof(counters));
+    }
+
+    void onWrite(BLECharacteristic* pCharacteristic) {
+        writes = 0;
+        bytes = 0;
+        overruns = 0;
+        highWater = 0;
+        processed = 0;
+        sequenceGaps = 0;
+        outOfOrder = 0;
+        corrupt = 0;
+        resetRequested = true;
+        LOG_INFO("Write sink counters reset");
+    }
+};
+
+SinkStatsCallbacks sinkStatsCallbacks;
+
+} // namespace
+
+void setupWriteSink(BLEService* pService) {
+    BLECharacteristic* pSinkCharacteristic = createBleCharacteristic(
+        pService,
+        WRITE_SINK_CHARACTERISTIC_UUID,
+        BleProperty::kWriteNoResponse
+    );
+    pSinkCharacteristic->setCallbacks(&sinkCallbacks);
+
+    BLECharacteristic* pStatsCharacteristic = createBleCharacteristic(
+        pService,
+        WRITE_SINK_STATS_CHARACTERISTIC_UUID,
+        BleProperty::kRead |
+        BleProperty::kWrite
+    );
+    pStatsCharacteristic->setCallbacks(&sinkStatsCallbacks);
+
+    createAppTask(sinkTask, "write_sink", 3072, nullptr, 1, &task);
+}
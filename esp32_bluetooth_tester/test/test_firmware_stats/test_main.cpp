@@ -0,0 +1,157 @@
+/**
+ * @file
+ * @brief Unity tests for the firmware-wide counters.
+ *
+ * The counters are global, so every test starts from resetFirmwareStats() and keeps its
+ * own tally of what it recorded. Nothing else records into them, as the BLE stack is never
+ * started.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "firmware_stats.h"
+
+namespace {
+
+uint32_t expectedWrites = 0;
+uint64_t expectedTotalUs = 0;
+uint32_t expectedMinUs = UINT32_MAX;
+uint32_t expectedMaxUs = 0;
+
+FirmwareStats stats;
+
+/**
+ * @brief Records a write and adds it to the tally.
+ */
+void recordWrite(uint32_t durationUs) {
+    statsRecordWrite(durationUs);
+    expectedWrites++;
+    expectedTotalUs += durationUs;
+    expectedMinUs = durationUs < expectedMinUs ? durationUs : expectedMinUs;
+    expectedMaxUs = durationUs > expectedMaxUs ? durationUs : expectedMaxUs;
+}
+
+void assertWriteFigures() {
+    firmwareStatsSnapshot(stats);
+    TEST_ASSERT_EQUAL_UINT32(expectedWrites, stats.writes);
+    TEST_ASSERT_EQUAL_UINT32(expectedMinUs, stats.writeMinUs);
+    TEST_ASSERT_EQUAL_UINT32(expectedTotalUs / expectedWrites, stats.writeAvgUs);
+    TEST_ASSERT_EQUAL_UINT32(expectedMaxUs, stats.writeMaxUs);
+}
+
+} // namespace
+
+void setUp() {
+    resetFirmwareStats();
+    expectedWrites = 0;
+    expectedTotalUs = 0;
+    expectedMinUs = UINT32_MAX;
+    expectedMaxUs = 0;
+}
+
+void tearDown() {
+}
+
+void test_fresh_counters() {
+    firmwareStatsSnapshot(stats);
+    TEST_ASSERT_EQUAL_UINT8(FIRMWARE_STATS_VERSION, stats.version);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writes);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writeMinUs);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writeAvgUs);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writeMaxUs);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.notifications);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.failedNotifications);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.skippedNotifications);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.coalescedNotifications);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.connects);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.disconnects);
+}
+
+void test_write_durations() {
+    recordWrite(100);
+    recordWrite(300);
+    recordWrite(50);
+    assertWriteFigures();
+}
+
+void test_write_average_survives_32_bit_overflow() {
+    // Together these are more than 2^32 microseconds of callback time.
+    recordWrite(3000000000u);
+    recordWrite(3000000000u);
+    TEST_ASSERT_TRUE(expectedTotalUs > UINT32_MAX);
+    assertWriteFigures();
+}
+
+void test_notification_counters() {
+    statsRecordNotification();
+    statsRecordNotification();
+    statsRecordFailedNotification();
+    statsRecordSkippedNotification();
+    statsRecordCoalescedNotification();
+    statsRecordCoalescedNotification();
+    statsRecordCoalescedNotification();
+    firmwareStatsSnapshot(stats);
+
+    TEST_ASSERT_EQUAL_UINT32(2, stats.notifications);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.failedNotifications);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.skippedNotifications);
+    TEST_ASSERT_EQUAL_UINT32(3, stats.coalescedNotifications);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writes);
+}
+
+void test_connection_counters() {
+    statsRecordConnect();
+    statsRecordDisconnect();
+    statsRecordConnect();
+    firmwareStatsSnapshot(stats);
+
+    TEST_ASSERT_EQUAL_UINT32(2, stats.connects);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.disconnects);
+}
+
+void test_reset() {
+    recordWrite(500);
+    statsRecordNotification();
+    statsRecordConnect();
+    resetFirmwareStats();
+    firmwareStatsSnapshot(stats);
+
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writes);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writeMinUs);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.writeMaxUs);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.notifications);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.connects);
+
+    // The minimum starts over too, rather than keeping the 500 us from before the reset.
+    statsRecordWrite(800);
+    firmwareStatsSnapshot(stats);
+    TEST_ASSERT_EQUAL_UINT32(800, stats.writeMinUs);
+    TEST_ASSERT_EQUAL_UINT32(800, stats.writeMaxUs);
+}
+
+void test_heap_figures() {
+    firmwareStatsSnapshot(stats);
+    TEST_ASSERT_TRUE(stats.freeHeap > 0);
+    TEST_ASSERT_TRUE(stats.minFreeHeap <= stats.freeHeap);
+    TEST_ASSERT_TRUE(stats.largestFreeBlock <= stats.freeHeap);
+    TEST_ASSERT_TRUE(stats.uptimeMs > 0);
+}
+
+void setup() {
+    // Give the serial monitor time to attach after the board resets.
+    delay(2000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fresh_counters);
+    RUN_TEST(test_write_durations);
+    RUN_TEST(test_write_average_survives_32_bit_overflow);
+    RUN_TEST(test_notification_counters);
+    RUN_TEST(test_connection_counters);
+    RUN_TEST(test_reset);
+    RUN_TEST(test_heap_figures);
+    UNITY_END();
+}
+
+void loop() {
+}
@@ -0,0 +1,137 @@
+/**
+ * @file
+ * @brief Unity tests for the power-of-two latency histogram.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "latency_histogram.h"
+
+namespace {
+
+// Kept out of the test functions' stacks, as the histogram is a few hundred bytes.
+LatencyHistogram histogram;
+LatencyHistogramSnapshot snapshot;
+
+} // namespace
+
+void setUp() {
+    histogram.reset();
+}
+
+void tearDown() {
+}
+
+void test_empty_histogram() {
+    histogram.snapshot(snapshot);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.count);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.minUs);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.maxUs);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.p50Us);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.p99Us);
+    TEST_ASSERT_EQUAL_UINT32(0, histogram.percentile(50));
+}
+
+void test_bucket_placement() {
+    histogram.record(0);    // Bucket 0 holds 0 us only.
+    histogram.record(1);    // Bucket 1 holds [1, 2).
+    histogram.record(2);    // Bucket 2 holds [2, 4).
+    histogram.record(3);
+    histogram.record(4);    // Bucket 3 holds [4, 8).
+    histogram.record(1023); // Bucket 10 holds [512, 1024).
+    histogram.record(1024); // Bucket 11 holds [1024, 2048).
+    histogram.snapshot(snapshot);
+
+    TEST_ASSERT_EQUAL_UINT32(7, snapshot.count);
+    TEST_ASSERT_EQUAL_UINT32(1, snapshot.buckets[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, snapshot.buckets[1]);
+    TEST_ASSERT_EQUAL_UINT32(2, snapshot.buckets[2]);
+    TEST_ASSERT_EQUAL_UINT32(1, snapshot.buckets[3]);
+    TEST_ASSERT_EQUAL_UINT32(1, snapshot.buckets[10]);
+    TEST_ASSERT_EQUAL_UINT32(1, snapshot.buckets[11]);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.buckets[4]);
+}
+
+void test_last_bucket_takes_overflow() {
+    const size_t last = LatencyHistogram::kBucketCount - 1;
+    histogram.record(1u << (last - 1)); // The lower bound of the last bucket.
+    histogram.record(UINT32_MAX);
+    histogram.snapshot(snapshot);
+
+    TEST_ASSERT_EQUAL_UINT32(2, snapshot.buckets[last]);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, snapshot.maxUs);
+}
+
+void test_min_and_max() {
+    histogram.record(250);
+    histogram.record(7);
+    histogram.record(90000);
+    histogram.snapshot(snapshot);
+
+    TEST_ASSERT_EQUAL_UINT32(3, snapshot.count);
+    TEST_ASSERT_EQUAL_UINT32(7, snapshot.minUs);
+    TEST_ASSERT_EQUAL_UINT32(90000, snapshot.maxUs);
+}
+
+void test_percentiles() {
+    // 98 samples in [64, 128) and 2 in [4096, 8192): the median falls in the first bucket
+    // and the 99th percentile in the second. Both report the bucket's upper bound.
+    for (int i = 0; i < 98; i++) {
+        histogram.record(100);
+    }
+    histogram.record(5000);
+    histogram.record(5000);
+    histogram.snapshot(snapshot);
+
+    TEST_ASSERT_EQUAL_UINT32(127, snapshot.p50Us);
+    TEST_ASSERT_EQUAL_UINT32(8191, snapshot.p99Us);
+    TEST_ASSERT_EQUAL_UINT32(127, histogram.percentile(98));
+    TEST_ASSERT_EQUAL_UINT32(8191, histogram.percentile(100));
+}
+
+void test_percentile_of_one_sample() {
+    histogram.record(300);
+    TEST_ASSERT_EQUAL_UINT32(511, histogram.percentile(1));
+    TEST_ASSERT_EQUAL_UINT32(511, histogram.percentile(50));
+    TEST_ASSERT_EQUAL_UINT32(511, histogram.percentile(99));
+}
+
+void test_reset() {
+    histogram.record(10);
+    histogram.record(20000);
+    histogram.reset();
+    histogram.snapshot(snapshot);
+
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.count);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.minUs);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.maxUs);
+    TEST_ASSERT_EQUAL_UINT32(0, snapshot.p99Us);
+    for (size_t i = 0; i < LatencyHistogram::kBucketCount; i++) {
+        TEST_ASSERT_EQUAL_UINT32(0, snapshot.buckets[i]);
+    }
+
+    // The minimum starts over too, rather than keeping the 10 us from before the reset.
+    histogram.record(40);
+    histogram.snapshot(snapshot);
+    TEST_ASSERT_EQUAL_UINT32(40, snapshot.minUs);
+    TEST_ASSERT_EQUAL_UINT32(40, snapshot.maxUs);
+}
+
+void setup() {
+    // Give the serial monitor time to attach after the board resets.
+    delay(2000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_histogram);
+    RUN_TEST(test_bucket_placement);
+    RUN_TEST(test_last_bucket_takes_overflow);
+    RUN_TEST(test_min_and_max);
+    RUN_TEST(test_percentiles);
+    RUN_TEST(test_percentile_of_one_sample);
+    RUN_TEST(test_reset);
+    UNITY_END();
+}
+
+void loop() {
+}
@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @brief Unity tests for the LED command parser and the LED write dispatch table.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "led_command.h"
+#include "led_route.h"
+
+namespace {
+
+/**
+ * @brief Parses a string as it would arrive in an attribute value, without the terminator.
+ */
+LedCommand parseText(const char* text) {
+    return parseLedCommand(reinterpret_cast<const uint8_t*>(text), strlen(text));
+}
+
+void assertCommand(LedCommand expected, LedCommand actual) {
+    TEST_ASSERT_EQUAL_UINT8(static_cast<uint8_t>(expected), static_cast<uint8_t>(actual));
+}
+
+// The route table only compares characteristic pointers, so any distinct addresses do.
+uint8_t characteristicStorage[3];
+
+const BLECharacteristic* fakeCharacteristic(size_t index) {
+    return reinterpret_cast<const BLECharacteristic*>(&characteristicStorage[index]);
+}
+
+} // namespace
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_text_commands() {
+    assertCommand(LedCommand::On, parseText("ON"));
+    assertCommand(LedCommand::Off, parseText("OFF"));
+}
+
+void test_text_commands_are_case_sensitive() {
+    assertCommand(LedCommand::Unknown, parseText("on"));
+    assertCommand(LedCommand::Unknown, parseText("Off"));
+}
+
+void test_binary_opcodes() {
+    const uint8_t on[] = {LED_OPCODE_ON};
+    const uint8_t off[] = {LED_OPCODE_OFF};
+    const uint8_t unknown[] = {0x02};
+    assertCommand(LedCommand::On, parseLedCommand(on, sizeof(on)));
+    assertCommand(LedCommand::Off, parseLedCommand(off, sizeof(off)));
+    assertCommand(LedCommand::Unknown, parseLedCommand(unknown, sizeof(unknown)));
+}
+
+void test_wrong_lengths() {
+    const uint8_t opcodes[] = {LED_OPCODE_ON, LED_OPCODE_ON};
+    assertCommand(LedCommand::Unknown, parseLedCommand(opcodes, 0));
+    assertCommand(LedCommand::Unknown, parseLedCommand(opcodes, sizeof(opcodes)));
+    assertCommand(LedCommand::Unknown, parseText("ONN"));
+    assertCommand(LedCommand::Unknown, parseText("OFFF"));
+    assertCommand(LedCommand::Unknown, parseText("O"));
+
+    // A trailing terminator is part of the value, so it makes the command unknown.
+    assertCommand(LedCommand::Unknown, parseLedCommand(reinterpret_cast<const uint8_t*>("ON"), 3));
+}
+
+void test_route_lookup() {
+    LedRouteTable<2> routes;
+    TEST_ASSERT_TRUE(routes.add(fakeCharacteristic(0), 0x00FF00, BroadcastLedState::Green, "Green LED on"));
+    TEST_ASSERT_TRUE(routes.add(fakeCharacteristic(1), 0xFF0000, BroadcastLedState::Red, "Red LED on"));
+    TEST_ASSERT_EQUAL_UINT32(2, routes.size());
+
+    const LedRoute* green = routes.find(fakeCharacteristic(0));
+    TEST_ASSERT_NOT_NULL(green);
+    TEST_ASSERT_EQUAL_HEX32(0x00FF00, green->onColor);
+    TEST_ASSERT_EQUAL_UINT8(static_cast<uint8_t>(BroadcastLedState::Green), static_cast<uint8_t>(green->onState));
+    TEST_ASSERT_EQUAL_STRING("Green LED on", green->onMessage);
+    TEST_ASSERT_EQUAL_UINT32(strlen("Green LED on"), green->onMessageLength);
+
+    const LedRoute* red = routes.find(fakeCharacteristic(1));
+    TEST_ASSERT_NOT_NULL(red);
+    TEST_ASSERT_EQUAL_HEX32(0xFF0000, red->onColor);
+    TEST_ASSERT_EQUAL_UINT8(static_cast<uint8_t>(BroadcastLedState::Red), static_cast<uint8_t>(red->onState));
+}
+
+void test_route_lookup_misses() {
+    LedRouteTable<2> routes;
+    TEST_ASSERT_NULL(routes.find(fakeCharacteristic(0)));
+    TEST_ASSERT_NULL(routes.find(nullptr));
+
+    routes.add(fakeCharacteristic(0), 0x00FF00, BroadcastLedState::Green, "Green LED on");
+    TEST_ASSERT_NULL(routes.find(fakeCharacteristic(1)));
+}
+
+void test_route_table_full() {
+    LedRouteTable<2> routes;
+    routes.add(fakeCharacteristic(0), 0x00FF00, BroadcastLedState::Green, "Green LED on");
+    routes.add(fakeCharacteristic(1), 0xFF0000, BroadcastLedState::Red, "Red LED on");
+    TEST_ASSERT_FALSE(routes.add(fakeCharacteristic(2), 0x0000FF, BroadcastLedState::Custom, "Blue LED on"));
+    TEST_ASSERT_EQUAL_UINT32(2, routes.size());
+    TEST_ASSERT_NULL(routes.find(fakeCharacteristic(2)));
+}
+
+void setup() {
+    // Give the serial monitor time to attach after the board resets.
+    delay(2000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_text_commands);
+    RUN_TEST(test_text_commands_are_case_sensitive);
+    RUN_TEST(test_binary_opcodes);
+    RUN_TEST(test_wrong_lengths);
+    RUN_TEST(test_route_lookup);
+    RUN_TEST(test_route_lookup_misses);
+    RUN_TEST(test_route_table_full);
+    UNITY_END();
+}
+
+void loop() {
+}
@@ -0,0 +1,97 @@
+/**
+ * @file
+ * @brief Unity tests for the coverage that tracks which payload bytes have arrived.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "payload_coverage.h"
+
+namespace {
+
+const size_t kPayloadBytes = 1000;
+
+// Kept out of the test functions' stacks, like the firmware's own coverage.
+PayloadCoverage<kPayloadBytes> coverage;
+
+} // namespace
+
+void setUp() {
+    coverage.reset();
+}
+
+void tearDown() {
+}
+
+void test_empty_coverage() {
+    TEST_ASSERT_EQUAL_UINT32(0, coverage.covered());
+    TEST_ASSERT_FALSE(coverage.covers(0));
+    TEST_ASSERT_FALSE(coverage.covers(kPayloadBytes - 1));
+}
+
+void test_chunks_in_any_order() {
+    TEST_ASSERT_EQUAL_UINT32(500, coverage.mark(500, 500));
+    TEST_ASSERT_EQUAL_UINT32(500, coverage.mark(0, 500));
+    TEST_ASSERT_EQUAL_UINT32(kPayloadBytes, coverage.covered());
+    TEST_ASSERT_TRUE(coverage.covers(0));
+    TEST_ASSERT_TRUE(coverage.covers(kPayloadBytes - 1));
+}
+
+void test_resent_chunk_adds_nothing() {
+    TEST_ASSERT_EQUAL_UINT32(244, coverage.mark(0, 244));
+    TEST_ASSERT_EQUAL_UINT32(244, coverage.mark(244, 244));
+
+    // The client resends the second chunk, as if it had missed the write's acknowledgement.
+    TEST_ASSERT_EQUAL_UINT32(0, coverage.mark(244, 244));
+    TEST_ASSERT_EQUAL_UINT32(488, coverage.covered());
+    TEST_ASSERT_FALSE(coverage.covers(488));
+
+    // The transfer is only complete once the rest of the payload arrives.
+    TEST_ASSERT_EQUAL_UINT32(kPayloadBytes - 488, coverage.mark(488, kPayloadBytes - 488));
+    TEST_ASSERT_EQUAL_UINT32(kPayloadBytes, coverage.covered());
+}
+
+void test_overlapping_chunks() {
+    TEST_ASSERT_EQUAL_UINT32(100, coverage.mark(3, 100));
+    TEST_ASSERT_EQUAL_UINT32(47, coverage.mark(53, 97));
+    TEST_ASSERT_EQUAL_UINT32(3, coverage.mark(0, 150));
+    TEST_ASSERT_EQUAL_UINT32(150, coverage.covered());
+    TEST_ASSERT_TRUE(coverage.covers(149));
+    TEST_ASSERT_FALSE(coverage.covers(150));
+}
+
+void test_unaligned_single_bytes() {
+    TEST_ASSERT_EQUAL_UINT32(1, coverage.mark(7, 1));
+    TEST_ASSERT_EQUAL_UINT32(1, coverage.mark(8, 1));
+    TEST_ASSERT_EQUAL_UINT32(0, coverage.mark(7, 1));
+    TEST_ASSERT_EQUAL_UINT32(0, coverage.mark(7, 0));
+    TEST_ASSERT_EQUAL_UINT32(2, coverage.covered());
+    TEST_ASSERT_FALSE(coverage.covers(6));
+    TEST_ASSERT_FALSE(coverage.covers(9));
+}
+
+void test_reset() {
+    coverage.mark(0, kPayloadBytes);
+    coverage.reset();
+    TEST_ASSERT_EQUAL_UINT32(0, coverage.covered());
+    TEST_ASSERT_FALSE(coverage.covers(0));
+    TEST_ASSERT_EQUAL_UINT32(kPayloadBytes, coverage.mark(0, kPayloadBytes));
+}
+
+void setup() {
+    // Give the serial monitor time to attach after the board resets.
+    delay(2000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_coverage);
+    RUN_TEST(test_chunks_in_any_order);
+    RUN_TEST(test_resent_chunk_adds_nothing);
+    RUN_TEST(test_overlapping_chunks);
+    RUN_TEST(test_unaligned_single_bytes);
+    RUN_TEST(test_reset);
+    UNITY_END();
+}
+
+void loop() {
+}
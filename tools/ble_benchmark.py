@@ -0,0 +1,291 @@
+#!/usr/bin/env python3
+"""Host-side benchmark client for the ESP32 Bluetooth Tester.
+
+Drives the tester's GATT profile over a real radio and reports connect time, pairing
+time, notification throughput, echo round-trip latency and the goodput of long writes
+versus chunked writes. Results are printed as JSON or CSV so that runs against different
+firmware builds can be compared automatically.
+
+Requires Python 3.8+ and bleak (pip install -r tools/requirements.txt).
+
+Examples:
+    python tools/ble_benchmark.py
+    python tools/ble_benchmark.py --throughput-seconds 20 --echo-count 500 --format csv
+    python tools/ble_benchmark.py --address AA:BB:CC:DD:EE:FF --output results.json
+"""
+
+import argparse
+import asyncio
+import csv
+import json
+import statistics
+import struct
+import sys
+import time
+import zlib
+
+from bleak import BleakClient, BleakScanner
+
+SERVICE_UUID = "abcd1234-1234-1234-1234-1234567890aa"
+ENCRYPTED_LED_UUID = "abcd1234-1234-1234-1234-1234567890ac"
+THROUGHPUT_UUID = "abcd1234-1234-1234-1234-1234567890ad"
+ECHO_UUID = "abcd1234-1234-1234-1234-1234567890ae"
+ECHO_HISTOGRAM_UUID = "abcd1234-1234-1234-1234-1234567890af"
+FIRMWARE_STATS_UUID = "abcd1234-1234-1234-1234-1234567890b4"
+LARGE_PAYLOAD_CONTROL_UUID = "abcd1234-1234-1234-1234-1234567890ba"
+LARGE_PAYLOAD_LONG_WRITE_UUID = "abcd1234-1234-1234-1234-1234567890bb"
+LARGE_PAYLOAD_CHUNK_UUID = "abcd1234-1234-1234-1234-1234567890bc"
+
+# LatencyHistogramSnapshot: count, min, max, p50, p99, then 24 buckets.
+HISTOGRAM_FORMAT = "<5I24I"
+
+# LargePayloadStats: method, state, total length, received, writes, rejected, elapsed, goodput.
+LARGE_PAYLOAD_STATS_FORMAT = "<BB6I"
+LARGE_PAYLOAD_COMPLETE = 2
+
+# The fields of FirmwareStats after the version byte, in wire order.
+FIRMWARE_STATS_FIELDS = [
+    "uptime_ms", "writes", "notifications", "failed_notifications", "connects",
+    "disconnects", "write_min_us", "write_avg_us", "write_max_us", "free_heap",
+    "min_free_heap", "largest_free_block", "ble_stack_high_water", "log_dropped",
+    "skipped_notifications", "coalesced_notifications",
+]
+
+
+def percentile(samples, percent):
+    """Returns the nearest-rank percentile of a list of samples."""
+    if not samples:
+        return None
+    ordered = sorted(samples)
+    rank = max(0, min(len(ordered) - 1, int(round(percent / 100.0 * len(ordered) + 0.5)) - 1))
+    return ordered[rank]
+
+
+async def find_device(args):
+    """Scans for the tester by address or by its advertised service UUID."""
+    if args.address:
+        device = await BleakScanner.find_device_by_address(args.address, timeout=args.scan_timeout)
+    else:
+        device = await BleakScanner.find_device_by_filter(
+            lambda d, adv: SERVICE_UUID in [u.lower() for u in adv.service_uuids],
+            timeout=args.scan_timeout,
+        )
+    if device is None:
+        raise RuntimeError("Tester not found; is it advertising?")
+    return device
+
+
+async def measure_connect(device, args):
+    """Connects to the tester and returns the client and the connect time in ms."""
+    client = BleakClient(device, timeout=args.connect_timeout)
+    started = time.perf_counter()
+    await client.connect()
+    connect_ms = (time.perf_counter() - started) * 1000
+    return client, {"connect_ms": round(connect_ms, 1), "mtu": client.mtu_size}
+
+
+async def measure_pairing(client):
+    """Pairs with the tester, or triggers pairing by writing the encrypted characteristic."""
+    started = time.perf_counter()
+    method = "pair"
+    try:
+        await client.pair()
+    except NotImplementedError:
+        # Some backends (macOS) pair implicitly on the first encrypted access.
+        method = "encrypted_write"
+    await client.write_gatt_char(ENCRYPTED_LED_UUID, b"OFF", response=True)
+    pairing_ms = (time.perf_counter() - started) * 1000
+    return {"pairing_ms": round(pairing_ms, 1), "pairing_method": method}
+
+
+async def measure_throughput(client, seconds):
+    """Runs the notification throughput test and checks the stream for gaps."""
+    done = asyncio.Event()
+    state = {"packets": 0, "bytes": 0, "gaps": 0, "corrupt": 0, "expected": 0,
+             "first": None, "last": None, "summary": None}
+
+    def on_notify(_, data):
+        if data.startswith(b"DONE"):
+            state["summary"] = data.decode(errors="replace")
+            done.set()
+            return
+        now = time.perf_counter()
+        if state["first"] is None:
+            state["first"] = now
+        state["last"] = now
+        sequence = int.from_bytes(data[:4], "little")
+        if sequence > state["expected"]:
+            state["gaps"] += sequence - state["expected"]
+        state["expected"] = sequence + 1
+        if any(b != ((sequence + i) & 0xFF) for i, b in enumerate(data[4:], start=4)):
+            state["corrupt"] += 1
+        state["packets"] += 1
+        state["bytes"] += len(data)
+
+    await client.start_notify(THROUGHPUT_UUID, on_notify)
+    await client.write_gatt_char(THROUGHPUT_UUID, f"START {seconds}".encode(), response=True)
+    await asyncio.wait_for(done.wait(), timeout=seconds + 15)
+    await client.stop_notify(THROUGHPUT_UUID)
+
+    elapsed = (state["last"] - state["first"]) if state["packets"] > 1 else 0
+    device = dict(field.split("=", 1) for field in state["summary"].split()[1:])
+    return {
+        "throughput_client_bps": round(state["bytes"] / elapsed) if elapsed > 0 else 0,
+        "throughput_device_bps": int(device.get("bps", 0)),
+        "throughput_packets": state["packets"],
+        "throughput_gaps": state["gaps"],
+        "throughput_corrupt": state["corrupt"],
+        "throughput_failed_sends": int(device.get("failed", 0)),
+    }
+
+
+async def measure_echo(client, count, payload_length):
+    """Measures write-to-notification round trips and reads the device-side histogram."""
+    replies = asyncio.Queue()
+
+    def on_notify(_, data):
+        replies.put_nowait((time.perf_counter(), bytes(data)))
+
+    await client.write_gatt_char(ECHO_HISTOGRAM_UUID, b"\x00", response=True)  # Reset
+    await client.start_notify(ECHO_UUID, on_notify)
+
+    round_trips_us = []
+    lost = 0
+    for sequence in range(count):
+        payload = sequence.to_bytes(4, "little") + bytes(payload_length - 4)
+        sent = time.perf_counter()
+        await client.write_gatt_char(ECHO_UUID, payload, response=False)
+        try:
+            while True:
+                received, data = await asyncio.wait_for(replies.get(), timeout=2.0)
+                if data[:4] == payload[:4]:
+                    round_trips_us.append((received - sent) * 1e6)
+                    break
+        except asyncio.TimeoutError:
+            lost += 1
+
+    await client.stop_notify(ECHO_UUID)
+    histogram = struct.unpack(HISTOGRAM_FORMAT, await client.read_gatt_char(ECHO_HISTOGRAM_UUID))
+
+    return {
+        "echo_samples": len(round_trips_us),
+        "echo_lost": lost,
+        "echo_rtt_min_us": round(min(round_trips_us)) if round_trips_us else None,
+        "echo_rtt_mean_us": round(statistics.mean(round_trips_us)) if round_trips_us else None,
+        "echo_rtt_p50_us": round(percentile(round_trips_us, 50)) if round_trips_us else None,
+        "echo_rtt_p99_us": round(percentile(round_trips_us, 99)) if round_trips_us else None,
+        "echo_rtt_max_us": round(max(round_trips_us)) if round_trips_us else None,
+        "echo_device_p50_us": histogram[3],
+        "echo_device_p99_us": histogram[4],
+    }
+
+
+async def measure_large_payload(client, length):
+    """Sends the same payload by long writes and by chunks and reads the device goodput."""
+    payload = bytes((i * 7) & 0xFF for i in range(length))
+    results = {}
+    for method, name in ((1, "long_write"), (2, "chunked")):
+        await client.write_gatt_char(
+            LARGE_PAYLOAD_CONTROL_UUID,
+            struct.pack("<BBII", 0x01, method, length, zlib.crc32(payload)),
+            response=True,
+        )
+        started = time.perf_counter()
+        if method == 1:
+            # Pieces longer than MTU - 3 go out as prepared writes
+            for offset in range(0, length, 512):
+                await client.write_gatt_char(LARGE_PAYLOAD_LONG_WRITE_UUID, payload[offset:offset + 512], response=True)
+        else:
+            step = client.mtu_size - 3 - 10
+            for offset in range(0, length, step):
+                chunk = payload[offset:offset + step]
+                header = struct.pack("<IHI", offset, len(chunk), zlib.crc32(chunk))
+                await client.write_gatt_char(LARGE_PAYLOAD_CHUNK_UUID, header + chunk, response=False)
+        # Writes without response may still be in flight; poll until the device has them all
+        for _ in range(50):
+            stats = struct.unpack(LARGE_PAYLOAD_STATS_FORMAT, await client.read_gatt_char(LARGE_PAYLOAD_CONTROL_UUID))
+            if stats[3] >= length:
+                break
+            await asyncio.sleep(0.1)
+        client_seconds = time.perf_counter() - started
+        results[name + "_complete"] = stats[1] == LARGE_PAYLOAD_COMPLETE
+        results[name + "_writes"] = stats[4]
+        results[name + "_rejected"] = stats[5]
+        results[name + "_client_goodput_bps"] = round(length / client_seconds) if client_seconds > 0 else 0
+        results[name + "_device_goodput_bps"] = stats[7]
+    return results
+
+
+async def read_firmware_stats(client):
+    """Reads the firmware stats record so results can be tied to the build's footprint."""
+    data = await client.read_gatt_char(FIRMWARE_STATS_UUID)
+    version = data[0]
+    values = struct.unpack_from("<%dI" % ((len(data) - 1) // 4), data, 1)
+    stats = {"firmware_stats_version": version}
+    for name, value in zip(FIRMWARE_STATS_FIELDS, values):
+        stats["fw_" + name] = value
+    return stats
+
+
+async def run(args):
+    results = {"timestamp": time.strftime("%Y-%m-%dT%H:%M:%S%z"), "label": args.label}
+
+    device = await find_device(args)
+    results["address"] = device.address
+
+    client, connect = await measure_connect(device, args)
+    results.update(connect)
+    try:
+        if not args.skip_pairing:
+            results.update(await measure_pairing(client))
+        if args.throughput_seconds > 0:
+            results.update(await measure_throughput(client, args.throughput_seconds))
+        if args.echo_count > 0:
+            results.update(await measure_echo(client, args.echo_count, args.echo_payload))
+        if args.payload_bytes > 0:
+            results.update(await measure_large_payload(client, args.payload_bytes))
+        results.update(await read_firmware_stats(client))
+    finally:
+        await client.disconnect()
+    return results
+
+
+def write_results(results, args):
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    try:
+        if args.format == "json":
+            json.dump(results, out, indent=2)
+            out.write("\n")
+        else:
+            writer = csv.writer(out)
+            writer.writerow(["metric", "value"])
+            for key, value in results.items():
+                writer.writerow([key, value])
+    finally:
+        if out is not sys.stdout:
+            out.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the ESP32 Bluetooth Tester over BLE.")
+    parser.add_argument("--address", help="Connect to this address instead of scanning for the service UUID")
+    parser.add_argument("--label", default="", help="A label stored with the results, such as the firmware env")
+    parser.add_argument("--scan-timeout", type=float, default=10.0)
+    parser.add_argument("--connect-timeout", type=float, default=20.0)
+    parser.add_argument("--skip-pairing", action="store_true", help="Do not measure pairing time")
+    parser.add_argument("--throughput-seconds", type=int, default=10, help="0 skips the throughput test")
+    parser.add_argument("--echo-count", type=int, default=200, help="0 skips the echo test")
+    parser.add_argument("--echo-payload", type=int, default=20, help="Echo payload length in bytes, at least 4")
+    parser.add_argument("--payload-bytes", type=int, default=4096,
+                        help="Large payload transfer size in bytes, up to the device buffer; 0 skips the test")
+    parser.add_argument("--format", choices=["json", "csv"], default="json")
+    parser.add_argument("--output", help="Write results to this file instead of stdout")
+    args = parser.parse_args()
+    if args.echo_payload < 4:
+        parser.error("--echo-payload must be at least 4 bytes")
+
+    write_results(asyncio.run(run(args)), args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Updates the ESP32 Bluetooth Tester firmware over BLE and reports the transfer rate.
+
+Streams a firmware image (for example .pio/build/<env>/firmware.bin) to the tester's OTA
+service with windowed acknowledgements, then prints the client-side rate together with the
+device's OtaStats, including the time acks were held back by flash writes.
+
+Requires Python 3.8+ and bleak (pip install -r tools/requirements.txt). The OTA
+characteristics are encrypted, so the host pairs with the tester first. The tester only
+takes an update from a bonded client that has reconnected, so after a new pairing the
+client disconnects and connects again before it starts the transfer.
+
+Example:
+    python tools/ble_ota.py esp32_bluetooth_tester/.pio/build/qt_py_esp32_nimble/firmware.bin
+"""
+
+import argparse
+import asyncio
+import json
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+SERVICE_UUID = "abcd1234-1234-1234-1234-1234567890aa"
+OTA_CONTROL_UUID = "abcd1234-1234-1234-1234-1234567890c1"
+OTA_DATA_UUID = "abcd1234-1234-1234-1234-1234567890c2"
+OTA_STATS_UUID = "abcd1234-1234-1234-1234-1234567890c3"
+
+NOTIFICATION_FORMAT = "<BBHIH"
+STATS_FORMAT = "<BH11Ii"
+STATS_FIELDS = [
+    "state", "window", "image_size", "received", "written", "packets", "dropped_packets",
+    "acks", "elapsed_ms", "rate_bps", "flash_write_ms", "max_flash_write_us", "stall_ms",
+    "last_error",
+]
+
+ACK, NACK, STATUS, REFUSED = 0x10, 0x11, 0x12, 0x13
+STATE_RECEIVING, STATE_DONE, STATE_FAILED = 2, 4, 5
+
+
+class OtaSession:
+    """Tracks the device's acknowledgements and drives the sliding window."""
+
+    def __init__(self):
+        self.acked = 0
+        self.resend_from = None
+        self.state = 0
+        self.window = 1
+        self.refused = False
+        self.changed = asyncio.Event()
+
+    def on_notify(self, _, data):
+        kind, state, next_sequence, _received, window = struct.unpack(NOTIFICATION_FORMAT, data)
+        self.state = state
+        self.window = window
+        if kind == ACK:
+            self.acked = max(self.acked, next_sequence)
+        elif kind == NACK:
+            self.resend_from = next_sequence
+            self.acked = next_sequence
+        elif kind == REFUSED:
+            self.refused = True
+        self.changed.set()
+
+    async def wait(self, timeout=5.0):
+        """Waits for a notification, returning at once if one arrived since the last wait."""
+        await asyncio.wait_for(self.changed.wait(), timeout)
+        self.changed.clear()
+
+
+async def find_tester(args):
+    if args.address:
+        device = await BleakScanner.find_device_by_address(args.address, timeout=10.0)
+    else:
+        device = await BleakScanner.find_device_by_filter(
+            lambda d, adv: SERVICE_UUID in [u.lower() for u in adv.service_uuids], timeout=10.0)
+    if device is None:
+        raise RuntimeError("Tester not found; is it advertising?")
+    return device
+
+
+async def run(args):
+    image = open(args.image, "rb").read()
+
+    # The first connection may only create the bond; the second then reconnects with it
+    for attempt in range(2):
+        stats = await update(await find_tester(args), image, args)
+        if stats is not None:
+            return stats
+        if attempt == 0:
+            sys.stderr.write("The tester refused the update, as expected after a new pairing; reconnecting\n")
+    raise RuntimeError("The tester refused the update; check that it kept the host's bond, and that no other "
+                       "client is updating it")
+
+
+async def update(device, image, args):
+    """Runs one transfer, or returns None if the tester refused to start it."""
+    async with BleakClient(device) as client:
+        try:
+            await client.pair()
+        except NotImplementedError:
+            pass  # Paired implicitly on the first encrypted access
+
+        session = OtaSession()
+        await client.start_notify(OTA_CONTROL_UUID, session.on_notify)
+
+        payload = min(args.payload or client.mtu_size - 5, 512)
+        packets = [image[i:i + payload] for i in range(0, len(image), payload)]
+        if len(packets) > 0xFFFF:
+            raise RuntimeError("Image needs more packets than the 16-bit sequence allows; raise --payload")
+
+        await client.write_gatt_char(OTA_CONTROL_UUID, struct.pack("<BIHH", 0x01, len(image), args.window, payload),
+                                     response=True)
+        while session.state != STATE_RECEIVING:
+            if session.refused:
+                return None
+            await session.wait(timeout=30.0)  # The device prepares the partition first
+            if session.state == STATE_FAILED:
+                raise RuntimeError("The device could not prepare the OTA partition")
+
+        started = time.perf_counter()
+        sequence = 0
+        while session.acked < len(packets):
+            if session.resend_from is not None:
+                sequence, session.resend_from = session.resend_from, None
+            # Acks that arrive while sending end the wait below at once, so the next window
+            # goes out without waiting for another ack
+            session.changed.clear()
+            # At most two windows may be unacknowledged
+            while sequence < len(packets) and sequence < session.acked + 2 * session.window:
+                await client.write_gatt_char(OTA_DATA_UUID, struct.pack("<H", sequence) + packets[sequence],
+                                             response=False)
+                sequence += 1
+            try:
+                await session.wait()
+            except asyncio.TimeoutError:
+                sequence = session.acked  # Resend everything unacknowledged
+        elapsed = time.perf_counter() - started
+
+        await client.write_gatt_char(OTA_CONTROL_UUID, struct.pack("<BB", 0x02, 1 if args.reboot else 0),
+                                     response=True)
+        while session.state not in (STATE_DONE, STATE_FAILED):
+            await session.wait(timeout=30.0)
+
+        stats = dict(zip(STATS_FIELDS, struct.unpack(STATS_FORMAT, await client.read_gatt_char(OTA_STATS_UUID))))
+        stats["client_rate_bps"] = round(len(image) / elapsed) if elapsed > 0 else 0
+        stats["payload"] = payload
+        stats["success"] = session.state == STATE_DONE
+        return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Update the ESP32 Bluetooth Tester over BLE.")
+    parser.add_argument("image", help="The firmware image (firmware.bin)")
+    parser.add_argument("--address", help="Connect to this address instead of scanning for the service UUID")
+    parser.add_argument("--window", type=int, default=8, help="Packets per acknowledgement; the device may lower it")
+    parser.add_argument("--payload", type=int, default=0, help="Packet payload in bytes; defaults to MTU - 5")
+    parser.add_argument("--reboot", action="store_true", help="Boot into the new firmware when done")
+    args = parser.parse_args()
+
+    stats = asyncio.run(run(args))
+    json.dump(stats, sys.stdout, indent=2)
+    sys.stdout.write("\n")
+    sys.exit(0 if stats["success"] else 1)
+
+
+if __name__ == "__main__":
+    main()